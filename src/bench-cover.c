@@ -0,0 +1,148 @@
+/*
+ * cmusfm - bench-cover.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <jpeglib.h>
+
+#include "cover.h"
+
+
+// Benchmark of the notification icon cost with and without the thumbnail
+// cache. Without the cache, the notification server has to decode the
+// full cover image for every track. With the cache, cmusfm checks for
+// the thumbnail and the server decodes the small image only.
+
+static double get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write pseudo-random (hard to compress) JPEG image of the given size.
+static void write_cover(const char *fname, unsigned int size) {
+
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned int x, seed = 1;
+	unsigned char *row;
+	FILE *f;
+
+	f = fopen(fname, "wb");
+	row = malloc(size * 3);
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, f);
+	cinfo.image_width = cinfo.image_height = size;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 95, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < size) {
+		for (x = 0; x < size * 3; x++) {
+			seed = seed * 1103515245 + 12345;
+			row[x] = x / 3 + cinfo.next_scanline + (seed >> 26);
+		}
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	free(row);
+	fclose(f);
+}
+
+// Decode the whole image, like the notification server does.
+static void decode_image(const char *fname) {
+
+	struct jpeg_decompress_struct dinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *row;
+	FILE *f;
+
+	f = fopen(fname, "rb");
+	dinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&dinfo);
+	jpeg_stdio_src(&dinfo, f);
+	jpeg_read_header(&dinfo, TRUE);
+	jpeg_start_decompress(&dinfo);
+	row = malloc(dinfo.output_width * dinfo.output_components);
+	while (dinfo.output_scanline < dinfo.output_height)
+		jpeg_read_scanlines(&dinfo, &row, 1);
+	jpeg_finish_decompress(&dinfo);
+	jpeg_destroy_decompress(&dinfo);
+	free(row);
+	fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+
+	unsigned int i, count = 20, size = argc > 1 ? atoi(argv[1]) : 3000;
+	char dir[] = "/tmp/cmusfm-bench-XXXXXX", cover[64], covers[64], thumbnail[256];
+	struct stat st;
+	double start;
+
+	if (mkdtemp(dir) == NULL)
+		return EXIT_FAILURE;
+	sprintf(cover, "%s/cover.jpg", dir);
+	sprintf(covers, "%s/covers", dir);
+
+	write_cover(cover, size);
+	stat(cover, &st);
+	printf("cover: %ux%u, %lld bytes\n", size, size, (long long)st.st_size);
+
+	start = get_time_ns();
+	for (i = 0; i < count; i++)
+		decode_image(cover);
+	printf("%-32s %10.1f us/op\n", "notification without cache", (get_time_ns() - start) / count / 1e3);
+
+	start = get_time_ns();
+	if (cmusfm_cover_thumbnail(cover, covers, thumbnail, sizeof(thumbnail)) == -1)
+		return EXIT_FAILURE;
+	printf("%-32s %10.1f us/op\n", "thumbnail generation (once)", (get_time_ns() - start) / 1e3);
+
+	count *= 100;
+	start = get_time_ns();
+	for (i = 0; i < count; i++) {
+		cmusfm_cover_thumbnail(cover, covers, thumbnail, sizeof(thumbnail));
+		decode_image(thumbnail);
+	}
+	printf("%-32s %10.1f us/op\n", "notification with cache", (get_time_ns() - start) / count / 1e3);
+
+	stat(thumbnail, &st);
+	printf("thumbnail: %lld bytes\n", (long long)st.st_size);
+
+	unlink(thumbnail);
+	rmdir(covers);
+	unlink(cover);
+	rmdir(dir);
+	return EXIT_SUCCESS;
+}
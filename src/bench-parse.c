@@ -0,0 +1,248 @@
+/*
+ * cmusfm - bench-parse.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cache.h"
+#include "cmusfm.h"
+#include "config.h"
+#include "libscrobbler2.h"
+
+
+// Microbenchmarks of the per-event parsing paths. Every benchmark reports
+// the average time and the number of heap allocations per operation.
+
+// Global configuration structure (normally defined in the main.c)
+struct cmusfm_config config;
+
+static unsigned long allocs = 0;
+
+#ifdef __GLIBC__
+// Count allocations by wrapping the glibc allocator.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+void *malloc(size_t size) {
+	allocs++;
+	return __libc_malloc(size);
+}
+void *calloc(size_t nmemb, size_t size) {
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+void *realloc(void *ptr, size_t size) {
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static double get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Run the benchmark function given number of times. Every call performs
+// `ops` operations.
+static void bench(const char *name, void (*fn)(void), unsigned int count,
+		unsigned int ops) {
+
+	unsigned long allocs_start;
+	unsigned int i;
+	double start;
+
+	fn();  // warm up
+
+	allocs_start = allocs;
+	start = get_time_ns();
+	for (i = 0; i < count; i++)
+		fn();
+
+	printf("%-28s %12.1f %12.2f\n", name,
+			(get_time_ns() - start) / count / ops,
+			(double)(allocs - allocs_start) / count / ops);
+}
+
+
+static const char *localfile = "Pink Floyd - Comfortably Numb.flac";
+static const char *shoutcast = "Daft Punk - Harder, Better, Faster, Stronger";
+
+static void bench_regexp_localfile(void) {
+	struct format_match *matches;
+	matches = get_regexp_format_matches(localfile, "^(?A.+) - (?T.+)\\.[^.]+$");
+	get_regexp_match(matches, CMFORMAT_ARTIST);
+	get_regexp_match(matches, CMFORMAT_TITLE);
+	free(matches);
+}
+
+// the same format as the localfile one, but not eligible for the fast path
+static void bench_regexp_generic(void) {
+	struct format_match *matches;
+	matches = get_regexp_format_matches(localfile, "^(?A.{1,}) - (?T.{1,})\\.[^.]+$");
+	get_regexp_match(matches, CMFORMAT_ARTIST);
+	get_regexp_match(matches, CMFORMAT_TITLE);
+	free(matches);
+}
+
+// list of formats, where only the last one matches
+static const char *formats[] = {
+	"^(?N[0-9]+)\\. (?A.+) - (?T.+)\\.[^.]+$",
+	"^(?A.+) - (?B.+) - (?N[0-9]+) - (?T.+)\\.[^.]+$",
+	"^(?A.{1,}) - (?T.{1,})\\.[^.]+$" };
+
+static void bench_regexp_list_each(void) {
+	struct format_match *matches = NULL;
+	unsigned int i;
+	for (i = 0; matches == NULL && i < 3; i++)
+		matches = get_regexp_format_matches(localfile, formats[i]);
+	free(matches);
+}
+
+static void bench_regexp_list_combined(void) {
+	struct format_matcher *matcher;
+	matcher = get_regexp_format_matcher(formats, 3);
+	free(get_regexp_matcher_matches(matcher, localfile));
+	free_regexp_format_matcher(matcher);
+}
+
+// pre-compiled matcher (e.g. reused for many files) with no match at all
+static struct format_matcher *matcher;
+static void bench_regexp_list_miss(void) {
+	free(get_regexp_matcher_matches(matcher, shoutcast));
+}
+
+static void bench_regexp_shoutcast(void) {
+	struct format_match *matches;
+	matches = get_regexp_format_matches(shoutcast, "^(?A.+) - (?T.+)$");
+	get_regexp_match(matches, CMFORMAT_ARTIST);
+	get_regexp_match(matches, CMFORMAT_TITLE);
+	free(matches);
+}
+
+static scrobbler_trackinfo_t sb_tinf = {
+	.artist = "Pink Floyd", .album = "The Wall", .track = "Comfortably Numb",
+	.track_number = 6, .duration = 382, .timestamp = 1400000000 };
+static struct cmusfm_cache_record *record;
+
+static void bench_cache_encode(void) {
+	free(get_cache_record(&sb_tinf));
+}
+
+static void bench_cache_decode(void) {
+	scrobbler_trackinfo_t sbt;
+	get_cache_record_trackinfo(record, &sbt);
+}
+
+#define CACHE_WALK_RECORDS 1000
+static char *cache_buffer;
+static size_t cache_buffer_size;
+
+static int cache_walk_callback(scrobbler_trackinfo_t *sbt, int count, void *data) {
+	(void)sbt;
+	*(int *)data += count;
+	return 0;
+}
+
+static void bench_cache_walk(void) {
+	FILE *f = fmemopen(cache_buffer, cache_buffer_size, "r");
+	int count = 0;
+	cmusfm_cache_walk(f, cache_walk_callback, &count);
+	fclose(f);
+}
+
+static void bench_config_value(void) {
+	char line[] = "format-localfile = \"^(?A.+) - (?T.+)\\.[^.]+$\"\n";
+	get_config_value(line);
+}
+
+static char config_fname[] = "/tmp/cmusfm-bench-XXXXXX";
+
+static void bench_config_read(void) {
+	struct cmusfm_config conf;
+	cmusfm_config_read(config_fname, &conf);
+}
+
+static CURL *curl;
+
+static void bench_getpost_string(void) {
+	struct sb_getpost_data sb_data[] = {
+		{"album", 's', sb_tinf.album},
+		{"api_key", 's', "67082e45dab1f6433da72a00e3bc037a"},
+		{"artist", 's', sb_tinf.artist},
+		{"duration", 'd', (void *)(long)sb_tinf.duration},
+		{"method", 's', "track.scrobble"},
+		{"sk", 's', "0123456789abcdef0123456789abcdef"},
+		{"timestamp", 'd', (void *)(long)sb_tinf.timestamp},
+		{"track", 's', sb_tinf.track},
+		{"trackNumber", 'd', (void *)(long)sb_tinf.track_number},
+		{"api_sig", 's', "0123456789abcdef0123456789abcdef"}};
+	char buffer[2048];
+	sb_make_curl_getpost_string(curl, buffer, sizeof(buffer), sb_data, 10);
+}
+
+int main(void) {
+
+	size_t size;
+	int i, fd;
+
+	record = get_cache_record(&sb_tinf);
+	size = get_cache_record_size(record);
+	cache_buffer_size = size * CACHE_WALK_RECORDS;
+	cache_buffer = malloc(cache_buffer_size);
+	for (i = 0; i < CACHE_WALK_RECORDS; i++)
+		memcpy(&cache_buffer[i * size], record, size);
+
+	fd = mkstemp(config_fname);
+	cmusfm_config_read("/dev/null", &config);
+	cmusfm_config_write(config_fname, &config);
+	close(fd);
+
+	curl = curl_easy_init();
+
+	printf("%-28s %12s %12s\n", "benchmark", "ns/op", "allocs/op");
+	bench("regexp localfile", bench_regexp_localfile, 20000, 1);
+	bench("regexp shoutcast", bench_regexp_shoutcast, 20000, 1);
+	bench("regexp generic", bench_regexp_generic, 20000, 1);
+	bench("regexp list (one by one)", bench_regexp_list_each, 5000, 1);
+	bench("regexp list (combined)", bench_regexp_list_combined, 5000, 1);
+	matcher = get_regexp_format_matcher(formats, 3);
+	bench("regexp list (reused, miss)", bench_regexp_list_miss, 20000, 1);
+	free_regexp_format_matcher(matcher);
+	bench("cache encode", bench_cache_encode, 1000000, 1);
+	bench("cache decode", bench_cache_decode, 1000000, 1);
+	bench("cache walk (per record)", bench_cache_walk, 200, CACHE_WALK_RECORDS);
+	bench("config value", bench_config_value, 1000000, 1);
+	bench("config read", bench_config_read, 20000, 1);
+	bench("getpost string", bench_getpost_string, 200000, 1);
+
+	curl_easy_cleanup(curl);
+	unlink(config_fname);
+	free(record);
+	free(cache_buffer);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/*
+ * cmusfm - bench-session.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "session.h"
+#include "track.h"
+
+
+#define EVENTS_COUNT 2000000
+#define TRACKS_COUNT 16
+
+// socket data of the benchmark tracks
+static struct {
+	char data[CMSOCKET_BUFFER_SIZE];
+	size_t len;
+	cmusfm_track_id_t track_id;
+} tracks[TRACKS_COUNT];
+
+static double get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static time_t bench_clock(void *data) {
+	return *(time_t *)data;
+}
+
+// Null sinks, so only the session lookup and the state machine are timed.
+static void bench_scrobble(void *data, struct cmusfm_session *sess) {
+	(void)data;
+	(void)sess;
+}
+
+static void bench_nowplaying(void *data, struct cmusfm_session *sess,
+		const struct sock_data_tag *dt) {
+	(void)data;
+	(void)sess;
+	(void)dt;
+}
+
+static void init_tracks(void) {
+
+	struct sock_data_tag *dt;
+	char *str;
+	unsigned int i;
+
+	for (i = 0; i < TRACKS_COUNT; i++) {
+		dt = (struct sock_data_tag *)tracks[i].data;
+		str = tracks[i].data + sizeof(*dt);
+		dt->duration = 120 + i * 15;
+		dt->alboff = sprintf(str, "Artist %u", i % 4) + 1;
+		dt->titoff = dt->alboff + sprintf(str + dt->alboff, "Album %u", i % 8) + 1;
+		dt->locoff = dt->titoff + sprintf(str + dt->titoff, "Title %u", i) + 1;
+		tracks[i].len = sizeof(*dt) + dt->locoff +
+			sprintf(str + dt->locoff, "/music/%u.mp3", i) + 1;
+		tracks[i].track_id = cmusfm_track_id(str, str + dt->alboff,
+				str + dt->titoff, dt->duration);
+	}
+}
+
+// Dispatch given number of events to randomly chosen sessions and return
+// the average cost of a single event in nanoseconds.
+static double bench_sessions(unsigned int count) {
+
+	time_t now = 1000000000;
+	struct cmusfm_session_ops ops = {
+		bench_clock, bench_scrobble, bench_nowplaying, &now };
+	char (*clients)[CMSOCKET_CLIENT_SIZE];
+	struct sock_data_tag *dt;
+	unsigned int *current;
+	unsigned int i, c, seed = 1;
+	double start;
+
+	clients = malloc(count * sizeof(*clients));
+	current = calloc(count, sizeof(*current));
+	for (i = 0; i < count; i++) {
+		snprintf(clients[i], sizeof(*clients), "host-%u:cmus-%u", i % 97, i);
+		cmusfm_session_get(clients[i]);
+	}
+
+	start = get_time_ns();
+	for (i = 0; i < EVENTS_COUNT; i++) {
+		seed = seed * 1103515245 + 12345;
+		now += (seed >> 4) % 64;
+		c = (seed >> 8) % count;
+		// mostly status changes of the current track, sometimes a new one
+		if ((seed >> 24) % 4 == 0)
+			current[c] = (seed >> 26) % TRACKS_COUNT;
+		dt = (struct sock_data_tag *)tracks[current[c]].data;
+		dt->status = CMSTATUS_PLAYING + (seed >> 12) % 3;
+		cmusfm_session_process(cmusfm_session_get(clients[c]), dt,
+				tracks[current[c]].len, tracks[current[c]].track_id, &ops);
+	}
+	start = (get_time_ns() - start) / EVENTS_COUNT;
+
+	cmusfm_session_free_all();
+	free(current);
+	free(clients);
+	return start;
+}
+
+int main(void) {
+
+	unsigned int count;
+
+	init_tracks();
+
+	printf("%10s %12s\n", "sessions", "ns/event");
+	for (count = 1; count <= 100000; count *= 10)
+		printf("%10u %12.1f\n", count, bench_sessions(count));
+
+	return EXIT_SUCCESS;
+}
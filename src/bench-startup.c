@@ -0,0 +1,169 @@
+/*
+ * cmusfm - bench-startup.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.h"
+
+
+// Cold-start benchmark of the server. The time is measured from the exec
+// of the server binary up to the moment when the first event has been
+// processed (the status request sent right after the event is answered).
+// The server either creates the socket on its own - then the client has
+// to retry until the socket is ready - or it gets the pre-bound socket
+// in the socket activation manner.
+
+static double get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bind_socket(const struct sockaddr_un *sock_a) {
+	int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	unlink(sock_a->sun_path);
+	if (bind(fd, (struct sockaddr *)sock_a, sizeof(*sock_a)) == -1 ||
+			listen(fd, 16) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Connect to the server, retry until the socket is ready.
+static int connect_server(const struct sockaddr_un *sock_a, unsigned int *retries) {
+	int fd;
+	for (;;) {
+		fd = socket(PF_UNIX, SOCK_STREAM, 0);
+		if (connect(fd, (struct sockaddr *)sock_a, sizeof(*sock_a)) == 0)
+			return fd;
+		close(fd);
+		(*retries)++;
+		usleep(100);
+	}
+}
+
+// Start the server, send one track event and wait until it is processed.
+static double cold_start(const char *binary, const struct sockaddr_un *sock_a,
+		int activation, double *ready, unsigned int *retries) {
+
+	char buffer[CMSOCKET_BUFFER_SIZE], env[32];
+	struct sock_data_tag *dt = (struct sock_data_tag *)buffer;
+	int fd = -1, req = CMREQUEST_STATUS;
+	double start;
+	pid_t pid;
+
+	memset(buffer, 0, sizeof(buffer));
+	dt->status = CMSTATUS_PLAYING;
+	dt->duration = 100;
+	dt->alboff = 2;
+	dt->titoff = 3;
+	dt->locoff = 5;
+	memcpy(dt + 1, "A\0\0T\0/bench.mp3", 16);
+
+	if (activation && (fd = bind_socket(sock_a)) == -1)
+		return -1;
+
+	start = get_time_ns();
+	if ((pid = fork()) == 0) {
+		if (activation) {
+			dup2(fd, LISTEN_FDS_START);
+			sprintf(env, "%d", getpid());
+			setenv("LISTEN_PID", env, 1);
+			setenv("LISTEN_FDS", "1", 1);
+		}
+		execl(binary, binary, "status", "stopped", (char *)NULL);
+		_exit(EXIT_FAILURE);
+	}
+	if (fd != -1)
+		close(fd);
+
+	fd = connect_server(sock_a, retries);
+	*ready += get_time_ns() - start;
+	write(fd, buffer, sizeof(*dt) + 16);
+	close(fd);
+
+	fd = connect_server(sock_a, retries);
+	write(fd, &req, sizeof(req));
+	while (read(fd, buffer, sizeof(buffer)) > 0)
+		continue;
+	close(fd);
+	start = get_time_ns() - start;
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(sock_a->sun_path);
+	return start;
+}
+
+int main(int argc, char *argv[]) {
+
+	const char *binary = argc > 1 ? argv[1] : "./cmusfm";
+	unsigned int i, mode, retries, count = argc > 2 ? atoi(argv[2]) : 20;
+	char dir[] = "/tmp/cmusfm-bench-XXXXXX", fname[128];
+	struct sockaddr_un sock_a;
+	double total, ready;
+	FILE *f;
+
+	if (mkdtemp(dir) == NULL)
+		return EXIT_FAILURE;
+	setenv("XDG_CONFIG_HOME", dir, 1);
+
+	// scrobbler service is replaced with the closed local port
+	snprintf(fname, sizeof(fname), "%s/cmus", dir);
+	mkdir(fname, 0700);
+	snprintf(fname, sizeof(fname), "%s/cmus/cmusfm.conf", dir);
+	if ((f = fopen(fname, "w")) == NULL)
+		return EXIT_FAILURE;
+	fprintf(f, "user = \"bench\"\nkey = \"00000000000000000000000000000000\"\n"
+			"service-url = \"http://127.0.0.1:1/\"\n");
+	fclose(f);
+
+	memset(&sock_a, 0, sizeof(sock_a));
+	sock_a.sun_family = AF_UNIX;
+	snprintf(sock_a.sun_path, sizeof(sock_a.sun_path), "%s/cmus/cmusfm.socket", dir);
+
+	for (mode = 0; mode < 2; mode++) {
+		total = ready = 0;
+		retries = 0;
+		for (i = 0; i < count; i++)
+			total += cold_start(binary, &sock_a, mode, &ready, &retries);
+		printf("%-20s ready: %8.1f us, first event: %8.1f us, connect retries: %.1f\n",
+				mode ? "socket activation" : "own socket",
+				ready / count / 1e3, total / count / 1e3, (double)retries / count);
+	}
+
+	snprintf(fname, sizeof(fname), "rm -rf %s", dir);
+	return system(fname) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -24,17 +24,61 @@
 
 #include "cache.h"
 
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #include "cmusfm.h"
 #include "debug.h"
+#include "dedup.h"
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
+
+
+// cache segment listed in the cmus home directory
+struct cache_segment {
+	unsigned int seq;
+	off_t size;
+	time_t mtime;
+};
+
+// context of the cache submission
+struct cache_submit {
+	scrobbler_session_t *sbs;
+	unsigned int batches;  // number of batches left
+	unsigned int records;  // number of records passed
+	time_t expired;  // records older are not submitted (zero if not limited)
+	int failed;
+};
+
+static struct {
+	size_t max_size;  // zero if not limited
+	time_t max_age;   // zero if not limited
+	unsigned int segment;  // the last segment, zero if not known
+	// position of the interrupted submission (zero sequence if none)
+	struct {
+		unsigned int seq;
+		ino_t ino;
+		long offset;
+	} resume;
+	// running totals of records which have not been submitted yet
+	struct {
+		size_t bytes;
+		unsigned int records;
+		int valid;
+	} stat;
+} cache;
 
 
 // Return the actual size of given cache record structure.
-static size_t get_cache_record_size(const struct cmusfm_cache_record *record) {
+size_t get_cache_record_size(const struct cmusfm_cache_record *record) {
 	return sizeof(*record) + record->artist_len + record->album_len +
 		record->album_artist_len + record->track_len + record->mbid_len;
 }
@@ -58,12 +102,12 @@ struct cmusfm_cache_record *get_cache_record(const scrobbler_trackinfo_t *sb_tin
 		cr->artist_len = strlen(sb_tinf->artist) + 1;
 	if (sb_tinf->album)
 		cr->album_len = strlen(sb_tinf->album) + 1;
-//	if (sb_tinf->album_artist)
-//		cr->album_artist_len = strlen(sb_tinf->album_artist) + 1;
+	if (sb_tinf->album_artist)
+		cr->album_artist_len = strlen(sb_tinf->album_artist) + 1;
 	if (sb_tinf->track)
 		cr->track_len = strlen(sb_tinf->track) + 1;
-//	if (sb_tinf->mbid)
-//		cr->mbid_len = strlen(sb_tinf->mbid) + 1;
+	if (sb_tinf->mbid)
+		cr->mbid_len = strlen(sb_tinf->mbid) + 1;
 
 	// enlarge allocated memory for string data payload
 	cr = (struct cmusfm_cache_record *)realloc(cr, get_cache_record_size(cr));
@@ -77,26 +121,259 @@ struct cmusfm_cache_record *get_cache_record(const scrobbler_trackinfo_t *sb_tin
 		strcpy(ptr, sb_tinf->album);
 		ptr += cr->album_len;
 	}
-//	if (cr->album_artist_len) {
-//		strcpy(ptr, sb_tinf->album_artist);
-//		ptr += cr->album_artist_len;
-//	}
+	if (cr->album_artist_len) {
+		strcpy(ptr, sb_tinf->album_artist);
+		ptr += cr->album_artist_len;
+	}
 	if (cr->track_len) {
 		strcpy(ptr, sb_tinf->track);
 		ptr += cr->track_len;
 	}
-//	if (cr->mbid_len) {
-//		strcpy(ptr, sb_tinf->mbid);
-//		ptr += cr->mbid_len;
-//	}
+	if (cr->mbid_len) {
+		strcpy(ptr, sb_tinf->mbid);
+		ptr += cr->mbid_len;
+	}
 
 	return cr;
 }
 
+// Restore scrobbler track info structure from the cache record. Strings
+// point into the record data. If the record is malformed, -1 is returned.
+int get_cache_record_trackinfo(const struct cmusfm_cache_record *record,
+		scrobbler_trackinfo_t *sb_tinf) {
+
+	char *ptr = (char *)&record[1];
+
+	memset(sb_tinf, 0, sizeof(*sb_tinf));
+	sb_tinf->timestamp = record->timestamp;
+	sb_tinf->track_number = record->track_number;
+	sb_tinf->duration = record->duration;
+
+	// every string has to be NULL-terminated
+	if (record->artist_len) {
+		sb_tinf->artist = ptr;
+		ptr += record->artist_len;
+		if (ptr[-1] != 0)
+			return -1;
+	}
+	if (record->album_len) {
+		sb_tinf->album = ptr;
+		ptr += record->album_len;
+		if (ptr[-1] != 0)
+			return -1;
+	}
+	if (record->album_artist_len) {
+		sb_tinf->album_artist = ptr;
+		ptr += record->album_artist_len;
+		if (ptr[-1] != 0)
+			return -1;
+	}
+	if (record->track_len) {
+		sb_tinf->track = ptr;
+		ptr += record->track_len;
+		if (ptr[-1] != 0)
+			return -1;
+	}
+	if (record->mbid_len) {
+		sb_tinf->mbid = ptr;
+		ptr += record->mbid_len;
+		if (ptr[-1] != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// Get the file name of the given cache segment.
+static char *get_cache_segment_file(unsigned int seq) {
+	static char fname[128 + 16];
+	if (seq == 0)
+		return get_cmusfm_cache_file();
+	sprintf(fname, "%s.%u", get_cmusfm_cache_file(), seq);
+	return fname;
+}
+
+static int cache_segment_cmp(const void *a, const void *b) {
+	const struct cache_segment *s1 = a, *s2 = b;
+	return s1->seq < s2->seq ? -1 : s1->seq > s2->seq;
+}
+
+// List cache segments ordered from the oldest one. Returned array has to
+// be freed by the `free` function.
+static int cache_list_segments(struct cache_segment **segments) {
+
+	const size_t prefix = sizeof(CACHE_FNAME) - 1;
+	struct dirent *ent;
+	struct stat st;
+	unsigned long seq;
+	DIR *dir;
+	char *end;
+	int count = 0;
+
+	*segments = NULL;
+	if ((dir = opendir(get_cmus_home_dir())) == NULL)
+		return 0;
+
+	while ((ent = readdir(dir)) != NULL) {
+
+		if (strncmp(ent->d_name, CACHE_FNAME, prefix) != 0)
+			continue;
+		if (ent->d_name[prefix] == '\0')
+			seq = 0;
+		else if (ent->d_name[prefix] == '.' && isdigit(ent->d_name[prefix + 1])) {
+			seq = strtoul(&ent->d_name[prefix + 1], &end, 10);
+			if (*end != '\0' || seq == 0 || seq > UINT32_MAX)
+				continue;
+		}
+		else
+			continue;
+
+		if (stat(get_cache_segment_file(seq), &st) == -1)
+			continue;
+
+		if (count % 16 == 0)
+			*segments = realloc(*segments, (count + 16) * sizeof(**segments));
+		(*segments)[count].seq = seq;
+		(*segments)[count].size = st.st_size;
+		(*segments)[count++].mtime = st.st_mtime;
+
+	}
+
+	closedir(dir);
+	qsort(*segments, count, sizeof(**segments), cache_segment_cmp);
+	return count;
+}
+
+// Get the size of the cache segment and the number of records in it,
+// which have not been submitted yet.
+static void cache_stat_segment(unsigned int seq, size_t *bytes, unsigned int *records) {
+
+	struct cmusfm_cache_record record;
+	struct stat st;
+	FILE *f;
+
+	if ((f = fopen(get_cache_segment_file(seq), "r")) == NULL)
+		return;
+
+	// skip records submitted by the interrupted submission
+	if (cache.resume.seq == seq && fstat(fileno(f), &st) == 0 &&
+			st.st_ino == cache.resume.ino)
+		fseek(f, cache.resume.offset, SEEK_SET);
+
+	// walk through record headers only
+	while (fread(&record, sizeof(record), 1, f) == 1 &&
+			record.signature == CMUSFM_CACHE_SIGNATURE) {
+		if (fseek(f, get_cache_record_size(&record) - sizeof(record), SEEK_CUR) == -1)
+			break;
+		*bytes += get_cache_record_size(&record);
+		(*records)++;
+	}
+
+	fclose(f);
+}
+
+// Account records added to (positive sign) or removed from the cache.
+static void cache_stat_update(int sign, size_t bytes, unsigned int records) {
+	if (!cache.stat.valid)
+		return;
+	if (sign > 0) {
+		cache.stat.bytes += bytes;
+		cache.stat.records += records;
+		return;
+	}
+	cache.stat.bytes -= bytes < cache.stat.bytes ? bytes : cache.stat.bytes;
+	cache.stat.records -= records < cache.stat.records ? records : cache.stat.records;
+}
+
+// Remove the whole segment and account evicted records.
+static void cache_evict_segment(unsigned int seq, enum metrics_counter counter) {
+
+	char *fname = get_cache_segment_file(seq);
+	unsigned int records = 0;
+	size_t bytes = 0;
+	int fd;
+
+	if ((fd = open(fname, O_RDONLY | O_CLOEXEC)) == -1)
+		return;
+
+	// wait for the pending append (see the append function)
+	flock(fd, LOCK_EX);
+	cache_stat_segment(seq, &bytes, &records);
+	debug("cache evict: %s (%u records)", fname, records);
+	unlink(fname);
+	if (cache.resume.seq == seq)
+		cache.resume.seq = 0;
+	close(fd);
+
+	cache_stat_update(-1, bytes, records);
+	cmusfm_metrics_add(counter, records);
+}
+
+// Evict the oldest segments, so the cache will not exceed the size limit
+// after appending the given number of bytes, and segments which have not
+// been modified for longer than the age limit. The modification time is
+// the time of the newest record, so older records of the segment might be
+// kept for longer (up to the time it takes to fill the segment) - such
+// records are dropped by the submission instead.
+static void cache_enforce_limits(size_t len) {
+
+	struct cache_segment *segments;
+	time_t now = time(NULL);
+	size_t total = len;
+	int i, count;
+
+	if (cache.max_size == 0 && cache.max_age == 0)
+		return;
+
+	count = cache_list_segments(&segments);
+	for (i = 0; i < count; i++)
+		total += segments[i].size;
+
+	for (i = 0; i < count; i++)
+		if (cache.max_size && total > cache.max_size) {
+			cache_evict_segment(segments[i].seq, METRICS_CACHE_EVICTED_SIZE);
+			total -= segments[i].size;
+		}
+		else if (cache.max_age && segments[i].mtime + cache.max_age < now) {
+			cache_evict_segment(segments[i].seq, METRICS_CACHE_EVICTED_AGE);
+			total -= segments[i].size;
+		}
+
+	free(segments);
+}
+
+// Get the maximal size of the segment. Small cache is split into several
+// segments anyway, so the eviction does not throw the whole cache away.
+static size_t cache_segment_size(void) {
+	if (cache.max_size && cache.max_size / 4 < CACHE_SEGMENT_SIZE)
+		return cache.max_size / 4;
+	return CACHE_SEGMENT_SIZE;
+}
+
+// Find the last cache segment. Legacy cache file is never appended.
+static unsigned int cache_last_segment(void) {
+
+	struct cache_segment *segments;
+	unsigned int seq = 1;
+	int count;
+
+	if ((count = cache_list_segments(&segments)) > 0 && segments[count - 1].seq > 0)
+		seq = segments[count - 1].seq;
+
+	free(segments);
+	return seq;
+}
+
+// Set the maximal size (in bytes) of the cache and the maximal time (in
+// seconds) for which records are kept in the cache. Zero means no limit.
+void cmusfm_cache_set_limits(size_t max_size, time_t max_age) {
+	cache.max_size = max_size;
+	cache.max_age = max_age;
+}
+
 // Write data, which should be submitted later, to the cache file.
 void cmusfm_cache_update(const scrobbler_trackinfo_t *sb_tinf) {
 
-	FILE *f;
 	struct cmusfm_cache_record *record;
 
 	debug("cache update: %ld", sb_tinf->timestamp);
@@ -104,103 +381,372 @@ void cmusfm_cache_update(const scrobbler_trackinfo_t *sb_tinf) {
 			sb_tinf->artist, sb_tinf->album, sb_tinf->album_artist,
 			sb_tinf->track_number, sb_tinf->track, sb_tinf->duration);
 
-	if ((f = fopen(get_cmusfm_cache_file(), "a")) == NULL)
-		return;
-
 	record = get_cache_record(sb_tinf);
-	fwrite(record, get_cache_record_size(record), 1, f);
+	if (cmusfm_cache_append(record, get_cache_record_size(record)) == 0) {
+		cmusfm_metrics_add(METRICS_SCROBBLES_CACHED, 1);
+		cmusfm_trace(TRACE_CACHE_APPEND, 0, get_cache_record_size(record), NULL);
+		probe2(cache__append, sb_tinf->timestamp, get_cache_record_size(record));
+	}
 
 	free(record);
-	fclose(f);
 }
 
-// Submit tracks saved in the cache file.
-void cmusfm_cache_submit(scrobbler_session_t *sbs) {
+// Append encoded cache records to the last cache segment. The segment is
+// locked, so records are not lost if it is being submitted or evicted by
+// other process in the meantime (e.g. during the import). If the segment
+// is full, the new one is started. Returns 0 on success, -1 otherwise.
+int cmusfm_cache_append(const void *data, size_t len) {
+
+	const struct cmusfm_cache_record *record;
+	unsigned int records;
+	struct stat st;
+	ssize_t wr_len;
+	size_t offset;
+	int retry = 0, fd;
+
+	for (;;) {
+
+		if (cache.segment == 0)
+			cache.segment = cache_last_segment();
+
+		if ((fd = open(get_cache_segment_file(cache.segment),
+						O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) == -1)
+			return -1;
+		if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1) {
+			close(fd);
+			return -1;
+		}
 
-	char rd_buff[4096];
-	char *fname;
-	FILE *f;
-	scrobbler_trackinfo_t sb_tinf;
-	struct cmusfm_cache_record *record;
-	size_t rd_len, record_size;
-	char *ptr;
+		// if the segment was submitted and removed, start over
+		if (st.st_nlink == 0) {
+			close(fd);
+			cache.segment = 0;
+			if (++retry == 3)
+				return -1;
+			continue;
+		}
 
-	debug("cache submit");
+		if (st.st_size > 0 && st.st_size + len > cache_segment_size()) {
+			close(fd);
+			// make room for the whole new segment, so the cache does not
+			// exceed the size limit until the next one is started
+			cache_enforce_limits(cache_segment_size());
+			cache.segment++;
+			continue;
+		}
 
-	fname = get_cmusfm_cache_file();
-	if ((f = fopen(fname, "r")) == NULL)
-		return;
+		break;
+	}
+
+	wr_len = write(fd, data, len);
+	close(fd);
+
+	if (wr_len != (ssize_t)len)
+		return -1;
+
+	// data might contain many records (e.g. during the import)
+	for (offset = 0, records = 0; offset + sizeof(*record) <= len; records++) {
+		record = (const struct cmusfm_cache_record *)((const char *)data + offset);
+		offset += get_cache_record_size(record);
+	}
+	cache_stat_update(1, len, records);
+
+	return 0;
+}
+
+// Submit the batch of tracks restored from the cache. Submitted tracks are
+// recorded in the duplication index - they were added to the index at the
+// time of the batch creation, so here we have to revert it on failure.
+// Batch rejected by the service is bisected and only rejected tracks are
+// dropped, so they do not block the rest of the cache. If the submission
+// has failed, -1 is returned.
+static int cmusfm_cache_submit_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sb_tinf, int count) {
+
+	int i, half, status;
+
+	if (count == 0)
+		return 0;
+
+	probe1(cache__replay__start, count);
+	status = scrobbler_scrobble_batch(sbs, sb_tinf, count);
+	probe2(cache__replay__finish, count, status);
+	cmusfm_trace(TRACE_CACHE_SUBMIT, status, count, NULL);
+
+	if (status == 0) {
+		cmusfm_metrics_add(METRICS_SCROBBLES_SUBMITTED, count);
+		return 0;
+	}
+
+	// 'invalid parameters' or the request can not be made - retrying
+	// will not help, but the rest of the batch might be accepted
+	if ((status == SCROBBERR_SBERROR && sbs->error_code == 6) ||
+			status == SCROBBERR_TRACKINF) {
+		if (count == 1) {
+			debug("cache record rejected: %s", sb_tinf->track);
+			cmusfm_dedup_remove(sb_tinf);
+			cmusfm_metrics_add(METRICS_CACHE_REJECTED, 1);
+			return 0;
+		}
+		half = count / 2;
+		if (cmusfm_cache_submit_batch(sbs, sb_tinf, half) == -1) {
+			for (i = half; i < count; i++)
+				cmusfm_dedup_remove(&sb_tinf[i]);
+			return -1;
+		}
+		return cmusfm_cache_submit_batch(sbs, &sb_tinf[half], count - half);
+	}
+
+	for (i = 0; i < count; i++)
+		cmusfm_dedup_remove(&sb_tinf[i]);
+
+	return -1;
+}
+
+// Walk through the cache file and pass decoded records to the callback in
+// batches (up to SCROBBLER_BATCH_SIZE records). Track info strings point
+// into the read buffer, so they are valid only during the callback call.
+// If the callback stops the walk, the file is positioned right after the
+// last passed record and 1 is returned. If the file is corrupted, -1 is
+// returned.
+int cmusfm_cache_walk(FILE *f, cmusfm_cache_walk_callback_t callback, void *data) {
+
+	char rd_buff[8192];
+	scrobbler_trackinfo_t sb_tinf[SCROBBLER_BATCH_SIZE];
+	struct cmusfm_cache_record *record;
+	size_t rd_len, offset, record_size;
+	int count, status = 0;
+	long start;
 
 	// read file until EOF
-	while (!feof(f)) {
-		rd_len = fread(rd_buff, 1, sizeof(rd_buff), f);
-		record = (struct cmusfm_cache_record*)rd_buff;
+	while ((start = ftell(f)) != -1 &&
+			(rd_len = fread(rd_buff, 1, sizeof(rd_buff), f)) > 0) {
+		offset = 0;
+		count = 0;
 
-		// iterate while there is no enough data for full cache record header
-		while ((void*)record - (void*)rd_buff + sizeof(*record) <= rd_len) {
+		// iterate while there is enough data for full cache record header
+		while (offset + sizeof(*record) <= rd_len) {
+			record = (struct cmusfm_cache_record *)&rd_buff[offset];
 
 			if (record->signature != CMUSFM_CACHE_SIGNATURE) {
 				debug("invalid cache record signature: %x", record->signature);
-				fclose(f);
-				return;
+				status = -1;
+				break;
 			}
 
 			record_size = get_cache_record_size(record);
 			debug("record size: %ld", record_size);
 
-			// break if current record is truncated
-			if ((void*)record - (void*)rd_buff + record_size > rd_len)
+			if (record_size > sizeof(rd_buff)) {
+				debug("invalid cache record size: %ld", record_size);
+				status = -1;
 				break;
+			}
 
-			// restore scrobbler track info structure from cache
-			memset(&sb_tinf, 0, sizeof(sb_tinf));
-			sb_tinf.timestamp = record->timestamp;
-			sb_tinf.track_number = record->track_number;
-			sb_tinf.duration = record->duration;
-			ptr = (char*)&record[1];
+			// break if current record is truncated
+			if (offset + record_size > rd_len)
+				break;
 
-			if (record->artist_len) {
-				sb_tinf.artist = ptr;
-				ptr += record->artist_len;
-			}
-			if (record->album_len) {
-				sb_tinf.album = ptr;
-				ptr += record->album_len;
-			}
-//			if (record->album_artist_len) {
-//				sb_tinf.album_artist = ptr;
-//				ptr += record->album_artist_len;
-//			}
-			if (record->track_len) {
-				sb_tinf.track = ptr;
-				ptr += record->track_len;
+			if (get_cache_record_trackinfo(record, &sb_tinf[count]) == -1) {
+				debug("invalid cache record payload");
+				status = -1;
+				break;
 			}
-//			if (record->mbid_len) {
-//				sb_tinf.mbid = ptr;
-//				ptr += record->mbid_len;
-//			}
 
-			debug("cache: %s - %s (%s) - %d. %s (%ds)",
-					sb_tinf.artist, sb_tinf.album, sb_tinf.album_artist,
-					sb_tinf.track_number, sb_tinf.track, sb_tinf.duration);
+			// point to next record
+			offset += record_size;
+
+			if (++count == SCROBBLER_BATCH_SIZE) {
+				count = 0;
+				if (callback(sb_tinf, SCROBBLER_BATCH_SIZE, data) != 0) {
+					status = 1;
+					break;
+				}
+			}
+		}
 
-			// submit tracks to Last.fm
-			scrobbler_scrobble(sbs, &sb_tinf);
+		// pass the rest of tracks, because their data will be
+		// overwritten by the next read
+		if (count && callback(sb_tinf, count, data) != 0)
+			status = 1;
 
-			// point to next record
-			record = (struct cmusfm_cache_record*)((char*)record + record_size);
+		if (status == 1) {
+			fseek(f, start + (long)offset, SEEK_SET);
+			break;
 		}
 
-		if ((unsigned)((void*)record - (void*)rd_buff) != rd_len)
+		// truncated record at the end of file
+		if (status == -1 || (offset != rd_len && feof(f)))
+			break;
+
+		if (offset != rd_len)
 			// seek to the beginning of current record, because
 			// it is truncated, so we have to read it one more time
-			fseek(f, (void*)record - (void*)rd_buff - rd_len, SEEK_CUR);
+			fseek(f, (long)offset - (long)rd_len, SEEK_CUR);
 	}
 
-	fclose(f);
+	return status;
+}
 
-	// remove cache file
-	unlink(fname);
+// Filter out duplicates and submit the batch of cached tracks. The walk
+// is stopped on failure or when the number of batches is exhausted.
+static int cmusfm_cache_submit_callback(scrobbler_trackinfo_t *sb_tinf,
+		int count, void *data) {
+
+	struct cache_submit *ctx = data;
+	int i, n;
+
+	for (i = n = 0; i < count; i++) {
+
+		debug("cache: %s - %s (%s) - %d. %s (%ds)",
+				sb_tinf[i].artist, sb_tinf[i].album,
+				sb_tinf[i].album_artist, sb_tinf[i].track_number,
+				sb_tinf[i].track, sb_tinf[i].duration);
+
+		// segment is evicted by its newest record, so older records of
+		// the segment might have expired in the meantime
+		if (sb_tinf[i].timestamp < ctx->expired) {
+			cmusfm_metrics_add(METRICS_CACHE_EVICTED_AGE, 1);
+			continue;
+		}
+
+		// drop duplicates locally instead of costing a request
+		if (!cmusfm_dedup_check(&sb_tinf[i])) {
+			cmusfm_dedup_add(&sb_tinf[i]);
+			sb_tinf[n++] = sb_tinf[i];
+		}
+		else
+			cmusfm_metrics_add(METRICS_SCROBBLES_DUPLICATED, 1);
+	}
+
+	// batch of duplicates does not cost a request
+	ctx->records += count;
+	if (n == 0)
+		return 0;
+
+	if (cmusfm_cache_submit_batch(ctx->sbs, sb_tinf, n) == -1) {
+		ctx->failed = 1;
+		return 1;
+	}
+
+	return --ctx->batches == 0;
+}
+
+// Submit tracks saved in the cache. Tracks are submitted in batches, so
+// the number of requests is significantly reduced. Tracks which have been
+// submitted already are skipped. Submission goes segment by segment (the
+// oldest first) and stops at the first failure or after the given number
+// of batches. Interrupted segment is resumed by the next call (if the
+// position is lost, e.g. by the restart, the duplication index skips
+// records submitted already). Returns 1 if there are records left, 0 if
+// the whole cache was submitted and -1 on failure.
+int cmusfm_cache_submit(scrobbler_session_t *sbs, unsigned int batches) {
+
+	struct cache_submit ctx = { sbs, batches, 0, 0, 0 };
+	struct cache_segment *segments;
+	struct stat st;
+	char *fname;
+	int i, count, status, left = 0;
+	long start;
+	FILE *f;
+
+	debug("cache submit: %u", batches);
+
+	// Records appended by other process (e.g. the import) are not accounted,
+	// so the cache is known to be empty only if there is no segment.
+	if (cache.stat.valid && cache.stat.records == 0) {
+		count = cache_list_segments(&segments);
+		free(segments);
+		if (count == 0)
+			return 0;
+		cmusfm_cache_recount();
+		if (cache.stat.records == 0)
+			return 0;
+	}
+
+	// do not submit records which are going to be evicted anyway
+	cache_enforce_limits(0);
+	if (cache.max_age)
+		ctx.expired = time(NULL) - cache.max_age;
+
+	count = cache_list_segments(&segments);
+	for (i = 0; i < count && ctx.batches && !ctx.failed; i++) {
+
+		fname = get_cache_segment_file(segments[i].seq);
+		if ((f = fopen(fname, "r")) == NULL)
+			continue;
+
+		// wait for appends of other processes (see the append function)
+		flock(fileno(f), LOCK_EX);
+
+		start = 0;
+		if (fstat(fileno(f), &st) == 0 && cache.resume.seq == segments[i].seq &&
+				cache.resume.ino == st.st_ino && cache.resume.offset <= st.st_size)
+			fseek(f, start = cache.resume.offset, SEEK_SET);
+
+		ctx.records = 0;
+		status = cmusfm_cache_walk(f, cmusfm_cache_submit_callback, &ctx);
+
+		// If the submission has been interrupted, keep the position for
+		// the next one. Otherwise, remove submitted segment while holding
+		// the lock, but keep corrupted segment for inspection.
+		if (!ctx.failed && status == 1 && ftell(f) < st.st_size) {
+			cache.resume.seq = segments[i].seq;
+			cache.resume.ino = st.st_ino;
+			cache.resume.offset = ftell(f);
+			cache_stat_update(-1, cache.resume.offset - start, ctx.records);
+			left = 1;
+		}
+		else if (!ctx.failed && status != -1) {
+			unlink(fname);
+			if (cache.resume.seq == segments[i].seq)
+				cache.resume.seq = 0;
+			cache_stat_update(-1, st.st_size - start, ctx.records);
+		}
+
+		fclose(f);
+	}
+
+	free(segments);
+	cache.segment = 0;
+
+	if (ctx.failed)
+		return -1;
+	if (left || i < count)
+		return 1;
+
+	// whole cache has been submitted
+	cache.stat.bytes = 0;
+	cache.stat.records = 0;
+	cache.stat.valid = 1;
+	return 0;
+}
+
+// Count records of all cache segments, e.g. when they were modified by
+// other process (the import).
+void cmusfm_cache_recount(void) {
+
+	struct cache_segment *segments;
+	int i, count;
+
+	cache.stat.bytes = 0;
+	cache.stat.records = 0;
+
+	count = cache_list_segments(&segments);
+	for (i = 0; i < count; i++)
+		cache_stat_segment(segments[i].seq, &cache.stat.bytes, &cache.stat.records);
+
+	free(segments);
+	cache.stat.valid = 1;
+}
+
+// Get the size of the cache and the number of records in it. Totals are
+// counted once and then updated on every cache operation.
+void cmusfm_cache_stat(size_t *bytes, unsigned int *records) {
+	if (!cache.stat.valid)
+		cmusfm_cache_recount();
+	*bytes = cache.stat.bytes;
+	*records = cache.stat.records;
 }
 
 // Helper function for retrieving cmusfm cache file.
@@ -21,12 +21,28 @@
 #ifndef __CMUSFM_CACHE_H
 #define __CMUSFM_CACHE_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 #include "libscrobbler2.h"
 
 
 #define CMUSFM_CACHE_SIGNATURE 0x6643
 
+// Cache is split into segments - files named after the cache file with the
+// sequence number suffix. Records are appended to the last segment, while
+// whole segments are submitted and evicted (the oldest one first), so the
+// cache is never rewritten. The cache file itself (without the suffix) is
+// handled as the very first segment.
+#define CACHE_SEGMENT_SIZE (256 * 1024)
+
+// Large cache (e.g. after the import) is drained gradually - at most the
+// given number of batches is submitted at once, then the submission is
+// resumed after the delay (in seconds).
+#define CACHE_SUBMIT_BATCHES 4
+#define CACHE_SUBMIT_DELAY 5
+
 // cache record header structure
 struct __attribute__((__packed__)) cmusfm_cache_record {
 	uint32_t signature;
@@ -40,9 +56,23 @@ struct __attribute__((__packed__)) cmusfm_cache_record {
 	//char mbid[];         // NULL-terminated
 };
 
+// called with the batch of records decoded from the cache, non-zero
+// return value stops the walk
+typedef int (*cmusfm_cache_walk_callback_t)(scrobbler_trackinfo_t *sb_tinf,
+		int count, void *data);
+
 
 char *get_cmusfm_cache_file(void);
+size_t get_cache_record_size(const struct cmusfm_cache_record *record);
+struct cmusfm_cache_record *get_cache_record(const scrobbler_trackinfo_t *sb_tinf);
+int get_cache_record_trackinfo(const struct cmusfm_cache_record *record,
+		scrobbler_trackinfo_t *sb_tinf);
+int cmusfm_cache_walk(FILE *f, cmusfm_cache_walk_callback_t callback, void *data);
 void cmusfm_cache_update(const scrobbler_trackinfo_t *sb_tinf);
-void cmusfm_cache_submit(scrobbler_session_t *sbs);
+int cmusfm_cache_append(const void *data, size_t len);
+int cmusfm_cache_submit(scrobbler_session_t *sbs, unsigned int batches);
+void cmusfm_cache_set_limits(size_t max_size, time_t max_age);
+void cmusfm_cache_recount(void);
+void cmusfm_cache_stat(size_t *bytes, unsigned int *records);
 
 #endif
@@ -0,0 +1,180 @@
+/*
+ * cmusfm - check-library.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libcmusfm.h"
+
+
+// Check of the public library API - the context life cycle, status
+// reports from many threads, the event loop integration and commands.
+// The scrobbler service is not reachable, so scrobbles end up in the
+// cache of the temporary configuration directory.
+
+#define THREADS 4
+
+static cmusfm_ctx_t *ctx = NULL;
+static unsigned int failures = 0;
+
+#define check(cond) if (!(cond)) { \
+		failures++; \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+	}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+	(void)st; (void)flag; (void)ftw;
+	return remove(path);
+}
+
+// Execute the command and check whether the reply contains the string.
+static int command_reply(cmusfm_ctx_t *ctx, enum cmusfm_command command,
+		const char *str) {
+
+	char reply[4096];
+	size_t len;
+	FILE *f;
+
+	if ((f = tmpfile()) == NULL)
+		return 0;
+	if (cmusfm_command(ctx, command, f) != 0) {
+		fclose(f);
+		return 0;
+	}
+
+	rewind(f);
+	len = fread(reply, 1, sizeof(reply) - 1, f);
+	reply[len] = 0;
+	fclose(f);
+
+	return strstr(reply, str) != NULL;
+}
+
+static void *report_thread(void *arg) {
+
+	struct cmusfm_trackinfo tinfo = {
+		.status = CMUSFM_STATUS_PLAYING, .artist = "Artist", .title = "Title",
+		.duration = 240 };
+	char client[16];
+	int i;
+
+	sprintf(client, "thread-%ld", (long)arg);
+	tinfo.client = client;
+
+	for (i = 0; i < 32; i++) {
+		tinfo.status = i % 2 ? CMUSFM_STATUS_PAUSED : CMUSFM_STATUS_PLAYING;
+		if (cmusfm_on_status(ctx, &tinfo) != 0)
+			return (void *)1;
+	}
+
+	return NULL;
+}
+
+int main(void) {
+
+	char home[] = "/tmp/cmusfm-check-XXXXXX", fname[64];
+	struct cmusfm_trackinfo tinfo = {
+		.status = CMUSFM_STATUS_PLAYING, .client = "check",
+		.artist = "Artist", .title = "Title", .duration = 1 };
+	struct pollfd fds[4];
+	pthread_t threads[THREADS];
+	cmusfm_ctx_t *ctx2;
+	void *status;
+	int count, timeout;
+	long i;
+	FILE *f;
+
+	if (mkdtemp(home) == NULL)
+		return EXIT_FAILURE;
+	setenv("XDG_CONFIG_HOME", home, 1);
+
+	// service which is not reachable
+	snprintf(fname, sizeof(fname), "%s/cmus", home);
+	mkdir(fname, 0700);
+	snprintf(fname, sizeof(fname), "%s/cmus/cmusfm.conf", home);
+	if ((f = fopen(fname, "w")) == NULL)
+		return EXIT_FAILURE;
+	fprintf(f, "user = \"check\"\nkey = \"0123456789abcdef0123456789abcdef\"\n"
+			"service-url = \"http://127.0.0.1:1/\"\n");
+	fclose(f);
+
+	ctx = cmusfm_ctx_new();
+	check(ctx != NULL);
+	if (ctx == NULL)
+		goto final;
+
+	// only one context can exist at once
+	ctx2 = cmusfm_ctx_new();
+	check(ctx2 == NULL && errno == EBUSY);
+
+	tinfo.status = 0;
+	check(cmusfm_on_status(ctx, &tinfo) == -1);
+
+	// track played long enough is cached, because the service is down
+	tinfo.status = CMUSFM_STATUS_PLAYING;
+	check(cmusfm_on_status(ctx, &tinfo) == 0);
+	sleep(1);
+	tinfo.status = CMUSFM_STATUS_STOPPED;
+	check(cmusfm_on_status(ctx, &tinfo) == 0);
+	check(command_reply(ctx, CMUSFM_COMMAND_STATUS, "cache: 1 records"));
+
+	// status reports from many threads at once
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, report_thread, (void *)(i + 1));
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], &status);
+		check(status == NULL);
+	}
+	check(command_reply(ctx, CMUSFM_COMMAND_STATUS, "thread-4"));
+
+	// event loop integration
+	count = cmusfm_poll_fds(ctx, fds, sizeof(fds) / sizeof(*fds), &timeout);
+	check(count >= 0 && count <= (int)(sizeof(fds) / sizeof(*fds)));
+	for (i = 0; i < count; i++)
+		fds[i].revents = 0;
+	check(cmusfm_dispatch(ctx, fds, count) == 0);
+
+	check(command_reply(ctx, CMUSFM_COMMAND_STATS, "cmusfm_events_received_total"));
+	check(command_reply(ctx, CMUSFM_COMMAND_PAUSE, ""));
+	check(command_reply(ctx, CMUSFM_COMMAND_STATUS, "submissions: paused"));
+
+	cmusfm_ctx_free(ctx);
+
+	// context can be created again after it was freed
+	ctx = cmusfm_ctx_new();
+	check(ctx != NULL);
+	cmusfm_ctx_free(ctx);
+
+final:
+	nftw(home, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+	printf("failures: %u\n", failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+/*
+ * cmusfm - check-monitor.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "core.h"
+#include "monitor.h"
+#include "server.h"
+
+
+// Scripted test of the remote monitor - a fake cmus answers the "status"
+// command with the playback state set by the script, and the clock of the
+// monitor is advanced by the script as well. Events passed to the core are
+// recorded by the stubs below and compared with the expected ones.
+
+// play time of the event which is not checked
+#define ANY_PLAYTIME -2
+
+struct event {
+	enum cmstatus status;
+	char title[64];
+	time_t playtime;
+};
+
+static pthread_mutex_t player_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	const char *status;
+	const char *title;
+	int position;
+} player;
+
+static uint64_t clock_ms = 1000;
+static struct event events[16];
+static int events_count = 0;
+static int failures = 0;
+
+
+static uint64_t script_clock(void) {
+	return clock_ms;
+}
+
+// Core stubs - the event is stored as the status and the title only.
+ssize_t cmusfm_core_pack_track(struct cmtrack_info *tinfo, const char *client,
+		char *buffer, size_t size) {
+
+	struct sock_data_tag *dt = (struct sock_data_tag *)buffer;
+
+	(void)client;
+	memset(dt, 0, sizeof(*dt));
+	dt->status = tinfo->status;
+	snprintf(&buffer[sizeof(*dt)], size - sizeof(*dt), "%s",
+			tinfo->title ? tinfo->title : "");
+	return sizeof(*dt) + strlen(&buffer[sizeof(*dt)]) + 1;
+}
+
+void cmusfm_core_process_measured(char *buffer, ssize_t len, time_t playtime) {
+
+	struct sock_data_tag *dt = (struct sock_data_tag *)buffer;
+	struct event *ev;
+
+	(void)len;
+	if (events_count == sizeof(events) / sizeof(*events))
+		return;
+
+	ev = &events[events_count++];
+	ev->status = dt->status;
+	snprintf(ev->title, sizeof(ev->title), "%s", &buffer[sizeof(*dt)]);
+	ev->playtime = playtime;
+}
+
+// Serve the "status" command of one client until it disconnects.
+static void *fake_cmus(void *arg) {
+
+	int fd, cfd = *(int *)arg;
+	char buffer[1024];
+	int len;
+
+	if ((fd = accept(cfd, NULL, NULL)) == -1)
+		return NULL;
+
+	while (read(fd, buffer, sizeof(buffer)) > 0) {
+		pthread_mutex_lock(&player_mutex);
+		len = snprintf(buffer, sizeof(buffer), "status %s\n"
+				"file /music/%s.mp3\nduration 100\nposition %d\n"
+				"tag artist Artist\ntag title %s\n\n",
+				player.status, player.title, player.position, player.title);
+		pthread_mutex_unlock(&player_mutex);
+		if (write(fd, buffer, len) != len)
+			break;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+// Set the player state, advance the clock and poll the fake cmus.
+static void step(const char *path, int advance, const char *status,
+		const char *title, int position) {
+
+	pthread_mutex_lock(&player_mutex);
+	player.status = status;
+	player.title = title;
+	player.position = position;
+	pthread_mutex_unlock(&player_mutex);
+
+	clock_ms += advance * 1000;
+	events_count = 0;
+	cmusfm_monitor_poll(path);
+}
+
+// Compare the recorded events with the expected ones (terminated by the
+// event with the empty title).
+static void expect(const char *name, const struct event *expected) {
+
+	int i;
+
+	for (i = 0; expected[i].title[0] != '\0'; i++)
+		if (i >= events_count || events[i].status != expected[i].status ||
+				strcmp(events[i].title, expected[i].title) != 0 ||
+				(expected[i].playtime != ANY_PLAYTIME &&
+					events[i].playtime != expected[i].playtime))
+			break;
+
+	if (expected[i].title[0] != '\0' || i != events_count) {
+		fprintf(stderr, "%s: unexpected events:", name);
+		for (i = 0; i < events_count; i++)
+			fprintf(stderr, " %d/%s/%ld", events[i].status, events[i].title,
+					(long)events[i].playtime);
+		fprintf(stderr, "\n");
+		failures++;
+	}
+}
+
+int main(void) {
+
+	static const struct event none[] = { { 0, "", 0 } };
+	char dir[] = "/tmp/check-monitor-XXXXXX";
+	struct sockaddr_un addr;
+	pthread_t thread;
+	int fd;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/socket", dir);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+			bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+			listen(fd, 1) == -1) {
+		perror("fake cmus");
+		return EXIT_FAILURE;
+	}
+
+	pthread_create(&thread, NULL, fake_cmus, &fd);
+	cmusfm_monitor_set_clock(script_clock);
+
+	// the play time before the first poll is accounted by the server
+	step(addr.sun_path, 0, "playing", "A", 0);
+	expect("start", (struct event[]){
+			{ CMSTATUS_PLAYING, "A", -1 }, { 0, "", 0 } });
+	step(addr.sun_path, 5, "playing", "A", 5);
+	expect("play", none);
+
+	// the previous track has been finished in between the polls
+	step(addr.sun_path, 7, "playing", "B", 2);
+	expect("track change", (struct event[]){
+			{ CMSTATUS_PLAYING, "B", 10 }, { 0, "", 0 } });
+
+	// the seek is not accounted
+	step(addr.sun_path, 3, "playing", "B", 50);
+	expect("seek", none);
+	step(addr.sun_path, 4, "paused", "B", 54);
+	expect("pause", (struct event[]){
+			{ CMSTATUS_PAUSED, "B", 6 }, { 0, "", 0 } });
+	step(addr.sun_path, 0, "playing", "B", 54);
+	expect("unpause", (struct event[]){
+			{ CMSTATUS_PLAYING, "B", 6 }, { 0, "", 0 } });
+	step(addr.sun_path, 10, "playing", "B", 64);
+	expect("play", none);
+
+	// the jump back to the track beginning finishes the play
+	step(addr.sun_path, 1, "playing", "B", 1);
+	expect("replay", (struct event[]){
+			{ CMSTATUS_STOPPED, "B", 16 },
+			{ CMSTATUS_PLAYING, "B", ANY_PLAYTIME }, { 0, "", 0 } });
+	step(addr.sun_path, 5, "playing", "B", 6);
+	expect("play", none);
+
+	// the stop resets the position, so the play since the previous poll
+	// is estimated by the elapsed time
+	step(addr.sun_path, 3, "stopped", "B", 0);
+	expect("stop", (struct event[]){
+			{ CMSTATUS_STOPPED, "B", 9 }, { 0, "", 0 } });
+
+	cmusfm_monitor_close();
+	pthread_join(thread, NULL);
+	close(fd);
+	unlink(addr.sun_path);
+	rmdir(dir);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,255 @@
+/*
+ * cmusfm - check-relay.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "relay.h"
+#include "server.h"
+
+
+// Loopback test of the relay mode - many node processes forward events to
+// one listener at the same time. Authenticated frames have to be received
+// intact and in the order they were sent by every node, while frames with
+// the wrong secret or malformed socket data have to be rejected. Captured
+// frame sent again has to be rejected as well, and a stalled node must not
+// block the listener for longer than the read time limit.
+
+#define NODES 4
+#define FRAMES 32
+
+static const char *secret = "0123456789";
+
+// Send one event of the given node (the sequence is stored as the track
+// number). Broken events have an offset outside of the frame.
+static int send_event(const char *address, const char *secret, int node,
+		int seq, int broken) {
+
+	char buffer[CMSOCKET_BUFFER_SIZE];
+	struct sock_data_tag *dt = (struct sock_data_tag *)buffer;
+	char *data = &buffer[sizeof(*dt)];
+	size_t len;
+
+	memset(buffer, 0, sizeof(buffer));
+	dt->status = CMSTATUS_PLAYING;
+	dt->tracknb = seq;
+	dt->duration = 240;
+	snprintf(dt->client, sizeof(dt->client), "node-%d", node);
+	len = sizeof(*dt) + sprintf(data, "Artist%cAlbum%cTitle %d%c/music/%d.mp3%c",
+			0, 0, seq, 0, seq, 0);
+	dt->alboff = 7;
+	dt->titoff = 13;
+	dt->locoff = broken ? 0x7fff0000 : 13 + (int)strlen(&data[13]) + 1;
+
+	return cmusfm_relay_send(address, secret, buffer, len, seq % 2 ? seq : 0);
+}
+
+static int run_node(const char *address, int node) {
+
+	int seq, failures = 0;
+
+	for (seq = 0; seq < FRAMES; seq++) {
+		if (send_event(address, secret, node, seq, 0) != 0)
+			failures++;
+		// interleave frames which have to be rejected
+		if (seq % 8 == 0) {
+			send_event(address, "wrong secret", node, seq, 0);
+			send_event(address, secret, node, seq, 1);
+		}
+	}
+
+	return failures;
+}
+
+// Connect to the listener and write the given raw data.
+static int write_raw(const struct sockaddr_in *addr, const void *data, size_t len) {
+
+	int fd, status = -1;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) == 0 &&
+			write(fd, data, len) == (ssize_t)len)
+		status = 0;
+	close(fd);
+	return status;
+}
+
+// Capture the frame on the plain listener and send it twice to the relay
+// listener - only the first copy can be accepted.
+static int check_replay(int fd, const struct sockaddr_in *addr) {
+
+	char frame[sizeof(struct cmusfm_relay_header) + CMSOCKET_BUFFER_SIZE];
+	char buffer[CMSOCKET_BUFFER_SIZE], address[32];
+	struct sockaddr_in capture_addr;
+	socklen_t addrlen = sizeof(capture_addr);
+	int capture, cfd, i, failures = 0;
+	ssize_t len = -1, accepted[2];
+	time_t age;
+
+	if ((capture = cmusfm_relay_listen("127.0.0.1:0")) == -1 ||
+			getsockname(capture, (struct sockaddr *)&capture_addr, &addrlen) == -1)
+		return -1;
+	sprintf(address, "127.0.0.1:%d", ntohs(capture_addr.sin_port));
+
+	if (send_event(address, secret, 0, FRAMES, 0) == 0 &&
+			(cfd = accept(capture, NULL, NULL)) != -1) {
+		len = read(cfd, frame, sizeof(frame));
+		close(cfd);
+	}
+	close(capture);
+	if (len <= 0)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		accepted[i] = -1;
+		if (write_raw(addr, frame, len) == 0 &&
+				(cfd = accept(fd, NULL, NULL)) != -1) {
+			accepted[i] = cmusfm_relay_read(cfd, secret, buffer, sizeof(buffer), &age);
+			close(cfd);
+		}
+	}
+
+	if (accepted[0] == -1 || accepted[1] != -1) {
+		fprintf(stderr, "relay: replayed frame: %zd, %zd\n", accepted[0], accepted[1]);
+		failures++;
+	}
+
+	return failures;
+}
+
+// Connect to the relay listener and send only the beginning of the frame.
+static int check_stall(int fd, const struct sockaddr_in *addr) {
+
+	char buffer[CMSOCKET_BUFFER_SIZE];
+	uint32_t length = htonl(sizeof(struct sock_data_tag) + 16);
+	struct timespec start, end;
+	int cfd, sfd, failures = 0;
+	long elapsed;
+	time_t age;
+
+	if ((sfd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+			connect(sfd, (struct sockaddr *)addr, sizeof(*addr)) == -1 ||
+			write(sfd, &length, sizeof(length)) != sizeof(length) ||
+			(cfd = accept(fd, NULL, NULL)) == -1)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (cmusfm_relay_read(cfd, secret, buffer, sizeof(buffer), &age) != -1)
+		failures++;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(cfd);
+	close(sfd);
+
+	elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+	if (elapsed > 2 * RELAY_READ_TIMEOUT) {
+		fprintf(stderr, "relay: stalled frame: %ld ms\n", elapsed);
+		failures++;
+	}
+
+	return failures;
+}
+
+int main(void) {
+
+	char buffer[CMSOCKET_BUFFER_SIZE], address[32];
+	struct sock_data_tag *dt = (struct sock_data_tag *)buffer;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int received[NODES] = { 0 };
+	int fd, cfd, node, status, total = 0, rejected = 0, failures = 0;
+	struct pollfd pfd;
+	ssize_t len;
+	time_t age;
+
+	if ((fd = cmusfm_relay_listen("127.0.0.1:0")) == -1 ||
+			getsockname(fd, (struct sockaddr *)&addr, &addrlen) == -1) {
+		perror("relay listen");
+		return EXIT_FAILURE;
+	}
+	sprintf(address, "127.0.0.1:%d", ntohs(addr.sin_port));
+
+	for (node = 0; node < NODES; node++)
+		if (fork() == 0)
+			return run_node(address, node) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (total < NODES * FRAMES && poll(&pfd, 1, 5000) > 0) {
+
+		if ((cfd = accept(fd, NULL, NULL)) == -1)
+			break;
+		len = cmusfm_relay_read(cfd, secret, buffer, sizeof(buffer), &age);
+		close(cfd);
+
+		if (len == -1) {
+			rejected++;
+			continue;
+		}
+
+		// events of every node have to arrive in order and intact
+		if (sscanf(dt->client, "node-%d", &node) != 1 || node < 0 || node >= NODES ||
+				dt->tracknb != received[node] || dt->duration != 240 ||
+				age != (dt->tracknb % 2 ? dt->tracknb : 0) ||
+				strcmp(&buffer[sizeof(*dt) + dt->alboff], "Album") != 0) {
+			fprintf(stderr, "relay: unexpected frame: %s: %d\n", dt->client, dt->tracknb);
+			failures++;
+			continue;
+		}
+
+		received[node]++;
+		total++;
+	}
+
+	while (wait(&status) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			failures++;
+
+	// remaining rejected frames might be pending after the last valid one
+	while (poll(&pfd, 1, 0) > 0 && (cfd = accept(fd, NULL, NULL)) != -1) {
+		if (cmusfm_relay_read(cfd, secret, buffer, sizeof(buffer), &age) == -1)
+			rejected++;
+		else
+			failures++;
+		close(cfd);
+	}
+
+	if (check_replay(fd, &addr) != 0 || check_stall(fd, &addr) != 0)
+		failures++;
+
+	close(fd);
+
+	printf("nodes: %d, received: %d, rejected: %d, failures: %d\n",
+			NODES, total, rejected, failures);
+	if (total != NODES * FRAMES || rejected != NODES * (FRAMES / 8) * 2)
+		failures++;
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+ * cmusfm - cmus-standin.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// Local stand-in of the cmus control socket (remote protocol), so the
+// cmusfm remote mode can be tested without the cmus. The playback is
+// driven by commands read from the standard input (one per line):
+//
+//   track <duration> <artist> - <title>  start playing the new track
+//   play | pause | stop                  change the playback status
+//   seek <position>                      set the playback position
+//
+// The position advances in real time during the playback. Point the server
+// to the stand-in with: cmus-socket = "<socket>"
+
+#define MAX_CLIENTS 8
+
+static struct {
+	const char *status;
+	char artist[128], title[128];
+	int duration;
+	// position at the time of the last status change
+	double position, changed;
+} player = { "stopped", "", "", 0, 0, 0 };
+
+static double get_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int get_position(void) {
+	double position = player.position;
+	if (strcmp(player.status, "playing") == 0)
+		position += get_time() - player.changed;
+	if (position > player.duration)
+		position = player.duration;
+	return position;
+}
+
+static void set_status(const char *status, double position) {
+	player.position = position;
+	player.changed = get_time();
+	player.status = status;
+}
+
+static void process_command(char *line) {
+
+	char *ptr;
+
+	line[strcspn(line, "\n")] = 0;
+	if (strncmp(line, "track ", 6) == 0) {
+		player.duration = atoi(&line[6]);
+		player.artist[0] = player.title[0] = 0;
+		if ((line = strchr(&line[6], ' ')) != NULL &&
+				(ptr = strstr(line, " - ")) != NULL) {
+			*ptr = 0;
+			snprintf(player.artist, sizeof(player.artist), "%s", line + 1);
+			snprintf(player.title, sizeof(player.title), "%s", ptr + 3);
+		}
+		set_status("playing", 0);
+	}
+	else if (strcmp(line, "play") == 0)
+		set_status("playing", get_position());
+	else if (strcmp(line, "pause") == 0)
+		set_status("paused", get_position());
+	else if (strcmp(line, "stop") == 0)
+		set_status("stopped", 0);
+	else if (strncmp(line, "seek ", 5) == 0)
+		set_status(player.status, atoi(&line[5]));
+	else if (line[0] != 0)
+		fprintf(stderr, "unknown command: %s\n", line);
+}
+
+// Write the reply of the "status" command (terminated by an empty line).
+static void write_status(int fd) {
+
+	char buffer[1024];
+	int len = 0;
+
+	len += snprintf(&buffer[len], sizeof(buffer) - len, "status %s\n", player.status);
+	if (player.duration != 0) {
+		len += snprintf(&buffer[len], sizeof(buffer) - len,
+				"file /music/%s - %s.mp3\nduration %d\nposition %d\n"
+				"tag artist %s\ntag title %s\n",
+				player.artist, player.title, player.duration, get_position(),
+				player.artist, player.title);
+	}
+	len += snprintf(&buffer[len], sizeof(buffer) - len,
+			"set repeat false\nset shuffle false\n\n");
+
+	write(fd, buffer, len);
+}
+
+int main(int argc, char *argv[]) {
+
+	struct pollfd pfds[2 + MAX_CLIENTS];
+	struct sockaddr_un addr;
+	char buffer[256];
+	ssize_t rd_len;
+	int i;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <socket>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+	unlink(addr.sun_path);
+	pfds[0].fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (bind(pfds[0].fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+			listen(pfds[0].fd, 4) == -1) {
+		perror("error: unable to listen");
+		return EXIT_FAILURE;
+	}
+
+	pfds[1].fd = STDIN_FILENO;
+	for (i = 0; i < 2 + MAX_CLIENTS; i++)
+		pfds[i].events = POLLIN;
+	for (i = 2; i < 2 + MAX_CLIENTS; i++)
+		pfds[i].fd = -1;
+
+	while (poll(pfds, 2 + MAX_CLIENTS, -1) > 0) {
+
+		if (pfds[0].revents & POLLIN)
+			for (i = 2; i < 2 + MAX_CLIENTS; i++)
+				if (pfds[i].fd == -1) {
+					pfds[i].fd = accept(pfds[0].fd, NULL, NULL);
+					break;
+				}
+
+		if (pfds[1].revents & (POLLIN | POLLHUP)) {
+			if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+				break;
+			process_command(buffer);
+		}
+
+		// commands are taken one per read - it is enough for the cmusfm
+		for (i = 2; i < 2 + MAX_CLIENTS; i++)
+			if (pfds[i].fd != -1 && pfds[i].revents & (POLLIN | POLLHUP)) {
+				if ((rd_len = read(pfds[i].fd, buffer, sizeof(buffer) - 1)) <= 0) {
+					close(pfds[i].fd);
+					pfds[i].fd = -1;
+					continue;
+				}
+				buffer[rd_len] = 0;
+				printf("request: %s", buffer);
+				fflush(stdout);
+				if (strncmp(buffer, "status", 6) == 0)
+					write_status(pfds[i].fd);
+				else
+					write(pfds[i].fd, "\n", 1);
+			}
+	}
+
+	unlink(addr.sun_path);
+	return EXIT_SUCCESS;
+}
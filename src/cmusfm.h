@@ -28,6 +28,13 @@
 #define CONFIG_FNAME "cmusfm.conf"
 #define SOCKET_FNAME "cmusfm.socket"
 #define CACHE_FNAME  "cmusfm.cache"
+#define HISTORY_FNAME "cmusfm.history"
+#define DEDUP_FNAME "cmusfm.dedup"
+#define TRACE_FNAME "cmusfm.trace"
+#define TAGS_FNAME "cmusfm.tags"
+#define SPOOL_FNAME "cmusfm.spool"
+#define SESSIONS_FNAME "cmusfm.sessions"
+#define COVERS_DNAME "cmusfm.covers"
 
 
 // time delay (in seconds) between login attempts to the Last.fm
@@ -51,6 +58,7 @@ enum cmstatus {
 struct cmtrack_info {
 	enum cmstatus status;
 	char *file, *url, *artist, *album, *title;
+	char *album_artist, *mbid;
 	int tracknb, duration;
 };
 
@@ -74,6 +82,9 @@ char *get_cmus_home_dir(void);
 #ifdef ENABLE_LIBNOTIFY
 char *get_album_cover_file(const char *location, const char *format);
 #endif
+struct format_matcher *get_regexp_format_matcher(const char *formats[], unsigned int count);
+struct format_match *get_regexp_matcher_matches(struct format_matcher *matcher, const char *str);
+void free_regexp_format_matcher(struct format_matcher *matcher);
 struct format_match *get_regexp_format_matches(const char *str, const char *format);
 struct format_match *get_regexp_match(struct format_match *matches, enum format_match_type type);
 
@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <fcntl.h>
@@ -38,15 +39,17 @@
 
 // Return the pointer to the configuration value substring. This function
 // strips all white-spaces and optional quotation marks.
-static char *get_config_value(char *str) {
+char *get_config_value(char *str) {
 
 	char *end;
 
-	// seek to the beginning of a value
-	str = strchr(str, '=') + 1;
+	// seek to the beginning of a value (empty if there is no value)
+	if ((end = strchr(str, '=')) == NULL)
+		return str + strlen(str);
+	str = end + 1;
 
 	// trim leading spaces and optional quotation
-	while (isspace(*str)) str++;
+	while (isspace((unsigned char)*str)) str++;
 	if (*str == '"') str++;
 
 	if (*str == 0) // edge case handling
@@ -54,7 +57,7 @@ static char *get_config_value(char *str) {
 
 	// trim trailing spaces and optional quotation
 	end = str + strlen(str) - 1;
-	while (end > str && isspace(*end)) end--;
+	while (end > str && isspace((unsigned char)*end)) end--;
 	if (*end == '"') end--;
 	*(end + 1) = 0;
 
@@ -69,16 +72,35 @@ static int decode_config_bool(const char *value) {
 	return strcmp(value, "yes") == 0;
 }
 
+// Add format into the list. The first format read from the file replaces
+// the default list, the following ones are appended in the given order.
+static void add_config_format(char list[][CMCONF_FORMAT_SIZE], unsigned int *count,
+		const char *value) {
+	if (*count == 0)
+		memset(list, 0, CMCONF_FORMAT_COUNT * CMCONF_FORMAT_SIZE);
+	if (*count < CMCONF_FORMAT_COUNT && value[0] != '\0')
+		strncpy(list[(*count)++], value, CMCONF_FORMAT_SIZE - 1);
+}
+
+static void write_config_formats(FILE *f, const char *key, char list[][CMCONF_FORMAT_SIZE]) {
+	unsigned int i;
+	// write an empty value for the empty list, so defaults are not restored
+	for (i = 0; i == 0 || (i < CMCONF_FORMAT_COUNT && list[i][0]); i++)
+		fprintf(f, "%s = \"%s\"\n", key, list[i]);
+}
+
 // Read cmusfm configuration from the file.
 int cmusfm_config_read(const char *fname, struct cmusfm_config *conf) {
 
 	FILE *f;
 	char line[128];
+	unsigned int localfile_count = 0;
+	unsigned int shoutcast_count = 0;
 
 	// initialize configuration defaults
 	memset(conf, 0, sizeof(*conf));
-	strcpy(conf->format_localfile, "^(?A.+) - (?T.+)\\.[^.]+$");
-	strcpy(conf->format_shoutcast, "^(?A.+) - (?T.+)$");
+	strcpy(conf->format_localfile[0], "^(?A.+) - (?T.+)\\.[^.]+$");
+	strcpy(conf->format_shoutcast[0], "^(?A.+) - (?T.+)$");
 #ifdef ENABLE_LIBNOTIFY
 	// set the MS Windows name convention as a default - compatible with most
 	// sailors from the pirate bay
@@ -98,9 +120,9 @@ int cmusfm_config_read(const char *fname, struct cmusfm_config *conf) {
 		else if (strncmp(line, CMCONF_SESSION_KEY, sizeof(CMCONF_SESSION_KEY) - 1) == 0)
 			strncpy(conf->session_key, get_config_value(line), sizeof(conf->session_key) - 1);
 		else if (strncmp(line, CMCONF_FORMAT_LOCALFILE, sizeof(CMCONF_FORMAT_LOCALFILE) - 1) == 0)
-			strncpy(conf->format_localfile, get_config_value(line), sizeof(conf->format_localfile) - 1);
+			add_config_format(conf->format_localfile, &localfile_count, get_config_value(line));
 		else if (strncmp(line, CMCONF_FORMAT_SHOUTCAST, sizeof(CMCONF_FORMAT_SHOUTCAST) - 1) == 0)
-			strncpy(conf->format_shoutcast, get_config_value(line), sizeof(conf->format_shoutcast) - 1);
+			add_config_format(conf->format_shoutcast, &shoutcast_count, get_config_value(line));
 		else if (strncmp(line, CMCONF_NOWPLAYING_LOCALFILE, sizeof(CMCONF_NOWPLAYING_LOCALFILE) - 1) == 0)
 			conf->nowplaying_localfile = decode_config_bool(get_config_value(line));
 		else if (strncmp(line, CMCONF_NOWPLAYING_SHOUTCAST, sizeof(CMCONF_NOWPLAYING_SHOUTCAST) - 1) == 0)
@@ -109,6 +131,24 @@ int cmusfm_config_read(const char *fname, struct cmusfm_config *conf) {
 			conf->submit_localfile = decode_config_bool(get_config_value(line));
 		else if (strncmp(line, CMCONF_SUBMIT_SHOUTCAST, sizeof(CMCONF_SUBMIT_SHOUTCAST) - 1) == 0)
 			conf->submit_shoutcast = decode_config_bool(get_config_value(line));
+		else if (strncmp(line, CMCONF_CMUS_SOCKET, sizeof(CMCONF_CMUS_SOCKET) - 1) == 0)
+			strncpy(conf->cmus_socket, get_config_value(line), sizeof(conf->cmus_socket) - 1);
+		else if (strncmp(line, CMCONF_CACHE_MAX_SIZE, sizeof(CMCONF_CACHE_MAX_SIZE) - 1) == 0)
+			conf->cache_max_size = strtoul(get_config_value(line), NULL, 10);
+		else if (strncmp(line, CMCONF_CACHE_MAX_AGE, sizeof(CMCONF_CACHE_MAX_AGE) - 1) == 0)
+			conf->cache_max_age = strtoul(get_config_value(line), NULL, 10);
+		else if (strncmp(line, CMCONF_RELAY_LISTEN, sizeof(CMCONF_RELAY_LISTEN) - 1) == 0)
+			strncpy(conf->relay_listen, get_config_value(line), sizeof(conf->relay_listen) - 1);
+		else if (strncmp(line, CMCONF_RELAY_SERVER, sizeof(CMCONF_RELAY_SERVER) - 1) == 0)
+			strncpy(conf->relay_server, get_config_value(line), sizeof(conf->relay_server) - 1);
+		else if (strncmp(line, CMCONF_RELAY_SECRET, sizeof(CMCONF_RELAY_SECRET) - 1) == 0)
+			strncpy(conf->relay_secret, get_config_value(line), sizeof(conf->relay_secret) - 1);
+		else if (strncmp(line, CMCONF_METRICS_FILE, sizeof(CMCONF_METRICS_FILE) - 1) == 0)
+			strncpy(conf->metrics_file, get_config_value(line), sizeof(conf->metrics_file) - 1);
+		else if (strncmp(line, CMCONF_RECORD_FILE, sizeof(CMCONF_RECORD_FILE) - 1) == 0)
+			strncpy(conf->record_file, get_config_value(line), sizeof(conf->record_file) - 1);
+		else if (strncmp(line, CMCONF_SERVICE_URL, sizeof(CMCONF_SERVICE_URL) - 1) == 0)
+			strncpy(conf->service_url, get_config_value(line), sizeof(conf->service_url) - 1);
 #ifdef ENABLE_LIBNOTIFY
 		else if (strncmp(line, CMCONF_FORMAT_COVERFILE, sizeof(CMCONF_FORMAT_COVERFILE) - 1) == 0)
 			strncpy(conf->format_coverfile, get_config_value(line), sizeof(conf->format_coverfile) - 1);
@@ -137,8 +177,8 @@ int cmusfm_config_write(const char *fname, struct cmusfm_config *conf) {
 	fprintf(f, "%s = \"%s\"\n", CMCONF_SESSION_KEY, conf->session_key);
 
 	fprintf(f, "\n# regular expressions for name parsers\n");
-	fprintf(f, "%s = \"%s\"\n", CMCONF_FORMAT_LOCALFILE, conf->format_localfile);
-	fprintf(f, "%s = \"%s\"\n", CMCONF_FORMAT_SHOUTCAST, conf->format_shoutcast);
+	write_config_formats(f, CMCONF_FORMAT_LOCALFILE, conf->format_localfile);
+	write_config_formats(f, CMCONF_FORMAT_SHOUTCAST, conf->format_shoutcast);
 #ifdef ENABLE_LIBNOTIFY
 	fprintf(f, "%s = \"%s\"\n", CMCONF_FORMAT_COVERFILE, conf->format_coverfile);
 #endif
@@ -152,6 +192,25 @@ int cmusfm_config_write(const char *fname, struct cmusfm_config *conf) {
 	fprintf(f, "%s = \"%s\"\n", CMCONF_NOTIFICATION, encode_config_bool(conf->notification));
 #endif
 
+	fprintf(f, "\n# cmus control socket (remote mode)\n");
+	fprintf(f, "%s = \"%s\"\n", CMCONF_CMUS_SOCKET, conf->cmus_socket);
+
+	fprintf(f, "\n# cache limits (size in KiB, age in days, zero means no limit)\n");
+	fprintf(f, "%s = \"%u\"\n", CMCONF_CACHE_MAX_SIZE, conf->cache_max_size);
+	fprintf(f, "%s = \"%u\"\n", CMCONF_CACHE_MAX_AGE, conf->cache_max_age);
+
+	fprintf(f, "\n# relay mode (central server and node)\n");
+	fprintf(f, "%s = \"%s\"\n", CMCONF_RELAY_LISTEN, conf->relay_listen);
+	fprintf(f, "%s = \"%s\"\n", CMCONF_RELAY_SERVER, conf->relay_server);
+	fprintf(f, "%s = \"%s\"\n", CMCONF_RELAY_SECRET, conf->relay_secret);
+
+	fprintf(f, "\n# server metrics export (Prometheus text format)\n");
+	fprintf(f, "%s = \"%s\"\n", CMCONF_METRICS_FILE, conf->metrics_file);
+
+	fprintf(f, "\n# events recording and scrobbler endpoint (testing purposes)\n");
+	fprintf(f, "%s = \"%s\"\n", CMCONF_RECORD_FILE, conf->record_file);
+	fprintf(f, "%s = \"%s\"\n", CMCONF_SERVICE_URL, conf->service_url);
+
 	return fclose(f);
 }
 
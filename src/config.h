@@ -37,19 +37,54 @@
 #define CMCONF_SUBMIT_LOCALFILE "submit-localfile"
 #define CMCONF_SUBMIT_SHOUTCAST "submit-shoutcast"
 #define CMCONF_NOTIFICATION "notification"
+#define CMCONF_RELAY_LISTEN "relay-listen"
+#define CMCONF_RELAY_SERVER "relay-server"
+#define CMCONF_RELAY_SECRET "relay-secret"
+#define CMCONF_METRICS_FILE "metrics-file"
+#define CMCONF_RECORD_FILE "record-file"
+#define CMCONF_SERVICE_URL "service-url"
+#define CMCONF_CMUS_SOCKET "cmus-socket"
+#define CMCONF_CACHE_MAX_SIZE "cache-max-size"
+#define CMCONF_CACHE_MAX_AGE "cache-max-age"
+
+// Name parser formats can be given many times (the first one which matches
+// wins), up to the following limit.
+#define CMCONF_FORMAT_COUNT 8
+#define CMCONF_FORMAT_SIZE 64
 
 
 struct cmusfm_config {
 	char user_name[64];
 	char session_key[16 * 2 + 1];
 
-	// regular expressions for name parsers
-	char format_localfile[64];
-	char format_shoutcast[64];
+	// regular expressions for name parsers (ordered by the priority)
+	char format_localfile[CMCONF_FORMAT_COUNT][CMCONF_FORMAT_SIZE];
+	char format_shoutcast[CMCONF_FORMAT_COUNT][CMCONF_FORMAT_SIZE];
 #ifdef ENABLE_LIBNOTIFY
 	char format_coverfile[64];
 #endif
 
+	// cmus control socket polled by the server (remote mode)
+	char cmus_socket[128];
+
+	// cache limits (in KiB and days), zero means no limit
+	unsigned int cache_max_size;
+	unsigned int cache_max_age;
+
+	// relay mode addresses ("host:port")
+	char relay_listen[64];
+	char relay_server[64];
+	// shared secret which authenticates relay nodes
+	char relay_secret[64];
+
+	// optional Prometheus text file with the server metrics
+	char metrics_file[128];
+
+	// optional recording of all received events (for later replay)
+	char record_file[128];
+	// scrobbler service endpoint override (e.g. local stand-in)
+	char service_url[128];
+
 	unsigned int nowplaying_localfile : 1;
 	unsigned int nowplaying_shoutcast : 1;
 	unsigned int submit_localfile : 1;
@@ -61,6 +96,7 @@ struct cmusfm_config {
 
 
 char *get_cmusfm_config_file(void);
+char *get_config_value(char *str);
 int cmusfm_config_read(const char *fname, struct cmusfm_config *conf);
 int cmusfm_config_write(const char *fname, struct cmusfm_config *conf);
 #if HAVE_SYS_INOTIFY_H
@@ -0,0 +1,867 @@
+/*
+ * cmusfm - core.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "core.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+
+#include "cache.h"
+#include "config.h"
+#include "debug.h"
+#include "dedup.h"
+#include "history.h"
+#include "metrics.h"
+#include "monitor.h"
+#include "probes.h"
+#include "record.h"
+#include "relay.h"
+#include "server.h"
+#include "session.h"
+#include "spool.h"
+#include "tags.h"
+#include "trace.h"
+#include "track.h"
+#ifdef ENABLE_LIBNOTIFY
+#include "notify.h"
+#endif
+
+
+// Last.fm API key for cmusfm
+unsigned char SC_api_key[16] = {0x67, 0x08, 0x2e, 0x45, 0xda, 0xb1,
+		0xf6, 0x43, 0x3d, 0xa7, 0x2a, 0x00, 0xe3, 0xbc, 0x03, 0x7a};
+unsigned char SC_secret[16] = {0x02, 0xfc, 0xbc, 0x90, 0x34, 0x1a,
+		0x01, 0xf2, 0x1c, 0x3b, 0xfc, 0x05, 0xb6, 0x36, 0xe3, 0xae};
+
+// Global configuration structure
+struct cmusfm_config config;
+
+// Scrobbler session of the core (NULL if not initialized).
+static scrobbler_session_t *sbs = NULL;
+
+// Helper function for artist name retrieval.
+static char *get_sock_data_artist(struct sock_data_tag *dt) {
+	return (char *)(dt + 1);
+}
+
+// Helper function for album name retrieval.
+static char *get_sock_data_album(struct sock_data_tag *dt) {
+	return &((char *)(dt + 1))[dt->alboff];
+}
+
+// Helper function for track name retrieval.
+static char *get_sock_data_track(struct sock_data_tag *dt) {
+	return &((char *)(dt + 1))[dt->titoff];
+}
+
+// Helper function for location retrieval.
+static char *get_sock_data_location(struct sock_data_tag *dt) {
+	return &((char *)(dt + 1))[dt->locoff];
+}
+
+// Helper function for optional fields retrieval: 0 - album artist, 1 -
+// MusicBrainz identifier. Optional fields follow the location and the rest
+// of the socket data buffer is zeroed, so older clients are supported.
+static char *get_sock_data_optional(struct sock_data_tag *dt, int index) {
+	char *data = (char *)(dt + 1);
+	size_t size = CMSOCKET_BUFFER_SIZE - sizeof(*dt);
+	size_t offset = dt->locoff;
+	do {
+		if (offset >= size)
+			return "";
+		offset += strlen(&data[offset]) + 1;
+	} while (index-- > 0);
+	return offset < size ? &data[offset] : "";
+}
+
+// Copy data from the socket data into the scrobbler structure.
+static void set_trackinfo(scrobbler_trackinfo_t *sbt, struct sock_data_tag *dt) {
+	memset(sbt, 0, sizeof(*sbt));
+	sbt->duration = dt->duration;
+	sbt->track_number = dt->tracknb;
+	sbt->artist = get_sock_data_artist(dt);
+	sbt->album = get_sock_data_album(dt);
+	sbt->track = get_sock_data_track(dt);
+	// do not send empty optional fields
+	if ((sbt->album_artist = get_sock_data_optional(dt, 0))[0] == '\0')
+		sbt->album_artist = NULL;
+	if ((sbt->mbid = get_sock_data_optional(dt, 1))[0] == '\0')
+		sbt->mbid = NULL;
+}
+
+// Time of the last scrobbler service failure (zero if service is OK).
+static time_t scrobbler_fail_time = 1;
+
+// Number of scrobbles written to the cache for the batch submission.
+static unsigned int relay_pending = 0;
+
+// If set, scrobbles are kept in the cache and now-playing is not updated.
+static int submission_paused = 0;
+
+// Time of the spooled event being processed (zero for live events).
+static time_t spool_event_time = 0;
+
+// If set, the replayed event (see record.c) is being processed.
+static int replay_event = 0;
+
+// Last play scrobbled from the session fed by the monitor (see monitor.c).
+static cmusfm_track_id_t monitor_track_id = 0;
+static time_t monitor_started = 0;
+
+// Time of the last partial cache submission (zero if the cache is drained).
+static time_t cache_backlog_time = 0;
+
+// Name parser formats compiled for the current configuration.
+static struct format_matcher *format_localfile = NULL;
+static struct format_matcher *format_shoutcast = NULL;
+
+// Compile the list of formats from the configuration.
+static struct format_matcher *get_format_list_matcher(char list[][CMCONF_FORMAT_SIZE]) {
+
+	const char *formats[CMCONF_FORMAT_COUNT];
+	unsigned int count;
+
+	for (count = 0; count < CMCONF_FORMAT_COUNT && list[count][0]; count++)
+		formats[count] = list[count];
+
+	return get_regexp_format_matcher(formats, count);
+}
+
+// Release compiled name parser formats.
+static void cmusfm_core_free_formats(void) {
+	free_regexp_format_matcher(format_localfile);
+	free_regexp_format_matcher(format_shoutcast);
+	format_localfile = format_shoutcast = NULL;
+}
+
+// Submit cached scrobbles if the scrobbler service is available. Large
+// cache is drained gradually, so the server stays responsive and the
+// service rate limit is not hit.
+void cmusfm_core_submit_cache(void) {
+	// cache is submitted anyway when the service is available again
+	if (scrobbler_fail_time != 0 || submission_paused) {
+		relay_pending = 0;
+		return;
+	}
+	if (cache_backlog_time != 0 && time(NULL) - cache_backlog_time < CACHE_SUBMIT_DELAY)
+		return;
+	if (cmusfm_cache_submit(sbs, CACHE_SUBMIT_BATCHES) == 1)
+		cache_backlog_time = time(NULL);
+	else
+		cache_backlog_time = 0;
+	relay_pending = 0;
+}
+
+// Current time for the session state machine.
+static time_t cmusfm_core_clock(void *data) {
+	(void)data;
+	// spooled events are processed as if they were received on time
+	if (spool_event_time != 0)
+		return spool_event_time;
+	return time(NULL);
+}
+
+// Check whether the play of the local client is also tracked by the
+// monitor - the cmus which is polled by the monitor might still run the
+// cmusfm as its status program. Such play has the same track and it has
+// been started at about the same time (the monitor detects the start by
+// the next poll) as the one which is or which has been played by the
+// monitor session, which takes precedence.
+static int cmusfm_core_monitor_play(const struct cmusfm_session *sess,
+		const scrobbler_trackinfo_t *sb_tinf) {
+
+	scrobbler_trackinfo_t monitor_tinf;
+	const struct cmusfm_session *monitor;
+	cmusfm_track_id_t track_id;
+	unsigned int i;
+
+	// relay nodes do not run the monitored cmus
+	if (config.cmus_socket[0] == 0 || strchr(sess->client, '/') != NULL ||
+			strcmp(sess->client, MONITOR_CLIENT) == 0)
+		return 0;
+
+	track_id = cmusfm_track_id_sbt(sb_tinf);
+	if (track_id == monitor_track_id &&
+			labs(sb_tinf->timestamp - monitor_started) <= MONITOR_POLL_MAX * 2 / 1000)
+		return 1;
+
+	for (i = 0; (monitor = cmusfm_session_at(i)) != NULL; i++)
+		if (strcmp(monitor->client, MONITOR_CLIENT) == 0)
+			break;
+	if (monitor == NULL || monitor->started == 0)
+		return 0;
+
+	set_trackinfo(&monitor_tinf, (struct sock_data_tag *)monitor->saved_data);
+	return cmusfm_track_id_sbt(&monitor_tinf) == track_id &&
+		labs(sb_tinf->timestamp - monitor->started) <= MONITOR_POLL_MAX * 2 / 1000;
+}
+
+// Scrobble sink of the session state machine - submit the saved track or
+// write it to the cache if the scrobbler service is not available.
+static void cmusfm_core_scrobble(void *data, struct cmusfm_session *sess) {
+
+	scrobbler_trackinfo_t sb_tinf;
+
+	(void)data;
+
+	// playing duration is OK so submit track
+	set_trackinfo(&sb_tinf, (struct sock_data_tag*)sess->saved_data);
+	sb_tinf.timestamp = sess->started;
+
+	if (replay_event) {
+		// replayed plays do not touch the duplication index, the cache nor
+		// the history, so the recording can be replayed many times
+		if (config.service_url[0] == 0) {
+			debug("replayed submission: %s", sess->client);
+			probe3(scrobble, sess->client, sb_tinf.timestamp, PROBE_DECISION_DISABLED);
+			return;
+		}
+		probe3(scrobble, sess->client, sb_tinf.timestamp, PROBE_DECISION_SUBMIT);
+		if (scrobbler_scrobble(sbs, &sb_tinf) != 0)
+			cmusfm_metrics_add(METRICS_SERVICE_FAILURES, 1);
+		return;
+	}
+
+	if ((sess->saved_is_radio && !config.submit_shoutcast) ||
+			(!sess->saved_is_radio && !config.submit_localfile)) {
+		// skip submission if we don't want it
+		debug("submission not enabled");
+		probe3(scrobble, sess->client, sb_tinf.timestamp, PROBE_DECISION_DISABLED);
+		return;
+	}
+
+	// status program of the polled cmus might report the same play
+	if (strcmp(sess->client, MONITOR_CLIENT) == 0) {
+		monitor_track_id = cmusfm_track_id_sbt(&sb_tinf);
+		monitor_started = sb_tinf.timestamp;
+	}
+
+	if (cmusfm_dedup_check(&sb_tinf)) {
+		// the very same play has been submitted already
+		debug("duplicated submission");
+		cmusfm_metrics_add(METRICS_SCROBBLES_DUPLICATED, 1);
+		probe3(scrobble, sess->client, sb_tinf.timestamp, PROBE_DECISION_DUPLICATE);
+		return;
+	}
+
+	if (cmusfm_core_monitor_play(sess, &sb_tinf)) {
+		// the very same play is scrobbled by the monitor session
+		debug("play tracked by the monitor: %s", sess->client);
+		cmusfm_metrics_add(METRICS_SCROBBLES_DUPLICATED, 1);
+		probe3(scrobble, sess->client, sb_tinf.timestamp, PROBE_DECISION_DUPLICATE);
+		return;
+	}
+
+	if (scrobbler_fail_time == 0 && !submission_paused &&
+			config.relay_listen[0] == 0) {
+		probe3(scrobble, sess->client, sb_tinf.timestamp, PROBE_DECISION_SUBMIT);
+		if (scrobbler_scrobble(sbs, &sb_tinf) != 0) {
+			scrobbler_fail_time = 1;
+			cmusfm_metrics_add(METRICS_SERVICE_FAILURES, 1);
+			goto action_submit_failed;
+		}
+		cmusfm_metrics_add(METRICS_SCROBBLES_SUBMITTED, 1);
+		cmusfm_dedup_add(&sb_tinf);
+	}
+	else {  // write data to cache
+action_submit_failed:
+		probe3(scrobble, sess->client, sb_tinf.timestamp, PROBE_DECISION_CACHE);
+		cmusfm_cache_update(&sb_tinf);
+
+		// in the relay mode scrobbles from all nodes are
+		// submitted in batches via the cache
+		if (config.relay_listen[0] && ++relay_pending >= SCROBBLER_BATCH_SIZE)
+			cmusfm_core_submit_cache();
+	}
+
+	// keep local listening history
+	cmusfm_history_append(&sb_tinf);
+}
+
+// Now-playing sink of the session state machine.
+static void cmusfm_core_nowplaying(void *data, struct cmusfm_session *sess,
+		const struct sock_data_tag *dt) {
+
+	scrobbler_trackinfo_t sb_tinf;
+
+	(void)data;
+	set_trackinfo(&sb_tinf, (struct sock_data_tag *)dt);
+
+	if (replay_event) {
+		if (config.service_url[0] == 0) {
+			debug("replayed now playing: %s", sess->client);
+			probe2(nowplaying, sess->client, PROBE_DECISION_DISABLED);
+			return;
+		}
+		probe2(nowplaying, sess->client, PROBE_DECISION_SUBMIT);
+		if (scrobbler_update_now_playing(sbs, &sb_tinf) != 0)
+			cmusfm_metrics_add(METRICS_SERVICE_FAILURES, 1);
+		return;
+	}
+
+	// spooled track which has been surely finished by now
+	if (spool_event_time != 0 && spool_event_time + dt->duration < time(NULL)) {
+		debug("stale spooled track");
+		return;
+	}
+
+#ifdef ENABLE_LIBNOTIFY
+	if (config.notification)
+		cmusfm_notify_show(&sb_tinf, get_sock_data_location((struct sock_data_tag *)dt),
+				config.format_coverfile);
+	else
+		debug("notification not enabled");
+#endif
+
+	// update now-playing indicator
+	if (scrobbler_fail_time != 0 || submission_paused) {
+		probe2(nowplaying, sess->client, PROBE_DECISION_UNAVAILABLE);
+		return;
+	}
+
+	if ((sess->saved_is_radio && !config.nowplaying_shoutcast) ||
+			(!sess->saved_is_radio && !config.nowplaying_localfile)) {
+		debug("now playing not enabled");
+		probe2(nowplaying, sess->client, PROBE_DECISION_DISABLED);
+		return;
+	}
+
+	probe2(nowplaying, sess->client, PROBE_DECISION_SUBMIT);
+	if (scrobbler_update_now_playing(sbs, &sb_tinf) != 0) {
+		scrobbler_fail_time = 1;
+		cmusfm_metrics_add(METRICS_SERVICE_FAILURES, 1);
+	}
+	else
+		cmusfm_metrics_add(METRICS_NOWPLAYING_SUBMITTED, 1);
+}
+
+// Process real server task - Last.fm submission.
+void cmusfm_core_process_data(char *buffer, ssize_t rd_len) {
+
+	struct sock_data_tag *sock_data = (struct sock_data_tag *)buffer;
+	struct cmusfm_session_ops ops = {
+		cmusfm_core_clock, cmusfm_core_scrobble, cmusfm_core_nowplaying, NULL };
+	struct cmusfm_session *sess;
+	cmusfm_track_id_t track_id, prev_track_id;
+	enum cmstatus prev_status;
+
+	debug("rdlen: %ld, status: %d", rd_len, sock_data->status);
+
+	// offsets might come from the network, so they have to be validated
+	if (rd_len < 0 || cmusfm_sock_data_check(buffer, rd_len) != 0)
+		return;  // something was wrong...
+
+	// make all strings (including optional ones) terminated
+	memset(&buffer[rd_len], 0, CMSOCKET_BUFFER_SIZE - rd_len);
+	buffer[CMSOCKET_BUFFER_SIZE - 1] = 0;
+
+	cmusfm_metrics_add(METRICS_EVENTS_RECEIVED, 1);
+	// replayed events are not recorded, otherwise the replay of the
+	// recording being written would never end
+	if (config.record_file[0] && !replay_event)
+		cmusfm_record_append(config.record_file, buffer, rd_len,
+				spool_event_time ? spool_event_time : time(NULL));
+	cmusfm_trace(TRACE_EVENT_RECEIVED, sock_data->status, rd_len, sock_data->client);
+
+	// playback state is tracked independently for every client
+	sock_data->client[sizeof(sock_data->client) - 1] = 0;
+	if ((sess = cmusfm_session_get(sock_data->client)) == NULL)
+		return;
+
+	prev_status = cmusfm_session_status(sess);
+	prev_track_id = sess->track_id;
+
+	debug("client: %s", sock_data->client);
+	debug("payload: %s - %s - %d. %s (%ds)",
+			get_sock_data_artist(sock_data), get_sock_data_album(sock_data),
+			sock_data->tracknb, get_sock_data_track(sock_data),
+			sock_data->duration);
+	debug("location: %s", get_sock_data_location(sock_data));
+
+#ifdef DEBUG_HICCUP
+	// simulate server "hiccup" (e.g. internet connection issue)
+	debug("server hiccup test (5s)");
+	sleep(5);
+#endif
+
+	// track change is detected by the canonical track identity
+	track_id = cmusfm_track_id(get_sock_data_artist(sock_data),
+			get_sock_data_album(sock_data), get_sock_data_track(sock_data),
+			sock_data->duration);
+
+	// test connection to server (on failure try again in some time)
+	if (!replay_event && scrobbler_fail_time != 0 &&
+			time(NULL) - scrobbler_fail_time > SERVICE_RETRY_DELAY) {
+		if (scrobbler_test_session_key(sbs) == 0) {  // everything should be OK now
+			scrobbler_fail_time = 0;
+
+			// if there is something in cache submit it
+			cmusfm_core_submit_cache();
+		}
+		else {
+			scrobbler_fail_time = time(NULL);
+			cmusfm_metrics_add(METRICS_SERVICE_FAILURES, 1);
+		}
+	}
+
+	cmusfm_session_process(sess, sock_data, rd_len, track_id, &ops);
+
+	if (cmusfm_session_status(sess) != prev_status || sess->track_id != prev_track_id)
+		cmusfm_trace(TRACE_STATE_CHANGE, cmusfm_session_status(sess), sess->track_id, sess->client);
+
+	// remove sessions of clients which are gone (the session pointer is
+	// not valid after that)
+	cmusfm_session_expire(cmusfm_core_clock(NULL));
+}
+
+// Process data with the play time of the current track measured by the
+// caller (e.g. the cmus remote poller), instead of the one accounted from
+// the time of events. Negative play time means, that it was not measured.
+void cmusfm_core_process_measured(char *buffer, ssize_t len, time_t playtime) {
+
+	struct sock_data_tag *sock_data = (struct sock_data_tag *)buffer;
+	struct cmusfm_session *sess;
+
+	if (len < 0 || cmusfm_sock_data_check(buffer, len) != 0)
+		return;
+
+	sock_data->client[sizeof(sock_data->client) - 1] = 0;
+	if (playtime >= 0 && (sess = cmusfm_session_get(sock_data->client)) != NULL)
+		cmusfm_session_measure(sess, playtime, cmusfm_core_clock(NULL));
+
+	cmusfm_core_process_data(buffer, len);
+}
+
+// Process event which could not be delivered on time, as if it was
+// received at the given time.
+void cmusfm_core_process_delayed(char *buffer, ssize_t len, time_t timestamp) {
+	spool_event_time = timestamp;
+	cmusfm_core_process_data(buffer, len);
+	spool_event_time = 0;
+}
+
+// Process the replayed event at its recorded time. Replayed plays are
+// tracked by sessions of their own, so they do not interfere with the live
+// ones, and they are submitted only to the configured service URL.
+void cmusfm_core_process_replay(char *buffer, ssize_t len, time_t timestamp) {
+
+	struct sock_data_tag *sock_data = (struct sock_data_tag *)buffer;
+	size_t prefix = strlen(REPLAY_CLIENT_PREFIX);
+	struct cmusfm_session *sess;
+
+	if (len < 0 || cmusfm_sock_data_check(buffer, len) != 0)
+		return;
+
+	memmove(&sock_data->client[prefix], sock_data->client,
+			sizeof(sock_data->client) - prefix);
+	memcpy(sock_data->client, REPLAY_CLIENT_PREFIX, prefix);
+	sock_data->client[sizeof(sock_data->client) - 1] = 0;
+
+	// the recording might be replayed again, so the state left by the
+	// previous replay (which is ahead of this event) is forgotten
+	if ((sess = cmusfm_session_get(sock_data->client)) != NULL &&
+			sess->updated > timestamp) {
+		sess->started = sess->paused = 0;
+		sess->track_id = 0;
+	}
+
+	replay_event = 1;
+	cmusfm_core_process_delayed(buffer, len, timestamp);
+	replay_event = 0;
+}
+
+// Spool callback - process event which could not be delivered on time.
+static void cmusfm_core_spool_event(char *buffer, size_t len, time_t timestamp,
+		void *data) {
+	(void)data;
+	cmusfm_core_process_delayed(buffer, len, timestamp);
+}
+
+// Process events spooled by the clients when the server was not running.
+void cmusfm_core_process_spool(void) {
+	if (cmusfm_spool_ingest(cmusfm_core_spool_event, NULL) == -1)
+		debug("spool ingest failed");
+}
+
+// Apply configuration settings to the scrobbler session.
+void cmusfm_core_apply_config(void) {
+	// recording file might have been changed
+	cmusfm_record_close();
+	scrobbler_set_session_key_str(sbs, config.session_key);
+	sbs->service_url = config.service_url[0] ? config.service_url : SCROBBLER_URL;
+	cmusfm_cache_set_limits((size_t)config.cache_max_size * 1024,
+			(time_t)config.cache_max_age * 24 * 60 * 60);
+
+	// compile name parser formats once per configuration load
+	cmusfm_core_free_formats();
+	format_localfile = get_format_list_matcher(config.format_localfile);
+	format_shoutcast = get_format_list_matcher(config.format_shoutcast);
+}
+
+// Update gauges which are not maintained during the data processing.
+void cmusfm_core_update_metrics(void) {
+#ifdef ENABLE_LIBNOTIFY
+	unsigned long latency;
+	if ((latency = cmusfm_notify_init_time()) != 0)
+		cmusfm_metrics_init(METRICS_INIT_NOTIFY, latency);
+#endif
+	cmusfm_metrics_set(METRICS_SERVICE_FAIL_TIME, scrobbler_fail_time);
+	cmusfm_metrics_set(METRICS_SESSIONS, cmusfm_session_count());
+}
+
+// Write the state of the server and all tracked sessions.
+static void cmusfm_core_dump_status(FILE *f) {
+
+	struct cmusfm_session *sess;
+	struct sock_data_tag *dt;
+	unsigned int i, records;
+	time_t playtime;
+	size_t bytes;
+
+	// cache might have been modified by other process (e.g. the import)
+	cmusfm_cache_recount();
+	cmusfm_cache_stat(&bytes, &records);
+	fprintf(f, "service: %s\n", scrobbler_fail_time == 0 ? "OK" : "unavailable");
+	fprintf(f, "submissions: %s\n", submission_paused ? "paused" : "enabled");
+	fprintf(f, "cache: %u records (%zu bytes)\n", records, bytes);
+
+	for (i = 0; (sess = cmusfm_session_at(i)) != NULL; i++) {
+		fprintf(f, "\nclient: %s\n", sess->client[0] ? sess->client : "(default)");
+
+		if (sess->started == 0) {
+			fprintf(f, "state: stopped\n");
+			continue;
+		}
+
+		playtime = sess->playtime;
+		if (sess->paused == 0)
+			playtime += time(NULL) - sess->unpaused;
+
+		dt = (struct sock_data_tag *)sess->saved_data;
+		fprintf(f, "state: %s\n", sess->paused ? "paused" : "playing");
+		fprintf(f, "track: %s - %s\n", get_sock_data_artist(dt), get_sock_data_track(dt));
+		fprintf(f, "played: %lds of %lds\n", (long)playtime, (long)sess->fulltime);
+	}
+}
+
+// Process request sent via the communication socket. The reply is written
+// into the given stream.
+void cmusfm_core_process_request(FILE *f, int request) {
+
+	struct cmusfm_config conf;
+	unsigned int records;
+	size_t bytes;
+
+	debug("request: %x", request);
+
+	switch (request) {
+	case CMREQUEST_STATS:
+		cmusfm_core_update_metrics();
+		cmusfm_metrics_write(f);
+		break;
+	case CMREQUEST_FLUSH:
+		if (submission_paused) {
+			fprintf(f, "error: submissions are paused\n");
+			break;
+		}
+		// do not wait for the retry delay
+		if (scrobbler_fail_time != 0) {
+			if (scrobbler_test_session_key(sbs) != 0) {
+				scrobbler_fail_time = time(NULL);
+				cmusfm_metrics_add(METRICS_SERVICE_FAILURES, 1);
+				fprintf(f, "error: scrobbler service not available\n");
+				break;
+			}
+			scrobbler_fail_time = 0;
+		}
+		cmusfm_cache_recount();
+		cmusfm_core_submit_cache();
+		cmusfm_cache_stat(&bytes, &records);
+		fprintf(f, "cache flushed (%u records left)\n", records);
+		break;
+	case CMREQUEST_RELOAD:
+		// keep the current configuration if the file is not readable
+		if (cmusfm_config_read(get_cmusfm_config_file(), &conf) == -1) {
+			fprintf(f, "error: unable to read config file\n");
+			break;
+		}
+		memcpy(&config, &conf, sizeof(config));
+		cmusfm_core_apply_config();
+		fprintf(f, "configuration reloaded\n");
+		break;
+	case CMREQUEST_PAUSE:
+		submission_paused = 1;
+		fprintf(f, "submissions paused\n");
+		break;
+	case CMREQUEST_RESUME:
+		submission_paused = 0;
+		fprintf(f, "submissions resumed\n");
+		break;
+	case CMREQUEST_STATUS:
+		cmusfm_core_dump_status(f);
+		break;
+	case CMREQUEST_TRACE:
+		if (cmusfm_trace_dump(get_cmusfm_trace_file()) == -1)
+			fprintf(f, "error: unable to write trace file\n");
+		break;
+	default:
+		fprintf(f, "error: unknown request\n");
+	}
+}
+
+// Trace HTTP request start (scrobbler request callback).
+static void cmusfm_core_request_start(const char *method) {
+	cmusfm_trace(TRACE_HTTP_START, 0, 0, method);
+}
+
+// Account finished HTTP request (scrobbler request callback).
+static void cmusfm_core_request_end(const char *method, unsigned long latency,
+		int status) {
+	cmusfm_trace(TRACE_HTTP_END, status, latency, method);
+	cmusfm_metrics_http(method, latency, status);
+}
+
+// Account deferred library initialization (scrobbler init callback).
+static void cmusfm_core_library_init(const char *library, unsigned long latency) {
+	debug("library initialized: %s (%luus)", library, latency);
+	if (strcmp(library, "curl") == 0)
+		cmusfm_metrics_init(METRICS_INIT_CURL, latency);
+}
+
+// Match the string against the list of formats from the configuration.
+// The matcher is compiled when the configuration is applied (or on the
+// first use in the client) and reused until the next configuration load.
+static struct format_match *get_format_list_matches(const char *str,
+		char list[][CMCONF_FORMAT_SIZE], struct format_matcher **matcher) {
+	if (*matcher == NULL)
+		*matcher = get_format_list_matcher(list);
+	return get_regexp_matcher_matches(*matcher, str);
+}
+
+// Pack track info into the socket data buffer. The client identifier is
+// used as is. Missing track information is taken from the file tags or
+// matched against name parser formats. Note, that strings of the track
+// info structure might be replaced. Returns the data length or -1.
+ssize_t cmusfm_core_pack_track(struct cmtrack_info *tinfo, const char *client,
+		char *buffer, size_t size) {
+
+	static const enum format_match_type types[] = {
+		CMFORMAT_ARTIST, CMFORMAT_ALBUM, CMFORMAT_TITLE };
+	struct sock_data_tag *sock_data = (struct sock_data_tag *)buffer;
+	char *artist, *album, *title, *location, *album_artist, *mbid;
+	struct format_match *match, *matches;
+	struct cmusfm_tags tags;
+	const char *fields[4];
+	size_t lengths[4];
+	unsigned int i;
+	size_t len;
+
+	if (size < CMSOCKET_BUFFER_SIZE)
+		return -1;
+
+	memset(buffer, 0, CMSOCKET_BUFFER_SIZE);
+	strncpy(sock_data->client, client, sizeof(sock_data->client) - 1);
+
+	// fill missing track information from the file tags
+	if (tinfo->file != NULL && cmusfm_tags_get(tinfo->file, &tags) == 0) {
+		if (tinfo->artist == NULL && tags.artist[0])
+			tinfo->artist = tags.artist;
+		if (tinfo->album == NULL && tags.album[0])
+			tinfo->album = tags.album;
+		if (tinfo->title == NULL && tags.title[0])
+			tinfo->title = tags.title;
+		if (tinfo->album_artist == NULL && tags.album_artist[0])
+			tinfo->album_artist = tags.album_artist;
+		if (tinfo->mbid == NULL && tags.mbid[0])
+			tinfo->mbid = tags.mbid;
+		if (tinfo->tracknb == 0)
+			tinfo->tracknb = tags.track_number;
+	}
+
+	// load data into the sock container
+	sock_data->status = tinfo->status;
+	sock_data->tracknb = tinfo->tracknb;
+	// if no duration time assume 3 min
+	sock_data->duration = tinfo->duration == 0 ? 180 : tinfo->duration;
+
+	// add Shoutcast (stream) flag
+	if (tinfo->url != NULL)
+		sock_data->status |= CMSTATUS_SHOUTCASTMASK;
+
+	fields[0] = tinfo->artist;
+	fields[1] = tinfo->album;
+	fields[2] = tinfo->title;
+	// track location (localfile or shoutcast)
+	fields[3] = tinfo->file != NULL ? tinfo->file : tinfo->url;
+	for (i = 0; i < 4; i++) {
+		if (fields[i] == NULL)
+			fields[i] = "";
+		lengths[i] = strlen(fields[i]);
+	}
+
+	matches = NULL;
+	if ((tinfo->url != NULL && tinfo->artist == NULL && tinfo->title != NULL) ||
+			(tinfo->file != NULL && tinfo->artist == NULL && tinfo->title == NULL)) {
+		// NOTE: Automatic format detection mode.
+		// When title and artist was not specified but URL or file is available.
+		debug("regular expression matching mode");
+
+		if (tinfo->url != NULL) {
+			// URL: try to fetch artist and track tile form the 'title' field
+
+			matches = get_format_list_matches(tinfo->title, config.format_shoutcast,
+					&format_shoutcast);
+			if (matches == NULL) {
+				fprintf(stderr, "error: shoutcast format match failed\n");
+				return -1;
+			}
+		}
+		else {
+			// FILE: try to fetch artist and track title from the 'file' field
+
+			tinfo->file = basename(tinfo->file);
+			matches = get_format_list_matches(tinfo->file, config.format_localfile,
+					&format_localfile);
+			if (matches == NULL) {
+				fprintf(stderr, "error: localfile format match failed\n");
+				return -1;
+			}
+		}
+
+		for (i = 0; i < 3; i++) {
+			match = get_regexp_match(matches, types[i]);
+			fields[i] = match->data != NULL ? match->data : "";
+			lengths[i] = match->len;
+		}
+
+	}
+
+	// all mandatory strings have to fit into the buffer, together with the
+	// terminators of the (possibly empty) optional ones
+	for (i = 0, len = sizeof(*sock_data) + 2; i < 4; i++)
+		len += lengths[i] + 1;
+	if (len > CMSOCKET_BUFFER_SIZE) {
+		debug("track info too long: %zu", len);
+		free(matches);
+		return -1;
+	}
+
+	artist = (char *)(sock_data + 1);
+	memcpy(artist, fields[0], lengths[0]);
+	album = &artist[lengths[0] + 1];
+	memcpy(album, fields[1], lengths[1]);
+	title = &album[lengths[1] + 1];
+	memcpy(title, fields[2], lengths[2]);
+	location = &title[lengths[2] + 1];
+	memcpy(location, fields[3], lengths[3]);
+
+	free(matches);
+
+	// Optional fields (if there is enough space in the buffer). Space for
+	// both terminators is reserved above, so pointers stay in the buffer.
+	album_artist = &location[lengths[3] + 1];
+	len = &buffer[CMSOCKET_BUFFER_SIZE] - album_artist;
+	if (tinfo->album_artist != NULL && strlen(tinfo->album_artist) + 2 <= len)
+		strcpy(album_artist, tinfo->album_artist);
+	mbid = &album_artist[strlen(album_artist) + 1];
+	len = &buffer[CMSOCKET_BUFFER_SIZE] - mbid;
+	if (tinfo->mbid != NULL && strlen(tinfo->mbid) + 1 <= len)
+		strcpy(mbid, tinfo->mbid);
+
+	// calculate data offsets
+	sock_data->alboff = album - artist;
+	sock_data->titoff = title - artist;
+	sock_data->locoff = location - artist;
+
+	return &mbid[strlen(mbid) + 1] - buffer;
+}
+
+
+// Time (in seconds) after which the cache should be submitted, because
+// scrobbles are waiting for the batch submission or the cache is being
+// drained. If there is nothing to submit, -1 is returned.
+time_t cmusfm_core_submit_delay(void) {
+
+	time_t delay = -1;
+
+	if (relay_pending)
+		delay = RELAY_BATCH_DELAY;
+	if (cache_backlog_time != 0 && scrobbler_fail_time == 0 && !submission_paused) {
+		delay = cache_backlog_time + CACHE_SUBMIT_DELAY - time(NULL);
+		if (delay < 0)
+			delay = 0;
+	}
+
+	return delay;
+}
+
+// Initialize the scrobbler session of the core. Configuration has to be
+// read before calling this function.
+int cmusfm_core_initialize(void) {
+
+	char fname[128 + 16];
+
+	if ((sbs = scrobbler_initialize(SC_api_key, SC_secret)) == NULL)
+		return -1;
+
+	// resume plays which were in progress when the server was stopped
+	sprintf(fname, "%s/" SESSIONS_FNAME, get_cmus_home_dir());
+	if (cmusfm_session_restore(fname) == -1)
+		debug("sessions checkpoint not available: %s", fname);
+
+	cmusfm_core_apply_config();
+	sbs->request_start_callback = cmusfm_core_request_start;
+	sbs->request_callback = cmusfm_core_request_end;
+	sbs->init_callback = cmusfm_core_library_init;
+
+	return 0;
+}
+
+// Initialize the HTTP library right away, instead of on the first use.
+int cmusfm_core_initialize_http(void) {
+	return scrobbler_curl_init(sbs);
+}
+
+// Release resources of the core. Scrobbles waiting for the batch are
+// submitted right away.
+void cmusfm_core_free(void) {
+
+	if (sbs == NULL)
+		return;
+
+	cmusfm_core_submit_cache();
+
+#ifdef ENABLE_LIBNOTIFY
+	cmusfm_notify_free();
+#endif
+	scrobbler_free(sbs);
+	sbs = NULL;
+	cmusfm_history_close();
+	cmusfm_dedup_close();
+	cmusfm_record_close();
+	cmusfm_session_free_all();
+	cmusfm_core_free_formats();
+}
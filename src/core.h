@@ -0,0 +1,51 @@
+/*
+ * cmusfm - core.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_CORE_H
+#define __CMUSFM_CORE_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include "cmusfm.h"
+
+
+// The core is the scrobbling engine shared by the server and the embedded
+// library (see libcmusfm.h) - it processes socket data messages (see
+// server.h) and keeps the scrobbler session. The state is global, so there
+// can be only one core per process, and it is not thread-safe.
+
+int cmusfm_core_initialize(void);
+int cmusfm_core_initialize_http(void);
+void cmusfm_core_free(void);
+ssize_t cmusfm_core_pack_track(struct cmtrack_info *tinfo, const char *client,
+		char *buffer, size_t size);
+void cmusfm_core_process_data(char *buffer, ssize_t len);
+void cmusfm_core_process_measured(char *buffer, ssize_t len, time_t playtime);
+void cmusfm_core_process_delayed(char *buffer, ssize_t len, time_t timestamp);
+void cmusfm_core_process_replay(char *buffer, ssize_t len, time_t timestamp);
+void cmusfm_core_process_spool(void);
+void cmusfm_core_process_request(FILE *f, int request);
+void cmusfm_core_apply_config(void);
+void cmusfm_core_submit_cache(void);
+time_t cmusfm_core_submit_delay(void);
+void cmusfm_core_update_metrics(void);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * cmusfm - cover.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "cover.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <jpeglib.h>
+#include <openssl/evp.h>
+#include <openssl/md5.h>
+
+#include "cmusfm.h"
+#include "debug.h"
+
+
+// upper limit of the decoded (DCT-scaled) image size in pixels
+#define COVER_MAX_PIXELS (16 * 1024 * 1024)
+
+struct cover_jpeg_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf jmp;
+};
+
+// By default libjpeg exits the process on fatal errors.
+static void cover_jpeg_error_exit(j_common_ptr cinfo) {
+	longjmp(((struct cover_jpeg_error *)cinfo->err)->jmp, 1);
+}
+
+static void cover_jpeg_output_message(j_common_ptr cinfo) {
+	(void)cinfo;
+	debug("cover jpeg error: %d", cinfo->err->msg_code);
+}
+
+// Scale RGB image down with the box filter (average of the source area).
+static void cover_box_scale(const uint8_t *src, unsigned int sw, unsigned int sh,
+		uint8_t *dst, unsigned int dw, unsigned int dh) {
+
+	unsigned int x, y, sx, sy, x0, x1, y0, y1, c;
+	uint32_t sum[3], n;
+
+	for (y = 0; y < dh; y++) {
+		y0 = (uint64_t)y * sh / dh;
+		y1 = (uint64_t)(y + 1) * sh / dh;
+		if (y1 == y0)
+			y1++;
+		for (x = 0; x < dw; x++) {
+			x0 = (uint64_t)x * sw / dw;
+			x1 = (uint64_t)(x + 1) * sw / dw;
+			if (x1 == x0)
+				x1++;
+			sum[0] = sum[1] = sum[2] = 0;
+			for (sy = y0; sy < y1; sy++)
+				for (sx = x0; sx < x1; sx++)
+					for (c = 0; c < 3; c++)
+						sum[c] += src[((size_t)sy * sw + sx) * 3 + c];
+			n = (y1 - y0) * (x1 - x0);
+			for (c = 0; c < 3; c++)
+				*dst++ = (sum[c] + n / 2) / n;
+		}
+	}
+}
+
+// Scale JPEG image, so it fits into the square of the given size. The image
+// is decoded already reduced (up to 1/8) in the DCT domain, hence for large
+// covers most of the decoding work is skipped.
+int cmusfm_cover_scale(FILE *in, FILE *out, unsigned int size) {
+
+	struct jpeg_decompress_struct dinfo;
+	struct jpeg_compress_struct cinfo;
+	struct cover_jpeg_error err;
+	uint8_t *volatile image = NULL, *volatile thumb = NULL;
+	unsigned int sw, sh, dw, dh, larger;
+	JSAMPROW row;
+
+	memset(&dinfo, 0, sizeof(dinfo));
+	memset(&cinfo, 0, sizeof(cinfo));
+	dinfo.err = cinfo.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = cover_jpeg_error_exit;
+	err.mgr.output_message = cover_jpeg_output_message;
+
+	if (setjmp(err.jmp)) {
+		jpeg_destroy_decompress(&dinfo);
+		jpeg_destroy_compress(&cinfo);
+		free(image);
+		free(thumb);
+		return -1;
+	}
+
+	jpeg_create_decompress(&dinfo);
+	jpeg_stdio_src(&dinfo, in);
+	jpeg_read_header(&dinfo, TRUE);
+
+	dinfo.out_color_space = JCS_RGB;
+	dinfo.scale_num = 1;
+	dinfo.scale_denom = 1;
+	larger = dinfo.image_width > dinfo.image_height ? dinfo.image_width : dinfo.image_height;
+	while (dinfo.scale_denom < 8 && larger / (dinfo.scale_denom * 2) >= size)
+		dinfo.scale_denom *= 2;
+
+	jpeg_start_decompress(&dinfo);
+	sw = dinfo.output_width;
+	sh = dinfo.output_height;
+	if (dinfo.output_components != 3 || (uint64_t)sw * sh > COVER_MAX_PIXELS ||
+			(image = malloc((size_t)sw * sh * 3)) == NULL)
+		longjmp(err.jmp, 1);
+
+	while (dinfo.output_scanline < sh) {
+		row = &image[(size_t)dinfo.output_scanline * sw * 3];
+		jpeg_read_scanlines(&dinfo, &row, 1);
+	}
+	jpeg_finish_decompress(&dinfo);
+
+	// keep the aspect ratio, do not scale up
+	dw = sw;
+	dh = sh;
+	if (sw >= sh && sw > size) {
+		dw = size;
+		dh = (uint64_t)sh * size / sw;
+	}
+	else if (sh > sw && sh > size) {
+		dh = size;
+		dw = (uint64_t)sw * size / sh;
+	}
+	if (dw == 0)
+		dw = 1;
+	if (dh == 0)
+		dh = 1;
+
+	if ((thumb = malloc((size_t)dw * dh * 3)) == NULL)
+		longjmp(err.jmp, 1);
+	cover_box_scale(image, sw, sh, thumb, dw, dh);
+
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, out);
+	cinfo.image_width = dw;
+	cinfo.image_height = dh;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 90, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < dh) {
+		row = &thumb[(size_t)cinfo.next_scanline * dw * 3];
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+
+	jpeg_destroy_decompress(&dinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(image);
+	free(thumb);
+	return 0;
+}
+
+// Get the thumbnail of the given cover file. If the thumbnail does not
+// exist in the covers directory, it is generated. Only JPEG covers are
+// supported - for other files (or on error) -1 is returned.
+int cmusfm_cover_thumbnail(const char *fname, const char *dir,
+		char *thumbnail, size_t size) {
+
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	char tmp[256], hex[MD5_DIGEST_LENGTH * 2 + 1];
+	uint64_t key[2];
+	struct stat st;
+	EVP_MD_CTX *md5;
+	FILE *in, *out;
+	int i, status;
+
+	if (stat(fname, &st) == -1)
+		return -1;
+
+	key[0] = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	key[1] = st.st_size;
+	if ((md5 = EVP_MD_CTX_new()) == NULL)
+		return -1;
+	status = EVP_DigestInit_ex(md5, EVP_md5(), NULL) &&
+		EVP_DigestUpdate(md5, fname, strlen(fname) + 1) &&
+		EVP_DigestUpdate(md5, key, sizeof(key)) &&
+		EVP_DigestFinal_ex(md5, digest, NULL);
+	EVP_MD_CTX_free(md5);
+	if (!status)
+		return -1;
+	for (i = 0; i < MD5_DIGEST_LENGTH; i++)
+		sprintf(&hex[i * 2], "%02x", digest[i]);
+
+	if ((size_t)snprintf(thumbnail, size, "%s/%s.jpg", dir, hex) >= size)
+		return -1;
+	if (access(thumbnail, R_OK) == 0)
+		return 0;
+
+	debug("cover thumbnail: %s -> %s", fname, thumbnail);
+
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+		return -1;
+	snprintf(tmp, sizeof(tmp), "%s/%s.tmp", dir, hex);
+
+	if ((in = fopen(fname, "rb")) == NULL)
+		return -1;
+	// check the JPEG SOI marker, before libjpeg gets its hands on it
+	if (fgetc(in) != 0xFF || fgetc(in) != 0xD8 || fseek(in, 0, SEEK_SET) == -1 ||
+			(out = fopen(tmp, "wb")) == NULL) {
+		fclose(in);
+		return -1;
+	}
+
+	status = cmusfm_cover_scale(in, out, COVER_THUMBNAIL_SIZE);
+	fclose(in);
+	if (fclose(out) == EOF || status == -1 || rename(tmp, thumbnail) == -1) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Helper function for retrieving cmusfm cover thumbnails directory.
+char *get_cmusfm_covers_dir(void) {
+	static char fname[128];
+	sprintf(fname, "%s/" COVERS_DNAME, get_cmus_home_dir());
+	return fname;
+}
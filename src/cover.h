@@ -0,0 +1,41 @@
+/*
+ * cmusfm - cover.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __CMUSFM_COVER_H
+#define __CMUSFM_COVER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+
+// maximal width and height of the cover thumbnail (in pixels)
+#define COVER_THUMBNAIL_SIZE 128
+
+// Cover thumbnails are stored in the covers directory under the name
+// derived from the cover file path, modification time and size. Hence,
+// modified covers get new thumbnails and no index is required.
+
+char *get_cmusfm_covers_dir(void);
+int cmusfm_cover_scale(FILE *in, FILE *out, unsigned int size);
+int cmusfm_cover_thumbnail(const char *fname, const char *dir,
+		char *thumbnail, size_t size);
+
+#endif
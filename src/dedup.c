@@ -0,0 +1,196 @@
+/*
+ * cmusfm - dedup.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "dedup.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cmusfm.h"
+#include "debug.h"
+#include "track.h"
+
+
+// size of the lookup table (has to be a power of two)
+#define DEDUP_SLOTS_SIZE (DEDUP_RING_SIZE * 2)
+#define DEDUP_FILE_SIZE (sizeof(struct cmusfm_dedup_header) + \
+		DEDUP_RING_SIZE * sizeof(struct cmusfm_dedup_entry))
+
+static struct cmusfm_dedup_header *dedup_index = NULL;
+// lookup table slot holds the ring position increased by one
+static uint16_t dedup_slots[DEDUP_SLOTS_SIZE];
+
+
+static struct cmusfm_dedup_entry *get_dedup_ring(void) {
+	return (struct cmusfm_dedup_entry *)&dedup_index[1];
+}
+
+// Return the home slot of the given key in the lookup table.
+static unsigned int get_key_home(uint64_t hash, uint32_t timestamp) {
+	return ((hash ^ timestamp) * 0x9E3779B97F4A7C15ULL) >> 32 & (DEDUP_SLOTS_SIZE - 1);
+}
+
+// Return the slot which holds given key or the first free one.
+static unsigned int get_key_slot(uint64_t hash, uint32_t timestamp) {
+	struct cmusfm_dedup_entry *ring = get_dedup_ring();
+	unsigned int i = get_key_home(hash, timestamp);
+	while (dedup_slots[i] && (ring[dedup_slots[i] - 1].hash != hash ||
+				ring[dedup_slots[i] - 1].timestamp != timestamp))
+		i = (i + 1) & (DEDUP_SLOTS_SIZE - 1);
+	return i;
+}
+
+// Remove key from the lookup table. Following keys from the same cluster
+// are shifted backward, so the linear probing stays valid.
+static void dedup_slot_delete(unsigned int i) {
+
+	struct cmusfm_dedup_entry *ring = get_dedup_ring();
+	unsigned int j = i, k;
+
+	dedup_slots[i] = 0;
+	for (;;) {
+		j = (j + 1) & (DEDUP_SLOTS_SIZE - 1);
+		if (dedup_slots[j] == 0)
+			break;
+		k = get_key_home(ring[dedup_slots[j] - 1].hash, ring[dedup_slots[j] - 1].timestamp);
+		// skip key if its home slot is cyclically in the range (i, j]
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		dedup_slots[i] = dedup_slots[j];
+		dedup_slots[j] = 0;
+		i = j;
+	}
+}
+
+// Open (or create) duplication index file and rebuild lookup table.
+static int dedup_open(void) {
+
+	struct cmusfm_dedup_entry *ring;
+	char fname[128 + 8];
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	if (dedup_index != NULL)
+		return 0;
+
+	sprintf(fname, "%s/" DEDUP_FNAME, get_cmus_home_dir());
+	if ((fd = open(fname, O_RDWR | O_CREAT, 0600)) == -1)
+		return -1;
+
+	if (fstat(fd, &st) == -1 || ftruncate(fd, DEDUP_FILE_SIZE) == -1 ||
+			(dedup_index = mmap(NULL, DEDUP_FILE_SIZE, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		dedup_index = NULL;
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	if ((size_t)st.st_size != DEDUP_FILE_SIZE ||
+			dedup_index->signature != CMUSFM_DEDUP_SIGNATURE ||
+			dedup_index->version != CMUSFM_DEDUP_VERSION ||
+			dedup_index->head >= DEDUP_RING_SIZE) {
+		debug("dedup index reset: %s", fname);
+		memset(dedup_index, 0, DEDUP_FILE_SIZE);
+		dedup_index->signature = CMUSFM_DEDUP_SIGNATURE;
+		dedup_index->version = CMUSFM_DEDUP_VERSION;
+	}
+
+	ring = get_dedup_ring();
+	memset(dedup_slots, 0, sizeof(dedup_slots));
+	for (i = 0; i < DEDUP_RING_SIZE; i++)
+		if (ring[i].timestamp)
+			dedup_slots[get_key_slot(ring[i].hash, ring[i].timestamp)] = i + 1;
+
+	return 0;
+}
+
+// Check whether given scrobble was already submitted. If the index is not
+// available, it is assumed that scrobble is not a duplicate.
+int cmusfm_dedup_check(const scrobbler_trackinfo_t *sb_tinf) {
+	if (dedup_open() == -1)
+		return 0;
+	return dedup_slots[get_key_slot(cmusfm_track_id_sbt(sb_tinf), sb_tinf->timestamp)] != 0;
+}
+
+// Add submitted scrobble into the index. The oldest entry is overwritten.
+int cmusfm_dedup_add(const scrobbler_trackinfo_t *sb_tinf) {
+
+	struct cmusfm_dedup_entry *ring;
+	uint64_t hash = cmusfm_track_id_sbt(sb_tinf);
+	unsigned int slot, pos;
+
+	if (dedup_open() == -1)
+		return -1;
+
+	slot = get_key_slot(hash, sb_tinf->timestamp);
+	if (dedup_slots[slot])
+		return 0;
+
+	ring = get_dedup_ring();
+	pos = dedup_index->head;
+
+	// evict the oldest entry from the lookup table
+	if (ring[pos].timestamp) {
+		dedup_slot_delete(get_key_slot(ring[pos].hash, ring[pos].timestamp));
+		slot = get_key_slot(hash, sb_tinf->timestamp);
+	}
+
+	ring[pos].hash = hash;
+	ring[pos].timestamp = sb_tinf->timestamp;
+	dedup_slots[slot] = pos + 1;
+	dedup_index->head = (pos + 1) % DEDUP_RING_SIZE;
+
+	return 0;
+}
+
+// Remove scrobble from the index (e.g. when the submission has failed).
+void cmusfm_dedup_remove(const scrobbler_trackinfo_t *sb_tinf) {
+
+	unsigned int slot;
+
+	if (dedup_open() == -1)
+		return;
+
+	slot = get_key_slot(cmusfm_track_id_sbt(sb_tinf), sb_tinf->timestamp);
+	if (dedup_slots[slot] == 0)
+		return;
+
+	get_dedup_ring()[dedup_slots[slot] - 1].timestamp = 0;
+	dedup_slot_delete(slot);
+}
+
+// Close duplication index file.
+void cmusfm_dedup_close(void) {
+	if (dedup_index == NULL)
+		return;
+	munmap(dedup_index, DEDUP_FILE_SIZE);
+	dedup_index = NULL;
+}
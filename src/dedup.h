@@ -0,0 +1,55 @@
+/*
+ * cmusfm - dedup.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_DEDUP_H
+#define __CMUSFM_DEDUP_H
+
+#include <stdint.h>
+#include "libscrobbler2.h"
+
+
+#define CMUSFM_DEDUP_SIGNATURE 0x44444d43
+#define CMUSFM_DEDUP_VERSION 2
+
+// number of recently submitted scrobbles remembered by the index
+#define DEDUP_RING_SIZE 4096
+
+// Duplication index is a memory-mapped ring of recently submitted
+// scrobble keys. Lookup is done via the in-memory hash table, which is
+// rebuilt from the ring when the index is opened.
+
+struct __attribute__((__packed__)) cmusfm_dedup_entry {
+	uint64_t hash;  // track identity
+	uint32_t timestamp;  // zero for an empty (removed) entry
+};
+
+struct __attribute__((__packed__)) cmusfm_dedup_header {
+	uint32_t signature, version;
+	uint32_t head;  // position of the next ring entry
+	//struct cmusfm_dedup_entry ring[DEDUP_RING_SIZE];
+};
+
+
+int cmusfm_dedup_check(const scrobbler_trackinfo_t *sb_tinf);
+int cmusfm_dedup_add(const scrobbler_trackinfo_t *sb_tinf);
+void cmusfm_dedup_remove(const scrobbler_trackinfo_t *sb_tinf);
+void cmusfm_dedup_close(void);
+
+#endif
@@ -0,0 +1,682 @@
+/*
+ * cmusfm - fuzz-parse.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "cmusfm.h"
+#include "config.h"
+#include "dedup.h"
+#include "libscrobbler2.h"
+#include "metrics.h"
+#include "remote.h"
+#include "server.h"
+#include "tags.h"
+
+
+// Randomized (deterministic) fuzzing of the parsing functions. Inputs are
+// generated by mutating valid samples. Beside crashes, which are best
+// detected with the sanitizers enabled (e.g. CFLAGS="-fsanitize=address"),
+// functions are checked against simple invariants.
+
+// Global configuration structure (normally defined in the main.c)
+struct cmusfm_config config;
+
+static unsigned int seed = 1;
+static unsigned int failures = 0;
+
+#define check(cond, name) if (!(cond)) { \
+		if (failures++ < 10) \
+			fprintf(stderr, "%s: check failed: %s\n", name, #cond); \
+	}
+
+static unsigned int fuzz_random(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+// Mutate the sample string into the buffer: flip, insert, delete or
+// duplicate random bytes, or truncate the string.
+static char *mutate(const char *sample, char *buffer, size_t size) {
+
+	size_t len = strlen(sample);
+	unsigned int i, n, pos;
+
+	if (len >= size)
+		len = size - 1;
+	memcpy(buffer, sample, len);
+
+	for (n = fuzz_random() % 4; n; n--) {
+		pos = len ? fuzz_random() % len : 0;
+		switch (fuzz_random() % 5) {
+		case 0:  // random byte
+			if (len)
+				buffer[pos] = 1 + fuzz_random() % 255;
+			break;
+		case 1:  // insert byte
+			if (len + 1 < size) {
+				memmove(&buffer[pos + 1], &buffer[pos], len - pos);
+				buffer[pos] = "()?.*+[]ABTN- \\^$"[fuzz_random() % 17];
+				len++;
+			}
+			break;
+		case 2:  // delete byte
+			if (len) {
+				memmove(&buffer[pos], &buffer[pos + 1], len - pos - 1);
+				len--;
+			}
+			break;
+		case 3:  // duplicate the tail
+			for (i = pos; i < len && len + 1 < size; i++)
+				buffer[len++] = buffer[i];
+			break;
+		case 4:  // truncate
+			len = pos;
+			break;
+		}
+	}
+
+	buffer[len] = 0;
+	return buffer;
+}
+
+// Check whether the regular expression contains stacked repetition
+// operators (e.g. "a++" or "a*{2}").
+static int has_stacked_repetitions(const char *regexp) {
+	for (; *regexp; regexp++)
+		if (strchr("*+?{", regexp[0]) && regexp[1] && strchr("*+?{", regexp[1]))
+			return 1;
+	return 0;
+}
+
+static void fuzz_regexp(unsigned int count) {
+
+	static const char *formats[] = {
+		"^(?A.+) - (?T.+)\\.[^.]+$", "^(?A.+) - (?T.+)$",
+		"^(?N[[:digit:]]+)\\. (?A.+) - (?B.+) - (?T.+)\\.mp3$", "(?" };
+	static const char *samples[] = {
+		"Pink Floyd - Comfortably Numb.flac", "Daft Punk - Around the World",
+		"01. Artist - Album - Title.mp3", "" };
+	struct format_match *matches, *match;
+	char format[128], str[128];
+	size_t len;
+
+	while (count--) {
+		mutate(formats[fuzz_random() % 4], format, sizeof(format));
+		mutate(samples[fuzz_random() % 4], str, sizeof(str));
+		// stacked repetitions might exhaust memory in the regcomp (format
+		// is a part of the user configuration, so it is not a real issue)
+		if (has_stacked_repetitions(format))
+			continue;
+		if ((matches = get_regexp_format_matches(str, format)) == NULL)
+			continue;
+		len = strlen(str);
+		for (match = matches; match->type; match++)
+			check(match->data >= str && match->data + match->len <= str + len, "regexp");
+		match = get_regexp_match(matches, CMFORMAT_TITLE);
+		check(match->type == 0 || match->type == CMFORMAT_TITLE, "regexp");
+		free(matches);
+	}
+}
+
+// Build the format from the literal separators and placeholders, so it is
+// eligible for the fast path in the format matching. The twin format uses
+// bounded repetitions instead, so it is always handled by the regex engine.
+static void make_plan_formats(char *format, char *twin) {
+
+	static const char *literals[] = {
+		"", " - ", "-", " ", "\\. ", "--", "_", "x", " - x", "\\(" };
+	static const char types[] = "ABTN";
+	unsigned int i, count = 1 + fuzz_random() % 4;
+	const char *literal;
+
+	strcpy(format, "^");
+	strcpy(twin, "^");
+	for (i = 0; i < count; i++) {
+		literal = literals[fuzz_random() % 10];
+		if (i > 0 && literal[0] == '\0')
+			literal = " - ";
+		strcat(strcat(format, literal), "(?");
+		strcat(strcat(twin, literal), "(?");
+		strncat(format, &types[fuzz_random() % 4], 1);
+		strncat(twin, &format[strlen(format) - 1], 1);
+		if (fuzz_random() % 4) {
+			strcat(format, ".+)");
+			strcat(twin, ".{1,})");
+		}
+		else {
+			strcat(format, ".*)");
+			strcat(twin, ".{0,})");
+		}
+	}
+	literal = fuzz_random() % 2 ? "\\.[^.]+$" : "$";
+	if (literal[1] == '\0' && fuzz_random() % 2)
+		literal = "\\.MP3$";
+	strcat(format, literal);
+	strcat(twin, literal);
+}
+
+static void fuzz_regexp_plan(unsigned int count) {
+
+	static const char *pieces[] = {
+		"Artist", "Title", " - ", "-", " ", ". ", ".", "--", "_", "x", "(", ".mp3" };
+	struct format_match *matches, *expected;
+	char format[128], twin[128], str[128];
+	unsigned int i, n, count_pieces;
+
+	while (count--) {
+		make_plan_formats(format, twin);
+		// mostly follow the format, so the string is likely to match
+		for (i = n = 0; format[i] && n < sizeof(str) - 32; i++) {
+			if (format[i] == '(' && format[i + 1] == '?') {
+				for (i += 5; format[i] != ')'; i++)
+					continue;
+				for (count_pieces = fuzz_random() % 4; count_pieces; count_pieces--)
+					n += sprintf(&str[n], "%s", pieces[fuzz_random() % 12]);
+			}
+			else if (strchr("^$[]+", format[i]) == NULL && fuzz_random() % 16)
+				str[n++] = format[i] == '\\' ? format[++i] : format[i];
+		}
+		str[n] = '\0';
+		matches = get_regexp_format_matches(str, format);
+		expected = get_regexp_format_matches(str, twin);
+		check((matches == NULL) == (expected == NULL), "regexp plan");
+		for (i = 0; matches && expected && i < FORMAT_MATCH_TYPE_COUNT; i++) {
+			check(matches[i].type == expected[i].type, "regexp plan");
+			check(matches[i].data == expected[i].data, "regexp plan");
+			check(matches[i].len == expected[i].len, "regexp plan");
+		}
+		free(matches);
+		free(expected);
+	}
+}
+
+// Check the combined matcher against formats matched one by one.
+static void fuzz_regexp_list(unsigned int count) {
+
+	static const char *formats[] = {
+		"^(?N[0-9]+)\\. (?A.+) - (?T.+)$", "^(?A.+) - (?B.+) - (?N[0-9]+) - (?T.+)$",
+		"^(?T.+) by (?A.+)$", "^(?A.+) - (?T.+)$", "(?A[a-z]+)-(?T[0-9]+)",
+		"^(?A.{1,}) - (?T.{1,})$", "^(?A[^-]+)(-(?T.*))?$", "(?A" };
+	static const char *pieces[] = {
+		"Artist", "Title", " - ", "-", " ", ". ", "01", "7", " by ", "x" };
+	struct format_matcher *matcher;
+	struct format_match *matches, *expected;
+	const char *list[4];
+	char str[128];
+	unsigned int i, n;
+
+	while (count--) {
+		n = 1 + fuzz_random() % 4;
+		for (i = 0; i < n; i++)
+			list[i] = formats[fuzz_random() % 8];
+		str[0] = '\0';
+		for (i = fuzz_random() % 8; i; i--)
+			strcat(str, pieces[fuzz_random() % 10]);
+
+		matcher = get_regexp_format_matcher(list, n);
+		matches = get_regexp_matcher_matches(matcher, str);
+		free_regexp_format_matcher(matcher);
+		for (i = 0, expected = NULL; expected == NULL && i < n; i++)
+			expected = get_regexp_format_matches(str, list[i]);
+
+		check((matches == NULL) == (expected == NULL), "regexp list");
+		for (i = 0; matches && expected && i < FORMAT_MATCH_TYPE_COUNT; i++) {
+			check(matches[i].type == expected[i].type, "regexp list");
+			check(matches[i].data == expected[i].data, "regexp list");
+			check(matches[i].len == expected[i].len, "regexp list");
+		}
+		free(matches);
+		free(expected);
+	}
+}
+
+static int cache_walk_callback(scrobbler_trackinfo_t *sbt, int count, void *data) {
+	int i;
+	for (i = 0; i < count; i++) {
+		// every string has to be terminated within the buffer
+		if (sbt[i].artist)
+			*(size_t *)data += strlen(sbt[i].artist);
+		if (sbt[i].album)
+			*(size_t *)data += strlen(sbt[i].album);
+		if (sbt[i].track)
+			*(size_t *)data += strlen(sbt[i].track);
+	}
+	return 0;
+}
+
+// Create the temporary cmus home directory (used for the state files).
+static int make_home(char *dir) {
+	char home[64];
+	if (mkdtemp(dir) == NULL)
+		return -1;
+	sprintf(home, "%s/cmus", dir);
+	setenv("XDG_CONFIG_HOME", dir, 1);
+	return mkdir(home, 0700);
+}
+
+// Remove the temporary cmus home directory with all files in it.
+static void remove_home(const char *dir) {
+
+	char home[64], fname[128];
+	struct dirent *ent;
+	DIR *d;
+
+	sprintf(home, "%s/cmus", dir);
+	if ((d = opendir(home)) != NULL) {
+		while ((ent = readdir(d)) != NULL) {
+			snprintf(fname, sizeof(fname), "%s/%s", home, ent->d_name);
+			if (ent->d_name[0] != '.')
+				unlink(fname);
+		}
+		closedir(d);
+	}
+
+	rmdir(home);
+	rmdir(dir);
+	unsetenv("XDG_CONFIG_HOME");
+}
+
+static int count_cache_segments(void) {
+	struct dirent *ent;
+	int count = 0;
+	DIR *d;
+	if ((d = opendir(get_cmus_home_dir())) == NULL)
+		return 0;
+	while ((ent = readdir(d)) != NULL)
+		if (strncmp(ent->d_name, CACHE_FNAME ".", sizeof(CACHE_FNAME)) == 0)
+			count++;
+	closedir(d);
+	return count;
+}
+
+static void fuzz_cache(unsigned int count) {
+
+	scrobbler_trackinfo_t sbt, sbt2;
+	struct cmusfm_cache_record *record;
+	char artist[64], album[64], track[64];
+	char buffer[16 * 1024];
+	size_t size, len, i, sum;
+	FILE *f;
+
+	while (count--) {
+
+		memset(&sbt, 0, sizeof(sbt));
+		sbt.artist = fuzz_random() % 8 ? mutate("Artist", artist, sizeof(artist)) : NULL;
+		sbt.album = fuzz_random() % 8 ? mutate("Album", album, sizeof(album)) : NULL;
+		sbt.track = fuzz_random() % 8 ? mutate("Title", track, sizeof(track)) : NULL;
+		sbt.timestamp = fuzz_random();
+		sbt.duration = fuzz_random() % 1000;
+		sbt.track_number = fuzz_random() % 100;
+
+		// encoder and decoder round trip
+		record = get_cache_record(&sbt);
+		size = get_cache_record_size(record);
+		check(get_cache_record_trackinfo(record, &sbt2) == 0, "cache");
+		check(sbt2.timestamp == sbt.timestamp && sbt2.duration == sbt.duration &&
+				sbt2.track_number == sbt.track_number, "cache");
+		check((sbt.artist == NULL) == (sbt2.artist == NULL), "cache");
+		check(sbt.artist == NULL || strcmp(sbt.artist, sbt2.artist) == 0, "cache");
+		check(sbt.track == NULL || strcmp(sbt.track, sbt2.track) == 0, "cache");
+
+		// walker over the corrupted stream of records
+		for (len = 0; len + size <= sizeof(buffer) && fuzz_random() % 64; len += size)
+			memcpy(&buffer[len], record, size);
+		for (i = fuzz_random() % 4; i && len; i--)
+			buffer[fuzz_random() % len] = fuzz_random();
+		if (len && fuzz_random() % 2)
+			len -= fuzz_random() % len;
+		free(record);
+
+		if (len == 0 || (f = fmemopen(buffer, len, "r")) == NULL)
+			continue;
+		sum = 0;
+		cmusfm_cache_walk(f, cache_walk_callback, &sum);
+		fclose(f);
+	}
+}
+
+// Cache segments - roll over, size and age eviction, the segment which
+// has failed to be submitted has to be kept. Service is not reachable, so
+// only expired records can be submitted (dropped without a request).
+static void check_cache_segments(void) {
+
+	uint8_t key[16] = { 0 };
+	char dir[] = "/tmp/cmusfm-fuzz-XXXXXX", artist[128], fname[160];
+	struct timespec times[2] = { { 0, 0 }, { 0, 0 } };
+	scrobbler_trackinfo_t sbt;
+	scrobbler_session_t *sbs;
+	unsigned int i, last, records;
+	uint64_t evicted;
+	size_t bytes;
+	time_t now = time(NULL);
+
+	if (make_home(dir) == -1 || (sbs = scrobbler_initialize(key, key)) == NULL)
+		return;
+	sbs->service_url = "http://127.0.0.1:1/";
+
+	memset(artist, 'A', sizeof(artist) - 1);
+	artist[sizeof(artist) - 1] = '\0';
+	memset(&sbt, 0, sizeof(sbt));
+	sbt.artist = artist;
+	sbt.track = "Title";
+	sbt.duration = 240;
+
+	// 16 KiB segments, the oldest ones are evicted by the size
+	cmusfm_cache_set_limits(64 * 1024, 0);
+	for (i = 0; i < 1000; i++) {
+		sbt.timestamp = now - 2000 + i;
+		cmusfm_cache_update(&sbt);
+	}
+
+	cmusfm_cache_recount();
+	cmusfm_cache_stat(&bytes, &records);
+	check(count_cache_segments() >= 4, "cache segments");
+	check(bytes > 0 && bytes <= 64 * 1024, "cache segments");
+	check(cmusfm_metrics_get(METRICS_CACHE_EVICTED_SIZE) + records == 1000, "cache segments");
+	sprintf(fname, "%s.1", get_cmusfm_cache_file());
+	check(access(fname, F_OK) != 0, "cache segments");
+
+	// all segments but the last one are evicted by the age (every segment
+	// holds more than 16 records), the last one fails to be submitted
+	for (last = 1000 / 16; last > 1; last--) {
+		sprintf(fname, "%s.%u", get_cmusfm_cache_file(), last);
+		if (access(fname, F_OK) == 0)
+			break;
+	}
+	times[0].tv_sec = times[1].tv_sec = now - 7200;
+	for (i = 1; i < last; i++) {
+		sprintf(fname, "%s.%u", get_cmusfm_cache_file(), i);
+		utimensat(AT_FDCWD, fname, times, 0);
+	}
+
+	cmusfm_cache_set_limits(0, 3600);
+	check(cmusfm_cache_submit(sbs, 4) == -1, "cache segments");
+	check(count_cache_segments() == 1, "cache segments");
+	sprintf(fname, "%s.%u", get_cmusfm_cache_file(), last);
+	check(access(fname, F_OK) == 0, "cache segments");
+	cmusfm_cache_stat(&bytes, &records);
+	check(records > 0 && cmusfm_metrics_get(METRICS_CACHE_EVICTED_SIZE) +
+			cmusfm_metrics_get(METRICS_CACHE_EVICTED_AGE) + records == 1000, "cache segments");
+
+	// records of the recently modified segment have expired
+	evicted = cmusfm_metrics_get(METRICS_CACHE_EVICTED_AGE);
+	cmusfm_cache_set_limits(0, 60);
+	check(cmusfm_cache_submit(sbs, 4) == 0, "cache segments");
+	check(count_cache_segments() == 0, "cache segments");
+	check(cmusfm_metrics_get(METRICS_CACHE_EVICTED_AGE) == evicted + records, "cache segments");
+	cmusfm_cache_stat(&bytes, &records);
+	check(records == 0, "cache segments");
+
+	cmusfm_cache_set_limits(0, 0);
+	cmusfm_dedup_close();
+	scrobbler_free(sbs);
+	remove_home(dir);
+}
+
+static void fuzz_tags(unsigned int count) {
+
+	// minimal ID3v2.4, FLAC, Ogg Vorbis and MP4 tags
+	static const struct { const char *data; size_t size; } samples[] = {
+		{ "ID3\4\0\0\0\0\0\x2d" "TPE1\0\0\0\7\0\0\3" "Artist"
+			"TIT2\0\0\0\6\0\0\0Title" "TRCK\0\0\0\2\0\0\0" "7", 55 },
+		{ "fLaC\x84\0\0\x22" "\0\0\0\0\2\0\0\0" "\x0b\0\0\0" "ARTIST=Flac"
+			"\7\0\0\0TITLE=T", 42 },
+		{ "OggS\0\2\0\0\0\0\0\0\0\0\1\0\0\0\0\0\0\0\0\0\0\0\2\7\x1a" "\1vorbis"
+			"\3vorbis\0\0\0\0\1\0\0\0\7\0\0\0TITLE=O", 62 },
+		{ "\0\0\0\x10" "ftypM4A \0\0\0\0" "\0\0\0\x3d" "moov\0\0\0\x35" "udta"
+			"\0\0\0\x2d" "meta\0\0\0\0\0\0\0\x21" "ilst\0\0\0\x19\xa9" "nam"
+			"\0\0\0\x11" "data\0\0\0\1\0\0\0\0T", 77 },
+	};
+	struct cmusfm_tags tags;
+	unsigned char *buffer;
+	size_t i, size;
+
+	// unmodified samples have to be parsed
+	for (i = 0; i < sizeof(samples) / sizeof(*samples); i++)
+		check(cmusfm_tags_parse(samples[i].data, samples[i].size, &tags) == 0 &&
+				tags.title[0] == "TTOT"[i], "tags");
+
+	while (count--) {
+		i = fuzz_random() % (sizeof(samples) / sizeof(*samples));
+		size = samples[i].size;
+		// exactly sized buffer, so overreads are caught by the sanitizer
+		if ((buffer = malloc(size)) == NULL)
+			return;
+		memcpy(buffer, samples[i].data, size);
+		for (i = fuzz_random() % 4; i; i--)
+			buffer[fuzz_random() % size] = fuzz_random() % 2 ? fuzz_random() : 0xff;
+		if (fuzz_random() % 4 == 0)
+			size -= fuzz_random() % size;
+
+		cmusfm_tags_parse(buffer, size, &tags);
+		check(memchr(tags.artist, 0, sizeof(tags.artist)) != NULL, "tags");
+		check(memchr(tags.album, 0, sizeof(tags.album)) != NULL, "tags");
+		check(memchr(tags.album_artist, 0, sizeof(tags.album_artist)) != NULL, "tags");
+		check(memchr(tags.title, 0, sizeof(tags.title)) != NULL, "tags");
+		check(memchr(tags.mbid, 0, sizeof(tags.mbid)) != NULL, "tags");
+		free(buffer);
+	}
+}
+
+// Re-tag the same file many times - replaced records of the tags index
+// have to be reclaimed, so the index file size is bounded.
+static void fuzz_tags_index(unsigned int count) {
+
+	static const char sample[] = "ID3\4\0\0\0\0\0\x2d" "TPE1\0\0\0\7\0\0\3" "Artist"
+		"TIT2\0\0\0\6\0\0\0Title" "TRCK\0\0\0\2\0\0\0" "7";
+	char dir[] = "/tmp/cmusfm-fuzz-XXXXXX", fname[64];
+	struct timespec times[2] = { { 0, 0 }, { 0, 0 } };
+	struct cmusfm_tags tags;
+	struct stat st;
+	FILE *f;
+
+	if (make_home(dir) == -1)
+		return;
+	sprintf(fname, "%s/track.mp3", dir);
+
+	if ((f = fopen(fname, "w")) != NULL) {
+		fwrite(sample, sizeof(sample) - 1, 1, f);
+		fclose(f);
+	}
+
+	while (count--) {
+		times[0].tv_sec = times[1].tv_sec = 1000000000 + count;
+		utimensat(AT_FDCWD, fname, times, 0);
+		check(cmusfm_tags_get(fname, &tags) == 0 && tags.title[0] == 'T', "tags index");
+	}
+
+	// live index is the table and one record, dead records take at most
+	// the same size
+	check(stat(get_cmusfm_tags_file(), &st) == 0 && (size_t)st.st_size <= 2 *
+			(sizeof(struct cmusfm_tags_header) + TAGS_INDEX_SLOTS *
+				sizeof(struct cmusfm_tags_slot) + 256), "tags index");
+
+	unlink(fname);
+	remove_home(dir);
+}
+
+static void fuzz_remote(unsigned int count) {
+
+	static const char sample[] = "status playing\n"
+		"file /music/Artist - Title.mp3\nduration 240\nposition 17\n"
+		"tag artist Artist\ntag albumartist Various\ntag title Title\n"
+		"tag tracknumber 3\nset repeat false\n\n";
+	struct cmusfm_remote_status st;
+	char *reply, *end;
+	size_t size;
+
+	// unmodified sample has to be parsed
+	reply = strdup(sample);
+	check(cmusfm_remote_parse(reply, &st) == 0 && st.status == CMSTATUS_PLAYING &&
+			st.duration == 240 && st.position == 17 && st.tracknb == 3 &&
+			strcmp(st.artist, "Artist") == 0 && strcmp(st.album_artist, "Various") == 0 &&
+			st.album == NULL, "remote");
+	free(reply);
+
+	while (count--) {
+		// exactly sized buffer, so overreads are caught by the sanitizer
+		size = sizeof(sample);
+		if ((reply = malloc(size)) == NULL)
+			return;
+		mutate(sample, reply, size);
+		if (fuzz_random() % 4 == 0)
+			reply[fuzz_random() % size] = '\0';
+		end = &reply[strlen(reply)];
+
+		cmusfm_remote_parse(reply, &st);
+		check(st.file == NULL || (st.file > reply && st.file <= end), "remote");
+		check(st.title == NULL || (st.title > reply && st.title <= end), "remote");
+		free(reply);
+	}
+}
+
+static void fuzz_sock_data(unsigned int count) {
+
+	char buffer[CMSOCKET_BUFFER_SIZE], *data = &buffer[sizeof(struct sock_data_tag)];
+	struct sock_data_tag *dt = (struct sock_data_tag *)buffer;
+	size_t len, i;
+	int *offset;
+
+	while (count--) {
+		memset(buffer, 0, sizeof(buffer));
+		len = sizeof(*dt) + sprintf(data, "Artist%cAlbum%cTitle%c/music/file.mp3%c", 0, 0, 0, 0);
+		dt->alboff = 7;
+		dt->titoff = 13;
+		dt->locoff = 19;
+		check(cmusfm_sock_data_check(buffer, len) == 0, "sock_data");
+
+		// corrupt offsets, terminators and the length of the frame
+		for (i = fuzz_random() % 4; i; i--) {
+			offset = &(&dt->alboff)[fuzz_random() % 3];
+			*offset = fuzz_random() % 2 ? (int)fuzz_random() : *offset + (int)(fuzz_random() % 9) - 4;
+		}
+		for (i = fuzz_random() % 4; i; i--)
+			data[fuzz_random() % (len - sizeof(*dt))] = 'X';
+		if (fuzz_random() % 4 == 0)
+			len = fuzz_random() % sizeof(buffer);
+
+		// accepted strings have to be terminated within the frame
+		if (cmusfm_sock_data_check(buffer, len) == 0) {
+			check(dt->alboff >= 0 && dt->locoff < (int)(len - sizeof(*dt)), "sock_data");
+			check(memchr(&data[dt->locoff], 0, len - sizeof(*dt) - dt->locoff) != NULL, "sock_data");
+		}
+	}
+}
+
+static void fuzz_config(unsigned int count) {
+
+	static const char *samples[] = {
+		"user = \"name\"\n", "key=\"0123\"", "format-localfile = \"^(?A.+)$\"",
+		"now-playing-localfile = \"yes\"\n", "relay-listen", "  =  \"  " };
+	struct cmusfm_config conf;
+	char line[128], fname[] = "/tmp/cmusfm-fuzz-XXXXXX";
+	char *value;
+	unsigned int i;
+	int fd;
+
+	fd = mkstemp(fname);
+
+	while (count--) {
+		mutate(samples[fuzz_random() % 6], line, sizeof(line));
+		value = get_config_value(line);
+		check(value >= line && value <= line + strlen(line), "config");
+
+		// whole file parser (with long lines)
+		if (count % 16 == 0) {
+			ftruncate(fd, 0);
+			lseek(fd, 0, SEEK_SET);
+			for (value = line; value - line < 16; value++)
+				write(fd, mutate(samples[fuzz_random() % 6], line, sizeof(line)), strlen(line));
+			check(cmusfm_config_read(fname, &conf) == 0, "config");
+			check(conf.user_name[sizeof(conf.user_name) - 1] == 0, "config");
+			for (i = 0; i < CMCONF_FORMAT_COUNT; i++)
+				check(conf.format_localfile[i][CMCONF_FORMAT_SIZE - 1] == 0, "config");
+		}
+	}
+
+	close(fd);
+	unlink(fname);
+}
+
+static void fuzz_getpost(unsigned int count) {
+
+	struct sb_getpost_data sb_data[2] = {
+		{"artist", 's', NULL}, {"duration", 'd', NULL}};
+	char buffer[256], str[128], *value;
+	CURL *curl = curl_easy_init();
+	size_t size;
+	int len;
+
+	while (count--) {
+		sb_data[0].data = fuzz_random() % 8 ? mutate("AC/DC & Friends", str, sizeof(str)) : NULL;
+		sb_data[1].data = (void *)(long)(fuzz_random() % 3);
+		size = 1 + fuzz_random() % sizeof(buffer);
+
+		// truncated data has to be reported, not passed on
+		if (sb_make_curl_getpost_string(curl, buffer, size, sb_data, 2) == NULL) {
+			check(size < sizeof("artist=&duration=2&") + strlen(str) * 3, "getpost");
+			continue;
+		}
+		check(strlen(buffer) < size, "getpost");
+
+		// escaped value has to decode to the original one
+		if (sb_data[0].data) {
+			value = strchr(buffer, '=') + 1;
+			value[strcspn(value, "&")] = 0;
+			value = curl_easy_unescape(curl, value, 0, &len);
+			check(strcmp(value, str) == 0, "getpost");
+			curl_free(value);
+		}
+	}
+
+	curl_easy_cleanup(curl);
+}
+
+int main(int argc, char *argv[]) {
+
+	unsigned int count = argc > 1 ? atoi(argv[1]) : 20000;
+	seed = argc > 2 ? atoi(argv[2]) : 1;
+
+	fuzz_regexp(count);
+	fuzz_regexp_plan(count);
+	fuzz_regexp_list(count);
+	fuzz_cache(count);
+	check_cache_segments();
+	fuzz_tags(count);
+	fuzz_tags_index(count / 10);
+	fuzz_remote(count);
+	fuzz_sock_data(count);
+	fuzz_config(count);
+	fuzz_getpost(count);
+
+	printf("iterations: %u, failures: %u\n", count, failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,461 @@
+/*
+ * cmusfm - history.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "history.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "cmusfm.h"
+#include "debug.h"
+#include "track.h"
+
+
+// initial number of slots in the aggregate tables
+#define HISTORY_TABLE_SIZE 1024
+// number of entries shown by the stats
+#define HISTORY_TOP_SIZE 10
+
+#define SECONDS_PER_DAY (24 * 60 * 60)
+#define SECONDS_PER_WEEK (7 * SECONDS_PER_DAY)
+
+// history writer state (used by the server only)
+static int history_log_fd = -1;
+static struct cmusfm_history_header *history_index = NULL;
+
+// top list used for the stats presentation
+struct history_top {
+	uint32_t plays[HISTORY_TOP_SIZE];
+	uint64_t offset[HISTORY_TOP_SIZE];
+	int count;
+};
+
+
+// Return the size of the index file with given table sizes.
+static size_t get_index_size(uint32_t tracks_size, uint32_t artists_size) {
+	return sizeof(struct cmusfm_history_header) +
+		tracks_size * sizeof(struct cmusfm_history_track) +
+		artists_size * sizeof(struct cmusfm_history_artist);
+}
+
+static struct cmusfm_history_track *get_index_tracks(struct cmusfm_history_header *hdr) {
+	return (struct cmusfm_history_track *)&hdr[1];
+}
+
+static struct cmusfm_history_artist *get_index_artists(struct cmusfm_history_header *hdr) {
+	return (struct cmusfm_history_artist *)&get_index_tracks(hdr)[hdr->tracks_size];
+}
+
+// Weeks are counted since the epoch and they start on Monday.
+static uint32_t get_week(time_t timestamp) {
+	return (timestamp + 3 * SECONDS_PER_DAY) / SECONDS_PER_WEEK;
+}
+
+// Get artist and track name from the history log record.
+static void get_record_names(const struct cmusfm_cache_record *record,
+		const char **artist, const char **track) {
+	const char *ptr = (const char *)&record[1];
+	*artist = record->artist_len ? ptr : "";
+	ptr += record->artist_len + record->album_len + record->album_artist_len;
+	*track = record->track_len ? ptr : "";
+}
+
+// Helper function for retrieving cmusfm history index file.
+static char *get_cmusfm_history_index_file(void) {
+	static char fname[128 + 4];
+	sprintf(fname, "%s.idx", get_cmusfm_history_file());
+	return fname;
+}
+
+// Create new empty index file. Returned index is mapped into the memory.
+static struct cmusfm_history_header *history_index_create(const char *fname,
+		uint32_t tracks_size, uint32_t artists_size) {
+
+	struct cmusfm_history_header *hdr;
+	size_t size = get_index_size(tracks_size, artists_size);
+	int fd;
+
+	debug("history index create: %s: %u, %u", fname, tracks_size, artists_size);
+
+	if ((fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0600)) == -1)
+		return NULL;
+
+	if (ftruncate(fd, size) == -1 ||
+			(hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	close(fd);
+	hdr->signature = CMUSFM_HISTORY_SIGNATURE;
+	hdr->version = CMUSFM_HISTORY_VERSION;
+	hdr->tracks_size = tracks_size;
+	hdr->artists_size = artists_size;
+	return hdr;
+}
+
+// Map existing index file. On error or if the index is not valid NULL is
+// returned.
+static struct cmusfm_history_header *history_index_map(const char *fname, int prot) {
+
+	struct cmusfm_history_header *hdr;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(fname, prot & PROT_WRITE ? O_RDWR : O_RDONLY)) == -1)
+		return NULL;
+
+	hdr = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(*hdr))
+		hdr = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	if (hdr->signature != CMUSFM_HISTORY_SIGNATURE ||
+			hdr->version != CMUSFM_HISTORY_VERSION ||
+			get_index_size(hdr->tracks_size, hdr->artists_size) != (size_t)st.st_size) {
+		debug("invalid history index: %s", fname);
+		munmap(hdr, st.st_size);
+		return NULL;
+	}
+
+	return hdr;
+}
+
+static void history_index_unmap(struct cmusfm_history_header *hdr) {
+	munmap(hdr, get_index_size(hdr->tracks_size, hdr->artists_size));
+}
+
+// Find the slot for the given track in the aggregate table.
+static struct cmusfm_history_track *get_track_slot(struct cmusfm_history_header *hdr,
+		uint64_t hash) {
+	struct cmusfm_history_track *tracks = get_index_tracks(hdr);
+	uint32_t mask = hdr->tracks_size - 1;
+	uint32_t i = hash & mask;
+	while (tracks[i].plays && tracks[i].hash != hash)
+		i = (i + 1) & mask;
+	return &tracks[i];
+}
+
+// Find the slot for the given artist and week in the aggregate table.
+static struct cmusfm_history_artist *get_artist_slot(struct cmusfm_history_header *hdr,
+		uint64_t hash, uint32_t week) {
+	struct cmusfm_history_artist *artists = get_index_artists(hdr);
+	uint32_t mask = hdr->artists_size - 1;
+	uint32_t i = (hash ^ (week * 0x9E3779B97F4A7C15ULL)) & mask;
+	while (artists[i].plays && (artists[i].hash != hash || artists[i].week != week))
+		i = (i + 1) & mask;
+	return &artists[i];
+}
+
+// Double the size of the full aggregate tables. Index is rebuilt in the
+// temporary file, which replaces the current one afterwards.
+static int history_index_grow(void) {
+
+	struct cmusfm_history_header *hdr = history_index;
+	struct cmusfm_history_header *tmp;
+	struct cmusfm_history_track *tracks = get_index_tracks(hdr);
+	struct cmusfm_history_artist *artists = get_index_artists(hdr);
+	char fname[128 + 8];
+	uint32_t i;
+
+	sprintf(fname, "%s.tmp", get_cmusfm_history_index_file());
+	tmp = history_index_create(fname,
+			hdr->tracks_size * ((hdr->tracks_count + 1) * 2 > hdr->tracks_size ? 2 : 1),
+			hdr->artists_size * ((hdr->artists_count + 1) * 2 > hdr->artists_size ? 2 : 1));
+	if (tmp == NULL)
+		return -1;
+
+	for (i = 0; i < hdr->tracks_size; i++)
+		if (tracks[i].plays)
+			*get_track_slot(tmp, tracks[i].hash) = tracks[i];
+	for (i = 0; i < hdr->artists_size; i++)
+		if (artists[i].plays)
+			*get_artist_slot(tmp, artists[i].hash, artists[i].week) = artists[i];
+
+	tmp->log_size = hdr->log_size;
+	tmp->plays = hdr->plays;
+	tmp->tracks_count = hdr->tracks_count;
+	tmp->artists_count = hdr->artists_count;
+
+	if (rename(fname, get_cmusfm_history_index_file()) == -1) {
+		history_index_unmap(tmp);
+		unlink(fname);
+		return -1;
+	}
+
+	history_index_unmap(hdr);
+	history_index = tmp;
+	return 0;
+}
+
+// Update aggregate tables with the given log record.
+static int history_index_add(const struct cmusfm_cache_record *record, uint64_t offset) {
+
+	struct cmusfm_history_track *track;
+	struct cmusfm_history_artist *artist;
+	const char *artist_name, *track_name;
+	uint64_t hash;
+	uint32_t week;
+
+	// keep the load factor of both tables below 50%
+	if ((history_index->tracks_count + 1) * 2 > history_index->tracks_size ||
+			(history_index->artists_count + 1) * 2 > history_index->artists_size)
+		if (history_index_grow() == -1)
+			return -1;
+
+	get_record_names(record, &artist_name, &track_name);
+	hash = cmusfm_track_id(artist_name, NULL, NULL, 0);
+	week = get_week(record->timestamp);
+
+	artist = get_artist_slot(history_index, hash, week);
+	if (artist->plays == 0) {
+		artist->hash = hash;
+		artist->week = week;
+		artist->offset = offset;
+		history_index->artists_count++;
+	}
+	artist->plays++;
+
+	// track aggregate does not depend on the release
+	hash = cmusfm_track_id(artist_name, NULL, track_name, 0);
+	track = get_track_slot(history_index, hash);
+	if (track->plays == 0) {
+		track->hash = hash;
+		track->offset = offset;
+		history_index->tracks_count++;
+	}
+	track->plays++;
+
+	history_index->plays++;
+	return 0;
+}
+
+// Update the index with all log records which are not indexed yet.
+static int history_index_sync(void) {
+
+	const struct cmusfm_cache_record *record;
+	uint64_t offset, size;
+	struct stat st;
+	char *log;
+
+	if (fstat(history_log_fd, &st) == -1)
+		return -1;
+
+	size = st.st_size;
+	offset = history_index->log_size;
+	if (offset == size)
+		return 0;
+
+	debug("history index sync: %lu-%lu", offset, size);
+
+	if (offset > size) {
+		// log file was truncated, so the index has to be rebuilt
+		history_index_unmap(history_index);
+		history_index = history_index_create(get_cmusfm_history_index_file(),
+				HISTORY_TABLE_SIZE, HISTORY_TABLE_SIZE);
+		if (history_index == NULL) {
+			// the log is opened again by the next open call
+			close(history_log_fd);
+			history_log_fd = -1;
+			return -1;
+		}
+		offset = 0;
+	}
+
+	if ((log = mmap(NULL, size, PROT_READ, MAP_SHARED, history_log_fd, 0)) == MAP_FAILED)
+		return -1;
+
+	while (offset + sizeof(*record) <= size) {
+		record = (const struct cmusfm_cache_record *)&log[offset];
+		if (record->signature != CMUSFM_CACHE_SIGNATURE ||
+				offset + get_cache_record_size(record) > size)
+			break;
+		if (history_index_add(record, offset) == -1)
+			break;
+		offset += get_cache_record_size(record);
+		history_index->log_size = offset;
+	}
+
+	munmap(log, size);
+	return 0;
+}
+
+// Open history log and index (or create them, if needed).
+static int history_open(void) {
+
+	if (history_index != NULL)
+		return 0;
+
+	history_log_fd = open(get_cmusfm_history_file(), O_RDWR | O_CREAT | O_APPEND, 0600);
+	if (history_log_fd == -1)
+		return -1;
+
+	if ((history_index = history_index_map(get_cmusfm_history_index_file(),
+					PROT_READ | PROT_WRITE)) == NULL)
+		history_index = history_index_create(get_cmusfm_history_index_file(),
+				HISTORY_TABLE_SIZE, HISTORY_TABLE_SIZE);
+
+	if (history_index == NULL) {
+		close(history_log_fd);
+		history_log_fd = -1;
+		return -1;
+	}
+
+	return history_index_sync();
+}
+
+// Append submitted (or cached) track to the listening history.
+int cmusfm_history_append(const scrobbler_trackinfo_t *sb_tinf) {
+
+	struct cmusfm_cache_record *record;
+	ssize_t size;
+	int status;
+
+	debug("history append: %ld", sb_tinf->timestamp);
+
+	if (history_open() == -1)
+		return -1;
+
+	record = get_cache_record(sb_tinf);
+	size = get_cache_record_size(record);
+	status = write(history_log_fd, record, size) == size ? 0 : -1;
+	free(record);
+
+	if (status == 0)
+		status = history_index_sync();
+	return status;
+}
+
+// Close history log and index files.
+void cmusfm_history_close(void) {
+	if (history_index == NULL)
+		return;
+	history_index_unmap(history_index);
+	history_index = NULL;
+	close(history_log_fd);
+	history_log_fd = -1;
+}
+
+// Insert an item into the top list, which is sorted by the play count.
+static void history_top_insert(struct history_top *top, uint32_t plays, uint64_t offset) {
+
+	int i;
+
+	if (top->count == HISTORY_TOP_SIZE && top->plays[top->count - 1] >= plays)
+		return;
+	if (top->count < HISTORY_TOP_SIZE)
+		top->count++;
+
+	for (i = top->count - 1; i > 0 && top->plays[i - 1] < plays; i--) {
+		top->plays[i] = top->plays[i - 1];
+		top->offset[i] = top->offset[i - 1];
+	}
+
+	top->plays[i] = plays;
+	top->offset[i] = offset;
+}
+
+// Print listening statistics based on the history index. This function
+// uses read-only mappings, so it does not disturb the running server.
+int cmusfm_history_print_stats(FILE *f, int weeks_ago) {
+
+	struct cmusfm_history_header *hdr;
+	struct cmusfm_history_track *tracks;
+	struct cmusfm_history_artist *artists;
+	const struct cmusfm_cache_record *record;
+	const char *artist_name, *track_name;
+	struct history_top top;
+	char *log = MAP_FAILED;
+	time_t week_start;
+	char date[16];
+	uint32_t i, week;
+	int fd;
+
+	if ((hdr = history_index_map(get_cmusfm_history_index_file(), PROT_READ)) == NULL)
+		return -1;
+
+	// only the indexed part of the log is used
+	if (hdr->log_size && (fd = open(get_cmusfm_history_file(), O_RDONLY)) != -1) {
+		log = mmap(NULL, hdr->log_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+
+	if (log == MAP_FAILED && hdr->log_size) {
+		history_index_unmap(hdr);
+		return -1;
+	}
+
+	tracks = get_index_tracks(hdr);
+	artists = get_index_artists(hdr);
+	week = get_week(time(NULL)) - weeks_ago;
+	week_start = (time_t)week * SECONDS_PER_WEEK - 3 * SECONDS_PER_DAY;
+	strftime(date, sizeof(date), "%Y-%m-%d", localtime(&week_start));
+
+	fprintf(f, "Total plays: %u (tracks: %u)\n", hdr->plays, hdr->tracks_count);
+
+	memset(&top, 0, sizeof(top));
+	for (i = 0; i < hdr->artists_size; i++)
+		if (artists[i].plays && artists[i].week == week)
+			history_top_insert(&top, artists[i].plays, artists[i].offset);
+
+	fprintf(f, "\nTop artists (week of %s):\n", date);
+	for (i = 0; i < (unsigned)top.count; i++) {
+		record = (const struct cmusfm_cache_record *)&log[top.offset[i]];
+		get_record_names(record, &artist_name, &track_name);
+		fprintf(f, "%8u  %s\n", top.plays[i], artist_name);
+	}
+
+	memset(&top, 0, sizeof(top));
+	for (i = 0; i < hdr->tracks_size; i++)
+		if (tracks[i].plays)
+			history_top_insert(&top, tracks[i].plays, tracks[i].offset);
+
+	fprintf(f, "\nTop tracks:\n");
+	for (i = 0; i < (unsigned)top.count; i++) {
+		record = (const struct cmusfm_cache_record *)&log[top.offset[i]];
+		get_record_names(record, &artist_name, &track_name);
+		fprintf(f, "%8u  %s - %s\n", top.plays[i], artist_name, track_name);
+	}
+
+	if (log != MAP_FAILED)
+		munmap(log, hdr->log_size);
+	history_index_unmap(hdr);
+	return 0;
+}
+
+// Helper function for retrieving cmusfm history file.
+char *get_cmusfm_history_file(void) {
+	static char fname[128];
+	sprintf(fname, "%s/" HISTORY_FNAME, get_cmus_home_dir());
+	return fname;
+}
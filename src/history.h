@@ -0,0 +1,68 @@
+/*
+ * cmusfm - history.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_HISTORY_H
+#define __CMUSFM_HISTORY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "libscrobbler2.h"
+
+
+#define CMUSFM_HISTORY_SIGNATURE 0x49484d43
+#define CMUSFM_HISTORY_VERSION 2
+
+// Listening history consists of two files. The first one is an append-only
+// log of cache records (see cache.h). The second one is a memory-mapped
+// index with aggregate tables, which are updated incrementally with every
+// appended record. The index can be always rebuilt from the log.
+
+// history index header structure
+struct __attribute__((__packed__)) cmusfm_history_header {
+	uint32_t signature, version;
+	uint64_t log_size;  // number of log bytes covered by the index
+	uint32_t plays;
+	uint32_t tracks_size, tracks_count;
+	uint32_t artists_size, artists_count;
+	//struct cmusfm_history_track tracks[tracks_size];
+	//struct cmusfm_history_artist artists[artists_size];
+};
+
+// play count aggregate per track
+struct __attribute__((__packed__)) cmusfm_history_track {
+	uint64_t hash;
+	uint64_t offset;  // log offset of the first play
+	uint32_t plays;
+};
+
+// play count aggregate per artist and week
+struct __attribute__((__packed__)) cmusfm_history_artist {
+	uint64_t hash;
+	uint64_t offset;  // log offset of the first play in the week
+	uint32_t week, plays;
+};
+
+
+char *get_cmusfm_history_file(void);
+int cmusfm_history_append(const scrobbler_trackinfo_t *sb_tinf);
+void cmusfm_history_close(void);
+int cmusfm_history_print_stats(FILE *f, int weeks_ago);
+
+#endif
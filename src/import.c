@@ -0,0 +1,846 @@
+/*
+ * cmusfm - import.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "import.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "cmusfm.h"
+#include "debug.h"
+#include "dedup.h"
+#include "history.h"
+#include "metrics.h"
+#include "track.h"
+
+
+// size of the buffer used for the run reading and writing
+#define IMPORT_BUFFER_SIZE (64 * 1024)
+
+// input file mapped into the memory
+struct import_file {
+	const char *name;
+	const char *data;
+	size_t size;
+	int binary;      // cmusfm cache records
+	int local_time;  // timestamps are given in the local time
+};
+
+// part of the input file parsed by a single worker
+struct import_chunk {
+	struct import_file *file;
+	size_t start, end;
+};
+
+// sorted sequence of records in the spill file
+struct import_run {
+	off_t offset, length;
+};
+
+// run index entry (sorting key and the record offset in the run buffer)
+struct import_entry {
+	uint32_t timestamp;
+	uint32_t offset;
+	uint64_t hash;
+};
+
+struct import_worker {
+	pthread_t thread;
+	char *buffer;
+	size_t length;
+	struct import_entry *entries;
+	unsigned int count;
+	// per-worker statistics
+	uint64_t lines, bytes, skipped;
+};
+
+// buffered reader of the single run in the spill file
+struct import_reader {
+	int fd;
+	off_t offset, end;
+	char buffer[IMPORT_BUFFER_SIZE];
+	size_t pos, len;
+	const struct cmusfm_cache_record *record;
+	uint32_t timestamp;
+	uint64_t hash;
+};
+
+// buffered writer of the merged records
+struct import_writer {
+	int fd;  // spill file or -1 for the cache
+	off_t offset;
+	char buffer[IMPORT_BUFFER_SIZE];
+	size_t len;
+	int error;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	struct import_chunk *chunks;
+	unsigned int chunks_count, chunks_next;
+	// spill file with sorted runs
+	FILE *spill;
+	off_t spill_size;
+	struct import_run *runs;
+	unsigned int runs_count, runs_size;
+	size_t page_size;
+	int error;
+} import = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+// Convert local time into the UTC time. Audioscrobbler log might store
+// timestamps in the local time zone, if player has no clue about the UTC.
+static time_t get_utc_time(time_t local) {
+	struct tm tm;
+	gmtime_r(&local, &tm);
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+// Trim leading and trailing white-spaces in place.
+static char *import_trim(char *str) {
+	char *end;
+	while (isspace((unsigned char)*str))
+		str++;
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	return str;
+}
+
+static int import_cmp_entry(const void *a, const void *b) {
+	const struct import_entry *e1 = a, *e2 = b;
+	if (e1->timestamp != e2->timestamp)
+		return e1->timestamp < e2->timestamp ? -1 : 1;
+	if (e1->hash != e2->hash)
+		return e1->hash < e2->hash ? -1 : 1;
+	return 0;
+}
+
+// Write bytes at the given spill file offset.
+static int import_pwrite(int fd, const char *data, size_t len, off_t offset) {
+	ssize_t rv;
+	while (len > 0) {
+		if ((rv = pwrite(fd, data, len, offset)) <= 0)
+			return -1;
+		data += rv;
+		len -= rv;
+		offset += rv;
+	}
+	return 0;
+}
+
+// Sort records collected by the worker and write them into the spill file
+// as a new run.
+static int import_flush_run(struct import_worker *w) {
+
+	char buffer[IMPORT_BUFFER_SIZE];
+	const struct cmusfm_cache_record *record;
+	struct import_run run;
+	unsigned int i;
+	size_t len, size;
+
+	if (w->count == 0)
+		return 0;
+
+	qsort(w->entries, w->count, sizeof(*w->entries), import_cmp_entry);
+
+	// reserve space in the spill file
+	pthread_mutex_lock(&import.mutex);
+	run.offset = import.spill_size;
+	run.length = w->length;
+	import.spill_size += w->length;
+	if (import.runs_count == import.runs_size) {
+		import.runs_size += 64;
+		import.runs = realloc(import.runs, import.runs_size * sizeof(*import.runs));
+	}
+	import.runs[import.runs_count++] = run;
+	pthread_mutex_unlock(&import.mutex);
+
+	for (i = len = 0; i < w->count; i++) {
+		record = (struct cmusfm_cache_record *)&w->buffer[w->entries[i].offset];
+		size = get_cache_record_size(record);
+		if (len + size > sizeof(buffer)) {
+			if (import_pwrite(fileno(import.spill), buffer, len, run.offset) == -1)
+				return -1;
+			run.offset += len;
+			len = 0;
+		}
+		memcpy(&buffer[len], record, size);
+		len += size;
+	}
+	if (import_pwrite(fileno(import.spill), buffer, len, run.offset) == -1)
+		return -1;
+
+	w->length = 0;
+	w->count = 0;
+	return 0;
+}
+
+// Normalize track info and add it to the current run.
+static int import_add(struct import_worker *w, scrobbler_trackinfo_t *sb_tinf) {
+
+	const char *strings[5] = { sb_tinf->artist, sb_tinf->album,
+		sb_tinf->album_artist, sb_tinf->track, sb_tinf->mbid };
+	size_t lengths[5] = { 0 };
+	struct cmusfm_cache_record *record;
+	struct import_entry *entry;
+	size_t size = sizeof(*record);
+	char *ptr;
+	int i;
+
+	// Last.fm rules: tracks shorter than 30 seconds are not scrobbled, and
+	// the artist and the title are mandatory
+	if (sb_tinf->timestamp == 0 ||
+			(sb_tinf->duration > 0 && sb_tinf->duration < 30) ||
+			sb_tinf->artist == NULL || sb_tinf->artist[0] == '\0' ||
+			sb_tinf->track == NULL || sb_tinf->track[0] == '\0')
+		goto skip;
+
+	for (i = 0; i < 5; i++)
+		if (strings[i] != NULL && strings[i][0] != '\0') {
+			if ((lengths[i] = strlen(strings[i]) + 1) > IMPORT_FIELD_SIZE)
+				goto skip;
+			size += lengths[i];
+		}
+
+	if (w->length + size > IMPORT_RUN_SIZE)
+		if (import_flush_run(w) == -1)
+			return -1;
+
+	record = (struct cmusfm_cache_record *)&w->buffer[w->length];
+	memset(record, 0, sizeof(*record));
+	record->signature = CMUSFM_CACHE_SIGNATURE;
+	record->timestamp = sb_tinf->timestamp;
+	record->track_number = sb_tinf->track_number;
+	record->duration = sb_tinf->duration;
+	record->artist_len = lengths[0];
+	record->album_len = lengths[1];
+	record->album_artist_len = lengths[2];
+	record->track_len = lengths[3];
+	record->mbid_len = lengths[4];
+
+	ptr = (char *)&record[1];
+	for (i = 0; i < 5; i++)
+		if (lengths[i]) {
+			memcpy(ptr, strings[i], lengths[i]);
+			ptr += lengths[i];
+		}
+
+	entry = &w->entries[w->count++];
+	entry->timestamp = sb_tinf->timestamp;
+	entry->offset = w->length;
+	entry->hash = cmusfm_track_id(sb_tinf->artist, NULL, sb_tinf->track, 0);
+
+	w->length += size;
+	return 0;
+
+skip:
+	w->skipped++;
+	return 0;
+}
+
+// Parse single line of the Audioscrobbler log. Entry fields are separated
+// with the TAB character: artist, album, title, track number, duration,
+// rating, timestamp and optional MusicBrainz track identifier.
+static int import_parse_line(struct import_worker *w, struct import_file *file,
+		const char *data, size_t len) {
+
+	char line[IMPORT_FIELD_SIZE * 4];
+	char *fields[8] = { NULL };
+	scrobbler_trackinfo_t sb_tinf;
+	char *ptr, *tmp;
+	int i;
+
+	if (len == 0 || data[0] == '#')
+		return 0;
+
+	w->lines++;
+	if (len >= sizeof(line)) {
+		w->skipped++;
+		return 0;
+	}
+
+	memcpy(line, data, len);
+	line[len] = '\0';
+
+	for (i = 0, ptr = line; i < 8 && ptr != NULL; i++) {
+		fields[i] = ptr;
+		if ((ptr = strchr(ptr, '\t')) != NULL)
+			*ptr++ = '\0';
+	}
+
+	for (i = 0; i < 8; i++)
+		if (fields[i] != NULL)
+			fields[i] = import_trim(fields[i]);
+
+	// skipped tracks and malformed entries
+	if (i < 7 || fields[6] == NULL || strcmp(fields[5], "L") != 0) {
+		w->skipped++;
+		return 0;
+	}
+
+	memset(&sb_tinf, 0, sizeof(sb_tinf));
+	sb_tinf.artist = fields[0];
+	sb_tinf.album = fields[1];
+	sb_tinf.track = fields[2];
+	sb_tinf.track_number = atoi(fields[3]);
+	sb_tinf.duration = atoi(fields[4]);
+	sb_tinf.timestamp = strtoul(fields[6], &tmp, 10);
+	sb_tinf.mbid = fields[7];
+
+	if (*tmp != '\0') {
+		w->skipped++;
+		return 0;
+	}
+
+	if (file->local_time && sb_tinf.timestamp)
+		sb_tinf.timestamp = get_utc_time(sb_tinf.timestamp);
+
+	return import_add(w, &sb_tinf);
+}
+
+// Parse the text chunk. Line which crosses the chunk start belongs to the
+// previous chunk, and the line which crosses the chunk end belongs to this
+// one - every line is parsed exactly once.
+static int import_parse_text(struct import_worker *w, struct import_chunk *chunk) {
+
+	const char *data = chunk->file->data;
+	const char *end = data + chunk->file->size;
+	const char *ptr = data + chunk->start;
+	const char *eol;
+
+	if (chunk->start > 0 && ptr[-1] != '\n') {
+		if ((ptr = memchr(ptr, '\n', end - ptr)) == NULL)
+			return 0;
+		ptr++;
+	}
+
+	while (ptr < data + chunk->end) {
+		if ((eol = memchr(ptr, '\n', end - ptr)) == NULL)
+			eol = end;
+		if (import_parse_line(w, chunk->file, ptr, eol - ptr) == -1)
+			return -1;
+		ptr = eol + 1;
+	}
+
+	return 0;
+}
+
+// Parse cmusfm cache records (e.g. the listening history log).
+static int import_parse_records(struct import_worker *w, struct import_chunk *chunk) {
+
+	const char *ptr = chunk->file->data + chunk->start;
+	const char *end = chunk->file->data + chunk->end;
+	struct cmusfm_cache_record record;
+	scrobbler_trackinfo_t sb_tinf;
+	size_t size;
+
+	while ((size_t)(end - ptr) >= sizeof(record)) {
+
+		// records in the mapped file are not aligned
+		memcpy(&record, ptr, sizeof(record));
+		if (record.signature != CMUSFM_CACHE_SIGNATURE ||
+				(size = get_cache_record_size(&record)) > (size_t)(end - ptr)) {
+			fprintf(stderr, "%s: invalid cache record at offset %zu\n",
+					chunk->file->name, (size_t)(ptr - chunk->file->data));
+			break;
+		}
+
+		w->lines++;
+		// access to the packed structure is alignment safe
+		if (get_cache_record_trackinfo((const struct cmusfm_cache_record *)ptr, &sb_tinf) == -1)
+			w->skipped++;
+		else if (import_add(w, &sb_tinf) == -1)
+			return -1;
+
+		ptr += size;
+	}
+
+	return 0;
+}
+
+static void *import_worker_thread(void *arg) {
+
+	struct import_worker *w = arg;
+	struct import_chunk *chunk;
+	int status = 0;
+
+	for (;;) {
+
+		pthread_mutex_lock(&import.mutex);
+		chunk = NULL;
+		if (import.error == 0 && import.chunks_next < import.chunks_count)
+			chunk = &import.chunks[import.chunks_next++];
+		pthread_mutex_unlock(&import.mutex);
+
+		if (chunk == NULL)
+			break;
+
+		debug("import chunk: %s [%zu, %zu)", chunk->file->name, chunk->start, chunk->end);
+		w->bytes += chunk->end - chunk->start;
+		if (chunk->file->binary)
+			status = import_parse_records(w, chunk);
+		else
+			status = import_parse_text(w, chunk);
+		if (status == -1)
+			break;
+
+		// parsed input is not needed any more, so release mapped pages to
+		// keep the memory usage bounded for huge files
+		madvise((void *)(chunk->file->data + (chunk->start & ~(import.page_size - 1))),
+				chunk->end - (chunk->start & ~(import.page_size - 1)), MADV_DONTNEED);
+
+	}
+
+	if (status == 0)
+		status = import_flush_run(w);
+
+	if (status == -1) {
+		pthread_mutex_lock(&import.mutex);
+		import.error = 1;
+		pthread_mutex_unlock(&import.mutex);
+	}
+
+	return NULL;
+}
+
+// Make sure, that at least given number of bytes is buffered. If the run
+// has been exhausted, 0 is returned.
+static int import_reader_fill(struct import_reader *r, size_t size) {
+
+	size_t len;
+	ssize_t rv;
+
+	while (r->len - r->pos < size) {
+		if (r->offset == r->end)
+			return 0;
+		// move remaining data to the buffer start and refill it
+		memmove(r->buffer, &r->buffer[r->pos], r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+		len = sizeof(r->buffer) - r->len;
+		if ((size_t)(r->end - r->offset) < len)
+			len = r->end - r->offset;
+		if ((rv = pread(r->fd, &r->buffer[r->len], len, r->offset)) <= 0)
+			return -1;
+		r->len += rv;
+		r->offset += rv;
+	}
+
+	return 1;
+}
+
+// Load the next record of the run. If the run has been exhausted, record
+// is set to NULL.
+static int import_reader_next(struct import_reader *r) {
+
+	struct cmusfm_cache_record header;
+	scrobbler_trackinfo_t sb_tinf;
+	size_t size;
+	int rv;
+
+	r->record = NULL;
+
+	if ((rv = import_reader_fill(r, sizeof(header))) != 1)
+		return r->len == r->pos ? rv : -1;
+	memcpy(&header, &r->buffer[r->pos], sizeof(header));
+	if ((size = get_cache_record_size(&header)) > sizeof(r->buffer) ||
+			import_reader_fill(r, size) != 1)
+		return -1;
+
+	r->record = (struct cmusfm_cache_record *)&r->buffer[r->pos];
+	r->pos += size;
+
+	if (get_cache_record_trackinfo(r->record, &sb_tinf) == -1)
+		return -1;
+	r->timestamp = sb_tinf.timestamp;
+	r->hash = cmusfm_track_id(sb_tinf.artist, NULL, sb_tinf.track, 0);
+
+	return 0;
+}
+
+static int import_writer_flush(struct import_writer *wr) {
+	if (wr->len == 0 || wr->error)
+		return wr->error ? -1 : 0;
+	if (wr->fd == -1) {
+		if (cmusfm_cache_append(wr->buffer, wr->len) == -1)
+			wr->error = 1;
+	}
+	else if (import_pwrite(wr->fd, wr->buffer, wr->len, wr->offset) == -1)
+		wr->error = 1;
+	wr->offset += wr->len;
+	wr->len = 0;
+	return wr->error ? -1 : 0;
+}
+
+static int import_writer_write(struct import_writer *wr, const void *data, size_t len) {
+	if (wr->len + len > sizeof(wr->buffer))
+		if (import_writer_flush(wr) == -1)
+			return -1;
+	memcpy(&wr->buffer[wr->len], data, len);
+	wr->len += len;
+	return 0;
+}
+
+static int import_reader_less(const struct import_reader *r1,
+		const struct import_reader *r2) {
+	if (r1->timestamp != r2->timestamp)
+		return r1->timestamp < r2->timestamp;
+	return r1->hash < r2->hash;
+}
+
+// Restore the heap property starting from the given node.
+static void import_heap_down(struct import_reader **heap, unsigned int count,
+		unsigned int i) {
+	struct import_reader *tmp;
+	unsigned int min;
+	for (;;) {
+		min = i;
+		if (2 * i + 1 < count && import_reader_less(heap[2 * i + 1], heap[min]))
+			min = 2 * i + 1;
+		if (2 * i + 2 < count && import_reader_less(heap[2 * i + 2], heap[min]))
+			min = 2 * i + 2;
+		if (min == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+// Merge given runs from the spill file. Records with the same timestamp
+// and track identity are written only once. If the final flag is set,
+// records which have been already submitted are dropped as well.
+static int import_merge(int fd, const struct import_run *runs, unsigned int count,
+		struct import_writer *wr, int final, uint64_t *written, uint64_t *duplicates) {
+
+	struct import_reader *readers, **heap;
+	scrobbler_trackinfo_t sb_tinf;
+	uint32_t last_timestamp = 0;
+	uint64_t last_hash = 0;
+	unsigned int i, n;
+	int status = -1;
+
+	readers = malloc(count * sizeof(*readers));
+	heap = malloc(count * sizeof(*heap));
+	if (readers == NULL || heap == NULL)
+		goto fail;
+
+	for (i = n = 0; i < count; i++) {
+		readers[i].fd = fd;
+		readers[i].offset = runs[i].offset;
+		readers[i].end = runs[i].offset + runs[i].length;
+		readers[i].pos = readers[i].len = 0;
+		if (import_reader_next(&readers[i]) == -1)
+			goto fail;
+		if (readers[i].record != NULL)
+			heap[n++] = &readers[i];
+	}
+
+	for (i = n / 2; i > 0; i--)
+		import_heap_down(heap, n, i - 1);
+
+	while (n > 0) {
+
+		const struct cmusfm_cache_record *record = heap[0]->record;
+
+		if (heap[0]->timestamp == last_timestamp && heap[0]->hash == last_hash)
+			(*duplicates)++;
+		else if (final && get_cache_record_trackinfo(record, &sb_tinf) == 0 &&
+				cmusfm_dedup_check(&sb_tinf))
+			(*duplicates)++;
+		else {
+			if (import_writer_write(wr, record, get_cache_record_size(record)) == -1)
+				goto fail;
+			(*written)++;
+		}
+
+		last_timestamp = heap[0]->timestamp;
+		last_hash = heap[0]->hash;
+
+		if (import_reader_next(heap[0]) == -1)
+			goto fail;
+		if (heap[0]->record == NULL)
+			heap[0] = heap[--n];
+		import_heap_down(heap, n, 0);
+
+	}
+
+	status = import_writer_flush(wr);
+
+fail:
+	free(readers);
+	free(heap);
+	return status;
+}
+
+// Check whether the file is the listening history or the cache of this
+// installation. Such scrobbles were submitted already (or are going to
+// be), while the duplication index covers only the most recent ones.
+static int import_own_file(const char *fname) {
+
+	char dir[PATH_MAX], base[PATH_MAX];
+	struct stat st, own;
+
+	if (stat(fname, &st) == -1)
+		return 0;
+	if (stat(get_cmusfm_history_file(), &own) == 0 &&
+			st.st_dev == own.st_dev && st.st_ino == own.st_ino)
+		return 1;
+
+	// cache segments are named after the cache file
+	strncpy(dir, fname, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = 0;
+	strcpy(base, dir);
+	if (strncmp(basename(base), CACHE_FNAME, sizeof(CACHE_FNAME) - 1) != 0)
+		return 0;
+	return stat(dirname(dir), &st) == 0 && stat(get_cmus_home_dir(), &own) == 0 &&
+		st.st_dev == own.st_dev && st.st_ino == own.st_ino;
+}
+
+// Map input file into the memory and split it into chunks.
+static int import_open_file(struct import_file *file, const char *fname) {
+
+	struct stat st;
+	uint32_t signature;
+	const char *ptr;
+	size_t offset;
+	int fd;
+
+	memset(file, 0, sizeof(*file));
+	file->name = fname;
+
+	if ((fd = open(fname, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return -1;
+	}
+
+	if ((file->size = st.st_size) > 0) {
+		file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (file->data == MAP_FAILED) {
+			file->data = NULL;
+			close(fd);
+			return -1;
+		}
+		madvise((void *)file->data, file->size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if (file->size >= sizeof(signature)) {
+		memcpy(&signature, file->data, sizeof(signature));
+		file->binary = signature == CMUSFM_CACHE_SIGNATURE;
+	}
+
+	// time zone is given in the log header
+	for (ptr = file->data; !file->binary && ptr != NULL &&
+			ptr < file->data + file->size && *ptr == '#'; ) {
+		if ((size_t)(file->data + file->size - ptr) >= 11 &&
+				memcmp(ptr, "#TZ/UNKNOWN", 11) == 0)
+			file->local_time = 1;
+		if ((ptr = memchr(ptr, '\n', file->data + file->size - ptr)) != NULL)
+			ptr++;
+	}
+
+	for (offset = 0; offset < file->size; offset += IMPORT_CHUNK_SIZE) {
+		if (import.chunks_count % 64 == 0)
+			import.chunks = realloc(import.chunks,
+					(import.chunks_count + 64) * sizeof(*import.chunks));
+		import.chunks[import.chunks_count].file = file;
+		import.chunks[import.chunks_count].start = offset;
+		import.chunks[import.chunks_count].end = file->size;
+		// binary records can not be split at an arbitrary position
+		if (!file->binary && file->size - offset > IMPORT_CHUNK_SIZE)
+			import.chunks[import.chunks_count].end = offset + IMPORT_CHUNK_SIZE;
+		import.chunks_count++;
+		if (file->binary)
+			break;
+	}
+
+	return 0;
+}
+
+static double import_elapsed(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Import scrobbles from given log files into the cache. Files are parsed
+// in parallel, and records are appended to the cache in the timestamp
+// order, so they can be submitted in batches afterwards. Import summary
+// is written into the report stream.
+int cmusfm_import(char *fnames[], int count, FILE *report) {
+
+	struct import_file *files;
+	struct import_worker *workers = NULL;
+	struct import_writer *wr = NULL;
+	struct timespec start;
+	uint64_t lines = 0, bytes = 0, skipped = 0;
+	uint64_t written = 0, duplicates = 0, evicted;
+	unsigned int i, threads = 0, merged;
+	double elapsed;
+	long cpus;
+	int status = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	import.page_size = sysconf(_SC_PAGESIZE);
+
+	files = calloc(count, sizeof(*files));
+	for (i = 0; i < (unsigned int)count; i++) {
+		if (import_own_file(fnames[i])) {
+			fprintf(stderr, "%s: scrobbled by this installation already\n", fnames[i]);
+			goto final;
+		}
+		if (import_open_file(&files[i], fnames[i]) == -1) {
+			fprintf(stderr, "%s: unable to open file\n", fnames[i]);
+			goto final;
+		}
+	}
+
+	if ((import.spill = tmpfile()) == NULL)
+		goto final;
+
+	if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		cpus = 1;
+	threads = cpus > IMPORT_MAX_THREADS ? IMPORT_MAX_THREADS : cpus;
+	if (threads > import.chunks_count)
+		threads = import.chunks_count;
+
+	workers = calloc(threads, sizeof(*workers));
+	for (i = 0; i < threads; i++) {
+		workers[i].buffer = malloc(IMPORT_RUN_SIZE);
+		workers[i].entries = malloc(IMPORT_RUN_SIZE /
+				sizeof(struct cmusfm_cache_record) * sizeof(*workers[i].entries));
+		if (workers[i].buffer == NULL || workers[i].entries == NULL ||
+				pthread_create(&workers[i].thread, NULL, import_worker_thread,
+					&workers[i]) != 0) {
+			import.error = 1;
+			threads = i;
+			free(workers[i].buffer);
+			free(workers[i].entries);
+			break;
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		lines += workers[i].lines;
+		bytes += workers[i].bytes;
+		skipped += workers[i].skipped;
+		free(workers[i].buffer);
+		free(workers[i].entries);
+	}
+
+	if (import.error)
+		goto final;
+
+	debug("import runs: %u (%lld bytes)", import.runs_count, (long long)import.spill_size);
+
+	wr = malloc(sizeof(*wr));
+
+	// Reduce the number of runs, so the final merge does not exceed the
+	// memory limit. Every pass writes merged runs into a new spill file.
+	while (import.runs_count > IMPORT_MERGE_WAYS) {
+
+		FILE *spill;
+		uint64_t tmp = 0;
+
+		if ((spill = tmpfile()) == NULL)
+			goto final;
+
+		memset(wr, 0, sizeof(*wr));
+		wr->fd = fileno(spill);
+
+		for (i = merged = 0; i < import.runs_count; i += IMPORT_MERGE_WAYS) {
+			unsigned int n = import.runs_count - i;
+			off_t offset = wr->offset;
+			if (n > IMPORT_MERGE_WAYS)
+				n = IMPORT_MERGE_WAYS;
+			if (import_merge(fileno(import.spill), &import.runs[i], n,
+						wr, 0, &tmp, &duplicates) == -1) {
+				fclose(spill);
+				goto final;
+			}
+			import.runs[merged].offset = offset;
+			import.runs[merged++].length = wr->offset - offset;
+		}
+
+		fclose(import.spill);
+		import.spill = spill;
+		import.runs_count = merged;
+
+	}
+
+	memset(wr, 0, sizeof(*wr));
+	wr->fd = -1;
+	if (import_merge(fileno(import.spill), import.runs, import.runs_count,
+				wr, 1, &written, &duplicates) == -1)
+		goto final;
+
+	status = 0;
+
+	elapsed = import_elapsed(&start);
+	fprintf(report, "Parsed %llu entries (%.1f MB) in %.3f s using %u threads "
+			"(%.0f entries/s, %.1f MB/s)\n",
+			(unsigned long long)lines, bytes / 1e6, elapsed, threads,
+			elapsed > 0 ? lines / elapsed : 0, elapsed > 0 ? bytes / 1e6 / elapsed : 0);
+	fprintf(report, "Imported %llu scrobbles (duplicates: %llu, skipped: %llu)\n",
+			(unsigned long long)written, (unsigned long long)duplicates,
+			(unsigned long long)skipped);
+	if ((evicted = cmusfm_metrics_get(METRICS_CACHE_EVICTED_SIZE) +
+				cmusfm_metrics_get(METRICS_CACHE_EVICTED_AGE)) > 0)
+		fprintf(report, "Evicted %llu cached scrobbles due to the cache limits\n",
+				(unsigned long long)evicted);
+
+final:
+	for (i = 0; i < (unsigned int)count; i++)
+		if (files[i].data != NULL)
+			munmap((void *)files[i].data, files[i].size);
+	if (import.spill != NULL)
+		fclose(import.spill);
+	cmusfm_dedup_close();
+	free(import.chunks);
+	free(import.runs);
+	free(workers);
+	free(files);
+	free(wr);
+	return status;
+}
@@ -0,0 +1,47 @@
+/*
+ * cmusfm - import.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_IMPORT_H
+#define __CMUSFM_IMPORT_H
+
+#include <stdio.h>
+
+
+// Input files are split into chunks, which are parsed in parallel. Every
+// worker collects records in its run buffer, which is sorted and spilled
+// into the temporary file when full. Spilled runs are merged (up to the
+// given number at once) and written into the cache in the timestamp order.
+#define IMPORT_CHUNK_SIZE (8 * 1024 * 1024)
+#define IMPORT_RUN_SIZE (8 * 1024 * 1024)
+#define IMPORT_MERGE_WAYS 256
+#define IMPORT_MAX_THREADS 16
+
+// maximal length of the imported string (longer entries are skipped)
+#define IMPORT_FIELD_SIZE 512
+
+// Supported input formats:
+// - Audioscrobbler portable player log (.scrobbler.log), tab-separated
+//   artist, album, title, track number, duration, rating, timestamp and
+//   MusicBrainz identifier, skipped tracks (rating "S") are not imported
+// - cmusfm cache and listening history log (binary cache records)
+
+int cmusfm_import(char *fnames[], int count, FILE *report);
+
+#endif
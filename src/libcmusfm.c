@@ -0,0 +1,276 @@
+/*
+ * cmusfm - libcmusfm.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "libcmusfm.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "cmusfm.h"
+#include "config.h"
+#include "core.h"
+#include "debug.h"
+#include "server.h"
+
+
+struct cmusfm_ctx {
+	// server instance lock (the context takes the place of the server)
+	int lock;
+	// configuration file watch (-1 if not available)
+	int inotify;
+	// time after which pending scrobbles are submitted (zero if none)
+	time_t deadline;
+};
+
+// The core keeps the global state, so there can be only one context
+// per process and all calls are serialized with the global lock.
+static pthread_mutex_t ctx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cmusfm_ctx_t *ctx_instance = NULL;
+
+
+cmusfm_ctx_t *cmusfm_ctx_new(void) {
+
+	cmusfm_ctx_t *ctx = NULL;
+	int err = EBUSY;
+
+	pthread_mutex_lock(&ctx_mutex);
+
+	if (ctx_instance != NULL)
+		goto fail;
+
+	if ((ctx = malloc(sizeof(*ctx))) == NULL) {
+		err = errno;
+		goto fail;
+	}
+
+	ctx->inotify = -1;
+	ctx->deadline = 0;
+
+	if ((ctx->lock = cmusfm_server_lock()) == -1)
+		goto fail;
+
+	errno = 0;
+	if (cmusfm_config_read(get_cmusfm_config_file(), &config) == -1 ||
+			cmusfm_core_initialize() == -1) {
+		err = errno != 0 ? errno : EINVAL;
+		close(ctx->lock);
+		goto fail;
+	}
+
+	// The HTTP library is initialized here, because its global initialization
+	// is not thread-safe, while the status might be reported from any thread.
+	if (cmusfm_core_initialize_http() == -1) {
+		err = EIO;
+		cmusfm_core_free();
+		close(ctx->lock);
+		goto fail;
+	}
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if ((ctx->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) != -1)
+		cmusfm_config_add_watch(ctx->inotify);
+#endif
+
+	// events which were spooled when no one was listening
+	cmusfm_core_process_spool();
+
+	debug("library context created");
+	ctx_instance = ctx;
+	pthread_mutex_unlock(&ctx_mutex);
+	return ctx;
+
+fail:
+	free(ctx);
+	pthread_mutex_unlock(&ctx_mutex);
+	errno = err;
+	return NULL;
+}
+
+void cmusfm_ctx_free(cmusfm_ctx_t *ctx) {
+
+	if (ctx == NULL)
+		return;
+
+	pthread_mutex_lock(&ctx_mutex);
+
+	cmusfm_core_process_spool();
+	cmusfm_core_free();
+	if (ctx->inotify != -1)
+		close(ctx->inotify);
+	close(ctx->lock);
+	free(ctx);
+	ctx_instance = NULL;
+
+	pthread_mutex_unlock(&ctx_mutex);
+}
+
+int cmusfm_on_status(cmusfm_ctx_t *ctx, const struct cmusfm_trackinfo *tinfo) {
+
+	char buffer[CMSOCKET_BUFFER_SIZE];
+	char file[CMSOCKET_BUFFER_SIZE];
+	struct cmtrack_info info;
+	ssize_t len;
+
+	(void)ctx;
+
+	memset(&info, 0, sizeof(info));
+	switch (tinfo->status) {
+	case CMUSFM_STATUS_PLAYING:
+		info.status = CMSTATUS_PLAYING;
+		break;
+	case CMUSFM_STATUS_PAUSED:
+		info.status = CMSTATUS_PAUSED;
+		break;
+	case CMUSFM_STATUS_STOPPED:
+		info.status = CMSTATUS_STOPPED;
+		break;
+	default:
+		return -1;
+	}
+
+	// file name might be modified during the format matching
+	if (tinfo->file != NULL) {
+		if (strlen(tinfo->file) >= sizeof(file))
+			return -1;
+		info.file = strcpy(file, tinfo->file);
+	}
+
+	info.url = (char *)tinfo->url;
+	info.artist = (char *)tinfo->artist;
+	info.album = (char *)tinfo->album;
+	info.album_artist = (char *)tinfo->album_artist;
+	info.title = (char *)tinfo->title;
+	info.mbid = (char *)tinfo->mbid;
+	info.tracknb = tinfo->track_number;
+	info.duration = tinfo->duration;
+
+	pthread_mutex_lock(&ctx_mutex);
+
+	len = cmusfm_core_pack_track(&info, tinfo->client != NULL ? tinfo->client : "",
+			buffer, sizeof(buffer));
+	if (len != -1) {
+		cmusfm_core_process_spool();
+		cmusfm_core_process_data(buffer, len);
+	}
+
+	pthread_mutex_unlock(&ctx_mutex);
+	return len == -1 ? -1 : 0;
+}
+
+int cmusfm_poll_fds(cmusfm_ctx_t *ctx, struct pollfd *fds, unsigned int count,
+		int *timeout) {
+
+	unsigned int i = 0;
+	time_t now, delay;
+
+	pthread_mutex_lock(&ctx_mutex);
+
+	if (ctx->inotify != -1 && i < count) {
+		fds[i].fd = ctx->inotify;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+		i++;
+	}
+
+	// submit pending scrobbles even if the batch is not full
+	*timeout = -1;
+	if ((delay = cmusfm_core_submit_delay()) != -1) {
+		now = time(NULL);
+		if (ctx->deadline == 0)
+			ctx->deadline = now + delay;
+		*timeout = ctx->deadline > now ? (ctx->deadline - now) * 1000 : 0;
+	}
+	else
+		ctx->deadline = 0;
+
+	pthread_mutex_unlock(&ctx_mutex);
+	return i;
+}
+
+int cmusfm_dispatch(cmusfm_ctx_t *ctx, const struct pollfd *fds,
+		unsigned int count) {
+
+	unsigned int i;
+#ifdef HAVE_SYS_INOTIFY_H
+	char buffer[sizeof(struct inotify_event) + 256];
+#endif
+
+	pthread_mutex_lock(&ctx_mutex);
+
+	for (i = 0; i < count; i++) {
+		if (fds[i].fd == -1 || !(fds[i].revents & POLLIN))
+			continue;
+#ifdef HAVE_SYS_INOTIFY_H
+		if (fds[i].fd == ctx->inotify) {
+			// we're watching only one file, so simply drain the descriptor
+			while (read(ctx->inotify, buffer, sizeof(buffer)) > 0)
+				continue;
+			debug("configuration file modified");
+			cmusfm_config_read(get_cmusfm_config_file(), &config);
+			cmusfm_core_apply_config();
+			cmusfm_config_add_watch(ctx->inotify);
+		}
+#endif
+	}
+
+	if (ctx->deadline != 0 && time(NULL) >= ctx->deadline) {
+		cmusfm_core_submit_cache();
+		ctx->deadline = 0;
+	}
+
+	cmusfm_core_process_spool();
+
+	pthread_mutex_unlock(&ctx_mutex);
+	return 0;
+}
+
+int cmusfm_command(cmusfm_ctx_t *ctx, enum cmusfm_command command, FILE *f) {
+
+	static const int requests[] = {
+		[CMUSFM_COMMAND_STATS] = CMREQUEST_STATS,
+		[CMUSFM_COMMAND_FLUSH] = CMREQUEST_FLUSH,
+		[CMUSFM_COMMAND_RELOAD] = CMREQUEST_RELOAD,
+		[CMUSFM_COMMAND_PAUSE] = CMREQUEST_PAUSE,
+		[CMUSFM_COMMAND_RESUME] = CMREQUEST_RESUME,
+		[CMUSFM_COMMAND_STATUS] = CMREQUEST_STATUS,
+	};
+
+	(void)ctx;
+
+	if (command < CMUSFM_COMMAND_STATS || command > CMUSFM_COMMAND_STATUS)
+		return -1;
+
+	pthread_mutex_lock(&ctx_mutex);
+	cmusfm_core_process_request(f, requests[command]);
+	pthread_mutex_unlock(&ctx_mutex);
+
+	return ferror(f) ? -1 : 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * cmusfm - libcmusfm.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBCMUSFM_H
+#define __LIBCMUSFM_H
+
+#include <poll.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// The libcmusfm library embeds the cmusfm scrobbling engine into the player
+// process, so there is no need to spawn the cmusfm program and to run its
+// server for every playback event. The library uses the cmusfm
+// configuration file, cache and listening history. While the context
+// exists, it takes the place of the cmusfm server - events of players
+// which use the cmusfm program are spooled and processed by the context.
+//
+// All functions are thread-safe - calls are serialized by the context
+// lock. Note, that the scrobbler API requests are made synchronously, so
+// some calls might block on the network.
+
+#define LIBCMUSFM_API_VERSION 1
+
+// playback status of the player
+enum cmusfm_status {
+	CMUSFM_STATUS_PLAYING = 1,
+	CMUSFM_STATUS_PAUSED,
+	CMUSFM_STATUS_STOPPED,
+};
+
+// commands available via the cmusfm_command() function
+enum cmusfm_command {
+	CMUSFM_COMMAND_STATS = 1,  // metrics (Prometheus text format)
+	CMUSFM_COMMAND_FLUSH,      // submit cached scrobbles right away
+	CMUSFM_COMMAND_RELOAD,     // re-read the configuration file
+	CMUSFM_COMMAND_PAUSE,      // keep all scrobbles in the cache
+	CMUSFM_COMMAND_RESUME,
+	CMUSFM_COMMAND_STATUS,     // state of the service and all sessions
+};
+
+// Track information. All strings are optional (NULL if not known), but
+// either the artist and the title or the file (URL) has to be given - in
+// the latter case the missing information is taken from the file tags or
+// from the file name (see the format-localfile configuration key). All
+// strings are copied, so they have to be valid during the call only.
+struct cmusfm_trackinfo {
+	enum cmusfm_status status;
+	// player identifier, playback state is tracked for every player
+	const char *client;
+	const char *file, *url;
+	const char *artist, *album, *album_artist, *title;
+	// MusicBrainz track identifier
+	const char *mbid;
+	int track_number;
+	int duration;  // in seconds
+};
+
+typedef struct cmusfm_ctx cmusfm_ctx_t;
+
+
+// Create the library context. The configuration file has to be initialized
+// with the `cmusfm init` command beforehand. There can be only one context
+// per user at once - if the context already exists or the cmusfm server is
+// running, NULL is returned and errno is set to EBUSY.
+cmusfm_ctx_t *cmusfm_ctx_new(void);
+// Free the context. Scrobbles waiting for the batch are submitted.
+void cmusfm_ctx_free(cmusfm_ctx_t *ctx);
+
+// Report the playback status change. Returns 0 on success, -1 otherwise.
+int cmusfm_on_status(cmusfm_ctx_t *ctx, const struct cmusfm_trackinfo *tinfo);
+
+// Get descriptors which should be polled by the player event loop. At most
+// count descriptors are stored in the fds array and the number of stored
+// descriptors is returned. The timeout (in milliseconds, -1 if infinite)
+// after which the cmusfm_dispatch() has to be called is stored in the
+// timeout variable.
+int cmusfm_poll_fds(cmusfm_ctx_t *ctx, struct pollfd *fds, unsigned int count,
+		int *timeout);
+// Dispatch events of the polled descriptors (and expired timeout). Returns
+// 0 on success, -1 otherwise.
+int cmusfm_dispatch(cmusfm_ctx_t *ctx, const struct pollfd *fds,
+		unsigned int count);
+
+// Execute the command and write the reply into the given stream. Returns 0
+// on success, -1 otherwise.
+int cmusfm_command(cmusfm_ctx_t *ctx, enum cmusfm_command command, FILE *f);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,10 +28,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #include <curl/curl.h>
+#include <openssl/evp.h>
 #include <openssl/md5.h>
 
 #include "debug.h"
+#include "probes.h"
 
 
 // used as a buffer for GET/POST server response
@@ -40,13 +43,6 @@ struct sb_response_data {
 	int len;
 };
 
-// used for quick URL and signature creation process
-struct sb_getpost_data {
-	char *name;
-	char data_format;
-	void *data;
-};
-
 char *mem2hex(const unsigned char *mem, int len, char *str);
 unsigned char *hex2mem(const char *str, int len, unsigned char *mem);
 
@@ -66,12 +62,36 @@ static size_t sb_curl_write_callback(char *ptr, size_t size, size_t nmemb,
 	return len;
 }
 
+// Initialize the CURL library. The global initialization is not thread
+// safe, so multi-threaded hosts should call it up front, otherwise it is
+// done on the first use, so sessions which never send anything do not pay
+// for it.
+int scrobbler_curl_init(scrobbler_session_t *sbs)
+{
+	struct timespec ts_start, ts_end;
+
+	if(sbs->curl_initialized)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	if(curl_global_init(CURL_GLOBAL_NOTHING) != 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	sbs->curl_initialized = 1;
+	if(sbs->init_callback)
+		sbs->init_callback("curl", (ts_end.tv_sec - ts_start.tv_sec) * 1000000 +
+				(ts_end.tv_nsec - ts_start.tv_nsec) / 1000);
+
+	return 0;
+}
+
 // Initialize CURL handler for internal usage.
-CURL *sb_curl_init(CURLoption method, struct sb_response_data *response)
+CURL *sb_curl_init(scrobbler_session_t *sbs, CURLoption method,
+		struct sb_response_data *response)
 {
 	CURL *curl;
 
-	if((curl = curl_easy_init()) == NULL)
+	if(scrobbler_curl_init(sbs) != 0 || (curl = curl_easy_init()) == NULL)
 		return NULL;
 
 #ifdef CURLOPT_PROTOCOLS
@@ -79,6 +99,8 @@ CURL *sb_curl_init(CURLoption method, struct sb_response_data *response)
 #endif
 	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
 	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1);
+	// signal based DNS timeouts are not safe in multi-threaded hosts
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
 
 	curl_easy_setopt(curl, method, 1);
 
@@ -121,35 +143,78 @@ int sb_check_response(struct sb_response_data *response, int curl_status,
 	return 0;
 }
 
-// Generate MD5 scrobbler API method signature
-void sb_generate_method_signature(struct sb_getpost_data *sb_data, int len,
+// Perform CURL request and check the response. If the request callback
+// is set, it is called with the latency of the request.
+int sb_curl_perform(CURL *curl, struct sb_response_data *response,
+		scrobbler_session_t *sbs, const char *method)
+{
+	struct timespec ts_start, ts_end;
+	int status;
+
+	if(sbs->request_start_callback)
+		sbs->request_start_callback(method);
+
+	probe1(http__start, method);
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	status = curl_easy_perform(curl);
+	status = sb_check_response(response, status, sbs);
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	probe2(http__finish, method, status);
+
+	if(sbs->request_callback)
+		sbs->request_callback(method, (ts_end.tv_sec - ts_start.tv_sec) * 1000000 +
+				(ts_end.tv_nsec - ts_start.tv_nsec) / 1000, status);
+	return status;
+}
+
+// Generate MD5 scrobbler API method signature. On error -1 is returned.
+int sb_generate_method_signature(struct sb_getpost_data *sb_data, int len,
 		uint8_t secret[16], uint8_t sign[MD5_DIGEST_LENGTH])
 {
+	EVP_MD_CTX *md5;
 	char secret_hex[16*2 + 1];
-	char tmp_str[2048], format[8];
-	int x, offset;
+	char tmp_str[32];
+	int x, status;
+
+	if((md5 = EVP_MD_CTX_new()) == NULL)
+		return -1;
 
 	mem2hex(secret, 16, secret_hex);
+	status = EVP_DigestInit_ex(md5, EVP_md5(), NULL);
 
-	for(x = offset = 0; x < len; x++) {
+	for(x = 0; x < len && status; x++) {
 		// it means that if numerical data is zero it is also discarded
 		if(sb_data[x].data == NULL) continue;
 
-		sprintf(format, "%%s%%%c", sb_data[x].data_format);
-		offset += sprintf(tmp_str + offset, format, sb_data[x].name, sb_data[x].data);
+		status = EVP_DigestUpdate(md5, sb_data[x].name, strlen(sb_data[x].name));
+		if(sb_data[x].data_format == 's')
+			status &= EVP_DigestUpdate(md5, sb_data[x].data, strlen(sb_data[x].data));
+		else {
+			sprintf(tmp_str, "%d", (int)(long)sb_data[x].data);
+			status &= EVP_DigestUpdate(md5, tmp_str, strlen(tmp_str));
+		}
+		debug("signature data: %s", sb_data[x].name);
 	}
 
-	debug("signature data: %s", tmp_str);
-	strcat(tmp_str, secret_hex);
-	MD5((unsigned char*)tmp_str, strlen(tmp_str), sign);
+	if(status)
+		status = EVP_DigestUpdate(md5, secret_hex, strlen(secret_hex)) &&
+			EVP_DigestFinal_ex(md5, sign, NULL);
+	EVP_MD_CTX_free(md5);
+	return status ? 0 : -1;
 }
 
-// Make curl GET/POST string (escape data)
-char *sb_make_curl_getpost_string(CURL *curl, char *str_buffer,
+// Make curl GET/POST string (escape data). If the data does not fit into
+// the buffer, NULL is returned - truncated data would not match the
+// signature, so the request has to be failed.
+char *sb_make_curl_getpost_string(CURL *curl, char *str_buffer, size_t size,
 		struct sb_getpost_data *sb_data, int len)
 {
 	char *escaped_data, format[8];
-	int x, offset;
+	size_t offset;
+	int x;
+
+	if(size == 0)
+		return NULL;
 
 	for(x = offset = 0; x < len; x++) {
 		// it means that if numerical data is zero it is also discarded
@@ -158,16 +223,26 @@ char *sb_make_curl_getpost_string(CURL *curl, char *str_buffer,
 		sprintf(format, "%%s=%%%c&", sb_data[x].data_format);
 
 		if(sb_data[x].data_format == 's'){ //escape for string data
-			escaped_data = curl_easy_escape(curl, sb_data[x].data, 0);
-			offset += sprintf(str_buffer + offset, format,
+			if((escaped_data = curl_easy_escape(curl, sb_data[x].data, 0)) == NULL)
+				return NULL;
+			offset += snprintf(str_buffer + offset, size - offset, format,
 					sb_data[x].name, escaped_data);
 			curl_free(escaped_data);}
 		else //non-string content -> no need for escaping
-			offset += sprintf(str_buffer + offset, format,
+			offset += snprintf(str_buffer + offset, size - offset, format,
 					sb_data[x].name, sb_data[x].data);
+
+		if(offset >= size) { //truncated data
+			debug("params truncated: %zu", offset);
+			str_buffer[0] = 0;
+			return NULL;
+		}
 	}
 
-	str_buffer[offset - 1] = 0; //strip '&' at the end of string
+	if(offset > 0) //strip '&' at the end of string
+		str_buffer[offset - 1] = 0;
+	else
+		str_buffer[0] = 0;
 	debug("params: %s", str_buffer);
 	return str_buffer;
 }
@@ -181,7 +256,7 @@ int scrobbler_scrobble(scrobbler_session_t *sbs, scrobbler_trackinfo_t *sbt)
 	char api_key_hex[sizeof(sbs->api_key)*2 + 1];
 	char session_key_hex[sizeof(sbs->session_key)*2 + 1];
 	char sign_hex[sizeof(sign)*2 + 1];
-	char post_data[2048];
+	char post_data[4096];
 	struct sb_response_data response;
 
 	// data in alphabetical order sorted by name field (except api_sig)
@@ -209,28 +284,139 @@ int scrobbler_scrobble(scrobbler_session_t *sbs, scrobbler_trackinfo_t *sbt)
 	if(sbt->artist == NULL || sbt->track == NULL || sbt->timestamp == 0)
 		return SCROBBERR_TRACKINF;
 
-	if((curl = sb_curl_init(CURLOPT_POST, &response)) == NULL)
+	if((curl = sb_curl_init(sbs, CURLOPT_POST, &response)) == NULL)
 		return SCROBBERR_CURLINIT;
 
 	mem2hex(sbs->api_key, sizeof(sbs->api_key), api_key_hex);
 	mem2hex(sbs->session_key, sizeof(sbs->session_key), session_key_hex);
 
 	// make signature for track.updateNowPlaying API call
-	sb_generate_method_signature(sb_data, 11, sbs->secret, sign);
+	if(sb_generate_method_signature(sb_data, 11, sbs->secret, sign) != 0) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_CURLINIT;
+	}
 	mem2hex(sign, sizeof(sign), sign_hex);
 
-	// make track.updateNowPlaying POST request
-	sb_make_curl_getpost_string(curl, post_data, sb_data, 12);
+	// make track.scrobble POST request
+	if(sb_make_curl_getpost_string(curl, post_data, sizeof(post_data), sb_data, 12) == NULL) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_TRACKINF;
+	}
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
-	curl_easy_setopt(curl, CURLOPT_URL, SCROBBLER_URL);
-	status = curl_easy_perform(curl);
-	status = sb_check_response(&response, status, sbs);
+	curl_easy_setopt(curl, CURLOPT_URL, sbs->service_url);
+	status = sb_curl_perform(curl, &response, sbs, "track.scrobble");
 	debug("scrobble status: %d", status);
 
 	sb_curl_cleanup(curl, &response);
 	return status;
 }
 
+// Compare function for sorting request parameters by the name field.
+static int sb_getpost_data_cmp(const void *a, const void *b)
+{
+	return strcmp(((struct sb_getpost_data*)a)->name,
+			((struct sb_getpost_data*)b)->name);
+}
+
+// Append indexed (array notation) parameter to the request data.
+#define SB_BATCH_PARAM(n, f, d) \
+	sprintf(names[len], n "[%d]", valid); \
+	sb_data[len].name = names[len]; \
+	sb_data[len].data_format = f; \
+	sb_data[len++].data = (void*)(d)
+
+// Scrobble a batch of tracks (up to SCROBBLER_BATCH_SIZE) using the array
+// notation of the track.scrobble method. Tracks without required fields
+// are skipped.
+int scrobbler_scrobble_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, int count)
+{
+	CURL *curl;
+	int status, x, len, valid;
+	uint8_t sign[MD5_DIGEST_LENGTH];
+	char api_key_hex[sizeof(sbs->api_key)*2 + 1];
+	char session_key_hex[sizeof(sbs->session_key)*2 + 1];
+	char sign_hex[sizeof(sign)*2 + 1];
+	char names[SCROBBLER_BATCH_SIZE * 8][16], *post_data;
+	struct sb_getpost_data sb_data[SCROBBLER_BATCH_SIZE * 8 + 4];
+	struct sb_response_data response;
+	size_t post_size;
+
+	debug("scrobble batch: %d", count);
+
+	if(count > SCROBBLER_BATCH_SIZE)
+		count = SCROBBLER_BATCH_SIZE;
+
+	for(x = len = valid = 0; x < count; x++) {
+		if(sbt[x].artist == NULL || sbt[x].track == NULL || sbt[x].timestamp == 0)
+			continue;
+
+		SB_BATCH_PARAM("album", 's', sbt[x].album);
+		SB_BATCH_PARAM("albumArtist", 's', sbt[x].album_artist);
+		SB_BATCH_PARAM("artist", 's', sbt[x].artist);
+		SB_BATCH_PARAM("duration", 'd', (long)sbt[x].duration);
+		SB_BATCH_PARAM("mbid", 's', sbt[x].mbid);
+		SB_BATCH_PARAM("timestamp", 'd', sbt[x].timestamp);
+		SB_BATCH_PARAM("track", 's', sbt[x].track);
+		SB_BATCH_PARAM("trackNumber", 'd', (long)sbt[x].track_number);
+		valid++;
+	}
+
+	if(valid == 0)
+		return 0;
+
+	sb_data[len++] = (struct sb_getpost_data){"api_key", 's', api_key_hex};
+	sb_data[len++] = (struct sb_getpost_data){"method", 's', "track.scrobble"};
+	sb_data[len++] = (struct sb_getpost_data){"sk", 's', session_key_hex};
+
+	// data has to be in alphabetical order sorted by name field
+	qsort(sb_data, len, sizeof(*sb_data), sb_getpost_data_cmp);
+	sb_data[len++] = (struct sb_getpost_data){"api_sig", 's', sign_hex};
+
+	// calculate the worst case size of the (escaped) POST data
+	for(x = 0, post_size = 1; x < len; x++) {
+		post_size += strlen(sb_data[x].name) + 2;
+		if(sb_data[x].data_format == 's' && sb_data[x].data != NULL)
+			post_size += strlen(sb_data[x].data) * 3;
+		else
+			post_size += 21;
+	}
+
+	if((post_data = malloc(post_size)) == NULL)
+		return SCROBBERR_CURLINIT;
+
+	if((curl = sb_curl_init(sbs, CURLOPT_POST, &response)) == NULL) {
+		free(post_data);
+		return SCROBBERR_CURLINIT;
+	}
+
+	mem2hex(sbs->api_key, sizeof(sbs->api_key), api_key_hex);
+	mem2hex(sbs->session_key, sizeof(sbs->session_key), session_key_hex);
+
+	// make signature for track.scrobble API call
+	if(sb_generate_method_signature(sb_data, len - 1, sbs->secret, sign) != 0) {
+		sb_curl_cleanup(curl, &response);
+		free(post_data);
+		return SCROBBERR_CURLINIT;
+	}
+	mem2hex(sign, sizeof(sign), sign_hex);
+
+	// make track.scrobble POST request
+	if(sb_make_curl_getpost_string(curl, post_data, post_size, sb_data, len) == NULL) {
+		sb_curl_cleanup(curl, &response);
+		free(post_data);
+		return SCROBBERR_TRACKINF;
+	}
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
+	curl_easy_setopt(curl, CURLOPT_URL, sbs->service_url);
+	status = sb_curl_perform(curl, &response, sbs, "track.scrobble");
+	debug("scrobble batch status: %d", status);
+
+	sb_curl_cleanup(curl, &response);
+	free(post_data);
+	return status;
+}
+
 // Notify Last.fm that a user has started listening to a track.
 // This is engine function (without required argument check)
 int sb_update_now_playing(scrobbler_session_t *sbs,
@@ -242,7 +428,7 @@ int sb_update_now_playing(scrobbler_session_t *sbs,
 	char api_key_hex[sizeof(sbs->api_key)*2 + 1];
 	char session_key_hex[sizeof(sbs->session_key)*2 + 1];
 	char sign_hex[sizeof(sign)*2 + 1];
-	char post_data[2048];
+	char post_data[4096];
 	struct sb_response_data response;
 
 	// data in alphabetical order sorted by name field (except api_sig)
@@ -265,22 +451,27 @@ int sb_update_now_playing(scrobbler_session_t *sbs,
 			sbt->artist, sbt->album, sbt->album_artist,
 			sbt->track_number, sbt->track, sbt->duration);
 
-	if((curl = sb_curl_init(CURLOPT_POST, &response)) == NULL)
+	if((curl = sb_curl_init(sbs, CURLOPT_POST, &response)) == NULL)
 		return SCROBBERR_CURLINIT;
 
 	mem2hex(sbs->api_key, sizeof(sbs->api_key), api_key_hex);
 	mem2hex(sbs->session_key, sizeof(sbs->session_key), session_key_hex);
 
 	// make signature for track.updateNowPlaying API call
-	sb_generate_method_signature(sb_data, 10, sbs->secret, sign);
+	if(sb_generate_method_signature(sb_data, 10, sbs->secret, sign) != 0) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_CURLINIT;
+	}
 	mem2hex(sign, sizeof(sign), sign_hex);
 
 	// make track.updateNowPlaying POST request
-	sb_make_curl_getpost_string(curl, post_data, sb_data, 11);
+	if(sb_make_curl_getpost_string(curl, post_data, sizeof(post_data), sb_data, 11) == NULL) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_TRACKINF;
+	}
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
-	curl_easy_setopt(curl, CURLOPT_URL, SCROBBLER_URL);
-	status = curl_easy_perform(curl);
-	status = sb_check_response(&response, status, sbs);
+	curl_easy_setopt(curl, CURLOPT_URL, sbs->service_url);
+	status = sb_curl_perform(curl, &response, sbs, "track.updateNowPlaying");
 	debug("now playing status: %d", status);
 
 	sb_curl_cleanup(curl, &response);
@@ -350,21 +541,27 @@ int scrobbler_authentication(scrobbler_session_t *sbs,
 		{"token", 's', token_hex},
 		{"api_sig", 's', sign_hex}};
 
-	if((curl = sb_curl_init(CURLOPT_HTTPGET, &response)) == NULL)
+	if((curl = sb_curl_init(sbs, CURLOPT_HTTPGET, &response)) == NULL)
 		return SCROBBERR_CURLINIT;
 
 	mem2hex(sbs->api_key, sizeof(sbs->api_key), api_key_hex);
 
 	// make signature for auth.getToken API call
-	sb_generate_method_signature(sb_data_token, 2, sbs->secret, sign);
+	if(sb_generate_method_signature(sb_data_token, 2, sbs->secret, sign) != 0) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_CURLINIT;
+	}
 	mem2hex(sign, sizeof(sign), sign_hex);
 
 	// make auth.getToken GET request
-	strcpy(get_url, SCROBBLER_URL "?");
-	sb_make_curl_getpost_string(curl, get_url + strlen(get_url), sb_data_token, 3);
+	snprintf(get_url, sizeof(get_url), "%s?", sbs->service_url);
+	if(sb_make_curl_getpost_string(curl, get_url + strlen(get_url),
+				sizeof(get_url) - strlen(get_url), sb_data_token, 3) == NULL) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_CURLINIT;
+	}
 	curl_easy_setopt(curl, CURLOPT_URL, get_url);
-	status = curl_easy_perform(curl);
-	status = sb_check_response(&response, status, sbs);
+	status = sb_curl_perform(curl, &response, sbs, "auth.getToken");
 
 	if(status != 0) {
 		sb_curl_cleanup(curl, &response);
@@ -383,18 +580,24 @@ int scrobbler_authentication(scrobbler_session_t *sbs,
 	}
 	
 	// make signature for auth.getSession API call
-	sb_generate_method_signature(sb_data_session, 3, sbs->secret, sign);
+	if(sb_generate_method_signature(sb_data_session, 3, sbs->secret, sign) != 0) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_CURLINIT;
+	}
 	mem2hex(sign, sizeof(sign), sign_hex);
 
 	// reinitialize response buffer
 	response.len = 0;
 
 	// make auth.getSession GET request
-	strcpy(get_url, SCROBBLER_URL "?");
-	sb_make_curl_getpost_string(curl, get_url + strlen(get_url), sb_data_session, 4);
+	snprintf(get_url, sizeof(get_url), "%s?", sbs->service_url);
+	if(sb_make_curl_getpost_string(curl, get_url + strlen(get_url),
+				sizeof(get_url) - strlen(get_url), sb_data_session, 4) == NULL) {
+		sb_curl_cleanup(curl, &response);
+		return SCROBBERR_CURLINIT;
+	}
 	curl_easy_setopt(curl, CURLOPT_URL, get_url);
-	status = curl_easy_perform(curl);
-	status = sb_check_response(&response, status, sbs);
+	status = sb_curl_perform(curl, &response, sbs, "auth.getSession");
 	debug("authentication status: %d", status);
 
 	if(status != 0) {
@@ -425,20 +628,17 @@ scrobbler_session_t *scrobbler_initialize(uint8_t api_key[16],
 	if((sbs = calloc(1, sizeof(scrobbler_session_t))) == NULL)
 		return NULL;
 
-	if(curl_global_init(CURL_GLOBAL_NOTHING) != 0) {
-		free(sbs);
-		return NULL;
-	}
-
 	memcpy(sbs->api_key, api_key, sizeof(sbs->api_key));
 	memcpy(sbs->secret, secret, sizeof(sbs->secret));
+	sbs->service_url = SCROBBLER_URL;
 
 	return sbs;
 }
 
 void scrobbler_free(scrobbler_session_t *sbs)
 {
-	curl_global_cleanup();
+	if(sbs->curl_initialized)
+		curl_global_cleanup();
 	free(sbs);
 }
 
@@ -24,12 +24,26 @@
 #ifndef __LIBSCROBBLER20_H
 #define __LIBSCROBBLER20_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
+#include <curl/curl.h>
 
 #define SCROBBLER_URL "http://ws.audioscrobbler.com/2.0/"
 #define SCROBBLER_USERAUTH_URL "http://www.last.fm/api/auth/"
 
+// maximal number of tracks accepted by a single scrobble request
+#define SCROBBLER_BATCH_SIZE 50
+
+// called before every API request
+typedef void (*scrobbler_request_start_callback_t)(const char *method);
+// called after every API request with its latency (in microseconds)
+typedef void (*scrobbler_request_callback_t)(const char *method,
+		unsigned long latency, int status);
+// called after the (deferred) initialization of the given library
+typedef void (*scrobbler_init_callback_t)(const char *library,
+		unsigned long latency);
+
 typedef struct scrobbler_session_tag {
 	uint8_t api_key[16];     //128-bit API key
 	uint8_t secret[16];      //128-bit secter
@@ -38,6 +52,11 @@ typedef struct scrobbler_session_tag {
 	char user_name[64];
 
 	int error_code;
+	const char *service_url; //API endpoint (SCROBBLER_URL by default)
+	scrobbler_request_start_callback_t request_start_callback;
+	scrobbler_request_callback_t request_callback;
+	scrobbler_init_callback_t init_callback;
+	int curl_initialized;    //curl is initialized before the first request
 } scrobbler_session_t;
 
 typedef struct scrobbler_trackinfo_tag {
@@ -51,11 +70,12 @@ typedef struct scrobbler_trackinfo_tag {
 #define SCROBBERR_CURLPERF 2 //curl perform error - network issue
 #define SCROBBERR_SBERROR  3 //scrobbler API error
 #define SCROBBERR_CALLBACK 4 //callback error (authentication)
-#define SCROBBERR_TRACKINF 5 //missing required field(s) in trackinfo structure
+#define SCROBBERR_TRACKINF 5 //missing required field(s) in trackinfo structure (or too long)
 
 scrobbler_session_t *scrobbler_initialize(uint8_t api_key[16],
 		uint8_t secret[16]);
 void scrobbler_free(scrobbler_session_t *sbs);
+int scrobbler_curl_init(scrobbler_session_t *sbs);
 
 typedef int (*scrobbler_authuser_callback_t)(const char *auth_url);
 int scrobbler_authentication(scrobbler_session_t *sbs,
@@ -68,5 +88,19 @@ void scrobbler_set_session_key_str(scrobbler_session_t *sbs, const char *str);
 int scrobbler_update_now_playing(scrobbler_session_t *sbs,
 		scrobbler_trackinfo_t *sbt);
 int scrobbler_scrobble(scrobbler_session_t *sbs, scrobbler_trackinfo_t *sbt);
+int scrobbler_scrobble_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, int count);
+
+// ----- internal helpers (exposed for the test suite) -----
+
+// used for quick URL and signature creation process
+struct sb_getpost_data {
+	char *name;
+	char data_format;
+	void *data;
+};
+
+char *sb_make_curl_getpost_string(CURL *curl, char *str_buffer, size_t size,
+		struct sb_getpost_data *sb_data, int len);
 
 #endif
@@ -26,20 +26,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cache.h"
 #include "cmusfm.h"
 #include "config.h"
 #include "debug.h"
+#include "history.h"
+#include "import.h"
+#include "record.h"
 #include "server.h"
-
-
-// Last.fm API key for cmusfm
-unsigned char SC_api_key[16] = {0x67, 0x08, 0x2e, 0x45, 0xda, 0xb1,
-		0xf6, 0x43, 0x3d, 0xa7, 0x2a, 0x00, 0xe3, 0xbc, 0x03, 0x7a};
-unsigned char SC_secret[16] = {0x02, 0xfc, 0xbc, 0x90, 0x34, 0x1a,
-		0x01, 0xf2, 0x1c, 0x3b, 0xfc, 0x05, 0xb6, 0x36, 0xe3, 0xae};
-
-// Global configuration structure
-struct cmusfm_config config;
+#include "trace.h"
 
 
 // Parse arguments which we've get from the cmus.
@@ -67,6 +62,10 @@ static int parse_argv(struct cmtrack_info *tinfo, int argc, char *argv[]) {
 			tinfo->artist = argv[i + 1];
 		else if (strcmp(argv[i], "album") == 0)
 			tinfo->album = argv[i + 1];
+		else if (strcmp(argv[i], "albumartist") == 0)
+			tinfo->album_artist = argv[i + 1];
+		else if (strcmp(argv[i], "musicbrainz_trackid") == 0)
+			tinfo->mbid = argv[i + 1];
 		else if (strcmp(argv[i], "tracknumber") == 0)
 			tinfo->tracknb = atoi(argv[i + 1]);
 		else if (strcmp(argv[i], "title") == 0)
@@ -87,6 +86,18 @@ static int parse_argv(struct cmtrack_info *tinfo, int argc, char *argv[]) {
 	return 1;
 }
 
+// Server requests available from the command line.
+static const struct {
+	const char *name;
+	enum cmsock_request request;
+} server_requests[] = {
+	{ "flush", CMREQUEST_FLUSH },
+	{ "reload", CMREQUEST_RELOAD },
+	{ "pause", CMREQUEST_PAUSE },
+	{ "resume", CMREQUEST_RESUME },
+	{ "status", CMREQUEST_STATUS },
+};
+
 // User authorization callback for the initialization process.
 static int user_authorization(const char *url) {
 	printf("Open this URL in your favorite web browser and afterwards "
@@ -144,9 +155,13 @@ static int cmusfm_initialization() {
 int main(int argc, char *argv[]) {
 
 	struct cmtrack_info tinfo;
+	unsigned int i;
 
 	if (argc == 1) {  // print initialization help message
-		printf("usage: cmusfm [init]\n\n"
+		printf("usage: cmusfm [init | stats [weeks-ago | server]]\n"
+"       cmusfm [flush | reload | pause | resume | status | trace]\n"
+"       cmusfm replay <record-file> [speed]\n"
+"       cmusfm import <log-file>...\n\n"
 "NOTE: Before usage with the cmus you should invoke this program with the\n"
 "      `init` argument. Afterwards you can set the status_display_program\n"
 "      (for more informations see `man cmus`). Enjoy!\n");
@@ -156,6 +171,65 @@ int main(int argc, char *argv[]) {
 	if (argc == 2 && strcmp(argv[1], "init") == 0)
 		return cmusfm_initialization();
 
+	// NOTE: cmus always passes arguments in pairs
+	for (i = 0; argc == 2 && i < sizeof(server_requests) / sizeof(*server_requests); i++)
+		if (strcmp(argv[1], server_requests[i].name) == 0) {
+			if (cmusfm_server_send_request(server_requests[i].request, stdout) == -1) {
+				fprintf(stderr, "error: unable to connect to cmusfm server\n");
+				return EXIT_FAILURE;
+			}
+			return EXIT_SUCCESS;
+		}
+
+	if ((argc == 3 || argc == 4) && strcmp(argv[1], "replay") == 0) {
+		// original speed by default, zero means as fast as possible
+		if (cmusfm_record_replay(argv[2], argc == 4 ? atof(argv[3]) : 1) == -1) {
+			fprintf(stderr, "error: events replay failed\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (argc >= 3 && strcmp(argv[1], "import") == 0) {
+		// imported scrobbles are subject to the cache limits
+		if (cmusfm_config_read(get_cmusfm_config_file(), &config) == 0)
+			cmusfm_cache_set_limits((size_t)config.cache_max_size * 1024,
+					(time_t)config.cache_max_age * 24 * 60 * 60);
+		if (cmusfm_import(&argv[2], argc - 2, stdout) == -1) {
+			fprintf(stderr, "error: scrobbles import failed\n");
+			return EXIT_FAILURE;
+		}
+		// let the running server submit imported scrobbles right away
+		cmusfm_server_send_request(CMREQUEST_FLUSH, stdout);
+		return EXIT_SUCCESS;
+	}
+
+	if (argc == 2 && strcmp(argv[1], "trace") == 0) {
+		// print the last dump if the server is not running
+		cmusfm_server_send_request(CMREQUEST_TRACE, stderr);
+		if (cmusfm_trace_print(stdout, get_cmusfm_trace_file()) == -1) {
+			fprintf(stderr, "error: trace dump not available\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (argc == 3 && strcmp(argv[1], "stats") == 0 && strcmp(argv[2], "server") == 0) {
+		if (cmusfm_server_send_request(CMREQUEST_STATS, stdout) == -1) {
+			fprintf(stderr, "error: unable to query cmusfm server\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (argc <= 3 && strcmp(argv[1], "stats") == 0) {
+		if (cmusfm_history_print_stats(stdout, argc == 3 ? atoi(argv[2]) : 0) == -1) {
+			fprintf(stderr, "error: listening history not available\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
 	if (cmusfm_config_read(get_cmusfm_config_file(), &config) == -1) {
 		perror("error: unable to read config file");
 		return EXIT_FAILURE;
@@ -166,7 +240,9 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "error: arguments parsing failed\n");
 		return EXIT_FAILURE;
 	case 1:
-		cmusfm_server_start();
+		// relay node does not run its own server instance
+		if (config.relay_server[0] == 0)
+			cmusfm_server_start();
 		return EXIT_SUCCESS;
 	}
 
@@ -0,0 +1,201 @@
+/*
+ * cmusfm - metrics.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "debug.h"
+
+
+// upper bounds (in microseconds) of the HTTP latency histogram buckets
+static const unsigned long metrics_buckets[] = {
+	10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000 };
+#define METRICS_BUCKET_COUNT (sizeof(metrics_buckets) / sizeof(*metrics_buckets))
+
+// scrobbler API methods with the latency tracking
+static const char *metrics_methods[] = {
+	"track.scrobble", "track.updateNowPlaying",
+	"auth.getToken", "auth.getSession", "other" };
+#define METRICS_METHOD_COUNT (sizeof(metrics_methods) / sizeof(*metrics_methods))
+
+static const char *metrics_init_phases[METRICS_INIT_PHASE_COUNT] = {
+	"socket", "scrobbler", "spool", "curl", "notify" };
+
+static const struct {
+	const char *name, *help;
+} metrics_counters[METRICS_COUNTER_COUNT] = {
+	{ "cmusfm_events_received_total", "Track events received from players." },
+	{ "cmusfm_scrobbles_submitted_total", "Scrobbles submitted to the service." },
+	{ "cmusfm_scrobbles_cached_total", "Scrobbles written to the cache." },
+	{ "cmusfm_scrobbles_duplicated_total", "Duplicated scrobbles dropped locally." },
+	{ "cmusfm_nowplaying_submitted_total", "Now playing notifications submitted." },
+	{ "cmusfm_service_failures_total", "Scrobbler service failures." },
+	{ "cmusfm_cache_evicted_size_total", "Cached scrobbles evicted due to the size limit." },
+	{ "cmusfm_cache_evicted_age_total", "Cached scrobbles evicted due to the age limit." },
+	{ "cmusfm_cache_rejected_total", "Cached scrobbles rejected by the service." },
+}, metrics_gauges[METRICS_GAUGE_COUNT] = {
+	{ "cmusfm_service_fail_time", "Time of the last service failure (0 if OK)." },
+	{ "cmusfm_sessions", "Number of tracked player sessions." },
+};
+
+static struct {
+	uint64_t counters[METRICS_COUNTER_COUNT];
+	int64_t gauges[METRICS_GAUGE_COUNT];
+	struct {
+		uint64_t buckets[METRICS_BUCKET_COUNT + 1];
+		uint64_t sum, errors;
+	} http[METRICS_METHOD_COUNT];
+	// time spent in the initialization phase (microseconds), zero if the
+	// subsystem has not been initialized (yet)
+	unsigned long init[METRICS_INIT_PHASE_COUNT];
+} metrics;
+
+
+// Increase the value of the given counter.
+void cmusfm_metrics_add(enum metrics_counter counter, uint64_t value) {
+	metrics.counters[counter] += value;
+}
+
+// Get the value of the given counter.
+uint64_t cmusfm_metrics_get(enum metrics_counter counter) {
+	return metrics.counters[counter];
+}
+
+// Set the value of the given gauge.
+void cmusfm_metrics_set(enum metrics_gauge gauge, int64_t value) {
+	metrics.gauges[gauge] = value;
+}
+
+// Account HTTP request of the given API method. Latency is given in the
+// microseconds. This function is compatible with the scrobbler request
+// callback type.
+void cmusfm_metrics_http(const char *method, unsigned long latency, int status) {
+
+	unsigned int i, bucket;
+
+	for (i = 0; i < METRICS_METHOD_COUNT - 1; i++)
+		if (strcmp(method, metrics_methods[i]) == 0)
+			break;
+
+	for (bucket = 0; bucket < METRICS_BUCKET_COUNT; bucket++)
+		if (latency <= metrics_buckets[bucket])
+			break;
+
+	metrics.http[i].buckets[bucket]++;
+	metrics.http[i].sum += latency;
+	if (status != 0)
+		metrics.http[i].errors++;
+}
+
+// Account the time spent in the given initialization phase (microseconds).
+void cmusfm_metrics_init(enum metrics_init_phase phase, unsigned long latency) {
+	// make initialized subsystems distinguishable from not initialized ones
+	metrics.init[phase] = latency ? latency : 1;
+}
+
+// Write all metrics in the Prometheus text exposition format.
+int cmusfm_metrics_write(FILE *f) {
+
+	unsigned int i, j, records;
+	uint64_t count;
+	size_t bytes;
+
+	for (i = 0; i < METRICS_COUNTER_COUNT; i++)
+		fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+				metrics_counters[i].name, metrics_counters[i].help,
+				metrics_counters[i].name, metrics_counters[i].name,
+				(unsigned long long)metrics.counters[i]);
+
+	for (i = 0; i < METRICS_GAUGE_COUNT; i++)
+		fprintf(f, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n",
+				metrics_gauges[i].name, metrics_gauges[i].help,
+				metrics_gauges[i].name, metrics_gauges[i].name,
+				(long long)metrics.gauges[i]);
+
+	cmusfm_cache_stat(&bytes, &records);
+	fprintf(f, "# HELP cmusfm_cache_bytes Size of all cache segments.\n"
+			"# TYPE cmusfm_cache_bytes gauge\ncmusfm_cache_bytes %zu\n", bytes);
+	fprintf(f, "# HELP cmusfm_cache_records Number of records in the cache.\n"
+			"# TYPE cmusfm_cache_records gauge\ncmusfm_cache_records %u\n", records);
+
+	fprintf(f, "# HELP cmusfm_http_request_seconds Scrobbler API request latency.\n"
+			"# TYPE cmusfm_http_request_seconds histogram\n");
+	for (i = 0; i < METRICS_METHOD_COUNT; i++) {
+		for (j = count = 0; j < METRICS_BUCKET_COUNT; j++) {
+			count += metrics.http[i].buckets[j];
+			fprintf(f, "cmusfm_http_request_seconds_bucket{method=\"%s\",le=\"%g\"} %llu\n",
+					metrics_methods[i], metrics_buckets[j] / 1e6, (unsigned long long)count);
+		}
+		count += metrics.http[i].buckets[j];
+		fprintf(f, "cmusfm_http_request_seconds_bucket{method=\"%s\",le=\"+Inf\"} %llu\n"
+				"cmusfm_http_request_seconds_sum{method=\"%s\"} %g\n"
+				"cmusfm_http_request_seconds_count{method=\"%s\"} %llu\n",
+				metrics_methods[i], (unsigned long long)count,
+				metrics_methods[i], metrics.http[i].sum / 1e6,
+				metrics_methods[i], (unsigned long long)count);
+	}
+
+	fprintf(f, "# HELP cmusfm_http_request_errors_total Failed scrobbler API requests.\n"
+			"# TYPE cmusfm_http_request_errors_total counter\n");
+	for (i = 0; i < METRICS_METHOD_COUNT; i++)
+		fprintf(f, "cmusfm_http_request_errors_total{method=\"%s\"} %llu\n",
+				metrics_methods[i], (unsigned long long)metrics.http[i].errors);
+
+	fprintf(f, "# HELP cmusfm_init_seconds Time spent in the initialization phase.\n"
+			"# TYPE cmusfm_init_seconds gauge\n");
+	for (i = 0; i < METRICS_INIT_PHASE_COUNT; i++)
+		if (metrics.init[i])
+			fprintf(f, "cmusfm_init_seconds{phase=\"%s\"} %g\n",
+					metrics_init_phases[i], metrics.init[i] / 1e6);
+
+	return ferror(f) ? -1 : 0;
+}
+
+// Export metrics into the text file. File is replaced atomically, so it
+// can be safely read by the node exporter text file collector.
+int cmusfm_metrics_export(const char *fname) {
+
+	char tmp[256];
+	FILE *f;
+	int status;
+
+	debug("metrics export: %s", fname);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	if ((f = fopen(tmp, "w")) == NULL)
+		return -1;
+
+	status = cmusfm_metrics_write(f);
+	if (fclose(f) == EOF || status == -1) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return rename(tmp, fname);
+}
@@ -0,0 +1,69 @@
+/*
+ * cmusfm - metrics.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_METRICS_H
+#define __CMUSFM_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+// minimal interval (in seconds) between exports into the metrics file
+#define METRICS_EXPORT_INTERVAL 15
+
+enum metrics_counter {
+	METRICS_EVENTS_RECEIVED = 0,
+	METRICS_SCROBBLES_SUBMITTED,
+	METRICS_SCROBBLES_CACHED,
+	METRICS_SCROBBLES_DUPLICATED,
+	METRICS_NOWPLAYING_SUBMITTED,
+	METRICS_SERVICE_FAILURES,
+	METRICS_CACHE_EVICTED_SIZE,
+	METRICS_CACHE_EVICTED_AGE,
+	METRICS_CACHE_REJECTED,
+	METRICS_COUNTER_COUNT
+};
+
+enum metrics_gauge {
+	METRICS_SERVICE_FAIL_TIME = 0,
+	METRICS_SESSIONS,
+	METRICS_GAUGE_COUNT
+};
+
+// server initialization phases (subsystems are initialized on demand)
+enum metrics_init_phase {
+	METRICS_INIT_SOCKET = 0,
+	METRICS_INIT_SCROBBLER,
+	METRICS_INIT_SPOOL,
+	METRICS_INIT_CURL,
+	METRICS_INIT_NOTIFY,
+	METRICS_INIT_PHASE_COUNT
+};
+
+
+void cmusfm_metrics_add(enum metrics_counter counter, uint64_t value);
+uint64_t cmusfm_metrics_get(enum metrics_counter counter);
+void cmusfm_metrics_set(enum metrics_gauge gauge, int64_t value);
+void cmusfm_metrics_http(const char *method, unsigned long latency, int status);
+void cmusfm_metrics_init(enum metrics_init_phase phase, unsigned long latency);
+int cmusfm_metrics_write(FILE *f);
+int cmusfm_metrics_export(const char *fname);
+
+#endif
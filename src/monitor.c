@@ -0,0 +1,245 @@
+/*
+ * cmusfm - monitor.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "monitor.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "debug.h"
+#include "remote.h"
+#include "server.h"
+
+
+// The server polls the cmus control socket instead of being fed by the
+// cmus status program. Since the playback position is known, the play time
+// is measured - position advances between polls are summed up, jumps
+// (seeks) are not accounted, and a jump back to the track beginning is
+// recognized as a replay.
+
+// connection to the cmus (-1 if not connected)
+static int monitor_fd = -1;
+// playback state seen at the previous poll
+static enum cmstatus monitor_status = CMSTATUS_STOPPED;
+static char monitor_track[CMSOCKET_BUFFER_SIZE];
+static int monitor_position = 0;
+static int monitor_duration = 0;
+static uint64_t monitor_polled = 0;
+static uint64_t monitor_next = 0;
+static int monitor_interval = MONITOR_POLL_MIN;
+// measured play time of the current track
+static time_t monitor_playtime = 0;
+// the last event passed to the core (used when the cmus quits)
+static char monitor_event[CMSOCKET_BUFFER_SIZE];
+static ssize_t monitor_event_len = 0;
+
+
+static uint64_t get_monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// clock of the polls (replaced by the scripted one in the check-monitor)
+static uint64_t (*monitor_clock)(void) = get_monotonic_ms;
+
+// Pass the playback event to the core with the measured play time.
+static void monitor_process(const struct cmusfm_remote_status *st, enum cmstatus status,
+		time_t playtime) {
+
+	struct cmtrack_info tinfo;
+	char file[CMSOCKET_BUFFER_SIZE];
+
+	memset(&tinfo, 0, sizeof(tinfo));
+	tinfo.status = status;
+	tinfo.artist = st->artist;
+	tinfo.album = st->album;
+	tinfo.album_artist = st->album_artist;
+	tinfo.title = st->title;
+	tinfo.mbid = st->mbid;
+	tinfo.tracknb = st->tracknb;
+	tinfo.duration = st->duration;
+
+	if (st->file != NULL && strstr(st->file, "://") != NULL) {
+		// stream title is passed by the cmus as the track title
+		tinfo.url = st->file;
+		if (st->stream != NULL)
+			tinfo.title = st->stream;
+	}
+	else if (st->file != NULL) {
+		// file name might be modified during the format matching
+		strncpy(file, st->file, sizeof(file) - 1);
+		file[sizeof(file) - 1] = '\0';
+		tinfo.file = file;
+	}
+
+	debug("cmus event: %d (played: %lds)", status, (long)playtime);
+	monitor_event_len = cmusfm_core_pack_track(&tinfo, MONITOR_CLIENT,
+			monitor_event, sizeof(monitor_event));
+	if (monitor_event_len == -1)
+		return;
+
+	cmusfm_core_process_measured(monitor_event, monitor_event_len, playtime);
+}
+
+// Poll the cmus for the playback status. Returns the delay (in
+// milliseconds) after which the cmus should be polled again.
+int cmusfm_monitor_poll(const char *path) {
+
+	struct cmusfm_remote_status st;
+	char reply[8192];
+	char track[CMSOCKET_BUFFER_SIZE];
+	struct sock_data_tag *dt;
+	int same_track, replay, changed, delta, elapsed, remaining, first;
+	uint64_t now;
+
+	if (monitor_fd == -1 && (monitor_fd = cmusfm_remote_connect(path)) == -1)
+		return MONITOR_RETRY_DELAY;
+
+	if (cmusfm_remote_status(monitor_fd, reply, sizeof(reply), &st) == -1) {
+		debug("cmus connection lost");
+		cmusfm_monitor_close();
+		// the cmus has quit, so finish the current play
+		if (monitor_status != CMSTATUS_STOPPED && monitor_event_len > 0) {
+			dt = (struct sock_data_tag *)monitor_event;
+			dt->status = CMSTATUS_STOPPED | (dt->status & CMSTATUS_SHOUTCASTMASK);
+			cmusfm_core_process_measured(monitor_event, monitor_event_len, monitor_playtime);
+		}
+		monitor_status = CMSTATUS_STOPPED;
+		return MONITOR_RETRY_DELAY;
+	}
+
+	now = monitor_clock();
+	first = monitor_polled == 0;
+	// seconds elapsed since the previous poll (rounded up)
+	elapsed = monitor_polled ? (now - monitor_polled + 999) / 1000 : 0;
+	monitor_polled = now;
+
+	// stream title changes with every track of the stream
+	snprintf(track, sizeof(track), "%s\n%s", st.file ? st.file : "",
+			st.stream ? st.stream : "");
+	same_track = strcmp(track, monitor_track) == 0;
+	delta = st.position - monitor_position;
+
+	// play time since the previous poll - position advance which is not
+	// greater than the elapsed time, otherwise the position was changed
+	if (monitor_status == CMSTATUS_PLAYING) {
+		if (!same_track) {
+			// the previous track has been (probably) finished in between
+			remaining = monitor_duration - monitor_position;
+			if (remaining > elapsed - st.position)
+				remaining = elapsed - st.position;
+			if (remaining > 0)
+				monitor_playtime += remaining;
+		}
+		else if (delta >= 0 && delta <= elapsed + 1)
+			monitor_playtime += delta;
+		else if (st.status == CMSTATUS_STOPPED) {
+			// the position is reset by the stop, so the play since the
+			// previous poll is estimated as in the track change case -
+			// the stop time is not known, so the estimate might credit up
+			// to the whole polling interval (MONITOR_POLL_MAX) of the time
+			// which has not been played at all
+			remaining = monitor_duration - monitor_position;
+			if (remaining > elapsed)
+				remaining = elapsed;
+			if (remaining > 0)
+				monitor_playtime += remaining;
+		}
+	}
+
+	replay = same_track && delta < 0 && st.position <= elapsed + 1 &&
+		st.status != CMSTATUS_STOPPED;
+	changed = !same_track || replay || st.status != monitor_status ||
+		(monitor_status == CMSTATUS_PLAYING && (delta < 0 || delta > elapsed + 1));
+
+	if (!same_track || replay) {
+		// finish the previous play explicitly, otherwise the replay of
+		// the paused track would be taken as the unpause
+		// play time of the play restored by the server is not known before
+		// the first poll, so it is accounted by the server itself
+		if (replay)
+			monitor_process(&st, CMSTATUS_STOPPED, monitor_playtime);
+		monitor_process(&st, st.status, first ? -1 : monitor_playtime);
+		// the new play has started in between (or before the first poll)
+		monitor_playtime = st.position;
+		if (elapsed > 0 && monitor_playtime > elapsed)
+			monitor_playtime = elapsed;
+		if (monitor_playtime < 0)
+			monitor_playtime = 0;
+	}
+	else if (st.status != monitor_status)
+		monitor_process(&st, st.status, monitor_playtime);
+
+	strcpy(monitor_track, track);
+	monitor_status = st.status;
+	monitor_position = st.position;
+	monitor_duration = st.duration;
+
+	// adaptive polling interval
+	if (changed)
+		monitor_interval = MONITOR_POLL_MIN;
+	else if ((monitor_interval *= 2) > MONITOR_POLL_MAX)
+		monitor_interval = MONITOR_POLL_MAX;
+
+	// do not miss the end of the current track
+	if (st.status == CMSTATUS_PLAYING && st.duration > 0) {
+		remaining = (st.duration - st.position) * 1000;
+		if (remaining < MONITOR_POLL_MIN)
+			remaining = MONITOR_POLL_MIN;
+		if (remaining < monitor_interval)
+			return remaining;
+	}
+
+	return monitor_interval;
+}
+
+// Poll the cmus if the polling interval has elapsed. Returns the time (in
+// milliseconds) left to the next poll.
+int cmusfm_monitor_dispatch(const char *path) {
+
+	uint64_t now = monitor_clock();
+
+	if (now >= monitor_next)
+		monitor_next = monitor_clock() + cmusfm_monitor_poll(path);
+
+	return monitor_next > now ? monitor_next - now : 0;
+}
+
+// Replace the clock used for the play time measurement (NULL restores
+// the monotonic one).
+void cmusfm_monitor_set_clock(uint64_t (*clock)(void)) {
+	monitor_clock = clock != NULL ? clock : get_monotonic_ms;
+}
+
+// Close the connection to the cmus.
+void cmusfm_monitor_close(void) {
+	if (monitor_fd != -1)
+		close(monitor_fd);
+	monitor_fd = -1;
+}
@@ -0,0 +1,44 @@
+/*
+ * cmusfm - monitor.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_MONITOR_H
+#define __CMUSFM_MONITOR_H
+
+#include <stdint.h>
+
+
+// Polling intervals (in milliseconds) of the cmus control socket. After
+// every change the interval is reset to the minimum and then it is doubled
+// up to the maximum, unless the end of the current track is closer.
+#define MONITOR_POLL_MIN 1000
+#define MONITOR_POLL_MAX 10000
+// delay between attempts to connect to the cmus
+#define MONITOR_RETRY_DELAY 10000
+
+// identifier of the session fed by the monitor
+#define MONITOR_CLIENT "cmus-remote"
+
+
+int cmusfm_monitor_poll(const char *path);
+int cmusfm_monitor_dispatch(const char *path);
+void cmusfm_monitor_set_clock(uint64_t (*clock)(void));
+void cmusfm_monitor_close(void);
+
+#endif
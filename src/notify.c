@@ -20,49 +20,186 @@
 
 #include "notify.h"
 
-#include <stdlib.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <libnotify/notify.h>
 
+#include "cmusfm.h"
+#ifdef HAVE_LIBJPEG
+#include "cover.h"
+#endif
+#include "debug.h"
 
-// global notification handler
-static NotifyNotification *cmus_notify;
 
+// Notifications are shown by the dedicated thread, so the server event
+// loop never waits for the D-Bus round trip or the cover file lookup.
+// The thread is fed via the single-slot mailbox - if it is still busy
+// with the previous track, the pending request is simply overwritten,
+// because only the latest track is worth showing.
+struct notify_request {
+	char summary[128];
+	char body[256];
+	char location[512];
+	char cover_format[64];
+};
 
-// Show track information via the notification system.
-void cmusfm_notify_show(const scrobbler_trackinfo_t *sb_tinf, const char *icon) {
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running, pending, quit;
+	struct notify_request request;
+	// time spent in the library initialization (microseconds)
+	unsigned long init_time;
+	// persistent notification updated in place (used by the thread only)
+	NotifyNotification *notification;
+#ifdef HAVE_LIBJPEG
+	char covers_dir[128];
+	char thumbnail[256];
+#endif
+} cmus_notify = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
 
-	char *body;
-	size_t art_len, alb_len;
 
-	if(cmus_notify) {
-		// forcefully close previous notification
-		notify_notification_close(cmus_notify, NULL);
-		g_object_unref(G_OBJECT(cmus_notify));
+static void *cmusfm_notify_thread(void *arg) {
+
+	struct notify_request req;
+	struct timespec ts_start, ts_end;
+	const char *icon;
+	(void)arg;
+
+	// library connects to the D-Bus, so it is initialized by the thread
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	notify_init("cmusfm");
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+	pthread_mutex_lock(&cmus_notify.mutex);
+	cmus_notify.init_time = (ts_end.tv_sec - ts_start.tv_sec) * 1000000 +
+		(ts_end.tv_nsec - ts_start.tv_nsec) / 1000 + 1;
+	for (;;) {
+
+		while (!cmus_notify.pending && !cmus_notify.quit)
+			pthread_cond_wait(&cmus_notify.cond, &cmus_notify.mutex);
+		if (cmus_notify.quit)
+			break;
+
+		memcpy(&req, &cmus_notify.request, sizeof(req));
+		cmus_notify.pending = 0;
+		pthread_mutex_unlock(&cmus_notify.mutex);
+
+		icon = NULL;
+		if (req.location[0] != '\0')
+			icon = get_album_cover_file(req.location, req.cover_format);
+#ifdef HAVE_LIBJPEG
+		// notification server would have to decode and scale the full cover
+		// image every time, so it gets the cached thumbnail instead
+		if (icon != NULL && cmusfm_cover_thumbnail(icon, cmus_notify.covers_dir,
+					cmus_notify.thumbnail, sizeof(cmus_notify.thumbnail)) == 0)
+			icon = cmus_notify.thumbnail;
+#endif
+
+		if (cmus_notify.notification == NULL)
+			cmus_notify.notification = notify_notification_new(req.summary, req.body, icon);
+		else
+			notify_notification_update(cmus_notify.notification, req.summary, req.body, icon);
+
+		debug("notification: %s", req.summary);
+		if (!notify_notification_show(cmus_notify.notification, NULL)) {
+			// notification daemon might have been restarted in the meantime
+			g_object_unref(G_OBJECT(cmus_notify.notification));
+			cmus_notify.notification = NULL;
+		}
+
+		pthread_mutex_lock(&cmus_notify.mutex);
+	}
+	pthread_mutex_unlock(&cmus_notify.mutex);
+
+	if (cmus_notify.notification)
+		g_object_unref(G_OBJECT(cmus_notify.notification));
+	cmus_notify.notification = NULL;
+	notify_uninit();
+
+	return NULL;
+}
+
+// Start the notification thread. It is done on the first notification, so
+// the server does not pay for it if notifications are not enabled.
+static int cmusfm_notify_start(void) {
+
+	cmus_notify.notification = NULL;
+	cmus_notify.pending = cmus_notify.quit = 0;
+#ifdef HAVE_LIBJPEG
+	strcpy(cmus_notify.covers_dir, get_cmusfm_covers_dir());
+#endif
+
+	if (pthread_create(&cmus_notify.thread, NULL, cmusfm_notify_thread, NULL) != 0) {
+		debug("notification thread create failed");
+		return -1;
 	}
 
+	cmus_notify.running = 1;
+	return 0;
+}
+
+// Show track information via the notification system. The cover file is
+// looked up (in the location directory) according to the given format.
+// This function does not block - the request is handled asynchronously.
+void cmusfm_notify_show(const scrobbler_trackinfo_t *sb_tinf, const char *location,
+		const char *cover_format) {
+
+	struct notify_request *req = &cmus_notify.request;
+
+	if (!cmus_notify.running && cmusfm_notify_start() == -1)
+		return;
+
+	pthread_mutex_lock(&cmus_notify.mutex);
+
+	snprintf(req->summary, sizeof(req->summary), "%s", sb_tinf->track ? sb_tinf->track : "");
 	// concatenate artist and album (when applicable)
-	art_len = strlen(sb_tinf->artist);
-	alb_len = strlen(sb_tinf->album);
-	body = (char*)malloc(art_len + alb_len + sizeof(" ()") + 1);
-	strcpy(body, sb_tinf->artist);
-	if(alb_len > 0)
-		sprintf(&body[art_len], " (%s)", sb_tinf->album);
-
-	cmus_notify = notify_notification_new(sb_tinf->track, body, icon);
-	notify_notification_show(cmus_notify, NULL);
-	free(body);
+	if (sb_tinf->album != NULL && sb_tinf->album[0] != '\0')
+		snprintf(req->body, sizeof(req->body), "%s (%s)",
+				sb_tinf->artist ? sb_tinf->artist : "", sb_tinf->album);
+	else
+		snprintf(req->body, sizeof(req->body), "%s", sb_tinf->artist ? sb_tinf->artist : "");
+	snprintf(req->location, sizeof(req->location), "%s", location ? location : "");
+	snprintf(req->cover_format, sizeof(req->cover_format), "%s", cover_format);
+
+	if (cmus_notify.pending)
+		debug("notification overwritten: %s", req->summary);
+	cmus_notify.pending = 1;
+	pthread_cond_signal(&cmus_notify.cond);
+
+	pthread_mutex_unlock(&cmus_notify.mutex);
 }
 
-// Initialize notification system.
-void cmusfm_notify_initialize() {
-	cmus_notify = NULL;
-	notify_init("cmusfm");
+// Get the time spent in the notification library initialization in
+// microseconds. If the library has not been initialized, 0 is returned.
+unsigned long cmusfm_notify_init_time(void) {
+
+	unsigned long init_time;
+
+	pthread_mutex_lock(&cmus_notify.mutex);
+	init_time = cmus_notify.init_time;
+	pthread_mutex_unlock(&cmus_notify.mutex);
+
+	return init_time;
 }
 
 // Free notification system resources.
 void cmusfm_notify_free() {
-	if(cmus_notify)
-		g_object_unref(G_OBJECT(cmus_notify));
-	notify_uninit();
+
+	if (!cmus_notify.running)
+		return;
+
+	pthread_mutex_lock(&cmus_notify.mutex);
+	cmus_notify.quit = 1;
+	pthread_cond_signal(&cmus_notify.cond);
+	pthread_mutex_unlock(&cmus_notify.mutex);
+
+	pthread_join(cmus_notify.thread, NULL);
+	cmus_notify.running = 0;
 }
@@ -24,8 +24,9 @@
 #include "libscrobbler2.h"
 
 
-void cmusfm_notify_initialize();
+unsigned long cmusfm_notify_init_time(void);
 void cmusfm_notify_free();
-void cmusfm_notify_show(const scrobbler_trackinfo_t *sb_tinf, const char *icon);
+void cmusfm_notify_show(const scrobbler_trackinfo_t *sb_tinf, const char *location,
+		const char *cover_format);
 
 #endif
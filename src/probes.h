@@ -0,0 +1,54 @@
+/*
+ * cmusfm - probes.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PROBES_H
+#define __PROBES_H
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+// USDT (user-level statically defined tracing) probes for perf, bpftrace
+// or SystemTap. Disabled probe is a single NOP instruction, however its
+// arguments are evaluated anyway (there are no semaphores), so only values
+// which are at hand shall be passed. All probes are defined in the "cmusfm"
+// provider, e.g.: bpftrace -l 'usdt:/usr/bin/cmusfm:*'
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+#define probe(name) DTRACE_PROBE(cmusfm, name)
+#define probe1(name, a) DTRACE_PROBE1(cmusfm, name, a)
+#define probe2(name, a, b) DTRACE_PROBE2(cmusfm, name, a, b)
+#define probe3(name, a, b, c) DTRACE_PROBE3(cmusfm, name, a, b, c)
+#else
+#define probe(name) do {} while (0)
+#define probe1(name, a) do {} while (0)
+#define probe2(name, a, b) do {} while (0)
+#define probe3(name, a, b, c) do {} while (0)
+#endif
+
+// decision codes of the scrobble and now-playing probes
+#define PROBE_DECISION_SUBMIT 0
+#define PROBE_DECISION_CACHE 1
+#define PROBE_DECISION_DISABLED 2
+#define PROBE_DECISION_DUPLICATE 3
+#define PROBE_DECISION_UNAVAILABLE 4
+
+#endif
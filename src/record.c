@@ -0,0 +1,143 @@
+/*
+ * cmusfm - record.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "record.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "debug.h"
+#include "server.h"
+
+
+// recording file kept open between events
+static FILE *record_file = NULL;
+
+
+// Get the current time of the monotonic clock in nanoseconds.
+static uint64_t get_monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Append the socket message received at the given time to the events
+// recording file. The file is kept open until cmusfm_record_close() is
+// called (e.g. when the configuration is reloaded).
+int cmusfm_record_append(const char *fname, const void *data, size_t len,
+		time_t time) {
+
+	struct cmusfm_record_file_header fheader = {
+		CMUSFM_RECORD_SIGNATURE, CMUSFM_RECORD_VERSION };
+	struct cmusfm_record_header header;
+
+	if (record_file == NULL) {
+		if ((record_file = fopen(fname, "a")) == NULL)
+			return -1;
+		// initialize newly created file
+		if (ftell(record_file) == 0)
+			fwrite(&fheader, sizeof(fheader), 1, record_file);
+	}
+
+	header.timestamp = get_monotonic_ns();
+	header.time = time;
+	header.length = len;
+	fwrite(&header, sizeof(header), 1, record_file);
+	fwrite(data, len, 1, record_file);
+
+	// recording has to be usable even if the server is killed
+	return fflush(record_file);
+}
+
+// Replay recorded events against the running server. Delays between
+// events are divided by the speed factor, zero means no delays at all.
+// The server processes events at the recorded time (as the spooled ones),
+// so the scrobble decisions do not depend on the speed.
+int cmusfm_record_replay(const char *fname, double speed) {
+
+	struct cmusfm_record_file_header fheader;
+	struct cmusfm_record_header header;
+	char frame[sizeof(struct sock_delayed_tag) + CMSOCKET_BUFFER_SIZE];
+	struct sock_delayed_tag *delayed = (struct sock_delayed_tag *)frame;
+	char *buffer = &frame[sizeof(*delayed)];
+	uint64_t prev = 0, start, delay;
+	unsigned int count = 0, failed = 0;
+	struct timespec ts;
+	FILE *f;
+
+	if ((f = fopen(fname, "r")) == NULL)
+		return -1;
+
+	if (fread(&fheader, sizeof(fheader), 1, f) != 1 ||
+			fheader.signature != CMUSFM_RECORD_SIGNATURE ||
+			fheader.version != CMUSFM_RECORD_VERSION) {
+		fclose(f);
+		return -1;
+	}
+
+	start = get_monotonic_ns();
+	while (fread(&header, sizeof(header), 1, f) == 1) {
+
+		if (header.length > CMSOCKET_BUFFER_SIZE ||
+				fread(buffer, header.length, 1, f) != 1) {
+			debug("truncated record: %u", header.length);
+			break;
+		}
+		if (cmusfm_sock_data_check(buffer, header.length) != 0) {
+			debug("malformed record: %u", header.length);
+			failed++;
+			continue;
+		}
+
+		// recording might span many server instances (clock restarts)
+		if (speed > 0 && prev != 0 && header.timestamp > prev) {
+			delay = (header.timestamp - prev) / speed;
+			ts.tv_sec = delay / 1000000000;
+			ts.tv_nsec = delay % 1000000000;
+			nanosleep(&ts, NULL);
+		}
+		prev = header.timestamp;
+
+		// events are processed at the recorded time, so the play time
+		// does not depend on the replay speed
+		delayed->status = CMSOCKET_DELAYED;
+		delayed->timestamp = header.time;
+		if (cmusfm_server_send_data(frame, sizeof(*delayed) + header.length) != 0)
+			failed++;
+		count++;
+	}
+
+	fclose(f);
+
+	printf("replayed: %u events (%u failed) in %.3fs\n", count, failed,
+			(get_monotonic_ns() - start) / 1e9);
+	return failed ? -1 : 0;
+}
+
+// Close the events recording file.
+void cmusfm_record_close(void) {
+	if (record_file != NULL)
+		fclose(record_file);
+	record_file = NULL;
+}
@@ -0,0 +1,55 @@
+/*
+ * cmusfm - record.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_RECORD_H
+#define __CMUSFM_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+#define CMUSFM_RECORD_SIGNATURE 0x45524d43
+#define CMUSFM_RECORD_VERSION 2
+
+// Replayed events are tracked by sessions of clients with this prefix.
+#define REPLAY_CLIENT_PREFIX "replay:"
+
+// Events recording is a sequence of socket messages (see server.h) as they
+// were received by the server, each one preceded by the record header.
+
+struct __attribute__((__packed__)) cmusfm_record_file_header {
+	uint32_t signature, version;
+};
+
+struct __attribute__((__packed__)) cmusfm_record_header {
+	uint64_t timestamp;  // nanoseconds (monotonic clock)
+	int64_t time;  // seconds since the Epoch (event time)
+	uint32_t length;
+	//char data[length];
+};
+
+
+int cmusfm_record_append(const char *fname, const void *data, size_t len,
+		time_t time);
+int cmusfm_record_replay(const char *fname, double speed);
+void cmusfm_record_close(void);
+
+#endif
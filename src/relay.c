@@ -0,0 +1,291 @@
+/*
+ * cmusfm - relay.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "relay.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "debug.h"
+#include "server.h"
+
+
+// Codes of recently received frames (see the replay detection).
+static unsigned char relay_seen[RELAY_SEEN_SIZE][RELAY_MAC_SIZE];
+static unsigned int relay_seen_next = 0;
+
+// Convert all integer fields of the socket data structure. Conversion
+// function should be either htonl or ntohl.
+static void convert_sock_data(struct sock_data_tag *dt, uint32_t (*conv)(uint32_t)) {
+	dt->status = conv(dt->status);
+	dt->tracknb = conv(dt->tracknb);
+	dt->duration = conv(dt->duration);
+	dt->alboff = conv(dt->alboff);
+	dt->titoff = conv(dt->titoff);
+	dt->locoff = conv(dt->locoff);
+}
+
+// Resolve relay address given in the "host:port" format. Empty host (or
+// the "*" wild-card) denotes any local address. Returned structure has to
+// be freed by the `freeaddrinfo` function. On error NULL is returned.
+static struct addrinfo *get_relay_addrinfo(const char *address, int passive) {
+
+	struct addrinfo hints, *res;
+	char host[128], *port;
+
+	strncpy(host, address, sizeof(host) - 1);
+	host[sizeof(host) - 1] = 0;
+	if ((port = strrchr(host, ':')) == NULL)
+		return NULL;
+	*port++ = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (passive)
+		hints.ai_flags = AI_PASSIVE;
+
+	if (getaddrinfo(host[0] && strcmp(host, "*") != 0 ? host : NULL,
+				port, &hints, &res) != 0)
+		return NULL;
+
+	return res;
+}
+
+// Create relay listening socket on the given address. On error -1 is
+// returned.
+int cmusfm_relay_listen(const char *address) {
+
+	struct addrinfo *res;
+	int fd, optval = 1;
+
+	debug("relay listen: %s", address);
+
+	if ((res = get_relay_addrinfo(address, 1)) == NULL)
+		return -1;
+
+	if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1)
+		goto fail;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+	if (bind(fd, res->ai_addr, res->ai_addrlen) == -1 || listen(fd, 16) == -1) {
+		close(fd);
+		fd = -1;
+	}
+
+fail:
+	freeaddrinfo(res);
+	return fd;
+}
+
+// Compute the authentication code of the frame - the time and age fields
+// and the socket data which follows them (length is given in the host
+// order).
+static void relay_frame_mac(const char *secret, struct cmusfm_relay_header *header,
+		size_t len, unsigned char *mac) {
+	unsigned int mac_len = RELAY_MAC_SIZE;
+	HMAC(EVP_sha256(), secret, strlen(secret), (unsigned char *)&header->time,
+			sizeof(header->time) + sizeof(header->age) + len, mac, &mac_len);
+}
+
+// Check whether the authenticated frame has been received already (e.g.
+// it was captured and sent again) and remember it otherwise. Frames older
+// than the time window are rejected before, so only the recent ones have
+// to be remembered.
+static int relay_frame_seen(const unsigned char *mac) {
+
+	unsigned int i;
+
+	for (i = 0; i < RELAY_SEEN_SIZE; i++)
+		if (CRYPTO_memcmp(relay_seen[i], mac, RELAY_MAC_SIZE) == 0)
+			return 1;
+
+	memcpy(relay_seen[relay_seen_next], mac, RELAY_MAC_SIZE);
+	relay_seen_next = (relay_seen_next + 1) % RELAY_SEEN_SIZE;
+	return 0;
+}
+
+// Get the time (in milliseconds) of the monotonic clock.
+static int64_t get_monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Connect the socket within the connection time limit. On error -1 is
+// returned.
+static int relay_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+
+	struct pollfd pfd = { fd, POLLOUT, 0 };
+	socklen_t optlen = sizeof(int);
+	int flags, err = 0;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+			fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+
+	if (connect(fd, addr, addrlen) == -1) {
+		if (errno != EINPROGRESS)
+			return -1;
+		if (poll(&pfd, 1, RELAY_CONNECT_TIMEOUT) != 1 ||
+				getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &optlen) == -1 ||
+				err != 0) {
+			debug("relay connect failed: %d", err);
+			return -1;
+		}
+	}
+
+	return fcntl(fd, F_SETFL, flags);
+}
+
+// Read exactly the given number of bytes before the deadline (time of the
+// monotonic clock in milliseconds). On error -1 is returned.
+static int relay_read_full(int fd, void *buffer, size_t len, int64_t deadline) {
+
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	int64_t timeout;
+	ssize_t rd_len;
+
+	while (len > 0) {
+		if ((timeout = deadline - get_monotonic_ms()) <= 0 ||
+				poll(&pfd, 1, timeout) != 1)
+			return -1;
+		if ((rd_len = recv(fd, buffer, len, MSG_DONTWAIT)) == -1 &&
+				(errno == EAGAIN || errno == EINTR))
+			continue;
+		if (rd_len <= 0)
+			return -1;
+		buffer = (char *)buffer + rd_len;
+		len -= rd_len;
+	}
+
+	return 0;
+}
+
+// Forward socket data to the relay server as a single frame. The age of
+// the event is given in seconds.
+int cmusfm_relay_send(const char *address, const char *secret,
+		const char *data, size_t len, time_t age) {
+
+	char buffer[sizeof(struct cmusfm_relay_header) + CMSOCKET_BUFFER_SIZE];
+	struct cmusfm_relay_header *header = (struct cmusfm_relay_header *)buffer;
+	struct addrinfo *res;
+	int fd, status = -1;
+
+	debug("relay send: %s: %zd", address, len);
+
+	if (len < sizeof(struct sock_data_tag) || len > CMSOCKET_BUFFER_SIZE)
+		return -1;
+
+	header->length = htonl(len);
+	header->time = htobe64(time(NULL));
+	header->age = htonl(age);
+	memcpy(buffer + sizeof(*header), data, len);
+	convert_sock_data((struct sock_data_tag *)(buffer + sizeof(*header)), htonl);
+	relay_frame_mac(secret, header, len, header->mac);
+	len += sizeof(*header);
+
+	if ((res = get_relay_addrinfo(address, 0)) == NULL)
+		return -1;
+
+	if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) != -1) {
+		if (relay_connect(fd, res->ai_addr, res->ai_addrlen) == 0 &&
+				write(fd, buffer, len) == (ssize_t)len)
+			status = 0;
+		close(fd);
+	}
+
+	freeaddrinfo(res);
+	return status;
+}
+
+// Read the whole relay frame from the given connection. Frames which are
+// not authenticated with the given secret, which are not recent or which
+// have been received already are rejected. Socket data is converted back
+// to the host byte order. Returns the length of the data stored in the
+// buffer or -1 on error.
+ssize_t cmusfm_relay_read(int fd, const char *secret, char *buffer, size_t size,
+		time_t *age) {
+
+	char frame[sizeof(struct cmusfm_relay_header) + CMSOCKET_BUFFER_SIZE];
+	struct cmusfm_relay_header *header = (struct cmusfm_relay_header *)frame;
+	unsigned char mac[RELAY_MAC_SIZE];
+	size_t len, frame_len;
+	int64_t deadline, sent;
+
+	// do not let a stalled (or malicious) node block the server main loop
+	deadline = get_monotonic_ms() + RELAY_READ_TIMEOUT;
+
+	if (relay_read_full(fd, &header->length, sizeof(header->length), deadline) == -1)
+		return -1;
+
+	frame_len = ntohl(header->length);
+	debug("relay frame: %zu", frame_len);
+	if (frame_len < sizeof(struct sock_data_tag) || frame_len > size ||
+			frame_len > CMSOCKET_BUFFER_SIZE)
+		return -1;
+
+	frame_len += sizeof(*header) - sizeof(header->length);
+	if (relay_read_full(fd, header->mac, frame_len, deadline) == -1)
+		return -1;
+
+	len = ntohl(header->length);
+	relay_frame_mac(secret, header, len, mac);
+	if (CRYPTO_memcmp(mac, header->mac, sizeof(mac)) != 0) {
+		debug("unauthenticated relay frame");
+		return -1;
+	}
+
+	sent = be64toh(header->time);
+	if (sent < time(NULL) - RELAY_TIME_WINDOW || sent > time(NULL) + RELAY_TIME_WINDOW) {
+		debug("stale relay frame: %lld", (long long)sent);
+		return -1;
+	}
+	if (relay_frame_seen(header->mac)) {
+		debug("replayed relay frame");
+		return -1;
+	}
+
+	memcpy(buffer, frame + sizeof(*header), len);
+	convert_sock_data((struct sock_data_tag *)buffer, ntohl);
+	if (cmusfm_sock_data_check(buffer, len) != 0) {
+		debug("invalid relay frame: %zu", len);
+		return -1;
+	}
+
+	*age = ntohl(header->age);
+	return len;
+}
@@ -0,0 +1,65 @@
+/*
+ * cmusfm - relay.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_RELAY_H
+#define __CMUSFM_RELAY_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+
+// time delay (in seconds) after which relayed scrobbles are submitted
+// even if the batch is not full
+#define RELAY_BATCH_DELAY 60
+
+// size of the frame authentication code (HMAC-SHA256)
+#define RELAY_MAC_SIZE 32
+
+// time limit (in milliseconds) for connecting to the relay server and for
+// receiving the whole frame by the relay server
+#define RELAY_CONNECT_TIMEOUT 2000
+#define RELAY_READ_TIMEOUT 1000
+
+// maximal difference (in seconds) between the time of sending the frame
+// and the time of receiving it - clocks of all nodes have to be in sync
+#define RELAY_TIME_WINDOW 120
+
+// number of recently received frames remembered for the replay detection
+#define RELAY_SEEN_SIZE 1024
+
+// Relay frame is the following header (all integers are big-endian) and
+// the socket data structure with all integer fields in the network order.
+// The code authenticates everything which follows it with the secret.
+struct __attribute__((__packed__)) cmusfm_relay_header {
+	uint32_t length;  // length of the socket data
+	unsigned char mac[RELAY_MAC_SIZE];
+	int64_t time;     // time of sending (seconds since the Epoch)
+	uint32_t age;     // seconds since the event (delayed delivery)
+	//char data[length];
+};
+
+int cmusfm_relay_listen(const char *address);
+int cmusfm_relay_send(const char *address, const char *secret,
+		const char *data, size_t len, time_t age);
+ssize_t cmusfm_relay_read(int fd, const char *secret, char *buffer, size_t size,
+		time_t *age);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * cmusfm - remote.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "remote.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "debug.h"
+
+
+// Get the value of the "key value" line if the key matches.
+static char *get_remote_value(char *line, const char *key) {
+	size_t len = strlen(key);
+	if (strncmp(line, key, len) != 0 || line[len] != ' ')
+		return NULL;
+	return &line[len + 1];
+}
+
+// Parse the reply of the "status" command. Reply buffer is modified in
+// place. Returns 0 on success, -1 if the reply has no status line.
+int cmusfm_remote_parse(char *reply, struct cmusfm_remote_status *st) {
+
+	char *line, *next, *value;
+	int has_status = 0;
+
+	memset(st, 0, sizeof(*st));
+	st->status = CMSTATUS_STOPPED;
+
+	for (line = reply; *line != '\0'; line = next) {
+
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = &line[strlen(line)];
+
+		if ((value = get_remote_value(line, "status")) != NULL) {
+			has_status = 1;
+			if (strcmp(value, "playing") == 0)
+				st->status = CMSTATUS_PLAYING;
+			else if (strcmp(value, "paused") == 0)
+				st->status = CMSTATUS_PAUSED;
+		}
+		else if ((value = get_remote_value(line, "file")) != NULL)
+			st->file = value;
+		else if ((value = get_remote_value(line, "stream")) != NULL)
+			st->stream = value;
+		else if ((value = get_remote_value(line, "duration")) != NULL)
+			st->duration = atoi(value);
+		else if ((value = get_remote_value(line, "position")) != NULL)
+			st->position = atoi(value);
+		else if ((value = get_remote_value(line, "tag artist")) != NULL)
+			st->artist = value;
+		else if ((value = get_remote_value(line, "tag album")) != NULL)
+			st->album = value;
+		else if ((value = get_remote_value(line, "tag albumartist")) != NULL)
+			st->album_artist = value;
+		else if ((value = get_remote_value(line, "tag title")) != NULL)
+			st->title = value;
+		else if ((value = get_remote_value(line, "tag musicbrainz_trackid")) != NULL)
+			st->mbid = value;
+		else if ((value = get_remote_value(line, "tag tracknumber")) != NULL)
+			st->tracknb = atoi(value);
+
+	}
+
+	return has_status ? 0 : -1;
+}
+
+// Connect to the cmus control socket.
+int cmusfm_remote_connect(const char *path) {
+
+	struct sockaddr_un sock_a;
+	int fd;
+
+	memset(&sock_a, 0, sizeof(sock_a));
+	sock_a.sun_family = AF_UNIX;
+	strncpy(sock_a.sun_path, path, sizeof(sock_a.sun_path) - 1);
+
+	if ((fd = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (connect(fd, (struct sockaddr *)&sock_a, sizeof(sock_a)) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	debug("connected to cmus: %s", path);
+	return fd;
+}
+
+// Send the "status" command and read the whole reply (terminated by an
+// empty line). The cmus is local, so the reply is waited for 1 second.
+// Returns 0 on success, -1 otherwise (connection should be closed).
+int cmusfm_remote_status(int fd, char *reply, size_t size,
+		struct cmusfm_remote_status *st) {
+
+	static const char command[] = "status\n";
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	size_t len = 0;
+	ssize_t rd_len;
+
+	if (write(fd, command, sizeof(command) - 1) != sizeof(command) - 1)
+		return -1;
+
+	while (len < size - 1) {
+		if (poll(&pfd, 1, 1000) <= 0)
+			return -1;
+		if ((rd_len = read(fd, &reply[len], size - 1 - len)) <= 0)
+			return -1;
+		len += rd_len;
+		reply[len] = '\0';
+		if (len >= 2 && strcmp(&reply[len - 2], "\n\n") == 0)
+			return cmusfm_remote_parse(reply, st);
+	}
+
+	// reply does not fit into the buffer, so the stream is out of sync
+	return -1;
+}
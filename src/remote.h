@@ -0,0 +1,44 @@
+/*
+ * cmusfm - remote.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_REMOTE_H
+#define __CMUSFM_REMOTE_H
+
+#include <stddef.h>
+#include "cmusfm.h"
+
+
+// Reply of the "status" command of the cmus remote protocol. Reply is
+// a sequence of "key value" lines terminated by an empty line. Strings
+// point into the reply buffer (NULL if not given).
+struct cmusfm_remote_status {
+	enum cmstatus status;
+	char *file, *stream;
+	char *artist, *album, *album_artist, *title, *mbid;
+	int tracknb, duration, position;
+};
+
+
+int cmusfm_remote_connect(const char *path);
+int cmusfm_remote_status(int fd, char *reply, size_t size,
+		struct cmusfm_remote_status *st);
+int cmusfm_remote_parse(char *reply, struct cmusfm_remote_status *st);
+
+#endif
@@ -29,262 +29,216 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <libgen.h>
+#include <errno.h>
 #include <poll.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/file.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #ifdef HAVE_SYS_INOTIFY_H
 #include <sys/inotify.h>
 #endif
 
-#include "cache.h"
 #include "cmusfm.h"
 #include "config.h"
+#include "core.h"
 #include "debug.h"
-#ifdef ENABLE_LIBNOTIFY
-#include "notify.h"
-#endif
+#include "metrics.h"
+#include "monitor.h"
+#include "probes.h"
+#include "relay.h"
+#include "spool.h"
+#include "trace.h"
 
 
-// Helper function for artist name retrieval.
-static char *get_sock_data_artist(struct sock_data_tag *dt) {
-	return (char *)(dt + 1);
-}
+// Process request sent via the communication socket.
+static void cmusfm_server_process_request(int fd, int request) {
 
-// Helper function for album name retrieval.
-static char *get_sock_data_album(struct sock_data_tag *dt) {
-	return &((char *)(dt + 1))[dt->alboff];
-}
+	FILE *f;
 
-// Helper function for track name retrieval.
-static char *get_sock_data_track(struct sock_data_tag *dt) {
-	return &((char *)(dt + 1))[dt->titoff];
-}
+	// reply stream takes the ownership of the descriptor
+	if ((f = fdopen(dup(fd), "w")) == NULL)
+		return;
 
-// Helper function for location retrieval.
-static char *get_sock_data_location(struct sock_data_tag *dt) {
-	return &((char *)(dt + 1))[dt->locoff];
+	cmusfm_core_process_request(f, request);
+	fclose(f);
 }
 
-// Copy data from the socket data into the scrobbler structure.
-static void set_trackinfo(scrobbler_trackinfo_t *sbt, struct sock_data_tag *dt) {
-	memset(sbt, 0, sizeof(*sbt));
-	sbt->duration = dt->duration;
-	sbt->track_number = dt->tracknb;
-	sbt->artist = get_sock_data_artist(dt);
-	sbt->album = get_sock_data_album(dt);
-	sbt->track = get_sock_data_track(dt);
+// server shutdown stuff
+static volatile sig_atomic_t server_on = 1;
+static void cmusfm_server_stop(int sig) {
+	(void)sig;
+	debug("stopping cmusfm server");
+	server_on = 0;
 }
 
-// Simple and fast "hashing" function.
-static int make_data_hash(const unsigned char *data, int len) {
-	int x, hash;
-	for (x = hash = 0; x < len; x++)
-		hash += data[x] * (x + 1);
-	return hash;
+// trace dump request (dump is done in the main loop)
+static volatile sig_atomic_t trace_dump = 0;
+static void cmusfm_server_trace_dump(int sig) {
+	(void)sig;
+	trace_dump = 1;
 }
 
-// Process real server task - Last.fm submission.
-static void cmusfm_server_process_data(int fd, scrobbler_session_t *sbs) {
+// time of the last metrics export (monotonic) and the flag of changes
+// which have not been exported yet
+static time_t metrics_export_time = 0;
+static int metrics_changed = 0;
 
-	static char saved_data[CMSOCKET_BUFFER_SIZE];
-	static char saved_is_radio = 0;
+// Export changed metrics into the file, but not more often than every
+// METRICS_EXPORT_INTERVAL seconds. Returns the time (in milliseconds)
+// after which the postponed export is due or -1 if nothing is pending.
+static int cmusfm_server_export_metrics(void) {
 
-	char buffer[CMSOCKET_BUFFER_SIZE];
-	struct sock_data_tag *sock_data = (struct sock_data_tag *)buffer;
-	ssize_t rd_len;
+	struct timespec now;
 
-	// scrobbler stuff
-	static time_t scrobbler_fail_time = 1;
-	static time_t started = 0, paused = 0, unpaused = 0;
-	static time_t playtime = 0, fulltime = 10;
-	static int prev_hash = 0;
-	scrobbler_trackinfo_t sb_tinf;
-	time_t pausedtime;
-	int new_hash;
-	char raw_status;
-
-	rd_len = read(fd, buffer, sizeof(buffer));
-	debug("rdlen: %ld, status: %d", rd_len, sock_data->status);
-
-	if (rd_len < (ssize_t)sizeof(struct sock_data_tag))
-		return;  // something was wrong...
-
-	debug("payload: %s - %s - %d. %s (%ds)",
-			get_sock_data_artist(sock_data), get_sock_data_album(sock_data),
-			sock_data->tracknb, get_sock_data_track(sock_data),
-			sock_data->duration);
-	debug("location: %s", get_sock_data_location(sock_data));
-
-#ifdef DEBUG
-	// simulate server "hiccup" (e.g. internet connection issue)
-	debug("server hiccup test (5s)");
-	sleep(5);
-#endif
+	if (!metrics_changed || config.metrics_file[0] == 0)
+		return -1;
 
-	// make data hash without status field
-	new_hash = make_data_hash((unsigned char*)&buffer[1], rd_len - 1);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (metrics_export_time != 0 &&
+			now.tv_sec < metrics_export_time + METRICS_EXPORT_INTERVAL)
+		return (metrics_export_time + METRICS_EXPORT_INTERVAL - now.tv_sec) * 1000;
 
-	raw_status = sock_data->status & ~CMSTATUS_SHOUTCASTMASK;
+	metrics_export_time = now.tv_sec;
+	metrics_changed = 0;
 
-	// test connection to server (on failure try again in some time)
-	if (scrobbler_fail_time != 0 &&
-			time(NULL) - scrobbler_fail_time > SERVICE_RETRY_DELAY) {
-		if (scrobbler_test_session_key(sbs) == 0) {  // everything should be OK now
-			scrobbler_fail_time = 0;
+	cmusfm_core_update_metrics();
+	if (cmusfm_metrics_export(config.metrics_file) == -1)
+		debug("metrics export failed");
+	return -1;
+}
 
-			// if there is something in cache submit it
-			cmusfm_cache_submit(sbs);
-		}
+// Get the time elapsed since the given moment (in microseconds).
+static unsigned long cmusfm_server_elapsed(const struct timespec *ts) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) * 1000000 + (now.tv_nsec - ts->tv_nsec) / 1000;
+}
+
+// Get listening sockets passed by the service manager (according to the
+// systemd socket activation protocol). The UNIX socket is used as the
+// server socket and the TCP one as the relay server socket. The number
+// of passed sockets is returned.
+static int cmusfm_server_listen_fds(int *server, int *relay) {
+
+	const char *pid = getenv("LISTEN_PID");
+	const char *fds = getenv("LISTEN_FDS");
+	struct sockaddr_storage addr;
+	socklen_t len;
+	int i, fd, count;
+
+	if (pid == NULL || fds == NULL || atoi(pid) != getpid())
+		return 0;
+
+	count = atoi(fds);
+	// sockets are not meant for our child processes
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	for (i = 0; i < count; i++) {
+		fd = LISTEN_FDS_START + i;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		len = sizeof(addr);
+		if (getsockname(fd, (struct sockaddr *)&addr, &len) == -1)
+			continue;
+		if (addr.ss_family == AF_UNIX && *server == -1)
+			*server = fd;
+		else if (addr.ss_family != AF_UNIX && *relay == -1)
+			*relay = fd;
 		else
-			scrobbler_fail_time = time(NULL);
+			close(fd);
 	}
 
-	if (new_hash != prev_hash) {  // maybe it's time to submit :)
-		prev_hash = new_hash;
-action_submit:
-		playtime += time(NULL) - unpaused;
-		if (started != 0 && (playtime * 100 / fulltime > 50 || playtime > 240)) {
-			// playing duration is OK so submit track
-			set_trackinfo(&sb_tinf, (struct sock_data_tag*)saved_data);
-			sb_tinf.timestamp = started;
-
-			if ((saved_is_radio && !config.submit_shoutcast) ||
-					(!saved_is_radio && !config.submit_localfile)) {
-				// skip submission if we don't want it
-				debug("submission not enabled");
-				goto action_submit_skip;
-			}
-
-			if (scrobbler_fail_time == 0) {
-				if (scrobbler_scrobble(sbs, &sb_tinf) != 0) {
-					scrobbler_fail_time = 1;
-					goto action_submit_failed;
-				}
-			}
-			else  // write data to cache
-action_submit_failed:
-				cmusfm_cache_update(&sb_tinf);
-		}
-
-action_submit_skip:
-		if (raw_status == CMSTATUS_STOPPED)
-			started = 0;
-		else {
-			// reinitialize variables, save track info in save_data
-			started = unpaused = time(NULL);
-			playtime = paused = 0;
-
-			if ((sock_data->status & CMSTATUS_SHOUTCASTMASK) != 0)
-				// you have to listen radio min 90s (50% of 180)
-				fulltime = 180;  // overrun DEVBYZERO in URL mode :)
-			else
-				fulltime = sock_data->duration;
-
-			// save information for later submission purpose
-			memcpy(saved_data, sock_data, rd_len);
-			saved_is_radio = sock_data->status & CMSTATUS_SHOUTCASTMASK;
-
-			if (raw_status == CMSTATUS_PLAYING) {
-action_nowplaying:
-				set_trackinfo(&sb_tinf, sock_data);
-
-#ifdef ENABLE_LIBNOTIFY
-				if (config.notification)
-					cmusfm_notify_show(&sb_tinf, get_album_cover_file(
-								get_sock_data_location(sock_data), config.format_coverfile));
-				else
-					debug("notification not enabled");
-#endif
-
-				// update now-playing indicator
-				if (scrobbler_fail_time == 0) {
-					if ((saved_is_radio && config.nowplaying_shoutcast) ||
-							(!saved_is_radio && config.nowplaying_localfile)) {
-						if (scrobbler_update_now_playing(sbs, &sb_tinf) != 0)
-							scrobbler_fail_time = 1;
-					}
-					else
-						debug("now playing not enabled");
-				}
+	return count;
+}
 
-			}
-		}
-	}
-	else {  // new_hash == prev_hash
-		if (raw_status == CMSTATUS_STOPPED)
-			goto action_submit;
+// Take the server instance lock. The lock is held by the running server or
+// by the embedded library context, because only one of them can own the
+// cache and the session state. Returns the lock descriptor or -1.
+int cmusfm_server_lock(void) {
 
-		if (raw_status == CMSTATUS_PAUSED) {
-			paused = time(NULL);
-			playtime += paused - unpaused;
-		}
+	char fname[128 + 8];
+	int fd;
 
-		// NOTE: There is no possibility to distinguish between replayed track
-		//       and unpaused. We assumed that if track was paused before, this
-		//       indicates that track is continued to play (unpaused). In other
-		//       case track is played again, so we should submit previous play.
-		if (raw_status == CMSTATUS_PLAYING) {
-			if (paused) {
-				unpaused = time(NULL);
-				pausedtime = unpaused - paused;
-				paused = 0;
-				if (pausedtime > 120)
-					// if playing was paused for more then 120 seconds, reinitialize
-					// now playing notification (scrobbler and libnotify)
-					goto action_nowplaying;
-			}
-			else
-				goto action_submit;
-		}
+	snprintf(fname, sizeof(fname), "%s.lock", get_cmusfm_socket_file());
+	if ((fd = open(fname, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+		return -1;
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		return -1;
 	}
-}
 
-// server shutdown stuff
-static int server_on = 1;
-static void cmusfm_server_stop(int sig) {
-	(void)sig;
-	debug("stopping cmusfm server");
-	server_on = 0;
+	return fd;
 }
 
 // Run server instance and manage connections to it.
 void cmusfm_server_start(void) {
 
-	scrobbler_session_t *sbs;
 	struct sigaction sigact;
 	struct sockaddr_un sock_a;
-	struct pollfd pfds[3];
+	struct pollfd pfds[5];
+	char buffer[sizeof(struct sock_delayed_tag) + CMSOCKET_BUFFER_SIZE];
+	struct sock_delayed_tag *delayed = (struct sock_delayed_tag *)buffer;
+	struct timespec ts;
+	ssize_t rd_len;
+	time_t age, delay, timestamp;
+	int timeout, monitor_timeout, export_timeout, lock, inherited;
 #ifdef HAVE_SYS_INOTIFY_H
 	struct inotify_event inot_even;
 #endif
 
 	debug("starting cmusfm server");
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	// only one server instance can be run at once (clients might spawn
+	// many of them simultaneously)
+	if ((lock = cmusfm_server_lock()) == -1)
+		return;
 
 	// setup poll structure for data reading
 	pfds[0].events = POLLIN;  // server
 	pfds[1].events = POLLIN;  // client
 	pfds[2].events = POLLIN;  // inotify
+	pfds[3].events = POLLIN;  // relay server
+	pfds[4].events = POLLIN;  // relay client
+	pfds[0].fd = -1;
 	pfds[1].fd = -1;
+	pfds[2].fd = -1;
+	pfds[3].fd = -1;
+	pfds[4].fd = -1;
 
 	memset(&sock_a, 0, sizeof(sock_a));
 	sock_a.sun_family = AF_UNIX;
 	strcpy(sock_a.sun_path, get_cmusfm_socket_file());
-	pfds[0].fd = socket(PF_UNIX, SOCK_STREAM, 0);
 
-	// check if behind the socket there is already an active server instance
-	if (connect(pfds[0].fd, (struct sockaddr*)(&sock_a), sizeof(sock_a)) == 0)
-		return;
+	// use sockets passed by the service manager (socket activation)
+	if (cmusfm_server_listen_fds(&pfds[0].fd, &pfds[3].fd) > 0)
+		debug("inherited sockets: %d %d", pfds[0].fd, pfds[3].fd);
+	inherited = pfds[0].fd != -1;
 
-	// initialize scrobbling library
-	sbs = scrobbler_initialize(SC_api_key, SC_secret);
-	scrobbler_set_session_key_str(sbs, config.session_key);
+	if (!inherited) {
 
-#ifdef ENABLE_LIBNOTIFY
-	// initialize notification library
-	cmusfm_notify_initialize();
-#endif
+		pfds[0].fd = socket(PF_UNIX, SOCK_STREAM, 0);
+
+		// check if behind the socket there is already an active server instance
+		if (connect(pfds[0].fd, (struct sockaddr*)(&sock_a), sizeof(sock_a)) == 0) {
+			close(pfds[0].fd);
+			close(lock);
+			return;
+		}
+
+		// Create server communication socket (no error check) before any
+		// other initialization, so clients can connect right away - events
+		// are queued in the socket backlog until the main loop is entered.
+		unlink(sock_a.sun_path);
+		bind(pfds[0].fd, (struct sockaddr*)(&sock_a), sizeof(sock_a));
+		listen(pfds[0].fd, 16);
+
+	}
+
+	cmusfm_metrics_init(METRICS_INIT_SOCKET, cmusfm_server_elapsed(&ts));
 
 	// catch signals which are used to quit server
 	memset(&sigact, 0, sizeof(sigact));
@@ -292,11 +246,33 @@ void cmusfm_server_start(void) {
 	sigaction(SIGHUP, &sigact, NULL);
 	sigaction(SIGTERM, &sigact, NULL);
 	sigaction(SIGINT, &sigact, NULL);
+	sigact.sa_handler = cmusfm_server_trace_dump;
+	sigaction(SIGUSR1, &sigact, NULL);
+	// client might not wait for the reply
+	sigact.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sigact, NULL);
+
+	// Initialize scrobbling library. Note, that the CURL library as well as
+	// the notification library are initialized on the first use.
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (cmusfm_core_initialize() == -1) {
+		fprintf(stderr, "error: unable to initialize scrobbler\n");
+		goto exit;
+	}
+	cmusfm_metrics_init(METRICS_INIT_SCROBBLER, cmusfm_server_elapsed(&ts));
+
+	// from now on clients connect to the socket, so the spool is complete
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	cmusfm_core_process_spool();
+	cmusfm_metrics_init(METRICS_INIT_SPOOL, cmusfm_server_elapsed(&ts));
 
-	// create server communication socket (no error check)
-	unlink(sock_a.sun_path);
-	bind(pfds[0].fd, (struct sockaddr*)(&sock_a), sizeof(sock_a));
-	listen(pfds[0].fd, 2);
+	// listen for events forwarded by the relay nodes
+	if (config.relay_listen[0] && config.relay_secret[0] == 0)
+		fprintf(stderr, "error: relay secret not set, not listening on: %s\n",
+				config.relay_listen);
+	else if (config.relay_listen[0] && pfds[3].fd == -1 &&
+			(pfds[3].fd = cmusfm_relay_listen(config.relay_listen)) == -1)
+		fprintf(stderr, "error: unable to listen on: %s\n", config.relay_listen);
 
 #ifdef HAVE_SYS_INOTIFY_H
 	// initialize inode notification to watch changes in the config file
@@ -309,20 +285,95 @@ void cmusfm_server_start(void) {
 	debug("entering server main loop");
 	while (server_on) {
 
-		if (poll(pfds, 3, -1) == -1)
-			break;  // signal interruption
+		if (trace_dump) {
+			trace_dump = 0;
+			if (cmusfm_trace_dump(get_cmusfm_trace_file()) == -1)
+				debug("trace dump failed");
+		}
+
+		// wake up to submit pending scrobbles even if the batch is not full
+		// and to continue the submission of the large cache
+		if ((delay = cmusfm_core_submit_delay()) != -1)
+			timeout = delay * 1000;
+		else
+			timeout = -1;
+
+		// poll the cmus for the playback status (remote mode)
+		if (config.cmus_socket[0]) {
+			monitor_timeout = cmusfm_monitor_dispatch(config.cmus_socket);
+			if (timeout == -1 || monitor_timeout < timeout)
+				timeout = monitor_timeout;
+			metrics_changed = 1;
+		}
+
+		// metrics export might be postponed by the throttling
+		if ((export_timeout = cmusfm_server_export_metrics()) != -1 &&
+				(timeout == -1 || export_timeout < timeout))
+			timeout = export_timeout;
+
+		// do not accept new connections until the current one is processed
+		pfds[0].events = pfds[1].fd == -1 ? POLLIN : 0;
+		pfds[3].events = pfds[4].fd == -1 ? POLLIN : 0;
+
+		switch (poll(pfds, 5, timeout)) {
+		case -1:
+			if (errno == EINTR)
+				continue;  // signal interruption
+			goto exit;
+		case 0:
+			cmusfm_core_submit_cache();
+			metrics_changed = 1;
+			continue;
+		}
 
 		if (pfds[0].revents & POLLIN) {
 			pfds[1].fd = accept(pfds[0].fd, NULL, NULL);
+			probe1(server__accept, pfds[1].fd);
 			debug("new client accepted: %d", pfds[1].fd);
 		}
 
 		if (pfds[1].revents & POLLIN && pfds[1].fd != -1) {
-			cmusfm_server_process_data(pfds[1].fd, sbs);
+			rd_len = read(pfds[1].fd, buffer, sizeof(buffer));
+			probe2(server__read, pfds[1].fd, rd_len);
+			if (rd_len >= (ssize_t)sizeof(int) && *(int *)buffer & CMSOCKET_REQUEST)
+				cmusfm_server_process_request(pfds[1].fd, *(int *)buffer);
+			else if (rd_len >= (ssize_t)sizeof(*delayed) && delayed->status == CMSOCKET_DELAYED) {
+				timestamp = delayed->timestamp;
+				rd_len -= sizeof(*delayed);
+				memmove(buffer, &buffer[sizeof(*delayed)], rd_len);
+				cmusfm_core_process_replay(buffer, rd_len, timestamp);
+			}
+			else {
+				// client which has just missed the server start-up might
+				// have spooled its (earlier) event
+				cmusfm_core_process_spool();
+				cmusfm_core_process_data(buffer, rd_len);
+			}
 			close(pfds[1].fd);
 			pfds[1].fd = -1;
 		}
 
+		if (pfds[3].revents & POLLIN) {
+			pfds[4].fd = accept(pfds[3].fd, NULL, NULL);
+			probe1(relay__accept, pfds[4].fd);
+			debug("new relay node accepted: %d", pfds[4].fd);
+		}
+
+		if (pfds[4].revents & POLLIN && pfds[4].fd != -1) {
+			rd_len = cmusfm_relay_read(pfds[4].fd, config.relay_secret,
+					buffer, sizeof(buffer), &age);
+			probe2(relay__read, pfds[4].fd, rd_len);
+			// node might have spooled the event, when we were not available
+			if (rd_len != -1 && age > 0)
+				cmusfm_core_process_delayed(buffer, rd_len, time(NULL) - age);
+			else
+				cmusfm_core_process_data(buffer, rd_len);
+			close(pfds[4].fd);
+			pfds[4].fd = -1;
+		}
+
+		metrics_changed = 1;
+
 #ifdef HAVE_SYS_INOTIFY_H
 		if (pfds[2].revents & POLLIN) {
 			// we're watching only one file, so the result if of no importance
@@ -330,110 +381,176 @@ void cmusfm_server_start(void) {
 			read(pfds[2].fd, &inot_even, sizeof(inot_even));
 			debug("inotify event occurred: %x", inot_even.mask);
 			cmusfm_config_read(get_cmusfm_config_file(), &config);
+			cmusfm_core_apply_config();
 			cmusfm_config_add_watch(pfds[2].fd);
 		}
 #endif
 	}
 
+exit:
+	cmusfm_monitor_close();
+	// do not keep relayed scrobbles waiting for the next start-up
+	cmusfm_core_free();
+
 	close(pfds[0].fd);
+	if (pfds[3].fd != -1)
+		close(pfds[3].fd);
 #ifdef HAVE_SYS_INOTIFY_H
-	close(pfds[2].fd);
+	if (pfds[2].fd != -1)
+		close(pfds[2].fd);
 #endif
-#ifdef ENABLE_LIBNOTIFY
-	cmusfm_notify_free();
-#endif
-	scrobbler_free(sbs);
-	unlink(sock_a.sun_path);
+	// socket file is owned by the service manager in the activation mode
+	if (!inherited)
+		unlink(sock_a.sun_path);
+	close(lock);
+}
+
+// Start server instance in the background.
+static int cmusfm_server_spawn(void) {
+
+	pid_t pid;
+	int fd;
+
+	if ((pid = fork()) == -1)
+		return -1;
+	if (pid > 0)
+		return 0;
+
+	// detach from the player
+	setsid();
+	if ((fd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+
+	cmusfm_server_start();
+	exit(EXIT_SUCCESS);
+}
+
+// Spool callback - forward event, which could not be delivered to the
+// central server on time. After the first failure all remaining events
+// are spooled again, so the order is preserved.
+static void cmusfm_server_relay_spooled(char *buffer, size_t len, time_t timestamp,
+		void *data) {
+
+	int *failed = (int *)data;
+	time_t now = time(NULL);
+
+	if (!*failed && cmusfm_relay_send(config.relay_server, config.relay_secret,
+				buffer, len, now > timestamp ? now - timestamp : 0) == 0)
+		return;
+
+	*failed = 1;
+	if (cmusfm_spool_append(buffer, len, timestamp) == -1)
+		debug("relay spool append failed");
+}
+
+// Forward data to the central server (relay node mode). Events which could
+// not be delivered are kept in the local spool and forwarded (in order)
+// together with the next event.
+static int cmusfm_server_relay_data(const char *buffer, size_t len) {
+
+	int lock, failed = 0;
+
+	// Node does not run the server, so its lock guards the spool against
+	// other node processes. If it is taken, keep the order by spooling.
+	if ((lock = cmusfm_server_lock()) == -1)
+		failed = 1;
+	else {
+		if (cmusfm_spool_ingest(cmusfm_server_relay_spooled, &failed) == -1)
+			failed = 1;
+		close(lock);
+	}
+
+	if (!failed && cmusfm_relay_send(config.relay_server, config.relay_secret,
+				buffer, len, 0) == 0)
+		return 0;
+
+	debug("central server not available, spooling track");
+	return cmusfm_spool_append(buffer, len, time(NULL));
 }
 
 // Send track info to server instance.
 int cmusfm_server_send_track(struct cmtrack_info *tinfo) {
 
 	char buffer[CMSOCKET_BUFFER_SIZE];
-	struct sock_data_tag *sock_data = (struct sock_data_tag *)buffer;
-	char *artist = (char *)(sock_data + 1);
-	char *album = (char *)(sock_data + 1);
-	char *title = (char *)(sock_data + 1);
-	char *location = (char *)(sock_data + 1);
-	struct format_match *match, *matches;
-	struct sockaddr_un sock_a;
-	int sock;
+	char hostname[CMSOCKET_CLIENT_SIZE];
+	char id[CMSOCKET_CLIENT_SIZE];
+	char *client;
+	ssize_t len;
 
 	debug("sending track to cmusfm server");
 
-	memset(buffer, 0, sizeof(buffer));
-
-	// load data into the sock container
-	sock_data->status = tinfo->status;
-	sock_data->tracknb = tinfo->tracknb;
-	// if no duration time assume 3 min
-	sock_data->duration = tinfo->duration == 0 ? 180 : tinfo->duration;
+	// identify the player, so one server can track many of them
+	if ((client = getenv("CMUSFM_CLIENT")) == NULL)
+		client = "";
+	if (config.relay_server[0]) {
+		// make client identifier unique across all relay nodes
+		gethostname(hostname, sizeof(hostname) - 1);
+		hostname[sizeof(hostname) - 1] = 0;
+		// identifier has to fit into the socket data, so the host name
+		// is shortened rather than the client name
+		len = strlen(client);
+		if (len > (ssize_t)sizeof(id) - 2)
+			len = sizeof(id) - 2;
+		snprintf(id, sizeof(id), "%.*s/%.*s", (int)(sizeof(id) - 2 - len), hostname,
+				(int)len, client);
+		client = id;
+	}
 
-	// add Shoutcast (stream) flag
-	if (tinfo->url != NULL)
-		sock_data->status |= CMSTATUS_SHOUTCASTMASK;
+	if ((len = cmusfm_core_pack_track(tinfo, client, buffer, sizeof(buffer))) == -1)
+		return -1;
 
-	if ((tinfo->url != NULL && tinfo->artist == NULL && tinfo->title != NULL) ||
-			(tinfo->file != NULL && tinfo->artist == NULL && tinfo->title == NULL)) {
-		// NOTE: Automatic format detection mode.
-		// When title and artist was not specified but URL or file is available.
-		debug("regular expression matching mode");
+	// forward data directly to the central server (relay node mode)
+	if (config.relay_server[0])
+		return cmusfm_server_relay_data(buffer, len);
 
-		if (tinfo->url != NULL) {
-			// URL: try to fetch artist and track tile form the 'title' field
+	if (cmusfm_server_send_data(buffer, len) == 0)
+		return 0;
 
-			matches = get_regexp_format_matches(tinfo->title, config.format_shoutcast);
-			if (matches == NULL) {
-				fprintf(stderr, "error: shoutcast format match failed\n");
-				return -1;
-			}
-		}
-		else {
-			// FILE: try to fetch artist and track title from the 'file' field
-
-			tinfo->file = basename(tinfo->file);
-			matches = get_regexp_format_matches(tinfo->file, config.format_localfile);
-			if (matches == NULL) {
-				fprintf(stderr, "error: localfile format match failed\n");
-				return -1;
-			}
-		}
+	// Server is not running (e.g. it has crashed), so keep the event in the
+	// spool and start a new server instance, which will process it.
+	debug("server not available, spooling track");
+	if (cmusfm_spool_append(buffer, len, time(NULL)) == -1)
+		return -1;
+	return cmusfm_server_spawn();
+}
 
-		match = get_regexp_match(matches, CMFORMAT_ARTIST);
-		strncpy(artist, match->data, match->len);
-		album = &artist[strlen(artist) + 1];
-		match = get_regexp_match(matches, CMFORMAT_ALBUM);
-		strncpy(album, match->data, match->len);
-		title = &album[strlen(album) + 1];
-		match = get_regexp_match(matches, CMFORMAT_TITLE);
-		strncpy(title, match->data, match->len);
+// Send raw socket data (track info) to server instance.
+int cmusfm_server_send_data(const char *buffer, size_t len) {
 
-		free(matches);
+	struct sockaddr_un sock_a;
+	int sock;
 
+	// connect to the communication socket
+	memset(&sock_a, 0, sizeof(sock_a));
+	strcpy(sock_a.sun_path, get_cmusfm_socket_file());
+	sock_a.sun_family = AF_UNIX;
+	sock = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (connect(sock, (struct sockaddr *)(&sock_a), sizeof(sock_a)) == -1) {
+		close(sock);
+		return -1;
 	}
-	else {
 
-		if (tinfo->artist != NULL) strcpy(artist, tinfo->artist);
-		album = &artist[strlen(artist) + 1];
-		if (tinfo->album != NULL) strcpy(album, tinfo->album);
-		title = &album[strlen(album) + 1];
-		if (tinfo->title != NULL) strcpy(title, tinfo->title);
+	debug("socket wrlen: %ld", len);
+	write(sock, buffer, len);
+	return close(sock);
+}
 
-	}
+// Send request to the server instance and write the reply into the stream.
+int cmusfm_server_send_request(enum cmsock_request request, FILE *f) {
 
-	// update track location (localfile or shoutcast)
-	location = &title[strlen(title) + 1];
-	if (tinfo->file != NULL)
-		strcpy(location, tinfo->file);
-	else if (tinfo->url != NULL)
-		strcpy(location, tinfo->url);
+	char buffer[CMSOCKET_BUFFER_SIZE];
+	struct sockaddr_un sock_a;
+	int req = request;
+	ssize_t rd_len;
+	int sock;
 
-	// calculate data offsets
-	sock_data->alboff = album - artist;
-	sock_data->titoff = title - artist;
-	sock_data->locoff = location - artist;
+	debug("sending request to cmusfm server: %x", request);
 
-	// connect to the communication socket
 	memset(&sock_a, 0, sizeof(sock_a));
 	strcpy(sock_a.sun_path, get_cmusfm_socket_file());
 	sock_a.sun_family = AF_UNIX;
@@ -443,11 +560,18 @@ int cmusfm_server_send_track(struct cmtrack_info *tinfo) {
 		return -1;
 	}
 
-	debug("socket wrlen: %ld", sizeof(struct sock_data_tag) +
-			sock_data->titoff + sock_data->locoff + strlen(location) + 1);
-	write(sock, buffer, sizeof(struct sock_data_tag) +
-			sock_data->titoff + sock_data->locoff + strlen(location) + 1);
-	return close(sock);
+	// signal the end of the request, so the server can reply
+	if (write(sock, &req, sizeof(req)) != sizeof(req) ||
+			shutdown(sock, SHUT_WR) == -1) {
+		close(sock);
+		return -1;
+	}
+
+	while ((rd_len = read(sock, buffer, sizeof(buffer))) > 0)
+		fwrite(buffer, 1, rd_len, f);
+
+	close(sock);
+	return rd_len == -1 ? -1 : 0;
 }
 
 // Helper function for retrieving cmusfm server socket file.
@@ -21,26 +21,58 @@
 #ifndef __CMUSFM_SERVER_H
 #define __CMUSFM_SERVER_H
 
+#include <stdint.h>
+#include <stdio.h>
 #include "cmusfm.h"
 
 
 // communication socket read/write buffer size
 #define CMSOCKET_BUFFER_SIZE 1024
+// maximal length of the client identifier (including NULL)
+#define CMSOCKET_CLIENT_SIZE 32
+// first file descriptor passed by the service manager (socket activation)
+#define LISTEN_FDS_START 3
 
 #define CMSTATUS_SHOUTCASTMASK 0xF0
 struct sock_data_tag {
 	enum cmstatus status;
 	int tracknb, duration;
 	int alboff, titoff, locoff;
+	char client[CMSOCKET_CLIENT_SIZE];
 // char artist[];
 // char album[];
 // char title[];
 // char location[];
 }__attribute__ ((packed));
 
+// Requests are distinguished from the track data by the status field. The
+// reply is written back to the client and the connection is closed.
+#define CMSOCKET_REQUEST 0x100
+enum cmsock_request {
+	CMREQUEST_STATS = CMSOCKET_REQUEST | 1,
+	CMREQUEST_FLUSH,
+	CMREQUEST_RELOAD,
+	CMREQUEST_PAUSE,
+	CMREQUEST_RESUME,
+	CMREQUEST_STATUS,
+	CMREQUEST_TRACE,
+};
 
+// Replayed event which has to be processed as if it was received at the
+// given time (see record.c). The socket data follows the header.
+#define CMSOCKET_DELAYED 0x200
+struct sock_delayed_tag {
+	int status;  // CMSOCKET_DELAYED
+	int64_t timestamp;
+}__attribute__ ((packed));
+
+
+int cmusfm_sock_data_check(const char *buffer, size_t len);
 char *get_cmusfm_socket_file(void);
+int cmusfm_server_lock(void);
 void cmusfm_server_start(void);
 int cmusfm_server_send_track(struct cmtrack_info *tinfo);
+int cmusfm_server_send_data(const char *buffer, size_t len);
+int cmusfm_server_send_request(enum cmsock_request request, FILE *f);
 
 #endif
@@ -0,0 +1,410 @@
+/*
+ * cmusfm - session.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "session.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+
+
+// Sessions are stored in a continuous array, which is indexed by the
+// open-addressing hash table (linear probing). Table slot holds the
+// session index increased by one, so zero means an empty slot.
+static struct cmusfm_session *sessions = NULL;
+static unsigned int sessions_count = 0;
+static unsigned int sessions_size = 0;
+static uint32_t *slots = NULL;
+static unsigned int slots_size = 0;
+
+// If the checkpoint file is opened, the sessions array is a part of its
+// memory mapping, otherwise it is allocated on the heap.
+static struct cmusfm_sessions_header *checkpoint = NULL;
+static int checkpoint_fd = -1;
+
+// time of the last check for expired sessions
+static time_t sessions_expired = 0;
+
+
+// FNV-1a hash of the client identifier.
+static uint32_t get_client_hash(const char *client) {
+	uint32_t hash = 2166136261U;
+	while (*client) {
+		hash ^= (unsigned char)*client++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+// Return the slot which holds given client or the first free one.
+static uint32_t *get_client_slot(const char *client) {
+	unsigned int mask = slots_size - 1;
+	unsigned int i = get_client_hash(client) & mask;
+	while (slots[i] && strcmp(sessions[slots[i] - 1].client, client) != 0)
+		i = (i + 1) & mask;
+	return &slots[i];
+}
+
+// Double the size of the index table and rehash all sessions.
+static int rehash_slots(void) {
+
+	unsigned int i;
+	uint32_t *tmp;
+
+	tmp = slots;
+	i = slots_size;
+	slots_size = slots_size ? slots_size * 2 : 16;
+	if ((slots = calloc(slots_size, sizeof(*slots))) == NULL) {
+		slots = tmp;
+		slots_size = i;
+		return -1;
+	}
+
+	free(tmp);
+	for (i = 0; i < sessions_count; i++)
+		*get_client_slot(sessions[i].client) = i + 1;
+
+	return 0;
+}
+
+static size_t get_checkpoint_size(unsigned int size) {
+	return sizeof(*checkpoint) + size * sizeof(*sessions);
+}
+
+// Resize the sessions array. Checkpoint file is enlarged and mapped again,
+// so previous pointers to sessions are not valid any more.
+static int resize_sessions(unsigned int size) {
+
+	struct cmusfm_sessions_header *header;
+	struct cmusfm_session *tmp;
+
+	if (checkpoint_fd == -1) {
+		if ((tmp = realloc(sessions, size * sizeof(*sessions))) == NULL)
+			return -1;
+		sessions = tmp;
+		sessions_size = size;
+		return 0;
+	}
+
+	if (ftruncate(checkpoint_fd, get_checkpoint_size(size)) == -1 ||
+			(header = mmap(NULL, get_checkpoint_size(size), PROT_READ | PROT_WRITE,
+					MAP_SHARED, checkpoint_fd, 0)) == MAP_FAILED)
+		return -1;
+
+	if (checkpoint != NULL)
+		munmap(checkpoint, get_checkpoint_size(sessions_size));
+	checkpoint = header;
+	checkpoint->size = size;
+	sessions = (struct cmusfm_session *)&checkpoint[1];
+	sessions_size = size;
+	return 0;
+}
+
+// Get the session associated with the given client identifier. If such
+// a session does not exist, it is created. Returned pointer is valid up
+// to the next call of this function. On error NULL is returned.
+struct cmusfm_session *cmusfm_session_get(const char *client) {
+
+	struct cmusfm_session *tmp;
+	uint32_t *slot;
+
+	// keep the load factor below 50%
+	if ((sessions_count + 1) * 2 > slots_size)
+		if (rehash_slots() == -1)
+			return NULL;
+
+	slot = get_client_slot(client);
+	if (*slot)
+		return &sessions[*slot - 1];
+
+	if (sessions_count == sessions_size)
+		if (resize_sessions(sessions_size ? sessions_size * 2 : 4) == -1)
+			return NULL;
+
+	debug("new session: %s", client);
+	tmp = &sessions[sessions_count];
+	memset(tmp, 0, sizeof(*tmp));
+	strncpy(tmp->client, client, sizeof(tmp->client) - 1);
+	tmp->fulltime = 10;
+
+	*slot = ++sessions_count;
+	if (checkpoint != NULL)
+		checkpoint->count = sessions_count;
+	return tmp;
+}
+
+// Return the number of currently tracked sessions.
+unsigned int cmusfm_session_count(void) {
+	return sessions_count;
+}
+
+// Get the session by its index (in the order of creation). If the index
+// is out of range, NULL is returned.
+struct cmusfm_session *cmusfm_session_at(unsigned int index) {
+	if (index >= sessions_count)
+		return NULL;
+	return &sessions[index];
+}
+
+// Get the playback status of the session.
+enum cmstatus cmusfm_session_status(const struct cmusfm_session *sess) {
+	if (sess->started == 0)
+		return CMSTATUS_STOPPED;
+	return sess->paused ? CMSTATUS_PAUSED : CMSTATUS_PLAYING;
+}
+
+// Set the play time of the current track measured by the caller (e.g. from
+// the playback position), which replaces the time accounted from events.
+void cmusfm_session_measure(struct cmusfm_session *sess, time_t playtime,
+		time_t now) {
+	if (sess->started == 0)
+		return;
+	sess->playtime = playtime;
+	// time accounted from now on is added to the measured one
+	if (sess->paused == 0)
+		sess->unpaused = now;
+}
+
+// Finish the current play. If the track was played long enough (more than
+// half of its duration or 4 minutes), it is passed to the scrobble sink.
+static void session_finish(struct cmusfm_session *sess, time_t now,
+		const struct cmusfm_session_ops *ops) {
+
+	// time of the pause has been already accounted
+	if (sess->paused == 0)
+		sess->playtime += now - sess->unpaused;
+
+	if (sess->started != 0 && sess->fulltime > 0 &&
+			(sess->playtime * 100 / sess->fulltime > 50 || sess->playtime > 240))
+		ops->scrobble(ops->data, sess);
+}
+
+// Start a new play of the given track (unless stopped).
+static void session_start(struct cmusfm_session *sess, const struct sock_data_tag *dt,
+		size_t len, enum cmstatus status, time_t now,
+		const struct cmusfm_session_ops *ops) {
+
+	if (status == CMSTATUS_STOPPED) {
+		sess->started = sess->paused = 0;
+		return;
+	}
+
+	// NOTE: New track is always assumed to be playing.
+	sess->started = sess->unpaused = now;
+	sess->playtime = sess->paused = 0;
+
+	if ((dt->status & CMSTATUS_SHOUTCASTMASK) != 0)
+		// you have to listen radio min 90s (50% of 180)
+		sess->fulltime = 180;
+	else
+		sess->fulltime = dt->duration;
+
+	// save information for later submission purpose
+	if (len > sizeof(sess->saved_data))
+		len = sizeof(sess->saved_data);
+	memcpy(sess->saved_data, dt, len);
+	memset(sess->saved_data + len, 0, sizeof(sess->saved_data) - len);
+	sess->saved_is_radio = (dt->status & CMSTATUS_SHOUTCASTMASK) != 0;
+
+	if (status == CMSTATUS_PLAYING)
+		ops->nowplaying(ops->data, sess, dt);
+}
+
+// Process the playback event of the given session. Track change is
+// detected by the track identity, which has to be computed by the caller.
+void cmusfm_session_process(struct cmusfm_session *sess,
+		const struct sock_data_tag *dt, size_t len, cmusfm_track_id_t track_id,
+		const struct cmusfm_session_ops *ops) {
+
+	enum cmstatus status = dt->status & ~CMSTATUS_SHOUTCASTMASK;
+	time_t now = ops->clock(ops->data);
+	time_t pausedtime;
+
+	sess->updated = now;
+
+	if (sess->restored) {
+		sess->restored = 0;
+		if (sess->started != 0 && sess->paused == 0 && !sess->saved_is_radio &&
+				now - sess->unpaused > sess->fulltime - sess->playtime + SESSION_RESTORE_GRACE) {
+			debug("restored play dropped: %s", sess->client);
+			sess->started = 0;
+		}
+		// There is no event in the middle of the play, so the play of the
+		// same track is continued (e.g. the first poll in the remote mode).
+		else if (track_id == sess->track_id && status == CMSTATUS_PLAYING &&
+				sess->started != 0 && sess->paused == 0)
+			return;
+	}
+
+	if (track_id != sess->track_id) {
+		sess->track_id = track_id;
+		session_finish(sess, now, ops);
+		session_start(sess, dt, len, status, now, ops);
+		return;
+	}
+
+	switch (status) {
+	case CMSTATUS_STOPPED:
+		session_finish(sess, now, ops);
+		session_start(sess, dt, len, status, now, ops);
+		break;
+	case CMSTATUS_PAUSED:
+		if (sess->started == 0 || sess->paused != 0)
+			break;
+		sess->paused = now;
+		sess->playtime += sess->paused - sess->unpaused;
+		break;
+	case CMSTATUS_PLAYING:
+		// NOTE: There is no possibility to distinguish between replayed track
+		//       and unpaused. We assumed that if track was paused before, this
+		//       indicates that track is continued to play (unpaused). In other
+		//       case track is played again, so we should submit previous play.
+		//       In the remote mode (see monitor.c) the replay is recognized
+		//       from the playback position and the play is finished first.
+		if (sess->paused == 0) {
+			session_finish(sess, now, ops);
+			session_start(sess, dt, len, status, now, ops);
+			break;
+		}
+		sess->unpaused = now;
+		pausedtime = sess->unpaused - sess->paused;
+		sess->paused = 0;
+		// if playing was paused for more then 120 seconds, reinitialize
+		// now playing notification (scrobbler and libnotify)
+		if (pausedtime > 120)
+			ops->nowplaying(ops->data, sess, dt);
+		break;
+	default:
+		break;
+	}
+}
+
+// Remove stopped sessions which have been idle for longer than the expiry
+// time, so the checkpoint does not grow with every client ever seen. The
+// order of remaining sessions is kept. Pointers to sessions are not valid
+// after this call.
+void cmusfm_session_expire(time_t now) {
+
+	unsigned int i, count;
+
+	if (now - sessions_expired < SESSION_EXPIRE_INTERVAL)
+		return;
+	sessions_expired = now;
+
+	for (i = count = 0; i < sessions_count; i++) {
+		if (sessions[i].started == 0 && sessions[i].updated + SESSION_IDLE_EXPIRY < now) {
+			debug("session expired: %s", sessions[i].client);
+			continue;
+		}
+		if (count != i)
+			memcpy(&sessions[count], &sessions[i], sizeof(*sessions));
+		count++;
+	}
+
+	if (count == sessions_count)
+		return;
+
+	sessions_count = count;
+	if (checkpoint != NULL)
+		checkpoint->count = sessions_count;
+
+	// rebuild the index table (of the same size)
+	memset(slots, 0, slots_size * sizeof(*slots));
+	for (i = 0; i < sessions_count; i++)
+		*get_client_slot(sessions[i].client) = i + 1;
+}
+
+// Open the checkpoint file and restore sessions saved by the previous
+// server instance. From now on, sessions are kept in the file. This
+// function has to be called before any session is created.
+int cmusfm_session_restore(const char *fname) {
+
+	struct cmusfm_sessions_header header;
+	unsigned int i, count = 0;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(fname, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+		return -1;
+
+	if (fstat(fd, &st) == 0 &&
+			read(fd, &header, sizeof(header)) == sizeof(header) &&
+			header.signature == CMUSFM_SESSIONS_SIGNATURE &&
+			header.version == CMUSFM_SESSIONS_VERSION &&
+			header.session_size == sizeof(struct cmusfm_session) &&
+			header.count <= header.size &&
+			get_checkpoint_size(header.size) <= (size_t)st.st_size)
+		count = header.count;
+
+	cmusfm_session_free_all();
+	checkpoint_fd = fd;
+
+	if (resize_sessions(count > 4 ? count : 4) == -1) {
+		close(fd);
+		checkpoint_fd = -1;
+		return -1;
+	}
+
+	checkpoint->signature = CMUSFM_SESSIONS_SIGNATURE;
+	checkpoint->version = CMUSFM_SESSIONS_VERSION;
+	checkpoint->session_size = sizeof(struct cmusfm_session);
+	checkpoint->count = sessions_count = count;
+
+	for (i = 0; i < count; i++) {
+		sessions[i].client[sizeof(sessions[i].client) - 1] = '\0';
+		sessions[i].restored = 1;
+		debug("restored session: %s", sessions[i].client);
+	}
+
+	// keep the load factor below 50%
+	while (sessions_count * 2 >= slots_size)
+		if (rehash_slots() == -1)
+			return -1;
+
+	return 0;
+}
+
+// Free all sessions and the lookup table. The checkpoint file is kept
+// for the next server instance.
+void cmusfm_session_free_all(void) {
+	if (checkpoint != NULL) {
+		munmap(checkpoint, get_checkpoint_size(sessions_size));
+		close(checkpoint_fd);
+	}
+	else
+		free(sessions);
+	free(slots);
+	checkpoint = NULL;
+	checkpoint_fd = -1;
+	sessions = NULL;
+	slots = NULL;
+	sessions_count = sessions_size = slots_size = 0;
+	sessions_expired = 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * cmusfm - session.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_SESSION_H
+#define __CMUSFM_SESSION_H
+
+#include <stdint.h>
+#include <time.h>
+#include "server.h"
+#include "track.h"
+
+
+#define CMUSFM_SESSIONS_SIGNATURE 0x53534d43
+#define CMUSFM_SESSIONS_VERSION 2
+
+// Restored play, which should have been finished for longer than this
+// time (in seconds) when the first event arrives, is dropped - the player
+// has not been running either (e.g. system reboot).
+#define SESSION_RESTORE_GRACE 60
+
+// Stopped session without any event for this time (in seconds) is removed
+// (e.g. relay node which is gone). Sessions are checked at most once per
+// the given interval.
+#define SESSION_IDLE_EXPIRY (7 * 24 * 60 * 60)
+#define SESSION_EXPIRE_INTERVAL (60 * 60)
+
+// Sessions of the server are kept in the memory-mapped checkpoint file,
+// so every playback state transition is persisted without any system
+// call, and the play in progress survives the server restart.
+struct __attribute__((__packed__)) cmusfm_sessions_header {
+	uint32_t signature, version;
+	uint32_t session_size;  // layout check of the session structure
+	uint32_t count, size;
+	uint32_t reserved;  // keep sessions 8-byte aligned
+	//struct cmusfm_session sessions[size];
+};
+
+// Playback state of a single player (cmus instance) connected to the
+// server. Structure is a plain data block - it contains no pointers.
+struct cmusfm_session {
+	char client[CMSOCKET_CLIENT_SIZE];
+
+	// track info saved for later submission purpose
+	char saved_data[CMSOCKET_BUFFER_SIZE];
+	char saved_is_radio;
+	// restored from the checkpoint and not processed since then
+	char restored;
+
+	time_t started, paused, unpaused;
+	time_t playtime, fulltime;
+	time_t updated;  // time of the last event
+	cmusfm_track_id_t track_id;
+};
+
+// Environment of the session state machine. Playback events are processed
+// without any side effects - the current time is taken from the clock
+// callback and decisions are passed to the sink callbacks.
+struct cmusfm_session_ops {
+	// return the current time (in seconds)
+	time_t (*clock)(void *data);
+	// saved track has been played long enough to be scrobbled
+	void (*scrobble)(void *data, struct cmusfm_session *sess);
+	// now-playing indicator should be updated with the given track
+	void (*nowplaying)(void *data, struct cmusfm_session *sess,
+			const struct sock_data_tag *dt);
+	void *data;
+};
+
+
+struct cmusfm_session *cmusfm_session_get(const char *client);
+unsigned int cmusfm_session_count(void);
+struct cmusfm_session *cmusfm_session_at(unsigned int index);
+enum cmstatus cmusfm_session_status(const struct cmusfm_session *sess);
+void cmusfm_session_measure(struct cmusfm_session *sess, time_t playtime,
+		time_t now);
+void cmusfm_session_process(struct cmusfm_session *sess,
+		const struct sock_data_tag *dt, size_t len, cmusfm_track_id_t track_id,
+		const struct cmusfm_session_ops *ops);
+void cmusfm_session_expire(time_t now);
+int cmusfm_session_restore(const char *fname);
+void cmusfm_session_free_all(void);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * cmusfm - sim-session.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "session.h"
+
+
+// Session state machine simulator. Random playback event sequences are
+// processed with a virtual clock and every decision is compared with the
+// reference model, which follows the scrobbling rules directly:
+//  - a play is scrobbled if it lasted more than half of the track
+//    duration or more than 4 minutes (pauses excluded),
+//  - a stream is assumed to be 180 seconds long,
+//  - now-playing is updated on every started play and after resuming
+//    a pause longer than 2 minutes.
+
+#define SIM_CLIENTS 4
+#define SIM_TRACKS 5
+// number of sequences run by the test suite (more can be given as the
+// first argument, the seed as the second one)
+#define SIM_SEQUENCES 20000
+
+// reference model of a single player
+struct sim_player {
+	enum cmstatus status;
+	cmusfm_track_id_t track_id;
+	time_t started, resumed, paused, played, fulltime;
+};
+
+struct sim_state {
+	time_t now;
+	unsigned int scrobbles, nowplayings;
+	time_t scrobble_timestamp;
+};
+
+static time_t sim_clock(void *data) {
+	return ((struct sim_state *)data)->now;
+}
+
+static void sim_scrobble(void *data, struct cmusfm_session *sess) {
+	struct sim_state *sim = data;
+	sim->scrobbles++;
+	sim->scrobble_timestamp = sess->started;
+}
+
+static void sim_nowplaying(void *data, struct cmusfm_session *sess,
+		const struct sock_data_tag *dt) {
+	(void)sess;
+	(void)dt;
+	((struct sim_state *)data)->nowplayings++;
+}
+
+static unsigned int sim_random(unsigned int *seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+// Finish the play of the reference player. Return 1 if it should be scrobbled.
+static int model_finish(struct sim_player *p, time_t now) {
+	time_t played = p->played;
+	if (p->status == CMSTATUS_STOPPED)
+		return 0;
+	if (p->status == CMSTATUS_PLAYING)
+		played += now - p->resumed;
+	return p->fulltime > 0 && (played * 100 / p->fulltime > 50 || played > 240);
+}
+
+// Start a new play of the reference player. Return 1 if now-playing
+// should be updated.
+static int model_start(struct sim_player *p, const struct sock_data_tag *dt,
+		enum cmstatus status, time_t now) {
+	if (status == CMSTATUS_STOPPED) {
+		p->status = CMSTATUS_STOPPED;
+		return 0;
+	}
+	p->status = CMSTATUS_PLAYING;
+	p->started = p->resumed = now;
+	p->played = 0;
+	p->fulltime = dt->status & CMSTATUS_SHOUTCASTMASK ? 180 : dt->duration;
+	return status == CMSTATUS_PLAYING;
+}
+
+// Apply the event to the reference player and return the expected
+// number of scrobbles and now-playing updates.
+static void model_process(struct sim_player *p, const struct sock_data_tag *dt,
+		cmusfm_track_id_t track_id, time_t now, int *scrobble, int *nowplaying) {
+
+	enum cmstatus status = dt->status & ~CMSTATUS_SHOUTCASTMASK;
+
+	*scrobble = *nowplaying = 0;
+
+	if (track_id != p->track_id || status == CMSTATUS_STOPPED ||
+			(status == CMSTATUS_PLAYING && p->status != CMSTATUS_PAUSED)) {
+		p->track_id = track_id;
+		*scrobble = model_finish(p, now);
+		*nowplaying = model_start(p, dt, status, now);
+	}
+	else if (status == CMSTATUS_PAUSED && p->status == CMSTATUS_PLAYING) {
+		p->played += now - p->resumed;
+		p->paused = now;
+		p->status = CMSTATUS_PAUSED;
+	}
+	else if (status == CMSTATUS_PLAYING && p->status == CMSTATUS_PAUSED) {
+		p->resumed = now;
+		p->status = CMSTATUS_PLAYING;
+		*nowplaying = now - p->paused > 120;
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	struct cmusfm_session_ops ops;
+	struct cmusfm_session *sessions[SIM_CLIENTS];
+	struct sim_player players[SIM_CLIENTS];
+	struct sim_state sim;
+	struct sock_data_tag dt;
+	cmusfm_track_id_t track_id;
+	unsigned long long events = 0, scrobbles = 0, errors = 0;
+	unsigned int sequences, length, seed;
+	unsigned int i, j, r, c;
+	int exp_scrobble, exp_nowplaying;
+	struct timespec ts0, ts1;
+	double elapsed;
+	char client[8];
+
+	sequences = argc > 1 ? atoi(argv[1]) : SIM_SEQUENCES;
+	seed = argc > 2 ? atoi(argv[2]) : 1;
+
+	ops.clock = sim_clock;
+	ops.scrobble = sim_scrobble;
+	ops.nowplaying = sim_nowplaying;
+	ops.data = &sim;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < sequences; i++) {
+
+		// fresh players for every sequence
+		cmusfm_session_free_all();
+		memset(players, 0, sizeof(players));
+		for (c = 0; c < SIM_CLIENTS; c++) {
+			sprintf(client, "sim-%u", c);
+			sessions[c] = NULL;
+			cmusfm_session_get(client);
+			players[c].status = CMSTATUS_STOPPED;
+		}
+		for (c = 0; c < SIM_CLIENTS; c++)
+			sessions[c] = cmusfm_session_at(c);
+
+		memset(&sim, 0, sizeof(sim));
+		sim.now = 1000000000;
+		length = 8 + sim_random(&seed) % 32;
+
+		for (j = 0; j < length; j++) {
+
+			r = sim_random(&seed);
+			c = r % SIM_CLIENTS;
+
+			// advance virtual clock: mostly short steps, sometimes long pauses
+			sim.now += (r >> 4) % 8 == 0 ? 100 + (r >> 8) % 300 : (r >> 8) % 150;
+
+			memset(&dt, 0, sizeof(dt));
+			dt.status = CMSTATUS_PLAYING + (r >> 12) % 3;
+			if ((r >> 16) % 8 == 0)
+				dt.status |= CMSTATUS_SHOUTCASTMASK;
+			// zero duration is not sent by the client, but may by relayed
+			dt.duration = (r >> 20) % 16 == 0 ? 0 : 30 + (r >> 20) % 400;
+			// prefer the current track, so pauses and replays are exercised
+			track_id = (r >> 24) % 3 == 0 ? 1 + (r >> 26) % SIM_TRACKS : players[c].track_id;
+			if (track_id == 0)
+				track_id = 1;
+
+			model_process(&players[c], &dt, track_id, sim.now, &exp_scrobble, &exp_nowplaying);
+
+			sim.scrobbles = sim.nowplayings = 0;
+			cmusfm_session_process(sessions[c], &dt, sizeof(dt), track_id, &ops);
+			events++;
+
+			if ((int)sim.scrobbles != exp_scrobble || (int)sim.nowplayings != exp_nowplaying ||
+					(exp_scrobble && sim.scrobble_timestamp > sim.now) ||
+					cmusfm_session_status(sessions[c]) != players[c].status) {
+				if (errors++ < 10)
+					fprintf(stderr, "mismatch: sequence %u event %u: scrobble %u/%d "
+							"now-playing %u/%d status %d/%d\n", i, j,
+							sim.scrobbles, exp_scrobble, sim.nowplayings, exp_nowplaying,
+							cmusfm_session_status(sessions[c]), players[c].status);
+			}
+			scrobbles += sim.scrobbles;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	cmusfm_session_free_all();
+
+	elapsed = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+	printf("sequences: %u, events: %llu, scrobbles: %llu, mismatches: %llu\n",
+			sequences, events, scrobbles, errors);
+	printf("%.0f events/s (model included)\n", events / elapsed);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+/*
+ * cmusfm - spool.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "spool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "cmusfm.h"
+#include "debug.h"
+#include "server.h"
+
+
+// Append the socket message to the spool file.
+int cmusfm_spool_append(const void *data, size_t len, time_t timestamp) {
+
+	char buffer[sizeof(struct cmusfm_spool_header) + CMSOCKET_BUFFER_SIZE];
+	struct cmusfm_spool_header *header = (struct cmusfm_spool_header *)buffer;
+	struct stat st;
+	int i, fd;
+	ssize_t wr_len;
+
+	if (len > CMSOCKET_BUFFER_SIZE)
+		return -1;
+
+	header->signature = CMUSFM_SPOOL_SIGNATURE;
+	header->length = len;
+	header->timestamp = timestamp;
+	memcpy(&buffer[sizeof(*header)], data, len);
+	len += sizeof(*header);
+
+	for (i = 0; i < 3; i++) {
+		if ((fd = open(get_cmusfm_spool_file(), O_WRONLY | O_APPEND | O_CREAT, 0600)) == -1)
+			return -1;
+		// Shared lock does not block other clients, however it makes the
+		// server wait for our write. If the file was taken over and unlinked
+		// in the meantime, we have to start over with a new one.
+		if (flock(fd, LOCK_SH) == 0 && fstat(fd, &st) == 0 && st.st_nlink > 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+
+	if (fd == -1)
+		return -1;
+
+	debug("spool append: %zu", len);
+	wr_len = write(fd, buffer, len);
+	close(fd);
+
+	return wr_len == (ssize_t)len ? 0 : -1;
+}
+
+// Process all messages from the given spool file and remove it. Messages
+// are read into the memory and the file is released before processing,
+// so appending clients do not wait for the callback (e.g. HTTP requests).
+static int spool_ingest_file(const char *fname, cmusfm_spool_callback callback,
+		void *data) {
+
+	struct cmusfm_spool_header header;
+	char buffer[CMSOCKET_BUFFER_SIZE];
+	char *spool = NULL;
+	size_t size = 0, offset;
+	struct stat st;
+	ssize_t rd_len;
+	int fd, count = 0;
+
+	if ((fd = open(fname, O_RDONLY)) == -1)
+		return errno == ENOENT ? 0 : -1;
+	// wait for clients which have opened the file before it was taken over
+	if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1 ||
+			(spool = malloc(st.st_size + 1)) == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	while (size < (size_t)st.st_size &&
+			(rd_len = read(fd, &spool[size], st.st_size - size)) > 0)
+		size += rd_len;
+
+	// remove the file while holding the lock (see the append function)
+	unlink(fname);
+	close(fd);
+
+	for (offset = 0; offset + sizeof(header) <= size; ) {
+		memcpy(&header, &spool[offset], sizeof(header));
+		offset += sizeof(header);
+		if (header.signature != CMUSFM_SPOOL_SIGNATURE ||
+				header.length > sizeof(buffer) || offset + header.length > size) {
+			debug("invalid spool record: %u", header.length);
+			break;
+		}
+		// callback might modify the buffer (as the socket one)
+		memcpy(buffer, &spool[offset], header.length);
+		offset += header.length;
+		if (cmusfm_sock_data_check(buffer, header.length) != 0) {
+			debug("malformed spool record: %u", header.length);
+			continue;
+		}
+		callback(buffer, header.length, header.timestamp, data);
+		count++;
+	}
+
+	free(spool);
+
+	debug("spool ingested: %d", count);
+	return count;
+}
+
+// Take over the spool file and pass all messages (in the order they were
+// appended) to the callback function. The number of messages is returned.
+int cmusfm_spool_ingest(cmusfm_spool_callback callback, void *data) {
+
+	char fname[256];
+	int count, status;
+
+	snprintf(fname, sizeof(fname), "%s.ingest", get_cmusfm_spool_file());
+
+	// leftover of the interrupted ingestion goes first
+	if ((count = spool_ingest_file(fname, callback, data)) == -1)
+		return -1;
+
+	if (rename(get_cmusfm_spool_file(), fname) == -1)
+		return errno == ENOENT ? count : -1;
+
+	if ((status = spool_ingest_file(fname, callback, data)) == -1)
+		return -1;
+	return count + status;
+}
+
+// Helper function for retrieving cmusfm spool file.
+char *get_cmusfm_spool_file(void) {
+	static char fname[128];
+	sprintf(fname, "%s/" SPOOL_FNAME, get_cmus_home_dir());
+	return fname;
+}
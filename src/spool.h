@@ -0,0 +1,54 @@
+/*
+ * cmusfm - spool.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __CMUSFM_SPOOL_H
+#define __CMUSFM_SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+#define CMUSFM_SPOOL_SIGNATURE 0x50534d43
+
+// Spool is a sequence of socket messages (see server.h), which could not
+// be delivered to the server, each one preceded by the spool header. Every
+// message is appended with a single write call, so clients never block
+// each other. The server takes over the whole spool by renaming it, then
+// it reads the spool into the memory and removes it, so the lock is not
+// held while messages are processed.
+
+struct __attribute__((__packed__)) cmusfm_spool_header {
+	uint32_t signature;
+	uint32_t length;
+	uint64_t timestamp;  // time of the event (UNIX time)
+	//char data[length];
+};
+
+typedef void (*cmusfm_spool_callback)(char *buffer, size_t len, time_t timestamp,
+		void *data);
+
+
+char *get_cmusfm_spool_file(void);
+int cmusfm_spool_append(const void *data, size_t len, time_t timestamp);
+int cmusfm_spool_ingest(cmusfm_spool_callback callback, void *data);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * cmusfm - standin.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+
+// Local stand-in of the scrobbler service endpoint. Every request is
+// answered with the successful (empty) response, optionally after the
+// given delay, so the server can be benchmarked without the network.
+// Requests which contain the given (URL-encoded) string are rejected with
+// the 'invalid parameters' error instead, e.g. to test cache submission.
+// Point the server to it with: service-url = "http://127.0.0.1:<port>/"
+
+static const char response[] = "HTTP/1.1 200 OK\r\n"
+	"Content-Type: text/xml; charset=utf-8\r\n"
+	"Content-Length: 47\r\n"
+	"Connection: close\r\n\r\n"
+	"<?xml version=\"1.0\"?>\n<lfm status=\"ok\">\n</lfm>\n";
+
+static const char response_rejected[] = "HTTP/1.1 200 OK\r\n"
+	"Content-Type: text/xml; charset=utf-8\r\n"
+	"Content-Length: 94\r\n"
+	"Connection: close\r\n\r\n"
+	"<?xml version=\"1.0\"?>\n<lfm status=\"failed\">\n"
+	"<error code=\"6\">Invalid parameters</error>\n</lfm>\n";
+
+// Read the whole HTTP request and return the API method name. If the
+// request contains the reject string, the rejected flag is set.
+static char *read_request(int fd, char *buffer, size_t size, const char *reject,
+		int *rejected) {
+
+	size_t len = 0, content_length = 0;
+	char *body = NULL, *ptr;
+	ssize_t rd_len;
+
+	while (len < size - 1) {
+		if ((rd_len = read(fd, buffer + len, size - 1 - len)) <= 0)
+			break;
+		len += rd_len;
+		buffer[len] = 0;
+
+		if (body == NULL && (body = strstr(buffer, "\r\n\r\n")) != NULL) {
+			body += 4;
+			if ((ptr = strstr(buffer, "Content-Length:")) != NULL)
+				content_length = atoi(ptr + 15);
+		}
+		if (body != NULL && (size_t)(buffer + len - body) >= content_length)
+			break;
+	}
+	buffer[len] = 0;
+
+	*rejected = reject != NULL && strstr(buffer, reject) != NULL;
+
+	if ((ptr = strstr(buffer, "method=")) == NULL)
+		return "unknown";
+	ptr += 7;
+	ptr[strcspn(ptr, "& \r\n")] = 0;
+	return ptr;
+}
+
+int main(int argc, char *argv[]) {
+
+	struct sockaddr_in addr;
+	struct timespec ts;
+	char buffer[65536];
+	unsigned long count = 0;
+	const char *reject, *method;
+	int sock, fd, delay, rejected, opt = 1;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <port> [delay-ms] [reject]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	delay = argc > 2 ? atoi(argv[2]) : 0;
+	reject = argc > 3 ? argv[3] : NULL;
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = (delay % 1000) * 1000000;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(argv[1]));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+			listen(sock, 16) == -1) {
+		perror("error: unable to listen");
+		return EXIT_FAILURE;
+	}
+
+	while ((fd = accept(sock, NULL, NULL)) != -1) {
+		method = read_request(fd, buffer, sizeof(buffer), reject, &rejected);
+		printf("%lu %s%s\n", ++count, method, rejected ? " rejected" : "");
+		fflush(stdout);
+		if (delay)
+			nanosleep(&ts, NULL);
+		if (rejected)
+			write(fd, response_rejected, sizeof(response_rejected) - 1);
+		else
+			write(fd, response, sizeof(response) - 1);
+		close(fd);
+	}
+
+	close(sock);
+	return EXIT_SUCCESS;
+}
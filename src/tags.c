@@ -0,0 +1,768 @@
+/*
+ * cmusfm - tags.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "tags.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "cmusfm.h"
+#include "debug.h"
+
+
+// maximal size of the Ogg comment packet which is taken into account
+#define TAGS_OGG_PACKET_SIZE (64 * 1024)
+
+#define be16(p) ((uint32_t)(p)[0] << 8 | (p)[1])
+#define be24(p) ((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2])
+#define be32(p) ((uint32_t)(p)[0] << 24 | be24((p) + 1))
+#define le32(p) ((uint32_t)(p)[3] << 24 | (uint32_t)(p)[2] << 16 | \
+		(uint32_t)(p)[1] << 8 | (p)[0])
+#define syncsafe32(p) ((uint32_t)(p)[0] << 21 | (uint32_t)(p)[1] << 14 | \
+		(uint32_t)(p)[2] << 7 | (p)[3])
+
+
+// Append UTF-8 encoded code point to the string. If there is no space for
+// the whole sequence (and the terminating NULL), -1 is returned.
+static int tags_put_utf8(char *str, size_t size, size_t *pos, uint32_t cp) {
+
+	char seq[4];
+	size_t len;
+
+	if (cp < 0x80)
+		seq[0] = cp, len = 1;
+	else if (cp < 0x800)
+		seq[0] = 0xC0 | cp >> 6, seq[1] = 0x80 | (cp & 0x3F), len = 2;
+	else if (cp < 0x10000)
+		seq[0] = 0xE0 | cp >> 12, seq[1] = 0x80 | (cp >> 6 & 0x3F),
+			seq[2] = 0x80 | (cp & 0x3F), len = 3;
+	else
+		seq[0] = 0xF0 | cp >> 18, seq[1] = 0x80 | (cp >> 12 & 0x3F),
+			seq[2] = 0x80 | (cp >> 6 & 0x3F), seq[3] = 0x80 | (cp & 0x3F), len = 4;
+
+	if (*pos + len >= size)
+		return -1;
+	memcpy(&str[*pos], seq, len);
+	*pos += len;
+	str[*pos] = '\0';
+	return 0;
+}
+
+// Set the string from the encoded text. Supported encodings are the ones
+// defined by the ID3v2: 0 - ISO-8859-1, 1 - UTF-16 with BOM, 2 - UTF-16BE
+// and 3 - UTF-8. Text is terminated by the NULL character or the length.
+static void tags_set_text(char *str, size_t size, const uint8_t *text, size_t len,
+		int encoding) {
+
+	size_t i, pos = 0;
+	uint32_t cp, cp2;
+	int be = 1;
+
+	str[0] = '\0';
+
+	switch (encoding) {
+	case 0:
+		for (i = 0; i < len && text[i]; i++)
+			if (tags_put_utf8(str, size, &pos, text[i]) == -1)
+				break;
+		break;
+	case 1:
+		if (len >= 2 && text[0] == 0xFF && text[1] == 0xFE)
+			be = 0;
+		if (len >= 2 && (text[0] == 0xFF || text[0] == 0xFE))
+			text += 2, len -= 2;
+		/* fall through */
+	case 2:
+		for (i = 0; i + 1 < len; i += 2) {
+			cp = be ? be16(&text[i]) : (uint32_t)text[i + 1] << 8 | text[i];
+			if (cp == 0)
+				break;
+			if (cp >= 0xD800 && cp < 0xDC00 && i + 3 < len) {
+				cp2 = be ? be16(&text[i + 2]) : (uint32_t)text[i + 3] << 8 | text[i + 2];
+				if (cp2 >= 0xDC00 && cp2 < 0xE000) {
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (cp2 - 0xDC00);
+					i += 2;
+				}
+			}
+			// unpaired surrogate is replaced with the replacement character
+			if (cp >= 0xD800 && cp < 0xE000)
+				cp = 0xFFFD;
+			if (tags_put_utf8(str, size, &pos, cp) == -1)
+				break;
+		}
+		break;
+	case 3:
+		for (i = 0; i < len && text[i]; i++)
+			continue;
+		// do not leave truncated multi-byte sequence at the end
+		if (i >= size) {
+			i = size - 1;
+			while (i > 0 && (text[i] & 0xC0) == 0x80)
+				i--;
+		}
+		memcpy(str, text, i);
+		str[i] = '\0';
+		break;
+	}
+}
+
+// Set the tag field (if not set already) identified by the Vorbis comment
+// field name. Names are matched case-insensitively.
+static void tags_set_vorbis_field(struct cmusfm_tags *tags, const uint8_t *name,
+		size_t name_len, const uint8_t *value, size_t value_len) {
+
+	static const struct {
+		const char *name;
+		size_t offset, size;
+	} fields[] = {
+		{ "ARTIST", offsetof(struct cmusfm_tags, artist), TAGS_STRING_SIZE },
+		{ "ALBUM", offsetof(struct cmusfm_tags, album), TAGS_STRING_SIZE },
+		{ "ALBUMARTIST", offsetof(struct cmusfm_tags, album_artist), TAGS_STRING_SIZE },
+		{ "ALBUM ARTIST", offsetof(struct cmusfm_tags, album_artist), TAGS_STRING_SIZE },
+		{ "TITLE", offsetof(struct cmusfm_tags, title), TAGS_STRING_SIZE },
+		{ "MUSICBRAINZ_TRACKID", offsetof(struct cmusfm_tags, mbid), sizeof(tags->mbid) },
+	};
+	char *str, number[8];
+	size_t i;
+
+	if (name_len == 11 && strncasecmp((char *)name, "TRACKNUMBER", 11) == 0) {
+		if (tags->track_number == 0) {
+			tags_set_text(number, sizeof(number), value, value_len, 3);
+			tags->track_number = atoi(number);
+		}
+		return;
+	}
+
+	for (i = 0; i < sizeof(fields) / sizeof(*fields); i++)
+		if (strlen(fields[i].name) == name_len &&
+				strncasecmp((char *)name, fields[i].name, name_len) == 0) {
+			str = (char *)tags + fields[i].offset;
+			if (str[0] == '\0')
+				tags_set_text(str, fields[i].size, value, value_len, 3);
+			return;
+		}
+}
+
+// Parse Vorbis comment structure (without the framing bit).
+static void tags_parse_vorbis_comment(const uint8_t *data, size_t size,
+		struct cmusfm_tags *tags) {
+
+	const uint8_t *value;
+	uint32_t len, count;
+	size_t pos;
+
+	if (size < 8 || (len = le32(data)) > size - 8)
+		return;
+	pos = 4 + len;
+	count = le32(&data[pos]);
+	pos += 4;
+
+	while (count-- && size - pos >= 4) {
+		len = le32(&data[pos]);
+		pos += 4;
+		if (len > size - pos)
+			break;
+		if ((value = memchr(&data[pos], '=', len)) != NULL)
+			tags_set_vorbis_field(tags, &data[pos], value - &data[pos],
+					value + 1, len - (value + 1 - &data[pos]));
+		pos += len;
+	}
+}
+
+// Parse FLAC metadata blocks - the stream marker is already checked.
+static void tags_parse_flac(const uint8_t *data, size_t size, struct cmusfm_tags *tags) {
+
+	size_t pos = 4;
+	uint32_t len;
+	int last = 0;
+
+	while (!last && size - pos >= 4) {
+		last = data[pos] & 0x80;
+		len = be24(&data[pos + 1]);
+		pos += 4;
+		if (len > size - pos)
+			len = size - pos;
+		// VORBIS_COMMENT block
+		if ((data[pos - 4] & 0x7F) == 4) {
+			tags_parse_vorbis_comment(&data[pos], len, tags);
+			break;
+		}
+		pos += len;
+	}
+}
+
+// Parse the comment header packet of the first logical Ogg bit-stream.
+// Packet can span many pages, so it is reassembled from the segments.
+static void tags_parse_ogg(const uint8_t *data, size_t size, struct cmusfm_tags *tags) {
+
+	uint8_t *packet;
+	size_t pos = 0, body, seg, len = 0;
+	unsigned int i, segments, index = 0;
+	uint32_t serial = le32(&data[14]);
+
+	if ((packet = malloc(TAGS_OGG_PACKET_SIZE)) == NULL)
+		return;
+
+	while (index < 2 && size - pos >= 27 && memcmp(&data[pos], "OggS", 4) == 0) {
+		segments = data[pos + 26];
+		if (size - pos - 27 < segments)
+			break;
+		body = pos + 27 + segments;
+		for (i = 0; i < segments && index < 2; i++) {
+			seg = data[pos + 27 + i];
+			if (seg > size - body)
+				goto final;
+			if (le32(&data[pos + 14]) == serial && index == 1) {
+				if (seg <= TAGS_OGG_PACKET_SIZE - len) {
+					memcpy(&packet[len], &data[body], seg);
+					len += seg;
+				}
+				else
+					index = 2;
+			}
+			// lacing value smaller than 255 terminates the packet
+			if (le32(&data[pos + 14]) == serial && seg < 255)
+				index++;
+			body += seg;
+		}
+		pos = body;
+	}
+
+final:
+	if (len >= 7 && memcmp(packet, "\x03vorbis", 7) == 0)
+		tags_parse_vorbis_comment(&packet[7], len - 7, tags);
+	else if (len >= 8 && memcmp(packet, "OpusTags", 8) == 0)
+		tags_parse_vorbis_comment(&packet[8], len - 8, tags);
+	free(packet);
+}
+
+// Parse ID3v2 (version 2.2, 2.3 or 2.4) tag. Returned value is the size of
+// the tag (including header and footer) or 0 if the tag is not valid.
+static size_t tags_parse_id3v2(const uint8_t *data, size_t size, struct cmusfm_tags *tags) {
+
+	const uint8_t *frame, *text;
+	size_t pos, end, hlen, flen, tlen, total;
+	unsigned int version = data[3];
+	char id[5] = "", number[8];
+	uint8_t flags = data[5], fflags;
+
+	if (size < 10 || version < 2 || version > 4 ||
+			(data[6] | data[7] | data[8] | data[9]) & 0x80)
+		return 0;
+
+	total = 10 + syncsafe32(&data[6]) + (flags & 0x10 ? 10 : 0);
+	end = 10 + syncsafe32(&data[6]);
+	if (end > size)
+		end = size;
+
+	// unsynchronisation of the whole tag is not supported
+	if (flags & 0x80)
+		return total;
+
+	pos = 10;
+	if (version >= 3 && flags & 0x40 && end - pos >= 4)
+		pos += version == 3 ? 4 + be32(&data[pos]) : syncsafe32(&data[pos]);
+
+	hlen = version == 2 ? 6 : 10;
+	while (pos < end && end - pos >= hlen && data[pos] != 0) {
+
+		if (version == 2) {
+			memcpy(id, &data[pos], 3);
+			id[3] = '\0';
+			flen = be24(&data[pos + 3]);
+		}
+		else {
+			memcpy(id, &data[pos], 4);
+			flen = version == 4 ? syncsafe32(&data[pos + 4]) : be32(&data[pos + 4]);
+		}
+
+		fflags = version == 2 ? 0 : data[pos + 9];
+		pos += hlen;
+		if (flen > end - pos)
+			break;
+		frame = &data[pos];
+		pos += flen;
+
+		// skip compressed, encrypted and unsynchronised frames
+		if ((version == 3 && fflags & 0xC0) || (version == 4 && fflags & 0x0E))
+			continue;
+		// grouping identity and data length indicator
+		if (((version == 3 && fflags & 0x20) || (version == 4 && fflags & 0x40)) && flen >= 1)
+			frame++, flen--;
+		if (version == 4 && fflags & 0x01 && flen >= 4)
+			frame += 4, flen -= 4;
+
+		if (flen < 1)
+			continue;
+
+		// UFID frame with the MusicBrainz recording identifier
+		if (strcmp(id, "UFID") == 0 || strcmp(id, "UFI") == 0) {
+			if (flen > 23 && memcmp(frame, "http://musicbrainz.org", 23) == 0 &&
+					tags->mbid[0] == '\0')
+				tags_set_text(tags->mbid, sizeof(tags->mbid), &frame[23], flen - 23, 0);
+			continue;
+		}
+
+		text = &frame[1];
+		tlen = flen - 1;
+		if (strcmp(id, "TPE1") == 0 || strcmp(id, "TP1") == 0) {
+			if (tags->artist[0] == '\0')
+				tags_set_text(tags->artist, sizeof(tags->artist), text, tlen, frame[0]);
+		}
+		else if (strcmp(id, "TPE2") == 0 || strcmp(id, "TP2") == 0) {
+			if (tags->album_artist[0] == '\0')
+				tags_set_text(tags->album_artist, sizeof(tags->album_artist), text, tlen, frame[0]);
+		}
+		else if (strcmp(id, "TALB") == 0 || strcmp(id, "TAL") == 0) {
+			if (tags->album[0] == '\0')
+				tags_set_text(tags->album, sizeof(tags->album), text, tlen, frame[0]);
+		}
+		else if (strcmp(id, "TIT2") == 0 || strcmp(id, "TT2") == 0) {
+			if (tags->title[0] == '\0')
+				tags_set_text(tags->title, sizeof(tags->title), text, tlen, frame[0]);
+		}
+		else if (strcmp(id, "TRCK") == 0 || strcmp(id, "TRK") == 0) {
+			if (tags->track_number == 0) {
+				tags_set_text(number, sizeof(number), text, tlen, frame[0]);
+				tags->track_number = atoi(number);
+			}
+		}
+
+	}
+
+	return total;
+}
+
+// Find MP4 atom of the given type within the container data.
+static const uint8_t *tags_mp4_find(const uint8_t *data, size_t size,
+		const char *type, size_t *len) {
+
+	size_t pos = 0;
+	uint64_t asize, hlen;
+
+	while (size - pos >= 8) {
+		asize = be32(&data[pos]);
+		hlen = 8;
+		if (asize == 1) {
+			if (size - pos < 16)
+				break;
+			asize = (uint64_t)be32(&data[pos + 8]) << 32 | be32(&data[pos + 12]);
+			hlen = 16;
+		}
+		else if (asize == 0)
+			asize = size - pos;
+		if (asize < hlen || asize > size - pos)
+			break;
+		if (memcmp(&data[pos + 4], type, 4) == 0) {
+			*len = asize - hlen;
+			return &data[pos + hlen];
+		}
+		pos += asize;
+	}
+
+	return NULL;
+}
+
+// Get the payload of the "data" atom of the MP4 metadata item.
+static const uint8_t *tags_mp4_data(const uint8_t *item, size_t size, size_t *len) {
+	const uint8_t *data;
+	// skip type indicator and locale
+	if ((data = tags_mp4_find(item, size, "data", len)) == NULL || *len < 8)
+		return NULL;
+	*len -= 8;
+	return data + 8;
+}
+
+// Parse iTunes-style metadata of the MP4 file.
+static void tags_parse_mp4(const uint8_t *data, size_t size, struct cmusfm_tags *tags) {
+
+	const uint8_t *atom, *value, *mean, *name;
+	size_t len, pos, asize, vlen, mlen, nlen;
+
+	if ((atom = tags_mp4_find(data, size, "moov", &len)) == NULL ||
+			(atom = tags_mp4_find(atom, len, "udta", &len)) == NULL ||
+			(atom = tags_mp4_find(atom, len, "meta", &len)) == NULL)
+		return;
+	// meta atom is a full atom (with version and flags) in the ISO format,
+	// but not in the QuickTime one
+	if (len >= 8 && memcmp(&atom[4], "hdlr", 4) != 0)
+		atom += 4, len -= 4;
+	if ((atom = tags_mp4_find(atom, len, "ilst", &len)) == NULL)
+		return;
+
+	for (pos = 0; len - pos >= 8; pos += asize) {
+		asize = be32(&atom[pos]);
+		if (asize < 8 || asize > len - pos)
+			break;
+		if ((value = tags_mp4_data(&atom[pos + 8], asize - 8, &vlen)) == NULL)
+			continue;
+
+		if (memcmp(&atom[pos + 4], "\xA9" "ART", 4) == 0 && tags->artist[0] == '\0')
+			tags_set_text(tags->artist, sizeof(tags->artist), value, vlen, 3);
+		else if (memcmp(&atom[pos + 4], "aART", 4) == 0 && tags->album_artist[0] == '\0')
+			tags_set_text(tags->album_artist, sizeof(tags->album_artist), value, vlen, 3);
+		else if (memcmp(&atom[pos + 4], "\xA9" "alb", 4) == 0 && tags->album[0] == '\0')
+			tags_set_text(tags->album, sizeof(tags->album), value, vlen, 3);
+		else if (memcmp(&atom[pos + 4], "\xA9" "nam", 4) == 0 && tags->title[0] == '\0')
+			tags_set_text(tags->title, sizeof(tags->title), value, vlen, 3);
+		else if (memcmp(&atom[pos + 4], "trkn", 4) == 0 && vlen >= 4)
+			tags->track_number = be16(&value[2]);
+		else if (memcmp(&atom[pos + 4], "----", 4) == 0) {
+			// free-form item identified by the mean and name atoms
+			if ((mean = tags_mp4_find(&atom[pos + 8], asize - 8, "mean", &mlen)) == NULL ||
+					(name = tags_mp4_find(&atom[pos + 8], asize - 8, "name", &nlen)) == NULL ||
+					mlen != 4 + 16 || memcmp(&mean[4], "com.apple.iTunes", 16) != 0 ||
+					nlen != 4 + 20 || memcmp(&name[4], "MusicBrainz Track Id", 20) != 0)
+				continue;
+			if (tags->mbid[0] == '\0')
+				tags_set_text(tags->mbid, sizeof(tags->mbid), value, vlen, 3);
+		}
+	}
+}
+
+// Parse tags from the beginning of the audio file data. If no known tag
+// was found, -1 is returned.
+int cmusfm_tags_parse(const void *buffer, size_t size, struct cmusfm_tags *tags) {
+
+	const uint8_t *data = buffer;
+	size_t len;
+
+	memset(tags, 0, sizeof(*tags));
+
+	if (size >= 10 && memcmp(data, "ID3", 3) == 0) {
+		len = tags_parse_id3v2(data, size, tags);
+		// ID3v2 tag might be prepended to the FLAC stream as well
+		if (len > 0 && len < size && size - len >= 4 && memcmp(&data[len], "fLaC", 4) == 0)
+			tags_parse_flac(&data[len], size - len, tags);
+	}
+	else if (size >= 4 && memcmp(data, "fLaC", 4) == 0)
+		tags_parse_flac(data, size, tags);
+	else if (size >= 27 && memcmp(data, "OggS", 4) == 0)
+		tags_parse_ogg(data, size, tags);
+	else if (size >= 8 && memcmp(&data[4], "ftyp", 4) == 0)
+		tags_parse_mp4(data, size, tags);
+
+	if (tags->artist[0] || tags->album[0] || tags->album_artist[0] ||
+			tags->title[0] || tags->mbid[0] || tags->track_number)
+		return 0;
+	return -1;
+}
+
+// Read tags from the audio file. File is memory-mapped, so only pages with
+// the tag data are read from the disk.
+int cmusfm_tags_read(const char *fname, struct cmusfm_tags *tags) {
+
+	struct stat st;
+	void *data;
+	int fd, status;
+
+	debug("tags read: %s", fname);
+
+	if ((fd = open(fname, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || st.st_size == 0 ||
+			(data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+	status = cmusfm_tags_parse(data, st.st_size, tags);
+	munmap(data, st.st_size);
+
+	return status;
+}
+
+// Opened (and exclusively locked) tags index file.
+struct tags_index {
+	int fd;
+	size_t size;
+	struct cmusfm_tags_header *header;
+};
+
+static struct cmusfm_tags_slot *get_tags_table(struct tags_index *idx) {
+	return (struct cmusfm_tags_slot *)&idx->header[1];
+}
+
+// Map the index file with the given size (file is resized if needed).
+static int tags_index_map(struct tags_index *idx, size_t size) {
+
+	if (idx->header != NULL)
+		munmap(idx->header, idx->size);
+	idx->header = NULL;
+
+	if (ftruncate(idx->fd, size) == -1 ||
+			(idx->header = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					MAP_SHARED, idx->fd, 0)) == MAP_FAILED) {
+		idx->header = NULL;
+		return -1;
+	}
+
+	idx->size = size;
+	return 0;
+}
+
+// Initialize empty index with the given number of slots.
+static int tags_index_reset(struct tags_index *idx, uint32_t slots) {
+
+	size_t size = sizeof(*idx->header) + slots * sizeof(struct cmusfm_tags_slot);
+
+	debug("tags index reset: %u", slots);
+
+	if (idx->header != NULL)
+		munmap(idx->header, idx->size);
+	idx->header = NULL;
+
+	// drop old content, so the table is filled with zeros
+	if (ftruncate(idx->fd, 0) == -1 || tags_index_map(idx, size) == -1)
+		return -1;
+
+	idx->header->signature = CMUSFM_TAGS_SIGNATURE;
+	idx->header->version = CMUSFM_TAGS_VERSION;
+	idx->header->slots = slots;
+	idx->header->used = 0;
+	idx->header->size = size;
+	idx->header->dead = 0;
+	return 0;
+}
+
+static int tags_index_open(struct tags_index *idx) {
+
+	struct cmusfm_tags_header *h;
+	struct stat st;
+
+	memset(idx, 0, sizeof(*idx));
+	if ((idx->fd = open(get_cmusfm_tags_file(), O_RDWR | O_CREAT, 0600)) == -1)
+		return -1;
+	if (flock(idx->fd, LOCK_EX) == -1 || fstat(idx->fd, &st) == -1)
+		goto fail;
+
+	if ((size_t)st.st_size < sizeof(*h)) {
+		if (tags_index_reset(idx, TAGS_INDEX_SLOTS) == -1)
+			goto fail;
+		return 0;
+	}
+
+	if (tags_index_map(idx, st.st_size) == -1)
+		goto fail;
+
+	h = idx->header;
+	if (h->signature != CMUSFM_TAGS_SIGNATURE || h->version != CMUSFM_TAGS_VERSION ||
+			h->slots == 0 || (h->slots & (h->slots - 1)) != 0 || h->used > h->slots ||
+			h->size > idx->size || h->size < sizeof(*h) + (uint64_t)h->slots * sizeof(struct cmusfm_tags_slot) ||
+			h->dead > h->size)
+		if (tags_index_reset(idx, TAGS_INDEX_SLOTS) == -1)
+			goto fail;
+
+	return 0;
+
+fail:
+	if (idx->header != NULL)
+		munmap(idx->header, idx->size);
+	close(idx->fd);
+	return -1;
+}
+
+static void tags_index_close(struct tags_index *idx) {
+	if (idx->header != NULL)
+		munmap(idx->header, idx->size);
+	close(idx->fd);
+}
+
+// Return the slot which holds the given file or the first free one.
+static struct cmusfm_tags_slot *tags_index_lookup(struct tags_index *idx,
+		uint64_t dev, uint64_t ino) {
+
+	struct cmusfm_tags_slot *table = get_tags_table(idx);
+	uint32_t mask = idx->header->slots - 1;
+	uint32_t i = ((dev * 0x9E3779B97F4A7C15ULL) ^ ino) * 0x9E3779B97F4A7C15ULL >> 32 & mask;
+
+	while (table[i].offset != 0 && (table[i].dev != dev || table[i].ino != ino))
+		i = (i + 1) & mask;
+	return &table[i];
+}
+
+// Get the record of the slot. If the record is not valid, NULL is returned.
+static struct cmusfm_cache_record *tags_index_record(struct tags_index *idx,
+		const struct cmusfm_tags_slot *slot) {
+
+	struct cmusfm_cache_record *record;
+
+	if (slot->offset < sizeof(*idx->header) ||
+			slot->offset > idx->header->size - sizeof(*record))
+		return NULL;
+	record = (struct cmusfm_cache_record *)((char *)idx->header + slot->offset);
+	if (record->signature != CMUSFM_CACHE_SIGNATURE ||
+			get_cache_record_size(record) > idx->header->size - slot->offset)
+		return NULL;
+	return record;
+}
+
+// Append the record and update the slot of the given file. Replaced record
+// is accounted as the dead one.
+static int tags_index_store(struct tags_index *idx, const struct cmusfm_tags_slot *key,
+		const struct cmusfm_cache_record *record) {
+
+	struct cmusfm_tags_slot *slot;
+	struct cmusfm_cache_record *old;
+	size_t size = get_cache_record_size(record);
+	uint64_t offset = idx->header->size;
+
+	if (tags_index_map(idx, offset + size) == -1)
+		return -1;
+	memcpy((char *)idx->header + offset, record, size);
+	idx->header->size += size;
+
+	slot = tags_index_lookup(idx, key->dev, key->ino);
+	if (slot->offset == 0)
+		idx->header->used++;
+	else if ((old = tags_index_record(idx, slot)) != NULL)
+		idx->header->dead += get_cache_record_size(old);
+	memcpy(slot, key, sizeof(*slot));
+	slot->offset = offset;
+
+	return 0;
+}
+
+// Rebuild the index with the given number of hash table slots. Only the
+// current records are copied into the new index.
+static int tags_index_rebuild(struct tags_index *idx, uint32_t slots) {
+
+	struct cmusfm_tags_header *old;
+	struct cmusfm_tags_slot *table;
+	struct cmusfm_cache_record *record;
+	struct tags_index tmp = { idx->fd, idx->size, idx->header };
+	uint32_t i;
+	int status = 0;
+
+	// copy of the old index is kept in the memory
+	if ((old = malloc(idx->size)) == NULL)
+		return -1;
+	memcpy(old, idx->header, idx->size);
+	tmp.header = old;
+
+	if (tags_index_reset(idx, slots) == -1) {
+		free(old);
+		return -1;
+	}
+
+	table = get_tags_table(&tmp);
+	for (i = 0; status == 0 && i < old->slots; i++)
+		if (table[i].offset != 0 && (record = tags_index_record(&tmp, &table[i])) != NULL)
+			status = tags_index_store(idx, &table[i], record);
+
+	free(old);
+	return status;
+}
+
+// Get tags of the audio file. Tags are read from the index if the file has
+// not been modified since, otherwise file is parsed and the index updated.
+int cmusfm_tags_get(const char *fname, struct cmusfm_tags *tags) {
+
+	struct tags_index idx;
+	struct cmusfm_tags_slot key = { 0 }, *slot;
+	struct cmusfm_cache_record *record;
+	scrobbler_trackinfo_t sb_tinf;
+	struct stat st;
+	int status;
+
+	if (stat(fname, &st) == -1)
+		return -1;
+
+	key.dev = st.st_dev;
+	key.ino = st.st_ino;
+	key.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	key.fsize = st.st_size;
+
+	if (tags_index_open(&idx) == -1)
+		return cmusfm_tags_read(fname, tags);
+
+	slot = tags_index_lookup(&idx, key.dev, key.ino);
+	if (slot->offset != 0 && slot->mtime == key.mtime && slot->fsize == key.fsize &&
+			(record = tags_index_record(&idx, slot)) != NULL &&
+			get_cache_record_trackinfo(record, &sb_tinf) == 0) {
+
+		debug("tags index hit: %s", fname);
+		memset(tags, 0, sizeof(*tags));
+		if (sb_tinf.artist)
+			strncpy(tags->artist, sb_tinf.artist, sizeof(tags->artist) - 1);
+		if (sb_tinf.album)
+			strncpy(tags->album, sb_tinf.album, sizeof(tags->album) - 1);
+		if (sb_tinf.album_artist)
+			strncpy(tags->album_artist, sb_tinf.album_artist, sizeof(tags->album_artist) - 1);
+		if (sb_tinf.track)
+			strncpy(tags->title, sb_tinf.track, sizeof(tags->title) - 1);
+		if (sb_tinf.mbid)
+			strncpy(tags->mbid, sb_tinf.mbid, sizeof(tags->mbid) - 1);
+		tags->track_number = sb_tinf.track_number;
+
+		// empty record is stored for files without tags
+		status = record->artist_len || record->album_len || record->album_artist_len ||
+			record->track_len || record->mbid_len || record->track_number ? 0 : -1;
+		tags_index_close(&idx);
+		return status;
+	}
+
+	status = cmusfm_tags_read(fname, tags);
+
+	memset(&sb_tinf, 0, sizeof(sb_tinf));
+	if (status == 0) {
+		sb_tinf.artist = tags->artist[0] ? tags->artist : NULL;
+		sb_tinf.album = tags->album[0] ? tags->album : NULL;
+		sb_tinf.album_artist = tags->album_artist[0] ? tags->album_artist : NULL;
+		sb_tinf.track = tags->title[0] ? tags->title : NULL;
+		sb_tinf.mbid = tags->mbid[0] ? tags->mbid : NULL;
+		sb_tinf.track_number = tags->track_number;
+	}
+
+	if (slot->offset == 0 && (idx.header->used + 1) * 4 > idx.header->slots * 3)
+		tags_index_rebuild(&idx, idx.header->slots * 2);
+	// records of modified (e.g. re-tagged) files are never reused
+	else if (idx.header->dead * 2 > idx.header->size)
+		tags_index_rebuild(&idx, idx.header->slots);
+
+	if (idx.header != NULL) {
+		record = get_cache_record(&sb_tinf);
+		tags_index_store(&idx, &key, record);
+		free(record);
+	}
+
+	tags_index_close(&idx);
+	return status;
+}
+
+// Helper function for retrieving cmusfm tags index file.
+char *get_cmusfm_tags_file(void) {
+	static char fname[128];
+	sprintf(fname, "%s/" TAGS_FNAME, get_cmus_home_dir());
+	return fname;
+}
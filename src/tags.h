@@ -0,0 +1,78 @@
+/*
+ * cmusfm - tags.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_TAGS_H
+#define __CMUSFM_TAGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define CMUSFM_TAGS_SIGNATURE 0x47544d43
+#define CMUSFM_TAGS_VERSION 2
+
+// initial number of the index hash table slots (power of 2)
+#define TAGS_INDEX_SLOTS 1024
+
+#define TAGS_STRING_SIZE 128
+
+// Tags index is a memory-mapped hash table of the file identities (device,
+// inode, modification time and size) followed by the tag records. Records
+// are stored in the cache record format (see cache.h) and are appended at
+// the end of the file. Files without tags have an empty record, so they
+// are not parsed again. The index is rebuilt with the doubled table when
+// it is filled in more than 3/4. Records of modified files are replaced by
+// the new ones, so the index is also compacted when such dead records take
+// more than a half of the file.
+
+struct __attribute__((__packed__)) cmusfm_tags_header {
+	uint32_t signature, version;
+	uint32_t slots, used;
+	uint64_t size;  // end of the last record
+	uint64_t dead;  // size of the replaced records
+	//struct cmusfm_tags_slot table[slots];
+	//struct cmusfm_cache_record records[];
+};
+
+struct __attribute__((__packed__)) cmusfm_tags_slot {
+	uint64_t dev, ino;
+	int64_t mtime;  // modification time (in nanoseconds)
+	uint64_t fsize;
+	uint64_t offset;  // record offset (zero for an empty slot)
+};
+
+// track information read from the ID3v2, Vorbis comment (Ogg and FLAC)
+// or MP4 tags - all strings are UTF-8 encoded
+struct cmusfm_tags {
+	char artist[TAGS_STRING_SIZE];
+	char album[TAGS_STRING_SIZE];
+	char album_artist[TAGS_STRING_SIZE];
+	char title[TAGS_STRING_SIZE];
+	char mbid[64];  // MusicBrainz recording identifier
+	unsigned int track_number;
+};
+
+
+char *get_cmusfm_tags_file(void);
+int cmusfm_tags_parse(const void *data, size_t size, struct cmusfm_tags *tags);
+int cmusfm_tags_read(const char *fname, struct cmusfm_tags *tags);
+int cmusfm_tags_get(const char *fname, struct cmusfm_tags *tags);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * cmusfm - trace.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "trace.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmusfm.h"
+#include "debug.h"
+
+
+static struct cmusfm_trace_record trace_ring[TRACE_RING_SIZE];
+static unsigned int trace_head = 0;
+
+
+// Get the current time of the given clock in nanoseconds.
+static uint64_t get_clock_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Write the event record into the ring buffer. The oldest record is
+// overwritten when the buffer is full. Tag is truncated if needed.
+void cmusfm_trace(enum trace_event event, int arg, uint64_t value, const char *tag) {
+
+	struct cmusfm_trace_record *rec;
+	unsigned int i;
+
+	// reserve the slot, so writers do not have to synchronize
+	i = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	rec = &trace_ring[i & (TRACE_RING_SIZE - 1)];
+
+	rec->timestamp = get_clock_ns(CLOCK_MONOTONIC);
+	rec->arg = arg;
+	rec->value = value;
+	if (tag != NULL)
+		strncpy(rec->tag, tag, sizeof(rec->tag));
+	else
+		rec->tag[0] = 0;
+	__atomic_store_n(&rec->event, event, __ATOMIC_RELEASE);
+}
+
+// Dump the content of the ring buffer into the file.
+int cmusfm_trace_dump(const char *fname) {
+
+	struct cmusfm_trace_header header;
+	unsigned int i, head;
+	char tmp[256];
+	FILE *f;
+
+	debug("trace dump: %s", fname);
+
+	head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+
+	header.signature = CMUSFM_TRACE_SIGNATURE;
+	header.version = CMUSFM_TRACE_VERSION;
+	header.count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+	header.realtime_offset = get_clock_ns(CLOCK_REALTIME) - get_clock_ns(CLOCK_MONOTONIC);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	if ((f = fopen(tmp, "w")) == NULL)
+		return -1;
+
+	fwrite(&header, sizeof(header), 1, f);
+	for (i = head - header.count; i != head; i++)
+		fwrite(&trace_ring[i & (TRACE_RING_SIZE - 1)], sizeof(*trace_ring), 1, f);
+
+	if (ferror(f) | fclose(f)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return rename(tmp, fname);
+}
+
+// Print the trace dump file in the human readable form.
+int cmusfm_trace_print(FILE *f, const char *fname) {
+
+	static const char *names[] = { "?", "event", "state", "http-start",
+		"http-end", "cache-append", "cache-submit" };
+	struct cmusfm_trace_header header;
+	struct cmusfm_trace_record rec;
+	uint64_t first = 0;
+	char tag[sizeof(rec.tag) + 1];
+	char tstr[32];
+	time_t sec;
+	FILE *ft;
+
+	if ((ft = fopen(fname, "r")) == NULL)
+		return -1;
+
+	if (fread(&header, sizeof(header), 1, ft) != 1 ||
+			header.signature != CMUSFM_TRACE_SIGNATURE ||
+			header.version != CMUSFM_TRACE_VERSION) {
+		fclose(ft);
+		return -1;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, ft) == 1) {
+		if (first == 0)
+			first = rec.timestamp;
+		sec = (rec.timestamp + header.realtime_offset) / 1000000000;
+		strftime(tstr, sizeof(tstr), "%F %T", localtime(&sec));
+		memcpy(tag, rec.tag, sizeof(rec.tag));
+		tag[sizeof(rec.tag)] = 0;
+		fprintf(f, "%s +%.6f %-12s %d %llu %s\n", tstr,
+				(rec.timestamp - first) / 1e9,
+				rec.event < sizeof(names) / sizeof(*names) ? names[rec.event] : names[0],
+				rec.arg, (unsigned long long)rec.value, tag);
+	}
+
+	return fclose(ft);
+}
+
+// Helper function for retrieving cmusfm trace dump file.
+char *get_cmusfm_trace_file(void) {
+	static char fname[128];
+	sprintf(fname, "%s/" TRACE_FNAME, get_cmus_home_dir());
+	return fname;
+}
@@ -0,0 +1,68 @@
+/*
+ * cmusfm - trace.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_TRACE_H
+#define __CMUSFM_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+#define CMUSFM_TRACE_SIGNATURE 0x52544d43
+#define CMUSFM_TRACE_VERSION 1
+
+// number of records kept in the ring buffer (power of two)
+#define TRACE_RING_SIZE 4096
+
+enum trace_event {
+	TRACE_EVENT_RECEIVED = 1,  // arg: status, value: data length, tag: client
+	TRACE_STATE_CHANGE,  // arg: new status, value: track identity, tag: client
+	TRACE_HTTP_START,  // tag: API method
+	TRACE_HTTP_END,  // arg: result, value: latency (us), tag: API method
+	TRACE_CACHE_APPEND,  // value: record size
+	TRACE_CACHE_SUBMIT,  // arg: result, value: number of records
+};
+
+// Trace records are written into the in-memory ring buffer, which is
+// dumped into the file on demand. Timestamps are taken from the monotonic
+// clock, the dump header contains the offset to the real time.
+
+struct __attribute__((__packed__)) cmusfm_trace_record {
+	uint64_t timestamp;  // nanoseconds (monotonic clock)
+	uint32_t event;  // zero for an empty record
+	int32_t arg;
+	uint64_t value;
+	char tag[24];
+};
+
+struct __attribute__((__packed__)) cmusfm_trace_header {
+	uint32_t signature, version;
+	uint32_t count;  // number of records (oldest first)
+	int64_t realtime_offset;  // add to timestamp to get the real time
+	//struct cmusfm_trace_record records[count];
+};
+
+
+char *get_cmusfm_trace_file(void);
+void cmusfm_trace(enum trace_event event, int arg, uint64_t value, const char *tag);
+int cmusfm_trace_dump(const char *fname);
+int cmusfm_trace_print(FILE *f, const char *fname);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * cmusfm - track.c
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include "track.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+#define TRACK_HASH_SEED 0x9E3779B97F4A7C15ULL
+#define TRACK_HASH_C1 0x87C37B91114253D5ULL
+#define TRACK_HASH_C2 0x4CF5AD432745937FULL
+
+
+// Copy given string into the destination buffer in the canonical form:
+// ASCII letters are lower-cased, every run of white-space (and control)
+// characters is replaced by a single space, leading and trailing ones are
+// removed. Destination buffer has to be at least strlen(src) + 1 long.
+// Return the length of the canonical string.
+size_t get_canonical_string(char *dest, const char *src) {
+
+	size_t i, len = strlen(src);
+	char *ptr = dest;
+	int space = 0;
+
+	for (i = 0; i < len; ) {
+
+#ifdef __SSE2__
+		// process block of 16 characters at once if there is no white-space
+		if (i + 16 <= len) {
+			__m128i data = _mm_loadu_si128((const __m128i *)&src[i]);
+			__m128i ws = _mm_cmpeq_epi8(_mm_min_epu8(data, _mm_set1_epi8(0x20)), data);
+			if (_mm_movemask_epi8(ws) == 0) {
+				__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(data, _mm_set1_epi8('A' - 1)),
+						_mm_cmplt_epi8(data, _mm_set1_epi8('Z' + 1)));
+				if (space) {
+					*ptr++ = ' ';
+					space = 0;
+				}
+				data = _mm_add_epi8(data, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+				_mm_storeu_si128((__m128i *)ptr, data);
+				ptr += 16;
+				i += 16;
+				continue;
+			}
+		}
+#endif
+
+		if ((unsigned char)src[i] <= 0x20)
+			// leading white-spaces are simply skipped
+			space = ptr != dest;
+		else {
+			if (space) {
+				*ptr++ = ' ';
+				space = 0;
+			}
+			*ptr++ = src[i] >= 'A' && src[i] <= 'Z' ? src[i] + 0x20 : src[i];
+		}
+		i++;
+	}
+
+	*ptr = 0;
+	return ptr - dest;
+}
+
+static uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+// Mix one 64-bit word into the hash state (MurmurHash3 round).
+static uint64_t hash_round(uint64_t hash, uint64_t word) {
+	word *= TRACK_HASH_C1;
+	word = rotl64(word, 31);
+	word *= TRACK_HASH_C2;
+	hash ^= word;
+	return rotl64(hash, 27) * 5 + 0x52DCE729;
+}
+
+// Final avalanche of the hash state (MurmurHash3 finalizer).
+static uint64_t hash_finalize(uint64_t hash) {
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+// Mix data block into the hash state - data is consumed word by word.
+static uint64_t hash_data(uint64_t hash, const char *data, size_t len) {
+
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&word, &data[i], sizeof(word));
+		hash = hash_round(hash, word);
+	}
+
+	// the length is mixed with the tail, so field boundaries are unambiguous
+	word = 0;
+	memcpy(&word, &data[i], len - i);
+	return hash_round(hash_round(hash, word), len);
+}
+
+// Calculate the track identity from the given track information.
+cmusfm_track_id_t cmusfm_track_id(const char *artist, const char *album,
+		const char *title, unsigned int duration) {
+
+	const char *fields[] = { artist, album, title };
+	char buffer[512], *tmp;
+	uint64_t hash = TRACK_HASH_SEED;
+	size_t i, len;
+
+	for (i = 0; i < sizeof(fields) / sizeof(*fields); i++) {
+
+		if (fields[i] == NULL) {
+			hash = hash_data(hash, "", 0);
+			continue;
+		}
+
+		if ((len = strlen(fields[i])) < sizeof(buffer))
+			tmp = buffer;
+		else if ((tmp = malloc(len + 1)) == NULL)
+			return 0;
+
+		len = get_canonical_string(tmp, fields[i]);
+		hash = hash_data(hash, tmp, len);
+
+		if (tmp != buffer)
+			free(tmp);
+	}
+
+	return hash_finalize(hash_round(hash, duration));
+}
+
+// Calculate the track identity of the scrobbler track info structure.
+cmusfm_track_id_t cmusfm_track_id_sbt(const scrobbler_trackinfo_t *sb_tinf) {
+	return cmusfm_track_id(sb_tinf->artist, sb_tinf->album, sb_tinf->track,
+			sb_tinf->duration);
+}
@@ -0,0 +1,41 @@
+/*
+ * cmusfm - track.h
+ * Copyright (c) 2014 Arkadiusz Bokowy
+ *
+ * This file is a part of a cmusfm.
+ *
+ * cmusfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cmusfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * If you want to read full version of the GNU General Public License
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMUSFM_TRACK_H
+#define __CMUSFM_TRACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libscrobbler2.h"
+
+
+// Track identity is a 64-bit hash of the canonical form of the artist,
+// album and title (ASCII letters are lower-cased, white-space runs are
+// collapsed and trimmed) and the duration. NULL strings are treated as
+// empty ones, so passing NULL album and zero duration gives a coarser
+// identity, which does not depend on the release.
+typedef uint64_t cmusfm_track_id_t;
+
+size_t get_canonical_string(char *dest, const char *src);
+cmusfm_track_id_t cmusfm_track_id(const char *artist, const char *album,
+		const char *title, unsigned int duration);
+cmusfm_track_id_t cmusfm_track_id_sbt(const scrobbler_trackinfo_t *sb_tinf);
+
+#endif
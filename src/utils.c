@@ -22,9 +22,11 @@
 #include "../config.h"
 #endif
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <regex.h>
 #ifdef ENABLE_LIBNOTIFY
 #include <dirent.h>
@@ -33,8 +35,37 @@
 
 #include "cmusfm.h"
 #include "debug.h"
+#include "server.h"
 
 
+// Validate the socket data, which might come from an untrusted source (e.g.
+// the relay connection, the spool or the record file). String offsets have
+// to point into the data in the order of strings, and every string has to
+// be terminated before the next one starts. Returns 0 if data is valid.
+int cmusfm_sock_data_check(const char *buffer, size_t len) {
+
+	const struct sock_data_tag *dt = (const struct sock_data_tag *)buffer;
+	const char *data = buffer + sizeof(*dt);
+	size_t size;
+
+	if (len < sizeof(*dt) || len > CMSOCKET_BUFFER_SIZE)
+		return -1;
+	size = len - sizeof(*dt);
+
+	if (dt->alboff < 0 || dt->alboff > dt->titoff || dt->titoff > dt->locoff ||
+			(size_t)dt->locoff >= size)
+		return -1;
+
+	// artist, album, title and location (optional fields follow it)
+	if (memchr(data, '\0', dt->alboff) == NULL ||
+			memchr(&data[dt->alboff], '\0', dt->titoff - dt->alboff) == NULL ||
+			memchr(&data[dt->titoff], '\0', dt->locoff - dt->titoff) == NULL ||
+			memchr(&data[dt->locoff], '\0', size - dt->locoff) == NULL)
+		return -1;
+
+	return 0;
+}
+
 // Helper function for retrieving cmus configuration home path.
 char *get_cmus_home_dir(void) {
 
@@ -106,58 +137,449 @@ char *get_album_cover_file(const char *location, const char *format) {
 }
 #endif
 
-// Get track information substrings from the given string. Matching is done
-// according to the provided format, which is a ERE pattern with customized
-// placeholders. Placeholder is defined as a marked subexpression with the
-// `?X` marker, where X can be one the following characters:
-//   A - artist, B - album, T - title, N - track number
-//   e.g.: ^(?A.+) - (?N[:digits:]+)\. (?T.+)$
-// In order to get a single match structure, one should use `get_regexp_match`
-// function. When matches are not longer needed, is should be freed by the
-// standard `free` function. When something goes wrong, NULL is returned.
-struct format_match *get_regexp_format_matches(const char *str, const char *format) {
-#define MATCHES_SIZE FORMAT_MATCH_TYPE_COUNT + 1
+// Compiled form of the format, which consists of placeholders separated by
+// literal strings only, e.g.: ^(?A.+) - (?T.+)\.[^.]+$
+// Such a format can be matched without the regular expression engine.
+struct format_plan {
+	unsigned int count;
+	char types[FORMAT_MATCH_TYPE_COUNT];
+	size_t minlen[FORMAT_MATCH_TYPE_COUNT];
+	// literal preceding every placeholder plus the trailing one
+	char literals[FORMAT_MATCH_TYPE_COUNT + 1][32];
+	size_t lengths[FORMAT_MATCH_TYPE_COUNT + 1];
+	// format ends with the file extension match: \.[^.]+$
+	int extension;
+};
+
+// Parse literal string (with escaped special characters) from the format.
+// Return pointer to the first not consumed character or NULL if the format
+// contains anything not supported by the plan.
+static const char *format_plan_literal(const char *p, char *literal, size_t *length) {
+
+	static const char *specials = ".[]()*+?{}|^$\\";
+	size_t len = 0;
+
+	while (*p && !(p[0] == '(' && p[1] == '?') && !(p[0] == '$' && p[1] == '\0')) {
+		if (p[0] == '\\' && p[1] && strchr(specials, p[1]))
+			p++;
+		else if (*p < 0x20 || *p > 0x7e || strchr(specials, *p))
+			return NULL;
+		if (len == 31)
+			return NULL;
+		literal[len++] = *p++;
+	}
+
+	literal[len] = '\0';
+	*length = len;
+	return p;
+}
+
+// Compile the format into the plan. On success 0 is returned, otherwise
+// the format has to be matched by the regular expression engine.
+static int format_plan_compile(const char *format, struct format_plan *plan) {
 
-	struct format_match *matches;
 	const char *p = format;
-	char *regexp;
-	int status, i = 0;
-	regex_t regex;
-	regmatch_t regmatch[MATCHES_SIZE];
 
-	debug("matching: %s: %s", format, str);
+	memset(plan, 0, sizeof(*plan));
+	if (*p++ != '^')
+		return -1;
 
-	// allocate memory for up to FORMAT_MATCH_TYPE_COUNT matches
-	// with one extra always empty terminating structure
-	matches = (struct format_match *)calloc(MATCHES_SIZE, sizeof(*matches));
+	for (;;) {
+		if ((p = format_plan_literal(p, plan->literals[plan->count],
+						&plan->lengths[plan->count])) == NULL)
+			return -1;
+		if (*p == '$')
+			break;
+		if (*p == '\0')
+			return -1;
+		// placeholders have to be separated by a non-empty literal
+		if (plan->count == FORMAT_MATCH_TYPE_COUNT ||
+				(plan->count > 0 && plan->lengths[plan->count] == 0))
+			return -1;
+		if (p[2] == '\0' || p[3] != '.' || (p[4] != '+' && p[4] != '*') || p[5] != ')')
+			return -1;
+		plan->types[plan->count] = p[2];
+		plan->minlen[plan->count] = p[4] == '+' ? 1 : 0;
+		plan->count++;
+		p += 6;
+		if (strcmp(p, "\\.[^.]+$") == 0) {
+			plan->extension = 1;
+			break;
+		}
+	}
+
+	return plan->count > 0 ? 0 : -1;
+}
+
+// Find the last occurrence of the literal (case-insensitive) in the buffer.
+static const char *format_plan_rsearch(const char *buf, size_t len,
+		const char *literal, size_t length) {
+
+	const char *p, *last = NULL;
+
+	if (length > len)
+		return NULL;
+	len -= length - 1;
+
+	if (isalpha(literal[0])) {
+		while (len--)
+			if (strncasecmp(&buf[len], literal, length) == 0)
+				return &buf[len];
+		return NULL;
+	}
+
+	for (p = buf; (p = memchr(p, literal[0], len - (p - buf))) != NULL; p++)
+		if (strncasecmp(p, literal, length) == 0)
+			last = p;
+	return last;
+}
+
+// Match the string according to the compiled plan. The result is the same
+// as the one of the POSIX leftmost-longest matching rule - every placeholder
+// takes as much as possible, provided that the remaining ones still match.
+static int format_plan_match(const struct format_plan *plan, const char *str,
+		struct format_match *matches) {
+
+	size_t begin, end, bound, len = strlen(str);
+	const char *p;
+	unsigned int i;
+
+	begin = plan->lengths[0];
+	if (len < begin || strncasecmp(str, plan->literals[0], begin) != 0)
+		return -1;
+
+	if (plan->extension) {
+		if ((p = strrchr(str, '.')) == NULL || p[1] == '\0')
+			return -1;
+		end = p - str;
+	}
+	else {
+		i = plan->count;
+		if (len < begin + plan->lengths[i] ||
+				strncasecmp(&str[len - plan->lengths[i]], plan->literals[i], plan->lengths[i]) != 0)
+			return -1;
+		end = len - plan->lengths[i];
+	}
+
+	if (end < begin)
+		return -1;
+
+	// place separators from the right, each one as late as possible
+	bound = end;
+	for (i = plan->count - 1; i > 0; i--) {
+		if (bound < begin + plan->minlen[i])
+			return -1;
+		if ((p = format_plan_rsearch(&str[begin], bound - plan->minlen[i] - begin,
+						plan->literals[i], plan->lengths[i])) == NULL)
+			return -1;
+		matches[i].data = p + plan->lengths[i];
+		matches[i].len = bound - (matches[i].data - str);
+		bound = p - str;
+	}
+
+	if (bound < begin + plan->minlen[0])
+		return -1;
+	matches[0].data = &str[begin];
+	matches[0].len = bound - begin;
+
+	for (i = 0; i < plan->count; i++)
+		matches[i].type = plan->types[i];
+	for (; i < FORMAT_MATCH_TYPE_COUNT; i++) {
+		matches[i].type = 0;
+		matches[i].data = str;
+		matches[i].len = 0;
+	}
+
+	return 0;
+}
+
+// Compiled list of formats. Formats which can not be matched with the plan
+// are joined into one combined regular expression - all of them are tried
+// in a single pass over the string. Stand-alone regular expressions are
+// compiled on demand only.
+struct format_matcher {
+	unsigned int count;
+	regex_t combined;
+	int combined_status;
+	struct format_alternative {
+		// -1 - invalid format, 0 - plan, 1 - regular expression
+		int status;
+		struct format_plan plan;
+		char types[FORMAT_MATCH_TYPE_COUNT];
+		char *regexp;
+		regex_t regex;
+		int compiled;
+		// alternative subexpression in the combined regular expression and
+		// the number of the alternative own subexpressions
+		size_t group, nsub;
+	} alternatives[];
+};
+
+// Strip placeholder markers from the format. Types of the placeholders
+// are stored in the given array. Returned string has to be freed.
+static char *format_strip_markers(const char *format, char *types) {
+
+	const char *p = format;
+	char *regexp;
+	int i = 0;
 
 	regexp = strdup(format);
-	while (++i < MATCHES_SIZE && (p = strstr(p, "(?"))) {
+	while (++i < FORMAT_MATCH_TYPE_COUNT + 1 && (p = strstr(p, "(?")) && p[2]) {
 		p += 3;
-		matches[i - 1].type = p[-1];
+		types[i - 1] = p[-1];
 		strcpy(&regexp[p - format - i * 2], p);
 	}
 
-	debug("regexp: %s", regexp);
+	return regexp;
+}
 
-	status = regcomp(&regex, regexp, REG_EXTENDED | REG_ICASE);
-	free(regexp);
-	if (status) {
-		free(matches);
-		return NULL;
+// Count subexpressions of the regular expression. If the expression can
+// not be used in the combined one (e.g. it contains back-references, which
+// would be renumbered), -1 is returned.
+static int format_count_groups(const char *regexp) {
+
+	int count = 0;
+
+	for (; *regexp; regexp++)
+		switch (*regexp) {
+		case '\\':
+			if (regexp[1] >= '1' && regexp[1] <= '9')
+				return -1;
+			if (regexp[1])
+				regexp++;
+			break;
+		case '[':
+			// skip bracket expression, where ']' might be the first element
+			if (*++regexp == '^')
+				regexp++;
+			if (*regexp == ']')
+				regexp++;
+			for (; *regexp && *regexp != ']'; regexp++)
+				if (regexp[0] == '[' && strchr(":.=", regexp[1]) && regexp[1]) {
+					const char *end = regexp + 2;
+					while (*end && !(end[0] == regexp[1] && end[1] == ']'))
+						end++;
+					if (*end == '\0')
+						return -1;
+					regexp = end + 1;
+				}
+			if (*regexp == '\0')
+				return -1;
+			break;
+		case '(':
+			count++;
+			break;
+		}
+
+	return count;
+}
+
+// Get compiled stand-alone regular expression of the alternative.
+static regex_t *format_alternative_regex(struct format_alternative *alt) {
+	if (!alt->compiled) {
+		if (regcomp(&alt->regex, alt->regexp, REG_EXTENDED | REG_ICASE) != 0) {
+			alt->status = -1;
+			return NULL;
+		}
+		alt->compiled = 1;
+		alt->nsub = alt->regex.re_nsub;
 	}
+	return &alt->regex;
+}
 
-	status = regexec(&regex, str, MATCHES_SIZE, regmatch, 0);
-	regfree(&regex);
-	if (status) {
-		free(matches);
-		return NULL;
+// Fill matches from the regular expression subexpressions. The first
+// subexpression of the alternative is given as the regmatch argument.
+static void format_fill_matches(struct format_match *matches, const char *types,
+		const char *str, const regmatch_t *regmatch, size_t count) {
+
+	size_t i;
+
+	for (i = 0; i < FORMAT_MATCH_TYPE_COUNT; i++) {
+		matches[i].type = types[i];
+		// unused subexpression results in an empty match
+		if (i >= count || regmatch[i].rm_so == -1) {
+			matches[i].data = str;
+			matches[i].len = 0;
+			continue;
+		}
+		matches[i].data = &str[regmatch[i].rm_so];
+		matches[i].len = regmatch[i].rm_eo - regmatch[i].rm_so;
 	}
+}
+
+// Compile the ordered list of formats. Format is a ERE pattern with
+// customized placeholders, see `get_regexp_format_matches` function. Not
+// valid formats are ignored. Matcher has to be freed with the function
+// `free_regexp_format_matcher`.
+struct format_matcher *get_regexp_format_matcher(const char *formats[], unsigned int count) {
+
+	struct format_matcher *matcher;
+	struct format_alternative *alt;
+	char *combined;
+	size_t size = 1, group = 1;
+	unsigned int i, alternatives = 0;
+	int nsub;
+
+	matcher = calloc(1, sizeof(*matcher) + count * sizeof(*matcher->alternatives));
+	matcher->count = count;
+	matcher->combined_status = -1;
+
+	for (i = 0; i < count; i++)
+		size += strlen(formats[i]) + 3;
+	combined = calloc(1, size);
 
-	for (i = 1; i < MATCHES_SIZE; i++) {
-		matches[i - 1].data = &str[regmatch[i].rm_so];
-		matches[i - 1].len = regmatch[i].rm_eo - regmatch[i].rm_so;
+	for (i = 0; i < count; i++) {
+		alt = &matcher->alternatives[i];
+
+		// Fast path for formats with literal separators only. Multibyte
+		// locales are excluded, because the regular expression engine does
+		// not match invalid character sequences there.
+		if (MB_CUR_MAX == 1 && format_plan_compile(formats[i], &alt->plan) == 0)
+			continue;
+
+		alt->status = 1;
+		alt->regexp = format_strip_markers(formats[i], alt->types);
+		debug("regexp: %s", alt->regexp);
+
+		if ((nsub = format_count_groups(alt->regexp)) != -1) {
+			sprintf(&combined[strlen(combined)], "%s(%s)", alternatives++ ? "|" : "", alt->regexp);
+			alt->group = group;
+			alt->nsub = nsub;
+			group += nsub + 1;
+		}
 	}
+
+	if (alternatives > 0) {
+		debug("combined regexp: %s", combined);
+		matcher->combined_status = regcomp(&matcher->combined, combined,
+				REG_EXTENDED | REG_ICASE);
+		// some of the alternatives is not valid, so the combined expression
+		// can not be used, or it is not aligned with the counted groups
+		if (matcher->combined_status == 0 && matcher->combined.re_nsub != group - 1) {
+			regfree(&matcher->combined);
+			matcher->combined_status = -1;
+		}
+	}
+
+	free(combined);
+	return matcher;
+}
+
+// Free resources allocated by the `get_regexp_format_matcher` function.
+void free_regexp_format_matcher(struct format_matcher *matcher) {
+
+	unsigned int i;
+
+	if (matcher == NULL)
+		return;
+
+	for (i = 0; i < matcher->count; i++) {
+		if (matcher->alternatives[i].compiled)
+			regfree(&matcher->alternatives[i].regex);
+		free(matcher->alternatives[i].regexp);
+	}
+	if (matcher->combined_status == 0)
+		regfree(&matcher->combined);
+	free(matcher);
+}
+
+// Get track information substrings from the given string using the list
+// of compiled formats. Formats are tried in the order of the list, and the
+// first one which matches wins. Returned matches are the same as for the
+// `get_regexp_format_matches` function.
+struct format_match *get_regexp_matcher_matches(struct format_matcher *matcher, const char *str) {
+#define MATCHES_SIZE FORMAT_MATCH_TYPE_COUNT + 1
+
+	struct format_alternative *alt;
+	struct format_match *matches;
+	regmatch_t regmatch[MATCHES_SIZE];
+	regmatch_t *combined = NULL;
+	size_t selected = 0;
+	regex_t *regex;
+	unsigned int i;
+
+	debug("matching: %s", str);
+
+	// allocate memory for up to FORMAT_MATCH_TYPE_COUNT matches
+	// with one extra always empty terminating structure
+	matches = (struct format_match *)calloc(MATCHES_SIZE, sizeof(*matches));
+
+	for (i = 0; i < matcher->count; i++) {
+		alt = &matcher->alternatives[i];
+
+		if (alt->status == 0) {
+			if (format_plan_match(&alt->plan, str, matches) == 0)
+				goto success;
+			continue;
+		}
+
+		if (alt->status != 1)
+			continue;
+
+		if (alt->group && matcher->combined_status == 0) {
+
+			// Run the combined expression once - it selects one of the matching
+			// alternatives or tells, that none of them matches at all.
+			if (combined == NULL) {
+				combined = malloc((matcher->combined.re_nsub + 1) * sizeof(*combined));
+				if (regexec(&matcher->combined, str, matcher->combined.re_nsub + 1, combined, 0) == 0) {
+					for (selected = 1; selected <= matcher->combined.re_nsub; selected++)
+						if (combined[selected].rm_so != -1)
+							break;
+				}
+			}
+
+			if (selected == 0)
+				continue;
+			if (alt->group == selected) {
+				format_fill_matches(matches, alt->types, str, &combined[selected + 1], alt->nsub);
+				goto success;
+			}
+
+			// Alternative with the higher priority than the selected one might
+			// match as well (e.g. with a shorter match), so it has to be
+			// checked on its own.
+			if (alt->group > selected)
+				continue;
+
+		}
+
+		if ((regex = format_alternative_regex(alt)) == NULL)
+			continue;
+		if (regexec(regex, str, MATCHES_SIZE, regmatch, 0) == 0) {
+			format_fill_matches(matches, alt->types, str, &regmatch[1], alt->nsub);
+			goto success;
+		}
+
+	}
+
+	free(combined);
+	free(matches);
+	return NULL;
+
+success:
+	free(combined);
+	return matches;
+}
+
+// Get track information substrings from the given string. Matching is done
+// according to the provided format, which is a ERE pattern with customized
+// placeholders. Placeholder is defined as a marked subexpression with the
+// `?X` marker, where X can be one the following characters:
+//   A - artist, B - album, T - title, N - track number
+//   e.g.: ^(?A.+) - (?N[:digits:]+)\. (?T.+)$
+// In order to get a single match structure, one should use `get_regexp_match`
+// function. When matches are not longer needed, is should be freed by the
+// standard `free` function. When something goes wrong, NULL is returned.
+struct format_match *get_regexp_format_matches(const char *str, const char *format) {
+
+	struct format_matcher *matcher;
+	struct format_match *matches;
+
+	matcher = get_regexp_format_matcher(&format, 1);
+	matches = get_regexp_matcher_matches(matcher, str);
+	free_regexp_format_matcher(matcher);
+
 	return matches;
 }
 